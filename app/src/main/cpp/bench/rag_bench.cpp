@@ -0,0 +1,397 @@
+// app/src/main/cpp/bench/rag_bench.cpp
+//
+// Benchmark host (Linux) cho lõi suy luận của bridge: chạy đúng InferenceEngine + cách dựng prompt
+// của app trên một file GGUF, theo các preset của ChatViewModel, rồi in báo cáo JSON để CI so sánh
+// giữa các commit (TTFT, prefill / decode tok/s, p50/p95/p99 độ trễ token, thời gian sampler, peak RSS).
+//
+//   rag_bench --model m.gguf [--prompts set.txt]... [--preset fast|balanced|creative|all]
+//             [--threads N] [--runs N] [--warmup N] [--reuse-kv] [--no-spec] [--exact-sampler]
+//             [--out report.json]
+//
+// File prompt: các prompt ngăn cách bởi một dòng chỉ có "---"; tên bộ prompt = tên file.
+// Không có --prompts thì dùng hai bộ dựng sẵn (câu hỏi ngắn, câu hỏi kèm passage dài kiểu RAG).
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+#include "chat_prompt.h"
+#include "engine.h"
+
+namespace {
+
+const char* kSystemPrompt = "You are a helpful AI assistant.";
+
+// Giống defaultPresets() trong ChatViewModel
+struct Preset {
+    const char* name;
+    float temp;
+    float top_p;
+    int   max_tokens;
+    int   n_ctx;
+};
+const Preset kPresets[] = {
+    { "fast",     0.1f,  0.9f,  128, 1024 },
+    { "balanced", 0.7f,  0.95f, 256, 2048 },
+    { "creative", 0.95f, 0.98f, 512, 3072 },
+};
+
+struct PromptSet {
+    std::string name;
+    std::vector<std::string> prompts;
+};
+
+struct Options {
+    std::string model;
+    std::vector<std::string> prompt_files;
+    std::string preset  = "all";
+    std::string out;
+    int  threads = 4;
+    int  runs    = 3;
+    int  warmup  = 1;
+    bool reuse_kv = false;
+    bool spec     = true;
+    bool exact_sampler = false;   // sampler tham chiếu (sắp xếp cả vocab) để so sample_ms
+};
+
+struct RunResult {
+    GenStats st;
+    double   decode_tps  = 0;
+    double   prefill_tps = 0;
+};
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+                 "usage: %s --model FILE.gguf [--prompts FILE]... [--preset fast|balanced|creative|all]\n"
+                 "          [--threads N] [--runs N] [--warmup N] [--reuse-kv] [--no-spec] [--exact-sampler]\n"
+                 "          [--out FILE]\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&](const char** v) {
+            if (i + 1 >= argc) return false;
+            *v = argv[++i];
+            return true;
+        };
+        const char* v = nullptr;
+        if (a == "--model" && next(&v))        o.model = v;
+        else if (a == "--prompts" && next(&v)) o.prompt_files.push_back(v);
+        else if (a == "--preset" && next(&v))  o.preset = v;
+        else if (a == "--out" && next(&v))     o.out = v;
+        else if (a == "--threads" && next(&v)) o.threads = std::max(1, std::atoi(v));
+        else if (a == "--runs" && next(&v))    o.runs = std::max(1, std::atoi(v));
+        else if (a == "--warmup" && next(&v))  o.warmup = std::max(0, std::atoi(v));
+        else if (a == "--reuse-kv")            o.reuse_kv = true;
+        else if (a == "--no-spec")             o.spec = false;
+        else if (a == "--exact-sampler")       o.exact_sampler = true;
+        else return false;
+    }
+    return !o.model.empty();
+}
+
+bool load_prompt_set(const std::string& path, PromptSet& set) {
+    std::ifstream in(path);
+    if (!in) return false;
+    const size_t slash = path.find_last_of('/');
+    set.name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    std::string line, cur;
+    auto flush = [&] {
+        const size_t b = cur.find_first_not_of(" \t\r\n");
+        const size_t e = cur.find_last_not_of(" \t\r\n");
+        if (b != std::string::npos) set.prompts.push_back(cur.substr(b, e - b + 1));
+        cur.clear();
+    };
+    while (std::getline(in, line)) {
+        if (line == "---" || line == "---\r") { flush(); continue; }
+        cur += line;
+        cur += '\n';
+    }
+    flush();
+    return !set.prompts.empty();
+}
+
+std::vector<PromptSet> builtin_prompt_sets() {
+    PromptSet shorts{ "builtin-short", {
+        "What is retrieval-augmented generation? Answer in two sentences.",
+        "Giải thích ngắn gọn vì sao mô hình ngôn ngữ cần KV cache.",
+        "List three ways to reduce memory use when running an LLM on a phone.",
+    } };
+
+    // passage dài kiểu RAG: vài trăm token ngữ cảnh + câu hỏi
+    std::string passage;
+    for (int i = 0; i < 12; ++i) {
+        passage += "[Passage " + std::to_string(i + 1) + "] The device runs a quantized language model "
+                   "entirely offline. Documents are split into chunks, embedded, and stored in a local "
+                   "vector index; at query time the closest chunks are retrieved and placed in the prompt "
+                   "before the question so the model can cite them.\n";
+    }
+    PromptSet rag{ "builtin-rag", {
+        passage + "\nQuestion: Where are document embeddings stored, and when are chunks retrieved?",
+        passage + "\nCâu hỏi: Mô hình chạy ở đâu và các đoạn văn được đưa vào prompt như thế nào?",
+    } };
+    return { shorts, rag };
+}
+
+// Đỉnh RSS (KB). Linux: VmHWM, reset được qua clear_refs để đo riêng từng preset.
+long peak_rss_kb() {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::atol(line.c_str() + 6);
+    }
+    struct rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+bool reset_peak_rss() {
+    std::ofstream f("/proc/self/clear_refs");
+    if (!f) return false;
+    f << "5";
+    return (bool)f;
+}
+
+double median(std::vector<double> v) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    const size_t m = v.size() / 2;
+    return v.size() % 2 ? v[m] : (v[m - 1] + v[m]) / 2;
+}
+
+double mean(const std::vector<double>& v) {
+    if (v.empty()) return 0;
+    double s = 0;
+    for (double x : v) s += x;
+    return s / (double)v.size();
+}
+
+std::string json_str(const std::string& s) {
+    std::string o = "\"";
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"':  o += "\\\""; break;
+            case '\\': o += "\\\\"; break;
+            case '\n': o += "\\n";  break;
+            case '\r': o += "\\r";  break;
+            case '\t': o += "\\t";  break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    o += buf;
+                } else {
+                    o += (char)c;
+                }
+        }
+    }
+    return o + "\"";
+}
+
+std::string json_num(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3f", v);
+    return buf;
+}
+
+// Một lần sinh trên slot 0 (giữ lease như hội thoại của app). Không --reuse-kv thì xoá KV của
+// slot trước để lần nào cũng prefill toàn bộ prompt.
+bool run_once(InferenceEngine& engine, const Options& o, const Preset& p, const std::string& prompt,
+              RunResult& r) {
+    GenRequest req = single_turn_request(engine, prompt, kSystemPrompt, p.max_tokens, p.temp, p.top_p,
+                                         /*ctx_shift*/ true);
+    if (req.prompt.empty()) return false;
+    req.speculative    = o.spec;
+    req.exact_sampling = o.exact_sampler;
+    req.seq            = 0;
+
+    auto lease = engine.lease(0);
+    if (!o.reuse_kv) {
+        engine.with_slot(0, [](llama_context* ctx, std::vector<llama_token>& tokens) {
+            llama_memory_seq_rm(llama_get_memory(ctx), 0, -1, -1);
+            tokens.clear();
+        });
+    }
+    auto job = engine.submit(std::move(req));
+    if (!job) return false;
+    std::string ignored;
+    while (job->wait_output(&ignored)) ignored.clear();
+    if (!job->ok()) return false;
+
+    r.st = job->stats();
+    const double decode_s = r.st.seconds - r.st.prefill_ms / 1000.0;
+    r.decode_tps  = (r.st.tokens > 1 && decode_s > 0) ? (r.st.tokens - 1) / decode_s : 0;
+    r.prefill_tps = r.st.prefill_ms > 0 ? r.st.n_prefill * 1000.0 / r.st.prefill_ms : 0;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parse_args(argc, argv, o)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<PromptSet> sets;
+    for (const auto& f : o.prompt_files) {
+        PromptSet s;
+        if (!load_prompt_set(f, s)) {
+            std::fprintf(stderr, "cannot read prompts from %s\n", f.c_str());
+            return 2;
+        }
+        sets.push_back(std::move(s));
+    }
+    if (sets.empty()) sets = builtin_prompt_sets();
+
+    std::vector<Preset> presets;
+    for (const auto& p : kPresets) {
+        if (o.preset == "all" || o.preset == p.name) presets.push_back(p);
+    }
+    if (presets.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    llama_backend_init();
+    InferenceEngine engine;
+
+    // phần presets dựng trước; metadata của model chỉ có sau lần load đầu
+    std::ostringstream js;
+    std::string model_desc;
+    uint64_t model_size = 0, model_params = 0;
+
+    int rc = 0;
+    bool first_preset = true;
+    for (const Preset& p : presets) {
+        const bool rss_reset = reset_peak_rss();
+
+        InferenceEngine::Params ep;
+        ep.n_ctx_seq      = p.n_ctx;
+        ep.n_threads      = o.threads;
+        ep.spec_max_draft = o.spec ? ep.spec_max_draft : 0;
+        if (!engine.load(o.model, ep)) {
+            std::fprintf(stderr, "failed to load %s\n", o.model.c_str());
+            rc = 1;
+            break;
+        }
+        if (first_preset) {
+            char desc[256] = {0};
+            llama_model_desc(engine.model(), desc, sizeof(desc));
+            model_desc   = desc;
+            model_size   = llama_model_size(engine.model());
+            model_params = llama_model_n_params(engine.model());
+        }
+
+        for (int w = 0; w < o.warmup && !sets.empty() && !sets[0].prompts.empty(); ++w) {
+            RunResult ignored;
+            run_once(engine, o, p, sets[0].prompts[0], ignored);
+        }
+        engine.perf_reset();
+
+        js << (first_preset ? "\n" : ",\n") << "    {\n"
+           << "      \"name\": " << json_str(p.name)
+           << ",\n      \"n_ctx\": " << p.n_ctx
+           << ",\n      \"max_tokens\": " << p.max_tokens
+           << ",\n      \"temp\": " << json_num(p.temp)
+           << ",\n      \"top_p\": " << json_num(p.top_p)
+           << ",\n      \"sets\": [";
+        first_preset = false;
+
+        for (size_t si = 0; si < sets.size(); ++si) {
+            const PromptSet& set = sets[si];
+            std::vector<double> ttft, prefill_tps, decode_tps, sample_ms, tokens;
+            LatencyHistogram token_ms;
+            int failed = 0;
+            for (const auto& prompt : set.prompts) {
+                for (int r = 0; r < o.runs; ++r) {
+                    RunResult res;
+                    if (!run_once(engine, o, p, prompt, res)) {
+                        ++failed;
+                        continue;
+                    }
+                    ttft.push_back(res.st.ttft_ms);
+                    prefill_tps.push_back(res.prefill_tps);
+                    decode_tps.push_back(res.decode_tps);
+                    sample_ms.push_back(res.st.tokens > 0 ? res.st.sample_ms / res.st.tokens : 0);
+                    tokens.push_back(res.st.tokens);
+                    token_ms.merge(res.st.token_ms);
+                }
+            }
+            if (failed > 0) rc = 1;
+            std::fprintf(stderr, "[%s/%s] ttft p50 %.1f ms, prefill %.1f tok/s, decode %.1f tok/s\n",
+                         p.name, set.name.c_str(), median(ttft), median(prefill_tps), median(decode_tps));
+
+            js << (si ? ",\n" : "\n") << "        {"
+               << " \"name\": " << json_str(set.name)
+               << ", \"prompts\": " << set.prompts.size()
+               << ", \"samples\": " << ttft.size()
+               << ", \"failed\": " << failed
+               << ",\n          \"ttft_ms\": { \"median\": " << json_num(median(ttft))
+               << ", \"mean\": " << json_num(mean(ttft)) << " }"
+               << ",\n          \"prefill_tok_s\": { \"median\": " << json_num(median(prefill_tps))
+               << ", \"mean\": " << json_num(mean(prefill_tps)) << " }"
+               << ",\n          \"decode_tok_s\": { \"median\": " << json_num(median(decode_tps))
+               << ", \"mean\": " << json_num(mean(decode_tps)) << " }"
+               << ",\n          \"token_ms\": { \"p50\": " << json_num(token_ms.percentile(0.50))
+               << ", \"p95\": " << json_num(token_ms.percentile(0.95))
+               << ", \"p99\": " << json_num(token_ms.percentile(0.99)) << " }"
+               << ",\n          \"sample_ms_per_token\": { \"median\": " << json_num(median(sample_ms))
+               << ", \"mean\": " << json_num(mean(sample_ms)) << " }"
+               << ",\n          \"tokens\": { \"mean\": " << json_num(mean(tokens)) << " } }";
+        }
+
+        // Bộ đếm của chính llama.cpp cho cả preset (không gồm warmup)
+        const llama_perf_context_data pc = engine.perf_context();
+        js << "\n      ],\n      \"llama_perf\": {"
+           << " \"prompt_ms\": " << json_num(pc.t_p_eval_ms)
+           << ", \"prompt_tokens\": " << pc.n_p_eval
+           << ", \"prompt_tok_s\": " << json_num(pc.t_p_eval_ms > 0 ? pc.n_p_eval * 1000.0 / pc.t_p_eval_ms : 0)
+           << ", \"eval_ms\": " << json_num(pc.t_eval_ms)
+           << ", \"eval_tokens\": " << pc.n_eval
+           << ", \"eval_tok_s\": " << json_num(pc.t_eval_ms > 0 ? pc.n_eval * 1000.0 / pc.t_eval_ms : 0)
+           << " }"
+           << ",\n      \"peak_rss_mb\": " << json_num(peak_rss_kb() / 1024.0)
+           << ",\n      \"peak_rss_per_preset\": " << (rss_reset ? "true" : "false")
+           << "\n    }";
+        engine.unload();
+    }
+    engine.unload();
+    llama_backend_free();
+
+    std::ostringstream head;
+    head << "{\n  \"model\": " << json_str(o.model)
+         << ",\n  \"model_desc\": " << json_str(model_desc)
+         << ",\n  \"model_size_mb\": " << json_num(model_size / 1048576.0)
+         << ",\n  \"model_params_m\": " << json_num(model_params / 1e6)
+         << ",\n  \"threads\": " << o.threads
+         << ",\n  \"runs\": " << o.runs
+         << ",\n  \"reuse_kv\": " << (o.reuse_kv ? "true" : "false")
+         << ",\n  \"speculative\": " << (o.spec ? "true" : "false")
+         << ",\n  \"exact_sampler\": " << (o.exact_sampler ? "true" : "false")
+         << ",\n  \"presets\": [" << js.str() << "\n  ]\n}\n";
+    const std::string report = head.str();
+    if (o.out.empty()) {
+        std::fwrite(report.data(), 1, report.size(), stdout);
+    } else {
+        std::ofstream f(o.out);
+        f << report;
+        if (!f) {
+            std::fprintf(stderr, "cannot write %s\n", o.out.c_str());
+            return 1;
+        }
+    }
+    return rc;
+}
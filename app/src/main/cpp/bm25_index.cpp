@@ -0,0 +1,431 @@
+// app/src/main/cpp/bm25_index.cpp
+#include "bm25_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+// --------- Tách từ ---------
+
+static uint32_t next_cp(const std::string& s, size_t& i) {
+    const unsigned char c = (unsigned char)s[i];
+    size_t len = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+    if (i + len > s.size()) len = 1;
+    uint32_t cp = len == 1 ? c : len == 2 ? (c & 0x1F) : len == 3 ? (c & 0x0F) : (c & 0x07);
+    for (size_t k = 1; k < len; ++k) cp = (cp << 6) | ((unsigned char)s[i + k] & 0x3F);
+    i += len;
+    return cp;
+}
+
+static void put_cp(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+static uint32_t to_lower(uint32_t c) {
+    if (c >= 'A' && c <= 'Z') return c + 32;
+    if (c >= 0xC0 && c <= 0xDE && c != 0xD7) return c + 32;
+    if (c == 0x110) return 0x111;                                            // Đ
+    if ((c >= 0x100 && c <= 0x137) || (c >= 0x14A && c <= 0x177)) return c | 1;
+    if (c == 0x1A0 || c == 0x1AF) return c + 1;                              // Ơ Ư
+    if (c >= 0x1EA0 && c <= 0x1EF9) return c | 1;                            // khối tiếng Việt
+    return c;
+}
+
+// Chữ cái gốc sau khi bỏ dấu (c đã là chữ thường); 0 = dấu kết hợp, bỏ đi
+static uint32_t fold(uint32_t c) {
+    if (c < 0x80) return c;
+    if (c >= 0x300 && c <= 0x36F) return 0;
+    if (c >= 0xE0 && c <= 0xE5) return 'a';
+    if (c == 0xE7)              return 'c';
+    if (c >= 0xE8 && c <= 0xEB) return 'e';
+    if (c >= 0xEC && c <= 0xEF) return 'i';
+    if (c == 0xF1)              return 'n';
+    if ((c >= 0xF2 && c <= 0xF6) || c == 0xF8) return 'o';
+    if (c >= 0xF9 && c <= 0xFC) return 'u';
+    if (c == 0xFD || c == 0xFF) return 'y';
+    switch (c) {
+        case 0x103: return 'a';   // ă
+        case 0x111: return 'd';   // đ
+        case 0x129: return 'i';   // ĩ
+        case 0x169: return 'u';   // ũ
+        case 0x1A1: return 'o';   // ơ
+        case 0x1B0: return 'u';   // ư
+        default: break;
+    }
+    if (c >= 0x1EA0 && c <= 0x1EB7) return 'a';
+    if (c >= 0x1EB8 && c <= 0x1EC7) return 'e';
+    if (c >= 0x1EC8 && c <= 0x1ECB) return 'i';
+    if (c >= 0x1ECC && c <= 0x1EE3) return 'o';
+    if (c >= 0x1EE4 && c <= 0x1EF1) return 'u';
+    if (c >= 0x1EF2 && c <= 0x1EF9) return 'y';
+    return c;
+}
+
+static bool is_word_cp(uint32_t c) {
+    if (c < 0x80) return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    if (c <= 0xBF || c == 0xD7 || c == 0xF7) return false;                  // ký hiệu Latin-1, NBSP
+    if (c >= 0x2000 && c <= 0x2BFF) return false;                           // dấu câu, ký hiệu, mũi tên
+    if (c >= 0x3000 && c <= 0x303F) return false;
+    if (c >= 0xFE30 && c <= 0xFE4F) return false;
+    if (c >= 0xFF00 && c <= 0xFF0F) return false;
+    if (c >= 0x1F000) return false;                                         // emoji
+    return true;
+}
+
+static bool is_joiner(uint32_t c) { return c == '-' || c == '_' || c == '.' || c == '/'; }
+
+static constexpr size_t kMaxTermBytes = 64;
+
+std::vector<std::string> lexical_terms(const std::string& text, size_t* n_words) {
+    std::vector<std::string> out;
+    size_t words = 0;
+
+    std::string exact, folded;      // từ đang đọc
+    std::string prev_folded;        // từ trước, nếu chỉ cách bằng khoảng trắng (cho bigram)
+    std::string compound;           // mã nối bằng joiner, vd "err-404"
+    size_t      compound_parts = 0;
+
+    // Các ký tự phân cách kể từ từ trước
+    uint32_t gap      = 0;
+    size_t   gap_len  = 0;
+    bool     gap_ws   = true;
+    bool     joined   = false;      // từ hiện tại nối với từ trước bằng một joiner
+
+    auto end_compound = [&] {
+        if (compound_parts > 1 && compound.size() <= kMaxTermBytes) out.push_back(compound);
+        compound.clear();
+        compound_parts = 0;
+    };
+
+    auto end_word = [&] {
+        if (folded.size() <= kMaxTermBytes) {
+            ++words;
+            out.push_back(folded);
+            if (exact != folded) out.push_back(exact);
+            if (!prev_folded.empty()) out.push_back(prev_folded + ' ' + folded);
+        }
+        if (joined) {
+            put_cp(compound, gap);
+            compound += folded;
+            ++compound_parts;
+        } else {
+            compound = folded;
+            compound_parts = 1;
+        }
+        prev_folded.swap(folded);
+        exact.clear();
+        folded.clear();
+        gap = 0;
+        gap_len = 0;
+        gap_ws = true;
+    };
+
+    size_t i = 0;
+    while (i < text.size()) {
+        const uint32_t c = next_cp(text, i);
+        if (is_word_cp(c)) {
+            if (exact.empty()) {
+                joined = gap_len == 1 && is_joiner(gap) && compound_parts > 0;
+                if (!joined) end_compound();
+                if (!gap_ws) prev_folded.clear();
+            }
+            const uint32_t lc = to_lower(c);
+            put_cp(exact, lc);
+            if (const uint32_t f = fold(lc)) put_cp(folded, f);
+        } else {
+            if (!exact.empty()) end_word();
+            gap = c;
+            ++gap_len;
+            if (c != ' ' && c != '\t') gap_ws = false;
+        }
+    }
+    if (!exact.empty()) end_word();
+    end_compound();
+
+    if (n_words) *n_words = words;
+    return out;
+}
+
+// --------- Index ---------
+
+static void put_varint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static uint32_t get_varint(const uint8_t*& p) {
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        const uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+void Bm25Index::clear() {
+    dict_.clear();
+    postings_.clear();
+    doc_len_.clear();
+    doc_ids_.clear();
+    total_len_ = 0;
+}
+
+size_t Bm25Index::postings_bytes() const {
+    size_t n = 0;
+    for (const auto& p : postings_) n += p.data.size() + p.blocks.size() * sizeof(Block);
+    return n;
+}
+
+void Bm25Index::add(int64_t id, const std::string& text) {
+    size_t n_words = 0;
+    std::vector<std::string> terms = lexical_terms(text, &n_words);
+    std::sort(terms.begin(), terms.end());
+
+    const uint32_t doc = (uint32_t)doc_len_.size();
+    const uint32_t len = (uint32_t)std::max<size_t>(1, n_words);
+    doc_len_.push_back(len);
+    doc_ids_.push_back(id);
+    total_len_ += len;
+
+    for (size_t i = 0; i < terms.size();) {
+        size_t j = i + 1;
+        while (j < terms.size() && terms[j] == terms[i]) ++j;
+        const uint16_t tf = (uint16_t)std::min<size_t>(j - i, UINT16_MAX);
+
+        auto it = dict_.find(terms[i]);
+        if (it == dict_.end()) {
+            it = dict_.emplace(terms[i], (uint32_t)postings_.size()).first;
+            postings_.emplace_back();
+        }
+        Postings& p = postings_[it->second];
+
+        uint32_t prev = 0;
+        if (p.blocks.empty() || p.blocks.back().count == kBlock) {
+            if (!p.blocks.empty()) prev = p.blocks.back().last_doc;
+            p.blocks.push_back({ doc, (uint32_t)p.data.size(), 0, 0, UINT32_MAX });
+        } else {
+            prev = p.blocks.back().last_doc;
+        }
+        Block& b = p.blocks.back();
+        put_varint(p.data, doc - prev);
+        put_varint(p.data, tf);
+        b.last_doc = doc;
+        b.count   += 1;
+        b.max_tf   = std::max(b.max_tf, tf);
+        b.min_len  = std::min(b.min_len, len);
+        p.df      += 1;
+        p.max_tf   = std::max(p.max_tf, tf);
+        p.min_len  = std::min(p.min_len, len);
+        i = j;
+    }
+}
+
+// --------- Search (block-max WAND) ---------
+
+static constexpr uint32_t kEnd = UINT32_MAX;
+
+struct Bm25Scorer {
+    float k1 = 1.2f, b = 0.75f, avgdl = 1.f;
+    // phần tf của BM25: tăng theo tf, giảm theo độ dài -> (max_tf, min_len) cho cận trên
+    float tf_part(uint32_t tf, uint32_t len) const {
+        const float t = (float)tf;
+        return t * (k1 + 1.f) / (t + k1 * (1.f - b + b * (float)len / avgdl));
+    }
+};
+
+struct Bm25Index::Cursor {
+    const Postings* p      = nullptr;
+    float           weight = 0;     // idf * số lần term xuất hiện trong truy vấn
+    float           ub     = 0;     // cận trên trên toàn posting list
+    size_t          blk    = 0;     // block "nông" (shallow) đang xét cận trên
+    size_t          dec    = SIZE_MAX;
+    int             pos    = 0;
+    uint32_t        doc    = kEnd;
+    uint32_t        docs[kBlock];
+    uint16_t        tfs[kBlock];
+
+    void decode(size_t b) {
+        const Block& bl = p->blocks[b];
+        const uint8_t* q = p->data.data() + bl.offset;
+        uint32_t prev = b > 0 ? p->blocks[b - 1].last_doc : 0;
+        for (int i = 0; i < bl.count; ++i) {
+            prev   += get_varint(q);
+            docs[i] = prev;
+            tfs[i]  = (uint16_t)get_varint(q);
+        }
+        dec = b;
+        pos = 0;
+    }
+
+    void start() {
+        if (p->blocks.empty()) return;
+        blk = 0;
+        decode(0);
+        doc = docs[0];
+    }
+
+    void next() {
+        if (doc == kEnd) return;
+        if (++pos < p->blocks[dec].count) {
+            doc = docs[pos];
+            return;
+        }
+        blk = std::max(blk, dec + 1);
+        if (blk >= p->blocks.size()) {
+            doc = kEnd;
+            return;
+        }
+        decode(blk);
+        doc = docs[0];
+    }
+
+    // Chỉ dời block (không giải mã) tới block có thể chứa target
+    void shallow(uint32_t target) {
+        while (blk < p->blocks.size() && p->blocks[blk].last_doc < target) ++blk;
+    }
+
+    void seek(uint32_t target) {
+        if (doc >= target) return;
+        shallow(target);
+        if (blk >= p->blocks.size()) {
+            doc = kEnd;
+            return;
+        }
+        if (dec != blk) decode(blk);
+        while (docs[pos] < target) ++pos;
+        doc = docs[pos];
+    }
+
+    float block_ub(const Bm25Scorer& sc) const {
+        if (blk >= p->blocks.size()) return 0.f;
+        return weight * sc.tf_part(p->blocks[blk].max_tf, p->blocks[blk].min_len);
+    }
+
+    uint32_t block_last() const {
+        return blk < p->blocks.size() ? p->blocks[blk].last_doc : kEnd - 1;
+    }
+};
+
+std::vector<Bm25Index::Hit> Bm25Index::search(const std::string& query, size_t k) const {
+    std::vector<Hit> out;
+    if (k == 0 || doc_len_.empty()) return out;
+
+    std::vector<std::string> terms = lexical_terms(query);
+    std::sort(terms.begin(), terms.end());
+
+    Bm25Scorer sc;
+    sc.avgdl = (float)((double)total_len_ / (double)doc_len_.size());
+    const float n_docs = (float)doc_len_.size();
+
+    std::vector<Cursor> cursors;
+    cursors.reserve(terms.size());
+    for (size_t i = 0; i < terms.size();) {
+        size_t j = i + 1;
+        while (j < terms.size() && terms[j] == terms[i]) ++j;
+        auto it = dict_.find(terms[i]);
+        if (it != dict_.end()) {
+            Cursor c;
+            c.p = &postings_[it->second];
+            const float df  = (float)c.p->df;
+            const float idf = std::log(1.f + (n_docs - df + 0.5f) / (df + 0.5f));
+            c.weight = idf * (float)(j - i);
+            c.ub     = c.weight * sc.tf_part(c.p->max_tf, c.p->min_len);
+            cursors.push_back(c);
+        }
+        i = j;
+    }
+    if (cursors.empty()) return out;
+
+    std::vector<Cursor*> order;
+    for (auto& c : cursors) {
+        c.start();
+        order.push_back(&c);
+    }
+
+    // min-heap (score, doc) giữ top-k
+    using Entry = std::pair<float, uint32_t>;
+    std::vector<Entry> heap;
+    auto threshold = [&] { return heap.size() < k ? 0.f : heap.front().first; };
+    auto by_doc = [](const Cursor* a, const Cursor* b) { return a->doc < b->doc; };
+
+    for (;;) {
+        std::sort(order.begin(), order.end(), by_doc);
+        while (!order.empty() && order.back()->doc == kEnd) order.pop_back();
+        if (order.empty()) break;
+
+        // Pivot: term đầu tiên mà tổng cận trên vượt ngưỡng
+        const float thr = threshold();
+        float acc = 0.f;
+        size_t pv = order.size();
+        for (size_t i = 0; i < order.size(); ++i) {
+            acc += order[i]->ub;
+            if (acc > thr) {
+                pv = i;
+                break;
+            }
+        }
+        if (pv == order.size()) break;
+        const uint32_t pivot = order[pv]->doc;
+        while (pv + 1 < order.size() && order[pv + 1]->doc == pivot) ++pv;
+
+        // Cận trên theo block tại pivot
+        float bound = 0.f;
+        for (size_t i = 0; i <= pv; ++i) {
+            order[i]->shallow(pivot);
+            bound += order[i]->block_ub(sc);
+        }
+
+        if (bound > thr) {
+            if (order[0]->doc == pivot) {
+                const uint32_t len = doc_len_[pivot];
+                float s = 0.f;
+                for (size_t i = 0; i <= pv; ++i) {
+                    s += order[i]->weight * sc.tf_part(order[i]->tfs[order[i]->pos], len);
+                    order[i]->next();
+                }
+                if (heap.size() < k) {
+                    heap.emplace_back(s, pivot);
+                    std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+                } else if (s > heap.front().first) {
+                    std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+                    heap.back() = { s, pivot };
+                    std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+                }
+            } else {
+                for (size_t i = 0; i <= pv && order[i]->doc < pivot; ++i) order[i]->seek(pivot);
+            }
+        } else {
+            // Không doc nào trong các block hiện tại vượt ngưỡng: nhảy qua
+            uint32_t d = kEnd;
+            for (size_t i = 0; i <= pv; ++i) d = std::min(d, order[i]->block_last() + 1);
+            if (pv + 1 < order.size()) d = std::min(d, order[pv + 1]->doc);
+            d = std::max(d, pivot + 1);
+            for (size_t i = 0; i <= pv; ++i) order[i]->seek(d);
+        }
+    }
+
+    std::sort(heap.begin(), heap.end(), [](const Entry& a, const Entry& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    out.reserve(heap.size());
+    for (const auto& e : heap) out.push_back({ doc_ids_[e.second], e.first });
+    return out;
+}
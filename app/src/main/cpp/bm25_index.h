@@ -0,0 +1,64 @@
+// app/src/main/cpp/bm25_index.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Tách từ cho tìm kiếm từ vựng, hiểu tiếng Việt:
+//  - chữ thường; mỗi âm tiết cho dạng bỏ dấu ("hà" -> "ha") và dạng giữ dấu nếu khác
+//  - bigram âm tiết liền nhau (bỏ dấu) để "hà nội" khớp cụm từ
+//  - mã/định danh nối bằng - _ . / giữ thêm dạng nguyên khối ("ERR-404" -> err, 404, err-404)
+// Truy vấn gõ không dấu khớp dạng bỏ dấu; gõ có dấu khớp cả hai, dạng đúng dấu được cộng điểm.
+std::vector<std::string> lexical_terms(const std::string& text, size_t* n_words = nullptr);
+
+// Inverted index BM25 trong RAM.
+// Posting list chia block kBlock tài liệu, mã hoá delta + varint (doc, tf); mỗi block giữ
+// doc cuối, tf lớn nhất và độ dài tài liệu nhỏ nhất để tính cận trên điểm cho block-max WAND.
+class Bm25Index {
+public:
+    static constexpr int kBlock = 128;
+
+    struct Hit {
+        int64_t id;
+        float   score;
+    };
+
+    void clear();
+    // id do phía gọi cấp (trùng id của kho vector); tài liệu chỉ được thêm, không sửa
+    void add(int64_t id, const std::string& text);
+
+    // Top-k theo BM25 (k1 = 1.2, b = 0.75), giảm dần theo score
+    std::vector<Hit> search(const std::string& query, size_t k) const;
+
+    size_t size()           const { return doc_len_.size(); }
+    size_t n_terms()        const { return postings_.size(); }
+    size_t postings_bytes() const;
+
+    struct Cursor;
+
+private:
+    struct Block {
+        uint32_t last_doc;
+        uint32_t offset;     // byte đầu block trong Postings::data
+        uint16_t count;
+        uint16_t max_tf;
+        uint32_t min_len;
+    };
+
+    struct Postings {
+        std::vector<uint8_t> data;
+        std::vector<Block>   blocks;
+        uint32_t             df      = 0;
+        uint16_t             max_tf  = 0;
+        uint32_t             min_len = UINT32_MAX;
+    };
+
+    std::unordered_map<std::string, uint32_t> dict_;      // term -> chỉ số trong postings_
+    std::vector<Postings>                     postings_;
+    std::vector<uint32_t>                     doc_len_;   // số từ, theo doc nội bộ
+    std::vector<int64_t>                      doc_ids_;   // doc nội bộ -> id ngoài
+    uint64_t                                  total_len_ = 0;
+};
@@ -0,0 +1,15 @@
+// app/src/main/cpp/bridge_log.h
+#pragma once
+
+#ifdef __ANDROID__
+#include <android/log.h>
+
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO , "llamabridge", __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "llamabridge", __VA_ARGS__)
+#else
+// Build host (benchmark / CI): log ra stderr
+#include <cstdio>
+
+#define LOGI(...) do { std::fprintf(stderr, "I/llamabridge: " __VA_ARGS__); std::fputc('\n', stderr); } while (0)
+#define LOGE(...) do { std::fprintf(stderr, "E/llamabridge: " __VA_ARGS__); std::fputc('\n', stderr); } while (0)
+#endif
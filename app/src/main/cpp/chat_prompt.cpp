@@ -0,0 +1,220 @@
+// app/src/main/cpp/chat_prompt.cpp
+#include "chat_prompt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+std::string render_chat(llama_model* model, const std::vector<llama_chat_message>& msgs, bool add_ass) {
+    // Lấy template mặc định từ model; có thể null nếu GGUF không có
+    const char* tmpl = llama_model_chat_template(model, /*name*/ nullptr);
+
+    size_t total = 0;
+    for (const auto& m : msgs) total += strlen(m.content);
+
+    // buffer tăng dần
+    size_t cap = std::max<size_t>(total * 2 + 256, 64 * 1024);
+    for (int tries = 0; tries < 6; ++tries) {
+        std::vector<char> buf(cap);
+        int n = llama_chat_apply_template(
+                /*tmpl*/ tmpl,                 // <- đúng chữ ký 6 tham số
+                /*chat*/ msgs.data(),
+                /*n_msg*/ (size_t)msgs.size(),
+                /*add_ass*/ add_ass,
+                /*buf*/ buf.data(),
+                /*length*/ (int32_t)buf.size()
+        );
+        if (n < 0) break;
+        if ((size_t)n <= buf.size()) {
+            return std::string(buf.data(), (size_t)n);
+        }
+        cap = (size_t)n + 1;
+    }
+    return {};
+}
+
+std::string render_plain(const std::vector<llama_chat_message>& msgs, bool add_ass) {
+    std::string fb;
+    for (const auto& m : msgs) {
+        const std::string role = m.role;
+        fb += role == "system" ? "System: " : role == "user" ? "User: " : "Assistant: ";
+        fb += m.content;
+        fb += "\n";
+    }
+    if (add_ass) fb += "Assistant:";
+    return fb;
+}
+
+std::string apply_chat_template(llama_model* model, const std::string& user_msg, const char* sys_msg_opt) {
+    std::vector<llama_chat_message> msgs;
+    if (sys_msg_opt && sys_msg_opt[0]) {
+        llama_chat_message msys{ "system", sys_msg_opt };
+        msgs.push_back(msys);
+    }
+    llama_chat_message muser{ "user", user_msg.c_str() };
+    msgs.push_back(muser);
+
+    std::string out = render_chat(model, msgs, /*add_ass*/ true);
+    return out.empty() ? render_plain(msgs, /*add_ass*/ true) : out;
+}
+
+std::string detok(const llama_vocab* vocab, const std::vector<llama_token>& toks) {
+    if (!vocab || toks.empty()) return {};
+    std::string out; out.reserve(toks.size() * 4);
+    char buf[256];
+    for (llama_token t : toks) {
+        const int n = llama_token_to_piece(
+                vocab, t, buf, (int)sizeof(buf),
+                /*lstrip*/ 0,
+                /*special*/ false
+        );
+        if (n > 0) out.append(buf, n);
+    }
+    return out;
+}
+
+void clamp_with_keep(std::vector<llama_token>& ptok, int n_ctx_total, int reserve, int n_keep_prefix) {
+    const int n_avail = std::max(0, n_ctx_total - reserve);
+    if ((int)ptok.size() <= n_avail) return;
+
+    n_keep_prefix = std::max(0, std::min(n_keep_prefix, (int)ptok.size()));
+    if (n_keep_prefix >= n_avail) { ptok.resize(n_avail); return; }
+
+    const int n_tail = n_avail - n_keep_prefix;
+    std::vector<llama_token> kept;
+    kept.reserve(n_avail);
+    kept.insert(kept.end(), ptok.begin(), ptok.begin() + n_keep_prefix);
+    kept.insert(kept.end(), ptok.end() - n_tail, ptok.end());
+    ptok.swap(kept);
+}
+
+std::vector<llama_token> tokenize_templated(const llama_vocab* vocab, const std::string& text) {
+    if (!vocab) return {};
+    std::vector<llama_token> toks(text.size() + 8);
+    int n = llama_tokenize(
+            vocab,
+            text.c_str(), (int)text.size(),
+            toks.data(), (int)toks.size(),
+            /*add_special*/ false,
+            /*parse_special*/ true
+    );
+    if (n < 0) n = 0;
+    toks.resize(n);
+    return toks;
+}
+
+std::vector<llama_token> system_prefix(llama_model* model, const char* sys_msg) {
+    static const char* kMarker = "\x01\x02";
+    const std::string full = apply_chat_template(model, kMarker, sys_msg);
+    const size_t cut = full.find(kMarker);
+    if (cut == std::string::npos || cut == 0) return {};
+    return tokenize_templated(llama_model_get_vocab(model), full.substr(0, cut));
+}
+
+int keep_prefix_len(llama_model* model, const char* sys_msg, size_t n_prompt) {
+    const size_t n_sys = system_prefix(model, sys_msg).size();
+    return (int)std::min(n_prompt, n_sys > 0 ? n_sys : (size_t)256);
+}
+
+int answer_reserve(int max_tokens, int n_ctx_total, bool ctx_shift) {
+    const int want = std::max<int>(std::max(32, max_tokens), 64);
+    return ctx_shift ? std::min(want, n_ctx_total / 4) : want;
+}
+
+GenRequest single_turn_request(const InferenceEngine& engine, const std::string& user_prompt,
+                               const char* sys_msg, int max_tokens, float temp, float top_p,
+                               bool ctx_shift, PromptTiming* timing) {
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+
+    GenRequest req;
+    const auto t0 = Clock::now();
+    const std::string prompt_templ = apply_chat_template(engine.model(), user_prompt, sys_msg);
+    const auto t1 = Clock::now();
+    req.prompt = tokenize_templated(engine.vocab(), prompt_templ);
+    const auto t2 = Clock::now();
+    if (timing) {
+        timing->template_ms = ms(t0, t1);
+        timing->tokenize_ms = ms(t1, t2);
+    }
+    if (req.prompt.empty()) return req;
+
+    const int n_ctx_total = engine.n_ctx_seq();
+    req.n_keep = keep_prefix_len(engine.model(), sys_msg, req.prompt.size());
+    if (timing) timing->template_ms += ms(t2, Clock::now());
+    clamp_with_keep(req.prompt, n_ctx_total, answer_reserve(max_tokens, n_ctx_total, ctx_shift), req.n_keep);
+
+    req.max_tokens    = max_tokens;
+    req.temp          = temp;
+    req.top_p         = top_p;
+    req.context_shift = ctx_shift;
+    return req;
+}
+
+RagPrompt rag_prompt(llama_model* model, const char* sys_msg, const std::vector<std::string>& passages,
+                     const std::string& question, int n_ctx_total, int reserve, PromptTiming* timing) {
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    static const char* kMarker   = "\x01\x02";
+    static const char* kHeader   = "Use the following passages to answer the question.\n\n";
+    static const char* kQuestion = "Question: ";
+
+    RagPrompt rp;
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    const auto t0 = Clock::now();
+    const std::string full = apply_chat_template(model, kMarker, sys_msg);
+    const size_t cut = full.find(kMarker);
+    const auto t1 = Clock::now();
+    if (timing) timing->template_ms = ms(t0, t1);
+
+    if (cut == std::string::npos) {
+        // template không tách được phần user: một khối như single_turn_request
+        std::string user = kHeader;
+        for (const auto& p : passages) user += p + "\n\n";
+        user += kQuestion + question;
+        rp.tokens = tokenize_templated(vocab, apply_chat_template(model, user, sys_msg));
+        rp.n_prefix = (size_t)keep_prefix_len(model, sys_msg, rp.tokens.size());
+        clamp_with_keep(rp.tokens, n_ctx_total, reserve, (int)rp.n_prefix);
+        if (timing) timing->tokenize_ms = ms(t1, Clock::now());
+        return rp;
+    }
+
+    const std::vector<llama_token> prefix = tokenize_templated(vocab, full.substr(0, cut) + kHeader);
+    const std::vector<llama_token> tail =
+        tokenize_templated(vocab, kQuestion + question + full.substr(cut + strlen(kMarker)));
+    std::vector<std::vector<llama_token>> chunks;
+    chunks.reserve(passages.size());
+    for (const auto& p : passages) {
+        chunks.push_back(tokenize_templated(vocab, p + "\n\n"));
+        if (chunks.back().empty()) chunks.pop_back();
+    }
+
+    const size_t n_avail = (size_t)std::max(0, n_ctx_total - reserve);
+    size_t total = prefix.size() + tail.size();
+    for (const auto& c : chunks) total += c.size();
+    while (total > n_avail && !chunks.empty()) {
+        total -= chunks.back().size();
+        chunks.pop_back();
+    }
+
+    rp.tokens.reserve(total);
+    rp.tokens.insert(rp.tokens.end(), prefix.begin(), prefix.end());
+    rp.n_prefix = prefix.size();
+    for (const auto& c : chunks) {
+        rp.tokens.insert(rp.tokens.end(), c.begin(), c.end());
+        rp.chunk_len.push_back(c.size());
+    }
+    rp.tokens.insert(rp.tokens.end(), tail.begin(), tail.end());
+    if (rp.tokens.size() > n_avail) {
+        // câu hỏi quá dài: giữ prefix + đuôi câu hỏi, không còn đoạn nào nguyên vẹn
+        clamp_with_keep(rp.tokens, n_ctx_total, reserve, (int)rp.n_prefix);
+        rp.n_prefix = std::min(rp.n_prefix, rp.tokens.size());
+        rp.chunk_len.clear();
+    }
+    if (timing) timing->tokenize_ms = ms(t1, Clock::now());
+    return rp;
+}
@@ -0,0 +1,66 @@
+// app/src/main/cpp/chat_prompt.h
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "llama.h"
+#include "engine.h"
+
+// Dựng prompt chat từ template trong GGUF và tokenize, dùng chung cho JNI và benchmark host
+// (không phụ thuộc JNI / Android).
+
+// Render danh sách message bằng chat template của model.
+// Trả về chuỗi rỗng nếu GGUF không có template / template không hỗ trợ.
+std::string render_chat(llama_model* model, const std::vector<llama_chat_message>& msgs, bool add_ass);
+
+// Fallback khi không có template: cực tối giản
+std::string render_plain(const std::vector<llama_chat_message>& msgs, bool add_ass);
+
+// system (tuỳ chọn) + một message user, kết thúc bằng lượt assistant
+std::string apply_chat_template(llama_model* model, const std::string& user_msg, const char* sys_msg_opt);
+
+// Detokenize: không render special tokens
+std::string detok(const llama_vocab* vocab, const std::vector<llama_token>& toks);
+
+// Clamp: giữ prefix (system/header) + phần đuôi câu hỏi hiện tại
+void clamp_with_keep(std::vector<llama_token>& ptok, int n_ctx_total, int reserve, int n_keep_prefix);
+
+// add_special=false vì template đã có special; parse_special=true để nhận diện token đặc biệt
+std::vector<llama_token> tokenize_templated(const llama_vocab* vocab, const std::string& text);
+
+// Token của phần system/template cố định đứng trước message user đầu tiên (rỗng nếu không tách được)
+std::vector<llama_token> system_prefix(llama_model* model, const char* sys_msg);
+
+// Số token đầu luôn được giữ khi clamp / dịch context: phần system, hoặc 256 token đầu
+int keep_prefix_len(llama_model* model, const char* sys_msg, size_t n_prompt);
+
+// Chỗ chừa cho câu trả lời khi clamp prompt. Có context shift thì câu trả lời dài vẫn sinh tiếp
+// sau khi đầy context, nên chỉ chừa tối đa 1/4 context thay vì cắt prompt theo cả maxTokens.
+int answer_reserve(int max_tokens, int n_ctx_total, bool ctx_shift);
+
+// Thời gian dựng prompt của một request (số liệu per-request)
+struct PromptTiming {
+    double template_ms = 0;   // render chat template (+ tách phần system để giữ khi clamp)
+    double tokenize_ms = 0;
+};
+
+// Request một lượt (system + user): prompt đã template, tokenize và clamp theo context của slot.
+// Các trường còn lại (speculative, priority, seq) để bên gọi đặt.
+GenRequest single_turn_request(const InferenceEngine& engine, const std::string& user_prompt,
+                               const char* sys_msg, int max_tokens, float temp, float top_p,
+                               bool ctx_shift, PromptTiming* timing = nullptr);
+
+// Prompt RAG một lượt: system + user (tiêu đề, các đoạn, câu hỏi) + lượt assistant. Từng phần
+// được tokenize riêng nên token của một đoạn không phụ thuộc đoạn đứng cạnh (KV của đoạn dùng lại
+// được, xem ChunkKvCache).
+struct RagPrompt {
+    std::vector<llama_token> tokens;
+    size_t                   n_prefix = 0;   // system + template + tiêu đề
+    std::vector<size_t>      chunk_len;      // các đoạn nối tiếp sau prefix; sau đó là câu hỏi
+};
+
+// Đoạn cuối bị bỏ cho tới khi prompt vừa n_ctx_total - reserve; vẫn không vừa (hoặc template không
+// tách được phần user) thì clamp như single_turn_request và chunk_len rỗng.
+RagPrompt rag_prompt(llama_model* model, const char* sys_msg, const std::vector<std::string>& passages,
+                     const std::string& question, int n_ctx_total, int reserve, PromptTiming* timing = nullptr);
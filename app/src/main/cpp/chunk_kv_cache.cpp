@@ -0,0 +1,536 @@
+// app/src/main/cpp/chunk_kv_cache.cpp
+#include "chunk_kv_cache.h"
+#include "bridge_log.h"
+#include "sha256.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using Clock = std::chrono::steady_clock;
+
+// seq của context phụ: kết quả ghép, và seq tạm để nạp / dời từng đoạn
+static constexpr llama_seq_id kSeqOut = 0;
+static constexpr llama_seq_id kSeqTmp = 1;
+// Số đoạn được đếm lượt dùng tối đa (quá thì đếm lại từ đầu)
+static constexpr size_t kMaxTracked = 4096;
+// Số lần chụp chờ worker tối đa (quá thì bỏ; đoạn được dựng lại sau min_uses lần truy hồi nữa)
+static constexpr size_t kMaxPending = 16;
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// Tên file của prefix (chunk = nullptr) hoặc của một đoạn sau prefix
+static std::string entry_name(const std::string& key, const std::vector<llama_token>& prefix,
+                              const std::vector<llama_token>* chunk) {
+    Sha256 h;
+    h.update((const uint8_t*)key.data(), key.size());
+    auto add = [&h](const std::vector<llama_token>& t) {
+        const uint32_t n = (uint32_t)t.size();
+        h.update((const uint8_t*)&n, sizeof(n));
+        h.update((const uint8_t*)t.data(), t.size() * sizeof(llama_token));
+    };
+    const uint8_t tag = chunk ? 'c' : 'p';
+    h.update(&tag, 1);
+    add(prefix);
+    if (chunk) add(*chunk);
+    return h.final_hex();
+}
+
+static std::shared_ptr<std::vector<uint8_t>> get_state(llama_context* ctx, llama_seq_id seq) {
+    auto out = std::make_shared<std::vector<uint8_t>>(llama_state_seq_get_size_ext(ctx, seq, /*flags*/ 0));
+    if (out->empty() || llama_state_seq_get_data_ext(ctx, out->data(), out->size(), seq, /*flags*/ 0) == 0) {
+        return nullptr;
+    }
+    return out;
+}
+
+// --------- Mở / đóng ---------
+
+bool ChunkKvCache::open(const std::string& dir, const std::string& model_sha256, uint64_t mem_budget,
+                        uint64_t disk_budget, int min_uses) {
+    close();
+    std::unique_lock<std::shared_mutex> st(store_mu_);
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!dir.empty() && !store_.open(dir, disk_budget)) return false;
+    model_sha256_ = model_sha256;
+    mem_budget_   = mem_budget;
+    min_uses_     = std::max(1, min_uses);
+    open_         = true;
+    stop_         = false;
+    worker_       = std::thread([this] { worker(); });
+    LOGI("ChunkKvCache: dir=%s mem=%llu MB disk=%llu MB min_uses=%d", dir.empty() ? "(none)" : dir.c_str(),
+         (unsigned long long)(mem_budget >> 20), (unsigned long long)(disk_budget >> 20), min_uses_);
+    return true;
+}
+
+void ChunkKvCache::close() {
+    stop_worker();
+    std::unique_lock<std::shared_mutex> st(store_mu_);
+    {
+        std::lock_guard<std::mutex> ws(ws_mu_);
+        release_workspace_locked();
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    store_.close();
+    lru_.clear();
+    index_.clear();
+    uses_.clear();
+    mem_bytes_ = 0;
+    open_ = false;
+}
+
+void ChunkKvCache::stop_worker() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+        pending_.clear();
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) worker_.join();
+}
+
+void ChunkKvCache::trim() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        trim_mem_locked(0);
+    }
+    std::lock_guard<std::mutex> ws(ws_mu_);
+    release_workspace_locked();
+}
+
+void ChunkKvCache::detach() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        ws_detached_.store(true);
+        ws_gen_.fetch_add(1);
+        pending_.clear();
+    }
+    // chờ việc đang chạy trên context phụ (worker / assemble) xong trước khi model bị giải phóng
+    std::lock_guard<std::mutex> ws(ws_mu_);
+    release_workspace_locked();
+}
+
+void ChunkKvCache::attach() {
+    std::lock_guard<std::mutex> lock(mu_);
+    ws_detached_.store(false);
+}
+
+void ChunkKvCache::prepare(const InferenceEngine& engine) {
+    Capture c;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!open_ || ws_detached_.load()) return;
+        c.spec = spec_of(engine);
+        if (!c.spec.model || c.spec.n_ctx <= 0) return;
+        c.gen = ws_gen_.load();
+        pending_.push_front(std::move(c));
+    }
+    cv_.notify_one();
+}
+
+void ChunkKvCache::release_workspace_locked() {
+    if (!ws_) return;
+    llama_batch_free(ws_batch_);
+    ws_batch_ = {};
+    llama_free(ws_);
+    ws_      = nullptr;
+    ws_spec_ = {};
+}
+
+ChunkKvCache::Stats ChunkKvCache::stats() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    Stats st = stats_;
+    st.bytes_mem = mem_bytes_;
+    return st;
+}
+
+// Đọc cùng ws_gen_ dưới mu_: context phụ chỉ được dựng theo spec khi chưa có detach nào sau đó
+ChunkKvCache::WsSpec ChunkKvCache::spec_of(const InferenceEngine& engine) {
+    const llama_context_params& ecp = engine.cparams();
+    WsSpec s;
+    s.model     = engine.model();
+    s.n_ctx     = engine.n_ctx_seq();
+    s.type_k    = ecp.type_k;
+    s.type_v    = ecp.type_v;
+    s.fa        = ecp.flash_attn_type;
+    s.n_threads = std::max(1, engine.n_threads_decode());
+    return s;
+}
+
+// KV chỉ dùng lại được với đúng model và kiểu KV (n_ctx, số slot không ảnh hưởng). Gọi khi giữ mu_.
+std::string ChunkKvCache::model_key(const InferenceEngine& engine) const {
+    const llama_context_params& cp = engine.cparams();
+    char buf[96];
+    snprintf(buf, sizeof(buf), "|type_k=%d|type_v=%d|fa=%d", (int)cp.type_k, (int)cp.type_v,
+             (int)cp.flash_attn_type);
+    return (model_sha256_.empty() ? engine.model_path() : model_sha256_) + buf;
+}
+
+// Context phụ cùng model và kiểu KV với engine, một stream n_ctx_seq ô cho 2 seq; batch nhỏ vì
+// chỉ decode một token (áp dịch vị trí). Gọi khi giữ ws_mu_.
+bool ChunkKvCache::ensure_workspace_locked(const WsSpec& spec) {
+    if (ws_detached_.load()) return false;
+    if (ws_ && ws_spec_.model == spec.model && ws_spec_.n_ctx == spec.n_ctx && ws_spec_.type_k == spec.type_k &&
+        ws_spec_.type_v == spec.type_v && ws_spec_.fa == spec.fa) {
+        return true;
+    }
+    release_workspace_locked();
+    if (!spec.model || spec.n_ctx <= 0) return false;
+
+    llama_context_params cp = llama_context_default_params();
+    cp.n_ctx           = (uint32_t)spec.n_ctx;
+    cp.n_seq_max       = 2;
+    cp.n_batch         = kWorkspaceBatch;
+    cp.n_ubatch        = kWorkspaceBatch;
+    cp.n_threads       = spec.n_threads;
+    cp.n_threads_batch = spec.n_threads;
+    cp.type_k          = spec.type_k;
+    cp.type_v          = spec.type_v;
+    cp.flash_attn_type = spec.fa;
+    cp.kv_unified      = true;
+    cp.no_perf         = true;
+    ws_ = llama_init_from_model(spec.model, cp);
+    if (!ws_) {
+        LOGE("ChunkKvCache: cannot create workspace context");
+        return false;
+    }
+    ws_spec_  = spec;
+    ws_batch_ = llama_batch_init(1, /*embd*/0, /*n_seq_max*/1);
+    ws_shift_ = llama_memory_can_shift(llama_get_memory(ws_));
+    LOGI("ChunkKvCache: workspace n_ctx=%d, can_shift=%d", spec.n_ctx, (int)ws_shift_);
+    return true;
+}
+
+// --------- RAM / đĩa ---------
+
+void ChunkKvCache::trim_mem_locked(uint64_t budget) {
+    while (mem_bytes_ > budget && !lru_.empty()) {
+        mem_bytes_ -= lru_.back().second.state->size();
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+}
+
+ChunkKvCache::Blob ChunkKvCache::lookup(const std::string& key, const std::string& name, const Tokens& tokens) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!open_) return nullptr;
+        auto it = index_.find(name);
+        if (it != index_.end()) {
+            if (it->second->second.tokens != tokens) return nullptr;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            ++stats_.hits_mem;
+            return it->second->second.state;
+        }
+    }
+
+    // load() chờ hàng đợi ghi rồi đọc file: không giữ mu_ (capture trên thread scheduler cần nó)
+    Blob blob;
+    {
+        std::shared_lock<std::shared_mutex> st(store_mu_);
+        KvSnapshotStore::Loaded l;
+        if (store_.is_open() && store_.load(name, key, &l, /*with_state*/ true) && l.meta.tokens == tokens &&
+            l.state_size > 0) {
+            blob = std::make_shared<const std::vector<uint8_t>>(l.state, l.state + l.state_size);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!blob || !open_) {
+        ++stats_.misses;
+        return nullptr;
+    }
+    if (!index_.count(name)) put_locked(name, tokens, blob);
+    ++stats_.hits_disk;
+    return blob;
+}
+
+void ChunkKvCache::put_locked(const std::string& name, const Tokens& tokens, Blob state) {
+    auto it = index_.find(name);
+    if (it != index_.end()) {
+        mem_bytes_ -= it->second->second.state->size();
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    lru_.emplace_front(name, Entry{ tokens, state });
+    index_[name] = lru_.begin();
+    mem_bytes_ += state->size();
+    trim_mem_locked(mem_budget_);
+}
+
+void ChunkKvCache::save(const std::string& key, const std::string& name, const Tokens& tokens, const Blob& state) {
+    std::shared_lock<std::shared_mutex> st(store_mu_);
+    if (!store_.is_open()) return;
+    KvSnapshot snap;
+    snap.key    = key;
+    snap.tokens = tokens;
+    snap.state  = *state;
+    store_.save_async(name, std::move(snap));
+}
+
+// --------- Dựng KV của đoạn ---------
+
+std::vector<size_t> ChunkKvCache::note_uses(const InferenceEngine& engine, const RagPrompt& rp) {
+    std::vector<size_t> need;
+    if (rp.chunk_len.empty() || rp.n_prefix == 0) return need;
+
+    const Tokens prefix(rp.tokens.begin(), rp.tokens.begin() + (long)rp.n_prefix);
+    std::string key;
+    std::vector<std::pair<size_t, std::string>> due;   // (chỉ số đoạn, tên) đã đủ lượt
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!open_) return need;
+        key = model_key(engine);
+        if (uses_.size() > kMaxTracked) uses_.clear();
+        size_t off = rp.n_prefix;
+        for (size_t i = 0; i < rp.chunk_len.size(); ++i) {
+            const Tokens chunk(rp.tokens.begin() + (long)off, rp.tokens.begin() + (long)(off + rp.chunk_len[i]));
+            off += rp.chunk_len[i];
+            std::string name = entry_name(key, prefix, &chunk);
+            if (index_.count(name)) continue;
+            if (++uses_[name] < min_uses_) continue;
+            // đủ lượt: dựng nếu trên đĩa cũng chưa có. Lượt đếm về 0 nên request dựng bị huỷ sẽ được
+            // thử lại sau min_uses lần truy hồi nữa.
+            uses_.erase(name);
+            due.emplace_back(i, std::move(name));
+        }
+    }
+
+    for (const auto& d : due) {
+        size_t off = rp.n_prefix;
+        for (size_t j = 0; j < d.first; ++j) off += rp.chunk_len[j];
+        const Tokens chunk(rp.tokens.begin() + (long)off, rp.tokens.begin() + (long)(off + rp.chunk_len[d.first]));
+        if (!lookup(key, d.second, chunk)) need.push_back(d.first);
+    }
+    return need;
+}
+
+GenRequest ChunkKvCache::build_request(const InferenceEngine& engine, const RagPrompt& rp, size_t i) {
+    size_t off = rp.n_prefix;
+    for (size_t j = 0; j < i; ++j) off += rp.chunk_len[j];
+    Tokens prefix(rp.tokens.begin(), rp.tokens.begin() + (long)rp.n_prefix);
+    Tokens chunk(rp.tokens.begin() + (long)off, rp.tokens.begin() + (long)(off + rp.chunk_len[i]));
+
+    GenRequest req;
+    req.prompt = prefix;
+    req.prompt.insert(req.prompt.end(), chunk.begin(), chunk.end());
+    req.max_tokens    = 0;
+    req.priority      = GenPriority::Background;
+    req.speculative   = false;
+    req.context_shift = false;
+    req.on_prefilled  = [this, &engine, prefix = std::move(prefix), chunk = std::move(chunk)](llama_context* ctx, int seq) {
+        capture(engine, ctx, seq, prefix, chunk);
+    };
+    return req;
+}
+
+// Thread scheduler của engine (đang giữ ctx_mu_): seq chứa đúng prefix + chunk. Chỉ copy state của
+// seq và xếp hàng cho worker, không chạm context phụ.
+void ChunkKvCache::capture(const InferenceEngine& engine, llama_context* ctx, int seq, const Tokens& prefix,
+                           const Tokens& chunk) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!open_ || ws_detached_.load() || pending_.size() >= kMaxPending) return;
+    }
+    Capture c;
+    c.full.resize(llama_state_seq_get_size_ext(ctx, seq, /*flags*/ 0));
+    if (c.full.empty() || llama_state_seq_get_data_ext(ctx, c.full.data(), c.full.size(), seq, /*flags*/ 0) == 0) {
+        LOGE("ChunkKvCache: cannot read KV of seq %d", seq);
+        return;
+    }
+    c.prefix = prefix;
+    c.chunk  = chunk;
+    c.seq    = seq;
+    c.n_seq  = (int)llama_n_seq_max(ctx);
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!open_ || ws_detached_.load() || pending_.size() >= kMaxPending) return;
+        c.key  = model_key(engine);
+        c.spec = spec_of(engine);
+        c.gen  = ws_gen_.load();
+        pending_.push_back(std::move(c));
+    }
+    cv_.notify_one();
+}
+
+void ChunkKvCache::worker() {
+    for (;;) {
+        Capture c;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+            if (stop_) return;
+            c = std::move(pending_.front());
+            pending_.pop_front();
+        }
+        split(c);
+    }
+}
+
+// Thread worker: tách KV của đoạn (ô từ vị trí prefix.size()) trên context phụ bằng seq_cp một
+// phần; prefix cũng được lưu nếu chưa có. c.full rỗng: chỉ dựng context phụ (prepare).
+void ChunkKvCache::split(const Capture& c) {
+    const auto t0 = Clock::now();
+    const std::string cname = entry_name(c.key, c.prefix, &c.chunk);
+    const std::string pname = entry_name(c.key, c.prefix, nullptr);
+    bool have_prefix = false;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        have_prefix = index_.count(pname) > 0;
+    }
+
+    Blob cblob, pblob;
+    {
+        std::lock_guard<std::mutex> ws(ws_mu_);
+        // detach sau khi xếp hàng: model của c.spec có thể đã bị giải phóng
+        if (c.gen != ws_gen_.load() || !ensure_workspace_locked(c.spec) || c.full.empty()) return;
+
+        std::vector<uint8_t> one;
+        if (!seq_state_to_single(c.full.data(), c.full.size(), c.seq, c.n_seq, &one)) {
+            LOGE("ChunkKvCache: KV of seq %d has an unexpected layout", c.seq);
+            return;
+        }
+        llama_memory_t mem = llama_get_memory(ws_);
+        llama_memory_clear(mem, /*data*/ false);
+        const llama_pos n_prefix = (llama_pos)c.prefix.size();
+        if (!seq_state_load(ws_, kSeqOut, one.data(), one.size(), 0, c.prefix.size() + c.chunk.size())) {
+            LOGE("ChunkKvCache: KV of seq %d does not fit the workspace", c.seq);
+            llama_memory_clear(mem, /*data*/ false);
+            return;
+        }
+
+        llama_memory_seq_cp(mem, kSeqOut, kSeqTmp, n_prefix, -1);
+        cblob = get_state(ws_, kSeqTmp);
+        llama_memory_seq_rm(mem, kSeqTmp, -1, -1);
+        if (!have_prefix) {
+            llama_memory_seq_rm(mem, kSeqOut, n_prefix, -1);
+            pblob = get_state(ws_, kSeqOut);
+        }
+        llama_memory_clear(mem, /*data*/ false);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!open_) return;
+        if (cblob) {
+            put_locked(cname, c.chunk, cblob);
+            ++stats_.captured;
+        }
+        if (pblob && !index_.count(pname)) put_locked(pname, c.prefix, pblob);
+    }
+    if (cblob) save(c.key, cname, c.chunk, cblob);
+    if (pblob) save(c.key, pname, c.prefix, pblob);
+    LOGI("ChunkKvCache: captured chunk %.12s (%zu tokens, %zu KB) in %.1f ms", cname.c_str(), c.chunk.size(),
+         cblob ? cblob->size() / 1024 : 0, ms_since(t0));
+}
+
+// --------- Ghép ---------
+
+bool ChunkKvCache::assemble(const InferenceEngine& engine, const RagPrompt& rp, Assembled* out) {
+    if (rp.chunk_len.empty() || rp.n_prefix == 0) return false;
+    const auto t0 = Clock::now();
+    std::string key;
+    WsSpec      spec;
+    uint64_t    gen = 0;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!open_ || ws_detached_.load()) return false;
+        key  = model_key(engine);
+        spec = spec_of(engine);
+        gen  = ws_gen_.load();
+    }
+
+    // blob của prefix và chuỗi đoạn đầu có sẵn KV (RAM hoặc đĩa), trước khi chạm context phụ
+    const Tokens prefix(rp.tokens.begin(), rp.tokens.begin() + (long)rp.n_prefix);
+    std::string ids = entry_name(key, prefix, nullptr);
+    const Blob pblob = lookup(key, ids, prefix);
+    if (!pblob) return false;
+
+    std::vector<Blob> run;
+    size_t off = rp.n_prefix;
+    for (size_t i = 0; i < rp.chunk_len.size(); ++i) {
+        const Tokens chunk(rp.tokens.begin() + (long)off, rp.tokens.begin() + (long)(off + rp.chunk_len[i]));
+        const std::string name = entry_name(key, prefix, &chunk);
+        Blob b = lookup(key, name, chunk);
+        if (!b) break;
+        run.push_back(std::move(b));
+        ids += name;
+        off += rp.chunk_len[i];
+    }
+    if (run.empty() || off >= rp.tokens.size()) return false;
+
+    std::unique_lock<std::mutex> ws(ws_mu_);
+    if (gen != ws_gen_.load() || !ensure_workspace_locked(spec) || !ws_shift_) return false;
+
+    llama_memory_t mem = llama_get_memory(ws_);
+    auto fail = [&](const char* what) {
+        LOGE("ChunkKvCache: assemble failed (%s), prefilling", what);
+        llama_memory_clear(mem, /*data*/ false);
+        return false;
+    };
+    llama_memory_clear(mem, /*data*/ false);
+    if (!seq_state_load(ws_, kSeqOut, pblob->data(), pblob->size(), 0, rp.n_prefix)) return fail("prefix");
+
+    // đoạn k được tính ở vị trí n_prefix: nạp vào seq tạm, dời tới vị trí của nó trong prompt rồi
+    // gắn sang seq kết quả (cùng stream nên seq_cp chỉ đổi metadata của ô)
+    llama_pos pos = (llama_pos)rp.n_prefix;
+    bool shifted = false;
+    for (size_t k = 0; k < run.size(); ++k) {
+        const llama_pos len = (llama_pos)rp.chunk_len[k];
+        if (!seq_state_load(ws_, kSeqTmp, run[k]->data(), run[k]->size(), (llama_pos)rp.n_prefix, (size_t)len)) {
+            return fail("chunk");
+        }
+        const llama_pos delta = pos - (llama_pos)rp.n_prefix;
+        if (delta != 0) {
+            llama_memory_seq_add(mem, kSeqTmp, -1, -1, delta);
+            shifted = true;
+        }
+        llama_memory_seq_cp(mem, kSeqTmp, kSeqOut, -1, -1);
+        llama_memory_seq_rm(mem, kSeqTmp, -1, -1);
+        pos += len;
+    }
+
+    // seq_add chỉ đổi vị trí của ô; RoPE của K được dời ở lần decode kế tiếp, nên decode luôn
+    // token kế tiếp của prompt trước khi chụp state
+    size_t n_tokens = (size_t)pos;
+    if (shifted) {
+        llama_set_n_threads(ws_, spec.n_threads, spec.n_threads);
+        ws_batch_.token[0]     = rp.tokens[n_tokens];
+        ws_batch_.pos[0]       = pos;
+        ws_batch_.n_seq_id[0]  = 1;
+        ws_batch_.seq_id[0][0] = kSeqOut;
+        ws_batch_.logits[0]    = false;
+        ws_batch_.n_tokens     = 1;
+        if (llama_decode(ws_, ws_batch_) != 0) return fail("decode");
+        ++n_tokens;
+    }
+    if (llama_memory_seq_pos_max(mem, kSeqOut) != (llama_pos)n_tokens - 1) return fail("positions");
+
+    Blob state = get_state(ws_, kSeqOut);
+    llama_memory_clear(mem, /*data*/ false);
+    ws.unlock();
+    if (!state) return false;
+
+    uint8_t digest[Sha256::kDigestSize];
+    Sha256 h;
+    h.update((const uint8_t*)ids.data(), ids.size());
+    h.final(digest);
+    uint64_t id = 0;
+    memcpy(&id, digest, sizeof(id));
+
+    out->state    = std::move(state);
+    out->n_tokens = n_tokens;
+    out->n_chunks = run.size();
+    out->id       = id != 0 ? id : 1;
+    out->ms       = ms_since(t0);
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        ++stats_.assembled;
+    }
+    LOGI("ChunkKvCache: assembled prefix + %zu/%zu chunks (%zu tokens, %zu KB) in %.1f ms", run.size(),
+         rp.chunk_len.size(), n_tokens, out->state->size() / 1024, out->ms);
+    return true;
+}
@@ -0,0 +1,175 @@
+// app/src/main/cpp/chunk_kv_cache.h
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "llama.h"
+#include "chat_prompt.h"
+#include "engine.h"
+#include "kv_snapshot.h"
+
+// KV dựng sẵn cho các đoạn tài liệu hay được truy hồi (cache-augmented generation).
+//
+// Prompt RAG = prefix | đoạn 1 | đoạn 2 | ... | câu hỏi (RagPrompt). KV của một đoạn được tính một
+// lần ngay sau prefix (đoạn chỉ nhìn thấy prefix, không thấy các đoạn khác) bởi request nền, rồi
+// giữ trong RAM (LRU theo byte) và trên đĩa (KvSnapshotStore, LRU theo mtime), tên file là
+// sha256(model + kiểu KV, prefix, đoạn). Khi dựng prompt, prefix và chuỗi đoạn đầu đã có KV được
+// ghép nối tiếp, dời vị trí bằng llama_memory_seq_add; engine nạp KV ghép thay cho prefill và chỉ
+// prefill phần còn lại (các đoạn chưa có, câu hỏi) trên toàn bộ ngữ cảnh.
+//
+// Engine dùng kv_unified=false nên seq_cp giữa hai slot chỉ copy được cả stream: việc ghép chạy
+// trên một context phụ kv_unified=true (KV n_ctx_seq ô, như một slot, dựng khi cần) rồi chuyển
+// sang slot của engine bằng llama_state_seq_*. Blob trong cache ở dạng một stream, không phụ thuộc
+// số slot của engine.
+//
+// Thread: on_prefilled (thread scheduler, đang giữ ctx_mu_ của engine) chỉ copy state của seq và
+// xếp hàng; việc tách KV đoạn trên context phụ chạy ở thread worker của cache. mu_ chỉ giữ LRU /
+// hàng chờ, không giữ qua đọc đĩa hay llama_decode; context phụ theo ws_mu_.
+class ChunkKvCache {
+public:
+    // n_batch / n_ubatch của context phụ, planner bộ nhớ tính compute buffer của nó theo giá trị này
+    static constexpr int kWorkspaceBatch = 64;
+
+    // KV ghép cho request (GenRequest::state / n_state / state_id)
+    struct Assembled {
+        std::shared_ptr<const std::vector<uint8_t>> state;   // llama_state_seq cho context của engine
+        size_t   n_tokens = 0;   // prompt[0, n_tokens) nằm trong state
+        size_t   n_chunks = 0;   // số đoạn đầu lấy từ cache
+        uint64_t id       = 0;   // theo prefix + các đoạn đã ghép
+        double   ms       = 0;
+    };
+
+    struct Stats {
+        uint64_t hits_mem  = 0;
+        uint64_t hits_disk = 0;
+        uint64_t misses    = 0;
+        uint64_t captured  = 0;
+        uint64_t assembled = 0;
+        uint64_t bytes_mem = 0;
+    };
+
+    ChunkKvCache() = default;
+    ~ChunkKvCache() { close(); }
+
+    ChunkKvCache(const ChunkKvCache&) = delete;
+    ChunkKvCache& operator=(const ChunkKvCache&) = delete;
+
+    // dir rỗng: chỉ giữ trong RAM. min_uses: số lần một đoạn được truy hồi trước khi dựng KV cho nó.
+    bool open(const std::string& dir, const std::string& model_sha256, uint64_t mem_budget,
+              uint64_t disk_budget, int min_uses);
+    void close();
+    bool is_open() const { return open_; }
+
+    // Ghi nhận các đoạn của prompt vừa được truy hồi; trả về chỉ số các đoạn chưa có KV và đã
+    // được dùng đủ min_uses lần (cần dựng bằng build_request)
+    std::vector<size_t> note_uses(const InferenceEngine& engine, const RagPrompt& rp);
+    // Request nền prefill prefix + đoạn i rồi chụp KV của đoạn (on_prefilled)
+    GenRequest build_request(const InferenceEngine& engine, const RagPrompt& rp, size_t i);
+    // Ghép prefix + chuỗi đoạn đầu đã có KV. false nếu chưa có đoạn đầu nào hoặc ghép lỗi
+    // (khi đó request prefill như bình thường).
+    bool assemble(const InferenceEngine& engine, const RagPrompt& rp, Assembled* out);
+
+    // Dựng sẵn context phụ trên worker (cache đang mở), để lần ghép đầu không phải dựng
+    void prepare(const InferenceEngine& engine);
+    // Bỏ phần giữ trong RAM và context phụ (onTrimMemory); file trên đĩa vẫn giữ
+    void trim();
+    // detach: chờ việc đang chạy trên context phụ, bỏ hàng chờ, giải phóng context phụ và không
+    // dựng lại (capture / assemble bỏ qua) tới attach. Gọi trước khi engine nạp model khác /
+    // giải phóng model.
+    void detach();
+    void attach();
+    void flush() { store_.flush(); }
+    Stats stats() const;
+
+private:
+    using Tokens = std::vector<llama_token>;
+    using Blob   = std::shared_ptr<const std::vector<uint8_t>>;
+
+    struct Entry {
+        Tokens tokens;   // token của đoạn (kiểm tra khi nạp)
+        Blob   state;    // llama_state_seq một stream, vị trí từ prefix.size()
+    };
+
+    // Tham số context phụ, đọc từ engine trên thread gọi (worker chỉ dùng bản sao)
+    struct WsSpec {
+        llama_model*          model     = nullptr;
+        int                   n_ctx     = 0;
+        ggml_type             type_k    = GGML_TYPE_F16;
+        ggml_type             type_v    = GGML_TYPE_F16;
+        llama_flash_attn_type fa        = LLAMA_FLASH_ATTN_TYPE_AUTO;
+        int                   n_threads = 1;
+    };
+
+    // Việc của worker: state của seq vừa prefill prefix + chunk (full rỗng: chỉ dựng context phụ)
+    struct Capture {
+        WsSpec               spec;
+        uint64_t             gen = 0;   // ws_gen_ lúc xếp hàng; detach làm mọi việc cũ hết hiệu lực
+        std::string          key;
+        Tokens               prefix;
+        Tokens               chunk;
+        std::vector<uint8_t> full;
+        int                  seq   = 0;
+        int                  n_seq = 0;
+    };
+
+    static WsSpec spec_of(const InferenceEngine& engine);
+    std::string model_key(const InferenceEngine& engine) const;
+    // RAM rồi tới đĩa; tự khoá mu_, đọc đĩa ngoài mu_
+    Blob lookup(const std::string& key, const std::string& name, const Tokens& tokens);
+    void put_locked(const std::string& name, const Tokens& tokens, Blob state);
+    void save(const std::string& key, const std::string& name, const Tokens& tokens, const Blob& state);
+    void capture(const InferenceEngine& engine, llama_context* ctx, int seq, const Tokens& prefix,
+                 const Tokens& chunk);
+    void worker();
+    void split(const Capture& c);
+    void stop_worker();
+    bool ensure_workspace_locked(const WsSpec& spec);
+    void release_workspace_locked();
+    void trim_mem_locked(uint64_t budget);
+
+    // khoá: ws_mu_ có thể giữ khi lấy mu_, không ngược lại
+    mutable std::mutex mu_;
+    bool               open_     = false;
+    std::string        model_sha256_;
+    uint64_t           mem_budget_ = 0;
+    int                min_uses_   = 2;
+    // open / close store_ (độc quyền) với đọc đĩa ngoài mu_ (chung)
+    std::shared_mutex  store_mu_;
+    KvSnapshotStore    store_;
+
+    // hàng chờ của worker (theo mu_)
+    std::deque<Capture>     pending_;
+    std::condition_variable cv_;
+    bool                    stop_ = false;
+    std::thread             worker_;
+
+    // LRU trong RAM: đầu danh sách là mục mới dùng nhất
+    std::list<std::pair<std::string, Entry>>                                           lru_;
+    std::unordered_map<std::string, std::list<std::pair<std::string, Entry>>::iterator> index_;
+    uint64_t                                                                           mem_bytes_ = 0;
+    std::unordered_map<std::string, int>                                               uses_;
+
+    // context phụ để ghép / tách KV (kv_unified = true, 2 seq), theo ws_mu_
+    std::mutex         ws_mu_;
+    llama_context*     ws_       = nullptr;
+    WsSpec             ws_spec_;
+    llama_batch        ws_batch_{};
+    bool               ws_shift_ = false;   // context phụ dịch được vị trí (llama_memory_seq_add)
+    // detach: ghi dưới mu_, đọc dưới ws_mu_ trước khi dùng model
+    std::atomic<bool>     ws_detached_{false};
+    std::atomic<uint64_t> ws_gen_{0};
+
+    Stats stats_;
+};
@@ -0,0 +1,108 @@
+// app/src/main/cpp/context_pool.cpp
+#include "context_pool.h"
+#include "bridge_log.h"
+
+#include <algorithm>
+
+ContextKey ContextKey::of(const llama_context_params& cp) {
+    ContextKey k;
+    k.n_ctx      = cp.n_ctx;
+    k.n_seq      = cp.n_seq_max;
+    k.n_batch    = cp.n_batch;
+    k.n_ubatch   = cp.n_ubatch;
+    k.type_k     = cp.type_k;
+    k.type_v     = cp.type_v;
+    k.flash_attn = (int)cp.flash_attn_type;
+    return k;
+}
+
+bool ContextKey::operator==(const ContextKey& o) const {
+    return n_ctx == o.n_ctx && n_seq == o.n_seq && n_batch == o.n_batch && n_ubatch == o.n_ubatch &&
+           type_k == o.type_k && type_v == o.type_v && flash_attn == o.flash_attn;
+}
+
+size_t estimate_context_bytes(const llama_model* model, const llama_context_params& cp) {
+    if (!model) return 0;
+    const int64_t n_layer   = llama_model_n_layer(model);
+    const int64_t n_head    = std::max(1, llama_model_n_head(model));
+    const int64_t n_head_kv = std::max(1, llama_model_n_head_kv(model));
+    const int64_t n_embd_kv = llama_model_n_embd(model) / n_head * n_head_kv;   // GQA
+    const size_t  per_cell  = ggml_row_size(cp.type_k, n_embd_kv) + ggml_row_size(cp.type_v, n_embd_kv);
+    return (size_t)n_layer * cp.n_ctx * per_cell;
+}
+
+// --------- ContextPool ---------
+
+void ContextPool::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mu_);
+    budget_ = bytes;
+}
+
+size_t ContextPool::budget() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return budget_;
+}
+
+bool ContextPool::take(const ContextKey& key, Entry* out) {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (!(it->key == key)) continue;
+        bytes_ -= it->bytes;
+        *out = std::move(*it);
+        entries_.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void ContextPool::put(Entry&& e, size_t active_bytes) {
+    if (!e.ctx) return;
+    std::lock_guard<std::mutex> lock(mu_);
+    e.last_use = ++clock_;
+    bytes_ += e.bytes;
+    entries_.push_back(std::move(e));
+    trim_locked(budget_ > active_bytes ? budget_ - active_bytes : 0);
+}
+
+bool ContextPool::has(const ContextKey& key) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (const Entry& e : entries_) {
+        if (e.key == key) return true;
+    }
+    return false;
+}
+
+bool ContextPool::fits(size_t bytes, size_t active_bytes) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return bytes_ + bytes + active_bytes <= budget_;
+}
+
+void ContextPool::trim(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mu_);
+    trim_locked(bytes);
+}
+
+void ContextPool::clear() {
+    trim(0);
+}
+
+void ContextPool::trim_locked(size_t bytes) {
+    while (bytes_ > bytes && !entries_.empty()) {
+        auto lru = std::min_element(entries_.begin(), entries_.end(),
+                                    [](const Entry& a, const Entry& b) { return a.last_use < b.last_use; });
+        LOGI("context pool: free n_ctx=%u (%zu MB)", lru->key.n_ctx, lru->bytes >> 20);
+        llama_free(lru->ctx);
+        bytes_ -= lru->bytes;
+        entries_.erase(lru);
+    }
+}
+
+size_t ContextPool::bytes() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return bytes_;
+}
+
+size_t ContextPool::size() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return entries_.size();
+}
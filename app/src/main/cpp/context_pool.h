@@ -0,0 +1,75 @@
+// app/src/main/cpp/context_pool.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "llama.h"
+
+// Khoá của một context dựng sẵn: các tham số cố định lúc llama_init_from_model.
+// Số luồng không nằm trong khoá vì engine đặt lại (llama_set_n_threads + threadpool) mỗi khi
+// kích hoạt context, không tốn gì.
+struct ContextKey {
+    uint32_t n_ctx     = 0;   // tổng mọi slot
+    uint32_t n_seq     = 0;
+    uint32_t n_batch   = 0;
+    uint32_t n_ubatch  = 0;
+    ggml_type type_k   = GGML_TYPE_F16;
+    ggml_type type_v   = GGML_TYPE_F16;
+    int       flash_attn = 0;
+
+    static ContextKey of(const llama_context_params& cp);
+    bool operator==(const ContextKey& o) const;
+};
+
+// Ước lượng bộ nhớ KV của context (chưa tính compute buffer, vài chục MB với n_ubatch 512)
+size_t estimate_context_bytes(const llama_model* model, const llama_context_params& cp);
+
+// Các context đang không dùng của một model, giữ nguyên KV + mirror token từng slot để quay lại
+// preset cũ vẫn dùng lại được tiền tố. Tổng dung lượng (cộng context đang dùng) không vượt
+// budget; vượt thì giải phóng context lâu không dùng nhất. Thread-safe.
+class ContextPool {
+public:
+    struct Entry {
+        ContextKey     key;
+        llama_context* ctx   = nullptr;
+        size_t         bytes = 0;
+        std::vector<std::vector<llama_token>> tokens;   // mirror KV theo seq; rỗng = KV trống
+        uint64_t       last_use = 0;
+    };
+
+    ContextPool() = default;
+    ~ContextPool() { clear(); }
+    ContextPool(const ContextPool&) = delete;
+    ContextPool& operator=(const ContextPool&) = delete;
+
+    // 0 = không giữ context nào ngoài context đang dùng
+    void   set_budget(size_t bytes);
+    size_t budget() const;
+
+    // Lấy context khớp key ra khỏi pool; false nếu không có
+    bool take(const ContextKey& key, Entry* out);
+    // Trả context vào pool (active_bytes = context đang dùng), rồi giải phóng LRU cho tới khi
+    // vừa budget, có thể gồm chính entry vừa trả
+    void put(Entry&& e, size_t active_bytes);
+    // Pool đã có context cho key, hoặc thêm bytes nữa sẽ vượt budget
+    bool has(const ContextKey& key) const;
+    bool fits(size_t bytes, size_t active_bytes) const;
+    // Giải phóng context LRU cho tới khi tổng pool <= bytes
+    void trim(size_t bytes);
+    void clear();
+
+    size_t bytes() const;
+    size_t size() const;
+
+private:
+    void trim_locked(size_t bytes);
+
+    mutable std::mutex mu_;
+    std::vector<Entry> entries_;
+    size_t             budget_ = 0;
+    size_t             bytes_  = 0;
+    uint64_t           clock_  = 0;
+};
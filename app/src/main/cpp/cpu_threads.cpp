@@ -0,0 +1,136 @@
+// app/src/main/cpp/cpu_threads.cpp
+#include "cpu_threads.h"
+#include "bridge_log.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "ggml-cpu.h"
+
+static uint32_t read_u32(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return 0;
+    unsigned long v = 0;
+    if (fscanf(f, "%lu", &v) != 1) v = 0;
+    fclose(f);
+    return (uint32_t)v;
+}
+
+static bool cpu_online(int id) {
+    if (id == 0) return true;   // cpu0 không có file online
+    const std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/online";
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return true;
+    int v = 1;
+    if (fscanf(f, "%d", &v) != 1) v = 1;
+    fclose(f);
+    return v != 0;
+}
+
+std::vector<CpuInfo> cpu_topology() {
+    const long n = std::max(1L, sysconf(_SC_NPROCESSORS_CONF));
+    std::vector<CpuInfo> cpus;
+    for (int id = 0; id < (int)n; ++id) {
+        if (!cpu_online(id)) continue;
+        const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(id);
+        CpuInfo c;
+        c.id       = id;
+        c.capacity = read_u32(base + "/cpu_capacity");
+        if (c.capacity == 0) c.capacity = read_u32(base + "/cpufreq/cpuinfo_max_freq");
+        cpus.push_back(c);
+    }
+    std::stable_sort(cpus.begin(), cpus.end(),
+                     [](const CpuInfo& a, const CpuInfo& b) { return a.capacity > b.capacity; });
+    return cpus;
+}
+
+int big_core_count(const std::vector<CpuInfo>& cpus) {
+    if (cpus.empty()) return 1;
+    const uint32_t top = cpus.front().capacity;
+    if (top == 0) return (int)cpus.size();
+    int n = 0;
+    for (const auto& c : cpus) {
+        if ((uint64_t)c.capacity * 10 >= (uint64_t)top * 6) ++n;
+    }
+    return std::max(1, n);
+}
+
+std::vector<int> fastest_cpus(const std::vector<CpuInfo>& cpus, int n) {
+    std::vector<int> ids;
+    for (int i = 0; i < (int)cpus.size() && i < n; ++i) ids.push_back(cpus[(size_t)i].id);
+    return ids;
+}
+
+bool pin_current_thread(const std::vector<int>& cpus) {
+    if (cpus.empty()) return true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int id : cpus) {
+        if (id >= 0 && id < CPU_SETSIZE) CPU_SET(id, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        LOGE("sched_setaffinity failed for %zu cpus", cpus.size());
+        return false;
+    }
+    return true;
+}
+
+ThreadConfig default_thread_config(const std::vector<CpuInfo>& cpus) {
+    const int big = big_core_count(cpus);
+    ThreadConfig cfg;
+    cfg.n_decode  = std::min(big, 4);
+    cfg.n_prefill = big;
+    return cfg;
+}
+
+// --------- ThreadPools ---------
+
+ThreadPools::~ThreadPools() {
+    release(nullptr);
+}
+
+bool ThreadPools::create(const ThreadConfig& cfg, bool pin) {
+    release(nullptr);
+    cfg_.n_decode  = std::max(1, std::min(cfg.n_decode, GGML_MAX_N_THREADS));
+    cfg_.n_prefill = std::max(1, std::min(cfg.n_prefill, GGML_MAX_N_THREADS));
+
+    const std::vector<CpuInfo> cpus = pin ? cpu_topology() : std::vector<CpuInfo>();
+    auto make = [&](int n_threads, bool strict) {
+        ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+        const std::vector<int> ids = fastest_cpus(cpus, n_threads);
+        // chỉ ghim khi đủ lõi riêng cho mỗi luồng; thiếu thì để hệ điều hành xếp
+        if (pin && (int)ids.size() >= n_threads) {
+            for (int id : ids) {
+                if (id < GGML_MAX_N_THREADS) tpp.cpumask[id] = true;
+            }
+            tpp.strict_cpu = strict;
+        }
+        return ggml_threadpool_new(&tpp);
+    };
+    // decode: mỗi luồng một lõi lớn cố định; prefill: cả nhóm lõi, luồng tự di chuyển trong nhóm
+    decode_  = make(cfg_.n_decode, /*strict*/ true);
+    prefill_ = cfg_.n_prefill == cfg_.n_decode ? nullptr : make(cfg_.n_prefill, /*strict*/ false);
+    if (!decode_ || (cfg_.n_prefill != cfg_.n_decode && !prefill_)) {
+        LOGE("ggml_threadpool_new failed (decode=%d, prefill=%d)", cfg_.n_decode, cfg_.n_prefill);
+        release(nullptr);
+        return false;
+    }
+    return true;
+}
+
+void ThreadPools::attach(llama_context* ctx) {
+    if (!ctx || !decode_) return;
+    llama_attach_threadpool(ctx, decode_, prefill_ ? prefill_ : decode_);
+}
+
+void ThreadPools::release(llama_context* ctx) {
+    if (ctx && decode_) llama_detach_threadpool(ctx);
+    if (prefill_) ggml_threadpool_free(prefill_);
+    if (decode_) ggml_threadpool_free(decode_);
+    decode_  = nullptr;
+    prefill_ = nullptr;
+}
@@ -0,0 +1,58 @@
+// app/src/main/cpp/cpu_threads.h
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "llama.h"
+
+// Cấu hình CPU cho suy luận trên SoC big.LITTLE: prefill nặng tính toán (nhiều luồng có lợi),
+// decode nặng băng thông bộ nhớ (luồng chạy trên lõi nhỏ kéo chậm cả bước vì ggml chia việc đều).
+
+struct CpuInfo {
+    int      id       = 0;
+    uint32_t capacity = 0;   // cpu_capacity (arm64) hoặc cpuinfo_max_freq (kHz); 0 = không rõ
+};
+
+// Các CPU online, nhanh nhất trước (cùng capacity: id tăng dần)
+std::vector<CpuInfo> cpu_topology();
+
+// Số lõi "lớn": capacity >= 60% lõi mạnh nhất (không đọc được sysfs: mọi lõi)
+int big_core_count(const std::vector<CpuInfo>& cpus);
+
+// id của n lõi nhanh nhất
+std::vector<int> fastest_cpus(const std::vector<CpuInfo>& cpus, int n);
+
+// Gắn thread đang gọi vào tập CPU; rỗng = không làm gì
+bool pin_current_thread(const std::vector<int>& cpus);
+
+// Số luồng mặc định khi chưa autotune: decode trên các lõi lớn (tối đa 4), prefill trên mọi lõi lớn
+struct ThreadConfig {
+    int n_decode  = 4;
+    int n_prefill = 4;
+};
+ThreadConfig default_thread_config(const std::vector<CpuInfo>& cpus);
+
+// Hai ggml threadpool gắn vào context: threadpool (batch 1 token = decode) và threadpool_batch
+// (prefill), mỗi pool chỉ chạy trên các lõi nhanh nhất đủ cho số luồng của nó.
+// ggml đặt affinity của luồng tạo pool theo worker 0, nên create() phải chạy trên chính luồng
+// gọi llama_decode.
+class ThreadPools {
+public:
+    ThreadPools() = default;
+    ~ThreadPools();
+    ThreadPools(const ThreadPools&) = delete;
+    ThreadPools& operator=(const ThreadPools&) = delete;
+
+    bool create(const ThreadConfig& cfg, bool pin);
+    void attach(llama_context* ctx);
+    // Tháo khỏi context (nếu có) rồi giải phóng pool
+    void release(llama_context* ctx);
+
+    const ThreadConfig& config() const { return cfg_; }
+
+private:
+    struct ggml_threadpool* decode_  = nullptr;
+    struct ggml_threadpool* prefill_ = nullptr;
+    ThreadConfig cfg_;
+};
@@ -0,0 +1,128 @@
+// app/src/main/cpp/embedder.cpp
+#include "embedder.h"
+#include "vec_kernels.h"
+#include "bridge_log.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool Embedder::load(const std::string& path, int n_threads, int n_ctx, int n_seq_max) {
+    release();
+    llama_backend_init();
+
+    llama_model_params mparams = llama_model_default_params();
+    mparams.use_mmap  = true;
+    mparams.use_mlock = false;
+
+    model_ = llama_model_load_from_file(path.c_str(), mparams);
+    if (!model_) {
+        LOGE("Embedder: failed to load %s", path.c_str());
+        return false;
+    }
+
+    n_ctx     = std::max(32, std::min(n_ctx, llama_model_n_ctx_train(model_)));
+    n_seq_max = std::max(1, std::min(n_seq_max, (int)llama_max_parallel_sequences()));
+
+    // Mỗi chuỗi tối đa n_ctx token; batch chứa được n_seq_max chuỗi đầy.
+    // Encoder không causal phải thấy trọn chuỗi trong một ubatch nên n_ubatch = n_batch.
+    const int n_total = n_ctx * n_seq_max;
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx           = (uint32_t)n_total;
+    cparams.n_batch         = (uint32_t)n_total;
+    cparams.n_ubatch        = (uint32_t)n_total;
+    cparams.n_seq_max       = (uint32_t)n_seq_max;
+    cparams.n_threads       = n_threads;
+    cparams.n_threads_batch = n_threads;
+    cparams.embeddings      = true;
+
+    ctx_ = llama_init_from_model(model_, cparams);
+    if (!ctx_) {
+        LOGE("Embedder: failed to create context");
+        release();
+        return false;
+    }
+
+    vocab_   = llama_model_get_vocab(model_);
+    n_embd_  = llama_model_n_embd(model_);
+    n_ctx_     = n_ctx;
+    n_batch_   = n_total;
+    n_seq_max_ = n_seq_max;
+    pooling_   = llama_pooling_type(ctx_);
+    LOGI("Embedder ready (dim=%d, n_ctx=%d, n_seq_max=%d, pooling=%d)", n_embd_, n_ctx_, n_seq_max_, (int)pooling_);
+    return true;
+}
+
+void Embedder::release() {
+    if (ctx_)   { llama_free(ctx_);         ctx_   = nullptr; }
+    if (model_) { llama_model_free(model_); model_ = nullptr; }
+    vocab_  = nullptr;
+    n_embd_    = 0;
+    n_ctx_     = 0;
+    n_batch_   = 0;
+    n_seq_max_ = 1;
+}
+
+std::vector<llama_token> Embedder::tokenize(const std::string& text) const {
+    std::vector<llama_token> toks(text.size() + 8);
+    int n = llama_tokenize(vocab_, text.c_str(), (int)text.size(), toks.data(), (int)toks.size(),
+                           /*add_special*/ true, /*parse_special*/ false);
+    if (n < 0) {
+        toks.resize((size_t)-n);
+        n = llama_tokenize(vocab_, text.c_str(), (int)text.size(), toks.data(), (int)toks.size(),
+                           /*add_special*/ true, /*parse_special*/ false);
+    }
+    toks.resize((size_t)std::max(0, n));
+    if ((int)toks.size() > n_ctx_) toks.resize((size_t)n_ctx_);
+    return toks;
+}
+
+void Embedder::clear_memory() {
+    // encoder thuần (BERT) không có memory
+    if (llama_memory_t mem = llama_get_memory(ctx_)) llama_memory_clear(mem, /*data*/ true);
+}
+
+bool Embedder::read_pooled(llama_seq_id seq_id, int first, int count, float* out) const {
+    if (pooling_ != LLAMA_POOLING_TYPE_NONE) {
+        const float* e = llama_get_embeddings_seq(ctx_, seq_id);
+        if (!e) return false;
+        memcpy(out, e, (size_t)n_embd_ * sizeof(float));
+    } else {
+        std::fill(out, out + n_embd_, 0.f);
+        for (int i = first; i < first + count; ++i) {
+            const float* e = llama_get_embeddings_ith(ctx_, i);
+            if (!e) return false;
+            for (int j = 0; j < n_embd_; ++j) out[j] += e[j];
+        }
+    }
+    veck::normalize(out, (size_t)n_embd_);
+    return true;
+}
+
+bool Embedder::embed(const std::string& text, std::vector<float>& out) {
+    if (!ctx_) return false;
+
+    const std::vector<llama_token> toks = tokenize(text);
+    if (toks.empty()) return false;
+
+    clear_memory();
+
+    llama_batch batch = llama_batch_init((int32_t)toks.size(), /*embd*/0, /*n_seq_max*/1);
+    for (size_t i = 0; i < toks.size(); ++i) {
+        batch.token[i]     = toks[i];
+        batch.pos[i]       = (llama_pos)i;
+        batch.n_seq_id[i]  = 1;
+        batch.seq_id[i][0] = 0;
+        batch.logits[i]    = true;
+    }
+    batch.n_tokens = (int32_t)toks.size();
+
+    const int rc = llama_decode(ctx_, batch);
+    llama_batch_free(batch);
+    if (rc != 0) {
+        LOGE("Embedder: decode failed (%d)", rc);
+        return false;
+    }
+
+    out.resize((size_t)n_embd_);
+    return read_pooled(0, 0, (int)toks.size(), out.data());
+}
@@ -0,0 +1,50 @@
+// app/src/main/cpp/embedder.h
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+// Tính embedding câu/đoạn từ một GGUF embedding (bge, e5, nomic, ...).
+// Model + context riêng, tách khỏi model sinh văn bản của LlamaBridge.
+class Embedder {
+public:
+    Embedder() = default;
+    ~Embedder() { release(); }
+
+    Embedder(const Embedder&) = delete;
+    Embedder& operator=(const Embedder&) = delete;
+
+    // n_ctx: số token tối đa mỗi chuỗi; n_seq_max: số chuỗi đóng gói được trong một batch
+    bool load(const std::string& path, int n_threads, int n_ctx, int n_seq_max = 1);
+    void release();
+
+    bool ready() const { return ctx_ != nullptr; }
+    int  dim()   const { return n_embd_; }
+    int  n_ctx() const { return n_ctx_; }
+    int  n_batch()   const { return n_batch_; }
+    int  n_seq_max() const { return n_seq_max_; }
+
+    // Embedding đã L2-normalize của text (bị cắt còn n_ctx token). false nếu decode lỗi.
+    bool embed(const std::string& text, std::vector<float>& out);
+
+    // Dùng cho pipeline nạp tài liệu (tokenize an toàn khi gọi từ thread khác)
+    llama_context*     ctx()   const { return ctx_; }
+    std::vector<llama_token> tokenize(const std::string& text) const;
+    void clear_memory();
+
+    // Đọc embedding của seq_id sau llama_decode; tự mean-pool nếu model không pool.
+    // first/count: vị trí các token của seq trong batch (chỉ cần khi pooling NONE).
+    bool read_pooled(llama_seq_id seq_id, int first, int count, float* out) const;
+
+private:
+    llama_model*       model_  = nullptr;
+    llama_context*     ctx_    = nullptr;
+    const llama_vocab* vocab_  = nullptr;
+    int                n_embd_ = 0;
+    int                n_ctx_  = 0;
+    int                n_batch_   = 0;
+    int                n_seq_max_ = 1;
+    enum llama_pooling_type pooling_ = LLAMA_POOLING_TYPE_NONE;
+};
@@ -0,0 +1,1094 @@
+// app/src/main/cpp/engine.cpp
+#include "engine.h"
+#include "bridge_log.h"
+#include "fast_sampler.h"
+#include "prompt_lookup.h"
+#include "token_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+using Clock = std::chrono::steady_clock;
+
+// --------- GenJob ---------
+
+bool GenJob::wait_output(std::string* out, PrefillProgress* progress) {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [&] { return !out_.empty() || done_ || (progress && progress_dirty_); });
+    bool any = false;
+    if (progress) {
+        *progress = progress_dirty_ ? progress_ : PrefillProgress{};
+        any = progress_dirty_;
+        progress_dirty_ = false;
+    }
+    if (!out_.empty()) {
+        out->append(out_);
+        out_.clear();
+        any = true;
+    }
+    return any;
+}
+
+bool GenJob::ok() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return done_ && ok_;
+}
+
+void GenJob::push_text(const char* s, size_t n) {
+    if (n == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        out_.append(s, n);
+    }
+    cv_.notify_all();
+}
+
+void GenJob::push_progress(size_t done, size_t total) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        progress_       = { (int)done, (int)total };
+        progress_dirty_ = true;
+    }
+    cv_.notify_all();
+}
+
+void GenJob::finish(bool ok, const char* err) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (err) error_ = err;
+        ok_   = ok;
+        done_ = true;
+    }
+    cv_.notify_all();
+}
+
+// --------- Slot ---------
+
+struct InferenceEngine::Slot {
+    static constexpr size_t kAllExact = std::numeric_limits<size_t>::max();
+
+    int                      seq = 0;
+    std::vector<llama_token> tokens;   // mirror KV của seq (vị trí i <-> tokens[i])
+    // KV của tokens[0, n_exact) trùng với prefill liền mạch; phần sau là KV ghép (GenRequest::state)
+    // của request có state_id, chỉ request cùng state_id được dùng lại
+    uint64_t                 state_id = 0;
+    size_t                   n_exact  = kAllExact;
+
+    std::shared_ptr<GenJob>  job;
+    llama_sampler*           smpl = nullptr;
+    Utf8Assembler            utf8;
+    PromptLookup             lookup;
+    Clock::time_point        t0;
+    Clock::time_point        t_emit;   // lúc giao token gần nhất (histogram độ trễ)
+
+    size_t      n_prompt   = 0;       // số token prompt đã nằm trong KV
+    bool        generating = false;   // prefill xong, cur đã sample + giao nhưng chưa decode
+    bool        spec_off   = false;   // memory không xoá được một phần -> không draft
+    bool        cur_pending = false;  // cur đã giao cho request nhưng chưa nằm trong KV
+    llama_token cur        = 0;
+    std::vector<llama_token> draft;
+
+    // vị trí của slot trong batch của vòng hiện tại
+    int i_batch = -1;
+    int n_batch = 0;
+    int n_draft = 0;
+
+    const GenRequest& req() const { return job->req_; }
+
+    // Số token đầu của prompt dùng được ngay từ KV của slot
+    size_t reusable(const GenRequest& r) const {
+        size_t n_max = std::min(tokens.size(), r.prompt.size());
+        if (state_id != 0 && state_id != r.state_id) n_max = std::min(n_max, n_exact);
+        size_t n = 0;
+        while (n < n_max && tokens[n] == r.prompt[n]) ++n;
+        return n;
+    }
+};
+
+// --------- State một stream ---------
+
+// Dạng đầu blob dưới đây là của llama_kv_cache::state_write ở phiên bản này
+static constexpr bool kStateLayoutKnown = LLAMA_STATE_SEQ_VERSION == 2 && LLAMA_SESSION_VERSION == 9;
+
+static uint32_t load_u32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+bool seq_state_to_single(const uint8_t* data, size_t size, int seq, int n_seq, std::vector<uint8_t>* out) {
+    if (!kStateLayoutKnown || seq < 0 || seq >= n_seq) return false;
+    const size_t head = 4 + 4 * (size_t)seq;              // n_stream + các stream trống trước seq
+    const size_t tail = 4 * (size_t)(n_seq - 1 - seq);    // các stream trống sau seq
+    if (size < head + 4 + tail || load_u32(data) != (uint32_t)n_seq) return false;
+    for (size_t off = 4; off < head; off += 4) {
+        if (load_u32(data + off) != 0) return false;
+    }
+    for (size_t off = size - tail; off < size; off += 4) {
+        if (load_u32(data + off) != 0) return false;
+    }
+    const uint32_t one = 1;
+    out->resize(4 + size - head - tail);
+    memcpy(out->data(), &one, 4);
+    memcpy(out->data() + 4, data + head, size - head - tail);
+    return true;
+}
+
+bool seq_state_from_single(const uint8_t* data, size_t size, int seq, int n_seq, std::vector<uint8_t>* out) {
+    if (!kStateLayoutKnown || seq < 0 || seq >= n_seq || size < 8 || load_u32(data) != 1) return false;
+    const uint32_t n = (uint32_t)n_seq;
+    out->assign(4 + 4 * (size_t)seq, 0);
+    memcpy(out->data(), &n, 4);
+    out->insert(out->end(), data + 4, data + size);
+    out->resize(out->size() + 4 * (size_t)(n_seq - 1 - seq), 0);
+    return true;
+}
+
+bool seq_state_load(llama_context* ctx, llama_seq_id seq, const uint8_t* data, size_t size, llama_pos pos0,
+                    size_t n) {
+    llama_memory_t mem = llama_get_memory(ctx);
+    const bool ok = n > 0 &&
+        llama_state_seq_set_data_ext(ctx, data, size, seq, /*flags*/ 0) == size &&
+        llama_state_seq_get_size_ext(ctx, seq, /*flags*/ 0) == size &&
+        llama_memory_seq_pos_min(mem, seq) == pos0 &&
+        llama_memory_seq_pos_max(mem, seq) == pos0 + (llama_pos)n - 1;
+    if (!ok) llama_memory_seq_rm(mem, seq, -1, -1);
+    return ok;
+}
+
+// --------- InferenceEngine ---------
+
+InferenceEngine::InferenceEngine() = default;
+InferenceEngine::~InferenceEngine() { unload(); }
+
+static void normalize_params(InferenceEngine::Params& p) {
+    p.n_seq           = std::max(2, p.n_seq);
+    p.n_ctx_seq       = std::max(256, p.n_ctx_seq);
+    p.n_batch         = std::max(32, p.n_batch);
+    p.n_threads       = std::max(1, p.n_threads);
+    p.n_threads_batch = p.n_threads_batch > 0 ? p.n_threads_batch : p.n_threads;
+}
+
+// Mỗi slot một stream KV riêng n_ctx_seq ô (kv_unified=false): slot nền không thể lấn
+// sang context của chat, và attention không phải quét KV của sequence khác.
+static llama_context_params make_cparams(const InferenceEngine::Params& p) {
+    llama_context_params cp = llama_context_default_params();
+    cp.n_ctx           = (uint32_t)(p.n_ctx_seq * p.n_seq);
+    cp.n_seq_max       = (uint32_t)p.n_seq;
+    cp.n_batch         = (uint32_t)p.n_batch;
+    cp.n_ubatch        = (uint32_t)(p.n_ubatch > 0 ? std::min(p.n_ubatch, p.n_batch) : std::min(p.n_batch, 512));
+    cp.n_threads       = (int32_t)p.n_threads;
+    cp.n_threads_batch = (int32_t)p.n_threads_batch;
+    cp.type_k          = p.type_k;
+    cp.type_v          = p.type_v;
+    cp.flash_attn_type = p.flash_attn;
+    cp.kv_unified      = false;
+    cp.no_perf         = false;   // llama_perf_context cho benchmark / thống kê
+    return cp;
+}
+
+bool InferenceEngine::load(const std::string& model_path, const Params& p) {
+    if (!load_model(model_path)) return false;
+    if (!configure(p)) {
+        unload();
+        return false;
+    }
+    return true;
+}
+
+bool InferenceEngine::load_model(const std::string& model_path) {
+    std::unique_lock<std::shared_mutex> life(life_mu_);
+    if (model_ && model_path == model_path_) return true;
+    unload_locked();
+
+    llama_model_params mparams = llama_model_default_params();
+    mparams.use_mmap  = true;
+    mparams.use_mlock = false;
+
+    LOGI("Loading model: %s", model_path.c_str());
+    model_ = llama_model_load_from_file(model_path.c_str(), mparams);
+    if (!model_) {
+        LOGE("Failed to load model");
+        return false;
+    }
+    vocab_      = llama_model_get_vocab(model_);
+    model_path_ = model_path;
+    return true;
+}
+
+bool InferenceEngine::configure(const Params& p) {
+    std::unique_lock<std::shared_mutex> life(life_mu_);
+    if (!model_) return false;
+    const auto t0 = Clock::now();
+    stop_thread();
+
+    Params q = p;
+    normalize_params(q);
+    const llama_context_params cp = make_cparams(q);
+
+    ContextPool::Entry e;
+    const bool pooled = ctx_pool_.take(ContextKey::of(cp), &e);
+    if (!pooled) {
+        e.key   = ContextKey::of(cp);
+        e.bytes = estimate_context_bytes(model_, cp);
+    }
+    // trả context cũ vào pool trước khi dựng context mới, để budget được tính cả context mới
+    park_context(e.bytes);
+    params_  = q;
+    cparams_ = cp;
+    spec_max_draft_.store(std::max(0, std::min(p.spec_max_draft, kSpecDraftCap)));
+    if (!pooled) e.ctx = new_context(cparams_);
+    if (!e.ctx) {
+        LOGE("Failed to create context");
+        return false;
+    }
+
+    ctx_       = e.ctx;
+    ctx_bytes_ = e.bytes;
+    batch_     = llama_batch_init(params_.n_batch, /*embd*/0, /*n_seq_max*/1);
+    can_shift_ = llama_memory_can_shift(llama_get_memory(ctx_));
+
+    for (int i = 0; i < params_.n_seq; ++i) {
+        slots_.push_back(std::make_unique<Slot>());
+        slots_.back()->seq = i;
+        if ((size_t)i < e.tokens.size()) slots_.back()->tokens = std::move(e.tokens[(size_t)i]);
+    }
+    // mutex của lease có thể đang bị giữ (lease() không cần engine chạy): chỉ thêm, giữ nguyên địa chỉ
+    while ((int)leases_.size() < params_.n_seq) leases_.push_back(std::make_unique<std::mutex>());
+
+    n_threads_decode_.store(params_.n_threads);
+    n_threads_prefill_.store(params_.n_threads_batch);
+    threads_batch_cur_ = params_.n_threads_batch;
+    stopping_.store(false);
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = false;
+        threads_pending_ = { params_.n_threads, params_.n_threads_batch };
+        threads_dirty_   = true;
+    }
+    thread_ = std::thread([this] { loop(); });
+
+    LOGI("engine ready: %d slots x n_ctx=%d, n_batch=%d, n_threads=%d/%d, can_shift=%d, "
+         "%s context %zu MB in %.1f ms (pool: %zu, %zu MB)",
+         params_.n_seq, n_ctx_seq(), params_.n_batch, params_.n_threads, params_.n_threads_batch,
+         (int)can_shift_, pooled ? "pooled" : "new", ctx_bytes_ >> 20,
+         std::chrono::duration<double, std::milli>(Clock::now() - t0).count(),
+         ctx_pool_.size(), ctx_pool_.bytes() >> 20);
+    return true;
+}
+
+bool InferenceEngine::prepare_context(const Params& p) {
+    std::shared_lock<std::shared_mutex> life(life_mu_);
+    if (!model_) return false;
+    Params q = p;
+    normalize_params(q);
+    const llama_context_params cp = make_cparams(q);
+    const ContextKey key = ContextKey::of(cp);
+    if ((ctx_ && key == ContextKey::of(cparams_)) || ctx_pool_.has(key)) return true;
+
+    const size_t bytes = estimate_context_bytes(model_, cp);
+    if (!ctx_pool_.fits(bytes, ctx_bytes_)) {
+        LOGI("context pool: n_ctx=%u (%zu MB) exceeds budget, not prepared", cp.n_ctx, bytes >> 20);
+        return false;
+    }
+    ContextPool::Entry e;
+    e.key   = key;
+    e.bytes = bytes;
+    e.ctx   = new_context(cp);
+    if (!e.ctx) return false;
+    ctx_pool_.put(std::move(e), ctx_bytes_);
+    return true;
+}
+
+void InferenceEngine::set_context_budget(size_t bytes) {
+    std::shared_lock<std::shared_mutex> life(life_mu_);
+    ctx_pool_.set_budget(bytes);
+    ctx_pool_.trim(bytes > ctx_bytes_ ? bytes - ctx_bytes_ : 0);
+}
+
+llama_context* InferenceEngine::new_context(const llama_context_params& cp) {
+    llama_context* ctx = llama_init_from_model(model_, cp);
+    if (ctx) llama_set_abort_callback(ctx, &InferenceEngine::abort_cb, this);
+    return ctx;
+}
+
+// Dừng scheduler: request còn lại kết thúc với lỗi
+void InferenceEngine::stop_thread() {
+    if (!thread_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    stopping_.store(true);
+    cv_.notify_all();
+    thread_.join();
+}
+
+// Scheduler đã dừng: tháo threadpool rồi trả ctx_ cùng mirror KV các slot vào pool
+// (next_bytes = context sắp dùng, tính vào budget)
+void InferenceEngine::park_context(size_t next_bytes) {
+    if (!ctx_) return;
+    pools_.release(ctx_);
+    llama_batch_free(batch_);
+    batch_ = {};
+
+    ContextPool::Entry e;
+    e.key   = ContextKey::of(cparams_);
+    e.ctx   = ctx_;
+    e.bytes = ctx_bytes_;
+    for (auto& s : slots_) {
+        // pool chỉ giữ mirror: phần KV ghép không còn nhận ra được, coi như không dùng lại
+        if (s->state_id != 0 && s->tokens.size() > s->n_exact) s->tokens.resize(s->n_exact);
+        e.tokens.push_back(std::move(s->tokens));
+    }
+    slots_.clear();
+    ctx_       = nullptr;
+    ctx_bytes_ = 0;
+    ctx_pool_.put(std::move(e), next_bytes);
+}
+
+void InferenceEngine::unload() {
+    std::unique_lock<std::shared_mutex> life(life_mu_);
+    unload_locked();
+}
+
+// Đang giữ life_mu_ độc quyền. leases_ giữ lại tới khi huỷ engine (xem configure)
+void InferenceEngine::unload_locked() {
+    stop_thread();
+    slots_.clear();
+    if (ctx_) {
+        pools_.release(ctx_);
+        llama_batch_free(batch_);
+        batch_ = {};
+        llama_free(ctx_);
+        ctx_       = nullptr;
+        ctx_bytes_ = 0;
+    }
+    ctx_pool_.clear();
+    if (model_) {
+        llama_model_free(model_);
+        model_ = nullptr;
+    }
+    model_path_.clear();
+    vocab_  = nullptr;
+    totals_ = {};
+}
+
+int InferenceEngine::n_ctx_seq() const {
+    return ctx_ ? (int)llama_n_ctx_seq(ctx_) : 0;
+}
+
+InferenceEngine::SlotLease InferenceEngine::lease(int seq) {
+    SlotLease l;
+    std::mutex* m = nullptr;
+    {
+        std::shared_lock<std::shared_mutex> life(life_mu_);
+        if (seq < 0 || seq >= params_.n_seq || seq >= (int)leases_.size()) return l;
+        m = leases_[(size_t)seq].get();
+    }
+    // chờ lease ngoài life_mu_: configure không phải đợi lượt hội thoại đang giữ lease
+    l.lock_ = std::unique_lock<std::mutex>(*m);
+    l.seq_  = seq;
+    return l;
+}
+
+std::shared_ptr<GenJob> InferenceEngine::submit(GenRequest req) {
+    std::shared_lock<std::shared_mutex> life(life_mu_);
+    if (!ctx_ || req.prompt.empty() || req.seq >= params_.n_seq) return nullptr;
+    if ((int)req.prompt.size() >= n_ctx_seq()) {
+        LOGE("submit: prompt %zu tokens >= n_ctx_seq %d", req.prompt.size(), n_ctx_seq());
+        return nullptr;
+    }
+    if (!req.context_shift) {
+        req.max_tokens = std::min(req.max_tokens, n_ctx_seq() - (int)req.prompt.size());
+    }
+    req.max_tokens = std::max(0, req.max_tokens);
+    req.n_keep     = std::max(0, std::min(req.n_keep, (int)req.prompt.size()));
+    // state phải chừa ít nhất một token prompt để prefill (lấy logits)
+    if (!req.state || req.state_id == 0 || req.n_state == 0 || req.n_state >= req.prompt.size()) {
+        req.state.reset();
+        req.n_state = 0;
+    }
+    req.n_state_exact = std::min(req.n_state_exact, req.n_state);
+
+    auto job = std::make_shared<GenJob>();
+    job->req_      = std::move(req);
+    job->t_submit_ = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        job->order_ = next_order_++;
+        queue_.push_back(job);
+        if (job->req_.priority == GenPriority::Interactive) interactive_waiting_.store(true);
+    }
+    cv_.notify_all();
+    return job;
+}
+
+void InferenceEngine::cancel_all(GenPriority prio) {
+    std::shared_lock<std::shared_mutex> life(life_mu_);
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto& job : queue_) {
+        if (job->req_.priority == prio) job->cancel();
+    }
+    for (auto& s : slots_) {
+        // job chỉ đổi trong vòng scheduler; ở đây chỉ đặt cờ nên không cần ctx_mu_
+        if (auto job = std::atomic_load(&s->job)) {
+            if (job->req_.priority == prio) job->cancel();
+        }
+    }
+}
+
+void InferenceEngine::with_slot(int seq, const SlotFn& fn) {
+    std::shared_lock<std::shared_mutex> life(life_mu_);
+    if (!ctx_ || seq < 0 || seq >= (int)slots_.size()) return;
+    slot_waiters_.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(ctx_mu_);
+        Slot& s = *slots_[(size_t)seq];
+        const std::vector<llama_token> before = s.state_id != 0 ? s.tokens : std::vector<llama_token>();
+        fn(ctx_, s.tokens);
+        // fn đã thay KV của slot (khôi phục snapshot...): KV mới coi như liền mạch
+        if (s.state_id != 0 && s.tokens != before) {
+            s.state_id = 0;
+            s.n_exact  = Slot::kAllExact;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        slot_waiters_.fetch_sub(1);
+    }
+    cv_.notify_all();
+}
+
+llama_perf_context_data InferenceEngine::perf_context() {
+    llama_perf_context_data d{};
+    with_slot(0, [&](llama_context* ctx, std::vector<llama_token>&) { d = llama_perf_context(ctx); });
+    return d;
+}
+
+void InferenceEngine::perf_reset() {
+    with_slot(0, [](llama_context* ctx, std::vector<llama_token>&) { llama_perf_context_reset(ctx); });
+}
+
+bool InferenceEngine::abort_cb(void* data) {
+    auto* self = (InferenceEngine*)data;
+    if (self->stopping_.load()) return true;
+    if (self->batch_bg_only_ && self->interactive_waiting_.load()) return true;
+    for (const GenJob* job : self->batch_prefill_jobs_) {
+        if (job->cancelled()) return true;
+    }
+    return false;
+}
+
+void InferenceEngine::set_speculative(int max_draft) {
+    spec_max_draft_.store(std::max(0, std::min(max_draft, kSpecDraftCap)));
+}
+
+void InferenceEngine::set_threads(int n_decode, int n_prefill) {
+    std::shared_lock<std::shared_mutex> life(life_mu_);
+    if (!ctx_) return;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        threads_pending_ = { std::max(1, n_decode), std::max(1, n_prefill) };
+        threads_dirty_   = true;
+    }
+    n_threads_decode_.store(std::max(1, n_decode));
+    n_threads_prefill_.store(std::max(1, n_prefill));
+    cv_.notify_all();
+}
+
+// Thread scheduler, đang giữ ctx_mu_. Không tạo được pool thì llama tự tạo pool mặc định
+// theo số luồng của context.
+void InferenceEngine::apply_threads(const ThreadConfig& cfg) {
+    pools_.release(ctx_);
+    if (pools_.create(cfg, params_.pin_cpus)) pools_.attach(ctx_);
+    llama_set_n_threads(ctx_, cfg.n_decode, cfg.n_prefill);
+    threads_batch_cur_ = cfg.n_prefill;
+    // OpenMP: luồng worker kế thừa affinity của luồng gọi llama_decode
+    if (params_.pin_cpus) pin_current_thread(fastest_cpus(cpu_topology(), std::max(cfg.n_decode, cfg.n_prefill)));
+    LOGI("engine: threads decode=%d prefill=%d (pin=%d)", cfg.n_decode, cfg.n_prefill, (int)params_.pin_cpus);
+}
+
+GenStats InferenceEngine::totals() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return totals_;
+}
+
+// --------- Scheduler ---------
+
+void InferenceEngine::loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            // std::mutex không công bằng: nhường ctx_mu_ cho with_slot trước khi vào vòng mới
+            cv_.wait(lock, [this] {
+                if (stop_ || threads_dirty_) return true;
+                if (slot_waiters_.load() > 0) return false;
+                if (!queue_.empty()) return true;
+                for (auto& s : slots_) if (s->job) return true;
+                return false;
+            });
+            if (stop_) break;
+        }
+
+        std::lock_guard<std::mutex> ctx_lock(ctx_mu_);
+        ThreadConfig threads;
+        bool retune = false;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            std::swap(retune, threads_dirty_);
+            threads = threads_pending_;
+        }
+        if (retune) apply_threads(threads);
+        admit_locked();
+        step();
+    }
+
+    // dừng: kết thúc mọi request còn lại
+    std::lock_guard<std::mutex> ctx_lock(ctx_mu_);
+    for (auto& s : slots_) {
+        if (s->job) finish_slot(*s, false, "engine đã dừng");
+    }
+    std::deque<std::shared_ptr<GenJob>> rest;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        rest.swap(queue_);
+    }
+    for (auto& job : rest) job->finish(false, "engine đã dừng");
+}
+
+// Đưa request chờ vào slot rảnh theo (ưu tiên, thứ tự đến). Gọi khi giữ ctx_mu_.
+bool InferenceEngine::admit_locked() {
+    std::vector<std::pair<Slot*, std::shared_ptr<GenJob>>> starts;
+    std::vector<std::shared_ptr<GenJob>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        std::stable_sort(queue_.begin(), queue_.end(), [](const auto& a, const auto& b) {
+            return a->req_.priority < b->req_.priority;
+        });
+
+        std::vector<bool> taken(slots_.size(), false);
+        for (size_t i = 0; i < slots_.size(); ++i) taken[i] = slots_[i]->job != nullptr;
+
+        for (auto it = queue_.begin(); it != queue_.end();) {
+            auto& job = *it;
+            if (job->cancelled()) {
+                dropped.push_back(job);
+                it = queue_.erase(it);
+                continue;
+            }
+
+            int pick = -1;
+            if (job->req_.seq >= 0) {
+                if (!taken[(size_t)job->req_.seq]) pick = job->req_.seq;
+            } else {
+                // slot tự chọn: tiền tố chung dài nhất với prompt (slot 0 dành cho request ghim)
+                size_t best = 0;
+                for (size_t i = 1; i < slots_.size(); ++i) {
+                    if (taken[i]) continue;
+                    const size_t n = slots_[i]->reusable(job->req_);
+                    if (pick < 0 || n > best) {
+                        pick = (int)i;
+                        best = n;
+                    }
+                }
+            }
+            if (pick < 0) {
+                ++it;
+                continue;
+            }
+            taken[(size_t)pick] = true;
+            starts.emplace_back(slots_[(size_t)pick].get(), job);
+            it = queue_.erase(it);
+        }
+        // request còn lại đang chờ slot: abort batch cũng không giúp gì cho chúng
+        interactive_waiting_.store(false);
+    }
+
+    for (auto& job : dropped) job->finish(true, nullptr);
+    for (auto& st : starts) start_slot(*st.first, std::move(st.second));
+    return !starts.empty();
+}
+
+void InferenceEngine::start_slot(Slot& s, std::shared_ptr<GenJob> job) {
+    const GenRequest& req = job->req_;
+    llama_memory_t mem = llama_get_memory(ctx_);
+
+    // Giữ tiền tố chung với KV hiện có; luôn decode lại ít nhất token cuối để có logits.
+    // KV của slot chưa phủ phần state của request thì nạp state (xoá cả seq).
+    size_t n_common = s.reusable(req);
+    if (req.max_tokens > 0 && n_common == req.prompt.size()) --n_common;
+
+    size_t n_restored = 0;
+    if (req.state && n_common < req.n_state) {
+        n_restored = restore_state(s, req) ? req.n_state : 0;
+        n_common   = n_restored;
+    } else if (!llama_memory_seq_rm(mem, s.seq, (llama_pos)n_common, -1)) {
+        llama_memory_seq_rm(mem, s.seq, -1, -1);
+        n_common = 0;
+    }
+    s.tokens.resize(n_common);
+    if (n_common <= s.n_exact) {   // phần KV ghép (nếu có) đã bị xoá
+        s.state_id = 0;
+        s.n_exact  = Slot::kAllExact;
+    }
+    LOGI("engine: seq %d reuse=%zu (restored %zu), prefill=%zu (%s)", s.seq, n_common, n_restored,
+         req.prompt.size() - n_common, req.priority == GenPriority::Interactive ? "interactive" : "background");
+
+    job->seq_ = s.seq;
+    job->stats_.n_prefill  = (int)(req.prompt.size() - n_common);
+    job->stats_.n_reused   = (int)n_common;
+    job->stats_.n_restored = (int)n_restored;
+    std::atomic_store(&s.job, std::move(job));
+    s.n_prompt   = n_common;
+    s.generating = false;
+    s.spec_off   = false;
+    s.utf8.clear();
+    s.t0 = Clock::now();
+    if (s.smpl) llama_sampler_free(s.smpl);
+    s.smpl = nullptr;
+
+    if (s.n_prompt == s.req().prompt.size()) {   // max_tokens == 0 và prompt đã nằm sẵn trong KV
+        if (s.req().on_prefilled) s.req().on_prefilled(ctx_, s.seq);
+        finish_slot(s, true, nullptr);
+        return;
+    }
+
+    // Sampler riêng của request: penalties -> top_p -> temp -> dist (greedy khi temp <= 0)
+    FastSamplerParams sp;
+    const float top_p = s.req().top_p;
+    sp.top_p          = (top_p > 0.f && top_p <= 1.f) ? top_p : 0.95f;
+    sp.temp           = s.req().temp;
+    sp.penalty_repeat = s.req().repeat_penalty > 0.f ? s.req().repeat_penalty : 1.f;
+    sp.penalty_last_n = s.req().repeat_last_n;
+    sp.exact          = s.req().exact_sampling;
+    s.smpl = fast_sampler_init(llama_vocab_n_tokens(vocab_), sp);
+
+    if (s.req().speculative) s.lookup.reset(s.req().prompt);
+    s.job->push_progress(s.n_prompt, s.req().prompt.size());
+}
+
+void InferenceEngine::finish_slot(Slot& s, bool ok, const char* err) {
+    std::shared_ptr<GenJob> job = s.job;
+    if (!job) return;
+
+    // phần đuôi dở dang (nếu có) vẫn được giao để không mất byte
+    if (s.utf8.pending() > 0) job->push_text(s.utf8.data(), s.utf8.pending());
+    s.utf8.clear();
+
+    job->stats_.seconds = std::chrono::duration<double>(Clock::now() - s.t0).count();
+    if (const FastSampler* fs = fast_sampler_get(s.smpl)) job->stats_.sample_ms = fs->sample_ms();
+    job->stats_.kv_used   = (int)s.tokens.size();
+    job->stats_.cancelled = job->cancelled();
+    job->n_uncommitted_   = s.cur_pending ? 1 : 0;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        totals_.tokens   += job->stats_.tokens;
+        totals_.drafted  += job->stats_.drafted;
+        totals_.accepted += job->stats_.accepted;
+        totals_.ctx_shifts += job->stats_.ctx_shifts;
+        totals_.aborts     += job->stats_.aborts;
+        totals_.token_ms.merge(job->stats_.token_ms);
+    }
+    const GenStats& st = job->stats_;
+    LOGI("engine: seq %d done, %d tokens, %d decodes, %.1f tok/s, draft %d accepted %d",
+         s.seq, st.tokens, st.decode_calls, st.seconds > 0 ? st.tokens / st.seconds : 0.0,
+         st.drafted, st.accepted);
+
+    if (s.smpl) {
+        llama_sampler_free(s.smpl);
+        s.smpl = nullptr;
+    }
+    std::atomic_store(&s.job, std::shared_ptr<GenJob>());
+    s.generating  = false;
+    s.cur_pending = false;
+    s.n_batch    = 0;
+    job->finish(ok, err);
+}
+
+// Giao tok cho request (chỉ các code point đã trọn vẹn)
+void InferenceEngine::emit(Slot& s, llama_token tok) {
+    char piece[128];
+    size_t ready = 0;
+    const int n = llama_token_to_piece(vocab_, tok, piece, (int)sizeof(piece), /*lstrip*/ 0, /*special*/ false);
+    if (n > 0) {
+        ready = s.utf8.push(piece, (size_t)n);
+    } else if (n < 0) {
+        std::string big((size_t)-n, '\0');
+        const int m = llama_token_to_piece(vocab_, tok, &big[0], (int)big.size(), 0, false);
+        if (m > 0) ready = s.utf8.push(big.data(), (size_t)m);
+    }
+    if (ready > 0) {
+        s.job->push_text(s.utf8.data(), ready);
+        s.utf8.consume(ready);
+    }
+    s.job->generated_.push_back(tok);
+    ++s.job->stats_.tokens;
+    if (s.req().speculative) s.lookup.push(tok);
+}
+
+// Nạp req.state (dạng một stream) vào seq của slot thay cho KV cũ. false: state không khớp
+// context (model / kiểu KV khác), seq để trống và prompt được prefill từ đầu.
+bool InferenceEngine::restore_state(Slot& s, const GenRequest& req) {
+    llama_memory_t mem = llama_get_memory(ctx_);
+    llama_memory_seq_rm(mem, s.seq, -1, -1);
+    s.tokens.clear();
+
+    std::vector<uint8_t> buf;
+    const bool ok =
+        seq_state_from_single(req.state->data(), req.state->size(), s.seq, params_.n_seq, &buf) &&
+        seq_state_load(ctx_, s.seq, buf.data(), buf.size(), 0, req.n_state);
+    if (!ok) {
+        LOGE("engine: seq %d state (%zu tokens) could not be restored, prefilling", s.seq, req.n_state);
+        llama_memory_seq_rm(mem, s.seq, -1, -1);
+        return false;
+    }
+    s.tokens.assign(req.prompt.begin(), req.prompt.begin() + (long)req.n_state);
+    s.state_id = req.state_id;
+    s.n_exact  = req.n_state_exact;
+    return true;
+}
+
+// Bỏ các vị trí >= keep khỏi seq của slot (draft bị từ chối).
+// false: memory không xoá được một phần (recurrent), slot phải dựng lại KV.
+bool InferenceEngine::truncate(Slot& s, size_t keep) {
+    if (s.tokens.size() <= keep) return true;
+    if (llama_memory_seq_rm(llama_get_memory(ctx_), s.seq, (llama_pos)keep, -1)) {
+        s.tokens.resize(keep);
+        return true;
+    }
+    return false;
+}
+
+// Một vòng: gom token của mọi slot vào batch_, decode một lần, rồi sample / verify từng slot.
+// false nếu không có gì để làm.
+bool InferenceEngine::step() {
+    const auto t_step = Clock::now();
+
+    std::vector<Slot*> order;
+    bool interactive_active = false;
+    for (auto& s : slots_) {
+        s->n_batch = 0;
+        if (!s->job) continue;
+        if (s->job->cancelled()) {
+            finish_slot(*s, true, nullptr);
+            continue;
+        }
+        order.push_back(s.get());
+        interactive_active |= s->req().priority == GenPriority::Interactive;
+    }
+    std::stable_sort(order.begin(), order.end(), [](const Slot* a, const Slot* b) {
+        if (a->req().priority != b->req().priority) return a->req().priority < b->req().priority;
+        return a->job->order_ < b->job->order_;
+    });
+
+    const int cap = params_.n_batch;
+    const int n_ctx = n_ctx_seq();
+    const int max_draft = spec_max_draft_.load();
+    int n = 0;
+
+    auto add = [&](Slot& s, llama_token tok, bool logits) {
+        batch_.token[n]     = tok;
+        batch_.pos[n]       = (llama_pos)(s.tokens.size() + (size_t)s.n_batch);
+        batch_.n_seq_id[n]  = 1;
+        batch_.seq_id[n][0] = s.seq;
+        batch_.logits[n]    = logits;
+        ++n;
+        ++s.n_batch;
+    };
+
+    // 0) slot đang sinh đã đầy context: dịch cửa sổ (chạy trước khi dựng batch vì đường
+    //    fallback dùng batch_ để prefill lại)
+    for (Slot* s : order) {
+        if (!s->generating || (int)s->tokens.size() < n_ctx) continue;
+        if (!s->req().context_shift) {
+            finish_slot(*s, true, nullptr);
+        } else if (!shift_context(*s)) {
+            finish_slot(*s, false, "không dịch được context");
+        }
+    }
+    order.erase(std::remove_if(order.begin(), order.end(), [](const Slot* s) { return !s->job; }), order.end());
+
+    // 1) decode: token vừa sinh (+ draft) của mọi slot đang sinh
+    for (Slot* s : order) {
+        if (!s->generating || n >= cap) continue;
+        const int budget = s->req().max_tokens - s->job->stats_.tokens;
+        const int room = std::min(cap - n - 1, n_ctx - (int)s->tokens.size() - 1);
+        int nd = 0;
+        if (s->req().speculative && !s->spec_off && max_draft > 0 && budget > 0) {
+            nd = s->lookup.draft(std::min({ max_draft, budget, room }), s->draft);
+        }
+        s->i_batch = n;
+        s->n_draft = nd;
+        add(*s, s->cur, true);
+        for (int i = 0; i < nd; ++i) add(*s, s->draft[(size_t)i], true);
+    }
+
+    // 2) prefill: phần batch còn lại, Background chỉ lấy từng đoạn nhỏ khi chat đang chạy
+    for (Slot* s : order) {
+        if (s->generating || n >= cap) continue;
+        const auto& prompt = s->req().prompt;
+        int chunk = std::min((int)(prompt.size() - s->n_prompt), cap - n);
+        if (interactive_active && s->req().priority == GenPriority::Background) {
+            chunk = std::min(chunk, params_.bg_prefill_chunk);
+        }
+        if (chunk <= 0) continue;
+        s->i_batch = n;
+        s->n_draft = 0;
+        for (int j = 0; j < chunk; ++j) {
+            const size_t at = s->n_prompt + (size_t)j;
+            add(*s, prompt[at], at + 1 == prompt.size() && s->req().max_tokens > 0);
+        }
+    }
+
+    if (n == 0) return false;
+    batch_.n_tokens = n;
+
+    batch_prefill_jobs_.clear();
+    batch_bg_only_ = true;
+    for (Slot* s : order) {
+        if (s->n_batch == 0) continue;
+        if (!s->generating) batch_prefill_jobs_.push_back(s->job.get());
+        batch_bg_only_ &= s->req().priority == GenPriority::Background;
+    }
+
+    // batch chỉ có token decode (nhiều slot / draft) vẫn là batch nhiều token với llama:
+    // dùng số luồng decode thay vì số luồng prefill
+    const int n_batch_threads = batch_prefill_jobs_.empty() ? n_threads_decode_.load() : n_threads_prefill_.load();
+    if (n_batch_threads != threads_batch_cur_) {
+        llama_set_n_threads(ctx_, n_threads_decode_.load(), n_batch_threads);
+        threads_batch_cur_ = n_batch_threads;
+    }
+
+    const int ret = llama_decode(ctx_, batch_);
+    // các decode phụ (dựng lại KV, dịch context) chỉ bị abort khi engine dừng
+    batch_prefill_jobs_.clear();
+    batch_bg_only_ = false;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        ++totals_.decode_calls;
+    }
+    if (ret == 2) {
+        resync_aborted(order);
+        return true;
+    }
+    if (ret != 0) {
+        LOGE("engine: decode failed (ret=%d, n_tokens=%d)", ret, n);
+        for (Slot* s : order) {
+            if (s->n_batch == 0) continue;
+            // KV của seq không còn chắc chắn khớp mirror: bỏ hẳn
+            llama_memory_seq_rm(llama_get_memory(ctx_), s->seq, -1, -1);
+            s->tokens.clear();
+            finish_slot(*s, false, "decode thất bại");
+        }
+        return true;
+    }
+
+    std::vector<Slot*> rebuild;
+    for (Slot* s : order) {
+        if (s->n_batch == 0 || !s->job) continue;
+        const GenRequest& req = s->req();
+        GenStats& st = s->job->stats_;
+
+        if (!s->generating) {
+            // prefill
+            s->tokens.insert(s->tokens.end(), req.prompt.begin() + (long)s->n_prompt,
+                             req.prompt.begin() + (long)(s->n_prompt + (size_t)s->n_batch));
+            s->n_prompt += (size_t)s->n_batch;
+            s->job->push_progress(s->n_prompt, req.prompt.size());
+            if (s->n_prompt < req.prompt.size()) continue;
+            if (req.max_tokens == 0) {
+                if (req.on_prefilled) req.on_prefilled(ctx_, s->seq);
+                finish_slot(*s, true, nullptr);
+                continue;
+            }
+            const llama_token tok = fast_sampler_sample(s->smpl, ctx_, s->i_batch + s->n_batch - 1);
+            const auto t_first = Clock::now();
+            st.prefill_ms = std::chrono::duration<double, std::milli>(t_first - s->t0).count();
+            st.ttft_ms    = std::chrono::duration<double, std::milli>(t_first - s->job->t_submit_).count();
+            s->t_emit     = t_first;
+            if (llama_vocab_is_eog(vocab_, tok)) {
+                finish_slot(*s, true, nullptr);
+                continue;
+            }
+            emit(*s, tok);
+            s->cur         = tok;
+            s->cur_pending = true;
+            s->generating  = true;
+            continue;
+        }
+
+        // decode: cur (+ draft) đã vào KV
+        const size_t pos0 = s->tokens.size();
+        s->tokens.push_back(s->cur);
+        s->tokens.insert(s->tokens.end(), s->draft.begin(), s->draft.begin() + s->n_draft);
+        s->cur_pending = false;
+        ++st.decode_calls;
+        st.drafted += s->n_draft;
+        if (st.tokens >= req.max_tokens) {
+            truncate(*s, pos0 + 1);
+            finish_slot(*s, true, nullptr);
+            continue;
+        }
+
+        // Verify: vị trí i cho token kế sau token thứ i của slot trong batch
+        int accepted = 0;
+        bool stop = false;
+        llama_token next = 0;
+        for (int i = 0; i <= s->n_draft; ++i) {
+            const llama_token t = fast_sampler_sample(s->smpl, ctx_, s->i_batch + i);
+            if (i < s->n_draft && t == s->draft[(size_t)i] && !llama_vocab_is_eog(vocab_, t)) {
+                emit(*s, t);
+                ++accepted;
+                if (st.tokens >= req.max_tokens) {
+                    stop = true;
+                    break;
+                }
+                continue;
+            }
+            next = t;
+            break;
+        }
+        st.accepted += accepted;
+
+        if (!truncate(*s, pos0 + 1 + (size_t)accepted)) {
+            rebuild.push_back(s);
+            s->tokens.resize(pos0 + 1 + (size_t)accepted);
+        }
+        const bool done = stop || llama_vocab_is_eog(vocab_, next);
+        const int n_out = accepted + (done ? 0 : 1);
+        if (n_out > 0) {
+            const auto now = Clock::now();
+            st.token_ms.record(std::chrono::duration<double, std::milli>(now - s->t_emit).count() / n_out,
+                               (uint32_t)n_out);
+            s->t_emit = now;
+        }
+        if (done) {
+            finish_slot(*s, true, nullptr);
+            continue;
+        }
+        emit(*s, next);
+        s->cur         = next;
+        s->cur_pending = true;
+    }
+
+    // memory không xoá được một phần: dựng lại KV từ mirror (sau khi mọi slot đã sample xong
+    // vì batch tạm sẽ ghi đè logits), và không draft nữa cho request này
+    for (Slot* s : rebuild) {
+        const std::vector<llama_token> kept = s->tokens;
+        llama_memory_seq_rm(llama_get_memory(ctx_), s->seq, -1, -1);
+        s->tokens.clear();
+        s->spec_off = true;
+        const bool ok = decode_plain(*s, kept, 0);
+        if (!ok && s->job) {
+            llama_memory_seq_rm(llama_get_memory(ctx_), s->seq, -1, -1);
+            s->tokens.clear();
+            finish_slot(*s, false, "decode thất bại");
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        totals_.seconds += std::chrono::duration<double>(Clock::now() - t_step).count();
+    }
+    return true;
+}
+
+// llama_decode bị abort: các ubatch đã chạy xong vẫn nằm trong KV. Đưa mirror của từng slot
+// về đúng KV: slot đang prefill giữ phần đã xử lý (trừ token cuối của prompt, vì logits đã mất),
+// slot đang sinh bỏ hẳn token của vòng này và gửi lại cur ở vòng sau.
+void InferenceEngine::resync_aborted(const std::vector<Slot*>& order) {
+    llama_memory_t mem = llama_get_memory(ctx_);
+    int n_kept = 0;
+    for (Slot* s : order) {
+        if (s->n_batch == 0 || !s->job) continue;
+        ++s->job->stats_.aborts;
+        const size_t base = s->tokens.size();
+        size_t got = 0;
+        if (!s->generating) {
+            const llama_pos pmax = llama_memory_seq_pos_max(mem, s->seq);
+            const size_t have = pmax < 0 ? 0 : (size_t)pmax + 1;
+            got = have > base ? std::min(have - base, (size_t)s->n_batch) : 0;
+            const auto& prompt = s->req().prompt;
+            if (s->req().max_tokens > 0 && s->n_prompt + got >= prompt.size()) {
+                got = prompt.size() - s->n_prompt - 1;
+            }
+        }
+        if (!llama_memory_seq_rm(mem, s->seq, (llama_pos)(base + got), -1)) {
+            // memory không xoá được một phần: làm lại prompt từ đầu
+            llama_memory_seq_rm(mem, s->seq, -1, -1);
+            s->tokens.clear();
+            if (s->generating) {
+                finish_slot(*s, false, "decode bị huỷ giữa chừng");
+                continue;
+            }
+            s->n_prompt = 0;
+            s->job->push_progress(0, s->req().prompt.size());
+            continue;
+        }
+        if (got > 0) {
+            const auto& prompt = s->req().prompt;
+            s->tokens.insert(s->tokens.end(), prompt.begin() + (long)s->n_prompt,
+                             prompt.begin() + (long)(s->n_prompt + got));
+            s->n_prompt += got;
+            s->job->push_progress(s->n_prompt, prompt.size());
+            n_kept += (int)got;
+        }
+    }
+    LOGI("engine: decode aborted, kept %d prefilled tokens", n_kept);
+}
+
+// Decode toks[from..] vào seq của slot nối sau s.tokens, không lấy logits (dựng lại KV)
+bool InferenceEngine::decode_plain(Slot& s, const std::vector<llama_token>& toks, size_t from) {
+    const size_t cap = (size_t)params_.n_batch;
+    for (size_t i = from; i < toks.size(); i += cap) {
+        const int m = (int)std::min(toks.size() - i, cap);
+        for (int j = 0; j < m; ++j) {
+            batch_.token[j]     = toks[i + (size_t)j];
+            batch_.pos[j]       = (llama_pos)(s.tokens.size() + (size_t)j);
+            batch_.n_seq_id[j]  = 1;
+            batch_.seq_id[j][0] = s.seq;
+            batch_.logits[j]    = false;
+        }
+        batch_.n_tokens = m;
+        if (llama_decode(ctx_, batch_) != 0) return false;
+        s.tokens.insert(s.tokens.end(), toks.begin() + (long)i, toks.begin() + (long)i + m);
+    }
+    return true;
+}
+
+// Slot đã dùng hết n_ctx: giữ n_keep token đầu, bỏ nửa cũ nhất của phần còn lại. Memory dịch
+// được vị trí thì chỉ seq_rm + seq_add (không decode lại gì); không thì xoá từ n_keep và prefill
+// lại phần đuôi được giữ ở vị trí mới.
+bool InferenceEngine::shift_context(Slot& s) {
+    llama_memory_t mem = llama_get_memory(ctx_);
+    const int n_past    = (int)s.tokens.size();
+    const int n_keep    = std::min(s.req().n_keep, n_past / 2);
+    const int n_discard = (n_past - n_keep) / 2;
+    if (n_discard <= 0) return false;
+    ++s.job->stats_.ctx_shifts;
+
+    if (can_shift_ && llama_memory_seq_rm(mem, s.seq, n_keep, n_keep + n_discard)) {
+        llama_memory_seq_add(mem, s.seq, n_keep + n_discard, -1, -n_discard);
+        s.tokens.erase(s.tokens.begin() + n_keep, s.tokens.begin() + n_keep + n_discard);
+        LOGI("engine: seq %d context shift, keep=%d discard=%d", s.seq, n_keep, n_discard);
+        return true;
+    }
+
+    std::vector<llama_token> kept(s.tokens.begin(), s.tokens.begin() + n_keep);
+    kept.insert(kept.end(), s.tokens.begin() + n_keep + n_discard, s.tokens.end());
+    size_t from = (size_t)n_keep;
+    if (!llama_memory_seq_rm(mem, s.seq, n_keep, -1)) {
+        llama_memory_seq_rm(mem, s.seq, -1, -1);
+        from = 0;
+    }
+    s.tokens.resize(from);
+    LOGI("engine: seq %d context shift by re-prefill, keep=%d discard=%d, prefill=%zu",
+         s.seq, n_keep, n_discard, kept.size() - from);
+    if (decode_plain(s, kept, from)) return true;
+    llama_memory_seq_rm(mem, s.seq, -1, -1);
+    s.tokens.clear();
+    return false;
+}
@@ -0,0 +1,320 @@
+// app/src/main/cpp/engine.h
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llama.h"
+#include "context_pool.h"
+#include "cpu_threads.h"
+#include "latency_histogram.h"
+
+// Số liệu của một request (hoặc cộng dồn của engine)
+struct GenStats {
+    int    tokens       = 0;
+    int    decode_calls = 0;
+    int    drafted      = 0;
+    int    accepted     = 0;
+    int    ctx_shifts   = 0;
+    double seconds      = 0;
+    // độ trễ (chỉ tính cho từng request, totals() để 0)
+    int    n_prefill    = 0;   // token prompt phải prefill (không tính tiền tố dùng lại từ KV)
+    int    n_reused     = 0;
+    int    n_restored   = 0;   // phần của n_reused nạp từ GenRequest::state
+    double ttft_ms      = 0;   // submit -> token đầu tiên (gồm thời gian chờ trong hàng)
+    double prefill_ms   = 0;   // bắt đầu chạy trên slot -> token đầu tiên
+    double sample_ms    = 0;   // thời gian trong sampler (FastSampler)
+    int    kv_used      = 0;   // ô KV của slot khi kết thúc
+    int    aborts       = 0;   // số lần decode có request này bị abort (nhường chat / huỷ)
+    bool   cancelled    = false;
+    // độ trễ mỗi token sau token đầu; một vòng sinh k token (speculative) tính k mẫu thời gian/k.
+    // totals() cộng dồn mọi request.
+    LatencyHistogram token_ms;
+};
+
+enum class GenPriority : int {
+    Interactive = 0,   // chat: được xếp trước, prefill không bị chia nhỏ
+    Background  = 1,   // tóm tắt / re-rank...: chỉ lấp phần batch còn trống
+};
+
+struct GenRequest {
+    std::vector<llama_token> prompt;      // đã template + tokenize; phải vừa n_ctx_seq
+    int         max_tokens  = 256;        // 0 = chỉ prefill (warm KV)
+    float       temp        = 0.f;
+    float       top_p       = 0.95f;
+    GenPriority priority    = GenPriority::Interactive;
+    int         seq         = -1;         // -1 = engine tự chọn slot; >= 0 cần giữ SlotLease
+    bool        speculative = true;
+    // Khi slot đầy context: bỏ nửa cũ nhất sau n_keep token đầu (system prompt) rồi sinh tiếp.
+    // false: max_tokens bị giới hạn bởi phần context còn trống sau prompt.
+    bool        context_shift = true;
+    int         n_keep        = 0;
+    // Phạt lặp trên repeat_last_n token vừa sinh (1 = tắt), như llama_sampler_init_penalties
+    float       repeat_penalty = 1.0f;
+    int         repeat_last_n  = 64;
+    // Sampler tham chiếu (sắp xếp cả vocab) thay cho đường nhanh: để kiểm tra tương đương
+    bool        exact_sampling = false;
+    // KV dựng sẵn cho prompt[0, n_state) (ví dụ ghép từ ChunkKvCache), dạng một stream
+    // (seq_state_to_single): slot nạp state thay cho prefill phần đó nếu KV của slot chưa có sẵn.
+    // KV ghép khác KV prefill liền mạch nên về sau slot chỉ dùng lại quá n_state_exact token đầu
+    // cho request có cùng state_id (khác 0).
+    std::shared_ptr<const std::vector<uint8_t>> state;
+    size_t      n_state       = 0;
+    size_t      n_state_exact = 0;
+    uint64_t    state_id      = 0;
+    // Gọi trên thread scheduler khi cả prompt đã nằm trong KV của seq (chỉ với max_tokens = 0),
+    // trước khi request kết thúc; dùng để chụp KV vừa prefill
+    std::function<void(llama_context* ctx, int seq)> on_prefilled;
+};
+
+// Blob llama_state_seq_* = u32 n_stream, rồi mỗi stream u32 cell_count (+ ô và dữ liệu nếu > 0).
+// Context của engine (kv_unified=false) ghi đủ n_seq mục, chỉ mục của seq có ô; dạng một stream
+// (như context kv_unified=true ghi) không phụ thuộc số slot. llama không có API đổi giữa hai dạng
+// nên phần đầu blob được sửa tay: chỉ làm với phiên bản state đã kiểm (LLAMA_STATE_SEQ_VERSION /
+// LLAMA_SESSION_VERSION của third_party/llama), bản khác luôn trả false (request prefill).
+// false nếu blob không đúng dạng đó.
+bool seq_state_to_single(const uint8_t* data, size_t size, int seq, int n_seq, std::vector<uint8_t>* out);
+bool seq_state_from_single(const uint8_t* data, size_t size, int seq, int n_seq, std::vector<uint8_t>* out);
+// Nạp blob vào seq và kiểm kết quả: llama đọc hết đúng size byte, ghi lại cho đúng size byte, và seq
+// chứa đúng các vị trí [pos0, pos0 + n). Lệch (dạng blob khác, context khác) thì xoá seq, false.
+bool seq_state_load(llama_context* ctx, llama_seq_id seq, const uint8_t* data, size_t size, llama_pos pos0,
+                    size_t n);
+
+// Tiến độ prefill của một request: done gồm cả phần tiền tố dùng lại từ KV
+struct PrefillProgress {
+    int done  = 0;
+    int total = 0;
+};
+
+// Trạng thái một request đang chạy trên engine. Văn bản (UTF-8 trọn code point) được engine
+// đẩy vào hàng chờ và bên gọi lấy ra bằng wait_output(), nên callback Java vẫn chạy trên
+// thread gọi JNI chứ không phải thread scheduler.
+class GenJob {
+public:
+    void cancel() { cancel_.store(true); }
+    bool cancelled() const { return cancel_.load(); }
+
+    // Chờ tới khi có văn bản mới, tiến độ prefill mới (nếu progress khác null) hoặc request
+    // kết thúc; chuyển phần mới vào out / progress (progress->total = 0: không có cập nhật).
+    // false = đã kết thúc và không còn gì để đọc.
+    bool wait_output(std::string* out, PrefillProgress* progress = nullptr);
+
+    bool ok() const;
+    const std::string& error() const { return error_; }        // hợp lệ sau khi kết thúc
+    const GenStats& stats() const { return stats_; }            // hợp lệ sau khi kết thúc
+    const std::vector<llama_token>& generated() const { return generated_; }
+    // Số token cuối của generated() đã giao nhưng chưa vào KV của seq (request dừng trước khi
+    // decode token vừa sinh: huỷ, đầy context, decode lỗi); 0 hoặc 1
+    size_t n_uncommitted() const { return n_uncommitted_; }
+    int seq() const { return seq_; }
+
+private:
+    friend class InferenceEngine;
+
+    void push_text(const char* s, size_t n);
+    void push_progress(size_t done, size_t total);
+    void finish(bool ok, const char* err);
+
+    GenRequest        req_;
+    uint64_t          order_ = 0;
+    std::chrono::steady_clock::time_point t_submit_;
+    std::atomic<bool> cancel_{false};
+
+    mutable std::mutex      mu_;
+    std::condition_variable cv_;
+    std::string             out_;
+    bool                    done_ = false;
+    bool                    ok_   = false;
+    PrefillProgress         progress_;
+    bool                    progress_dirty_ = false;
+
+    // chỉ thread scheduler ghi; bên gọi đọc sau khi kết thúc
+    std::string              error_;
+    GenStats                 stats_;
+    std::vector<llama_token> generated_;
+    size_t                   n_uncommitted_ = 0;
+    int                      seq_ = -1;
+};
+
+// Engine suy luận: một model + một context nhiều sequence, một thread scheduler.
+// Đổi tham số context (configure) không nạp lại model: context cũ cùng KV được giữ trong pool.
+//
+// Mỗi sequence là một slot có KV riêng, giữ lại giữa các request (mirror token ở tokens) để
+// request sau chỉ prefill phần hậu tố khác. Mỗi vòng scheduler gom vào cùng một llama_batch:
+// token decode của mọi request đang sinh (kèm draft prompt-lookup) rồi tới các đoạn prefill,
+// request Interactive trước Background. Slot 0 dành cho request ghim (hội thoại); request
+// tự chọn slot dùng các slot còn lại, ưu tiên slot có tiền tố chung dài nhất.
+class InferenceEngine {
+public:
+    struct Params {
+        int n_seq            = 2;      // số slot song song (>= 2: slot 0 dành cho chat)
+        int n_ctx_seq        = 2048;   // context của mỗi slot
+        int n_batch          = 512;    // số token tối đa mỗi llama_decode
+        int n_ubatch         = 0;      // token mỗi lần tính graph; 0 = min(n_batch, 512)
+        int n_threads        = 4;      // decode (batch 1 token)
+        int n_threads_batch  = 0;      // prefill / batch nhiều token; 0 = như n_threads
+        bool pin_cpus        = true;   // ghim threadpool vào các lõi nhanh nhất
+        int spec_max_draft   = 6;      // 0 = tắt speculative
+        int bg_prefill_chunk = 64;     // token prefill Background mỗi vòng khi có Interactive đang chạy
+        ggml_type type_k     = GGML_TYPE_F16;   // kiểu KV cache (V lượng tử cần flash attention)
+        ggml_type type_v     = GGML_TYPE_F16;
+        llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+    };
+
+    static constexpr int kSpecDraftCap = 16;
+
+    InferenceEngine();
+    ~InferenceEngine();
+
+    InferenceEngine(const InferenceEngine&) = delete;
+    InferenceEngine& operator=(const InferenceEngine&) = delete;
+
+    // Nạp model rồi configure(p); model_path trùng model đang nạp thì chỉ configure
+    bool load(const std::string& model_path, const Params& p);
+    // Chỉ nạp model (chưa có context, is_loaded() = false) để đọc metadata trước khi chọn Params;
+    // model_path trùng model đang nạp thì giữ nguyên
+    bool load_model(const std::string& model_path);
+    // Đổi context (n_ctx, số slot, n_batch, kiểu KV) mà không nạp lại model: context đang dùng
+    // cùng KV các slot được trả vào pool, context khớp tham số lấy từ pool hoặc dựng mới.
+    // Request đang chạy kết thúc với lỗi như khi unload().
+    bool configure(const Params& p);
+    // Dựng sẵn context cho p vào pool khi còn vừa budget, để configure(p) sau đó chỉ đổi context.
+    // Gọi được khi engine đang chạy (không chặn scheduler).
+    bool prepare_context(const Params& p);
+    // Trần bộ nhớ KV cho context đang dùng + các context trong pool (0 = không giữ context rảnh)
+    void set_context_budget(size_t bytes);
+    void trim_contexts() { ctx_pool_.clear(); }
+    size_t context_bytes() const { return ctx_bytes_ + ctx_pool_.bytes(); }
+    void unload();
+    bool is_loaded() const { return ctx_ != nullptr; }
+    const std::string& model_path() const { return model_path_; }
+
+    llama_model*       model() const { return model_; }
+    const llama_vocab* vocab() const { return vocab_; }
+    int n_ctx_seq() const;
+    int n_seq() const { return params_.n_seq; }
+    const Params& params() const { return params_; }
+    const llama_context_params& cparams() const { return cparams_; }
+
+    // Giữ độc quyền một slot giữa các request (hội thoại cần KV của slot ổn định từ lúc
+    // khôi phục snapshot tới lúc chụp lại). Request ghim seq phải được submit khi đang giữ lease.
+    // configure() / unload() không chờ lease: muốn đổi context mà không cắt ngang lượt đang chạy
+    // của slot thì giữ lease đó trước khi gọi.
+    class SlotLease {
+    public:
+        SlotLease() = default;
+        SlotLease(SlotLease&&) = default;
+        SlotLease& operator=(SlotLease&&) = default;
+        int seq() const { return seq_; }
+        explicit operator bool() const { return lock_.owns_lock(); }
+    private:
+        friend class InferenceEngine;
+        std::unique_lock<std::mutex> lock_;
+        int seq_ = -1;
+    };
+    SlotLease lease(int seq);
+
+    // Đưa request vào hàng chờ; nullptr nếu engine chưa load / tham số sai
+    std::shared_ptr<GenJob> submit(GenRequest req);
+
+    // Huỷ mọi request (đang chờ lẫn đang chạy) có độ ưu tiên prio
+    void cancel_all(GenPriority prio);
+
+    // Thao tác trực tiếp với KV của một slot đang rảnh (snapshot / khôi phục) giữa hai vòng
+    // scheduler; tokens là mirror của slot và phải được cập nhật đúng với KV sau thao tác.
+    using SlotFn = std::function<void(llama_context* ctx, std::vector<llama_token>& tokens)>;
+    void with_slot(int seq, const SlotFn& fn);
+
+    void set_speculative(int max_draft);
+
+    // Đổi số luồng decode / prefill khi đang chạy: threadpool được dựng lại trên thread scheduler
+    // ngay trước vòng kế tiếp (request submit sau lời gọi này chạy với cấu hình mới).
+    void set_threads(int n_decode, int n_prefill);
+    int n_threads_decode() const { return n_threads_decode_.load(); }
+    int n_threads_prefill() const { return n_threads_prefill_.load(); }
+
+    // Gọi từ llama_decode (thread compute): huỷ graph đang chạy khi engine dừng, khi request
+    // có prefill trong batch bị huỷ, hoặc khi chat đang chờ mà batch chỉ có việc nền
+    static bool abort_cb(void* data);
+    GenStats totals() const;
+
+    // Bộ đếm llama_perf_context của context (prefill / decode tổng cộng)
+    llama_perf_context_data perf_context();
+    void perf_reset();
+
+private:
+    struct Slot;
+
+    void loop();
+    bool admit_locked();
+    void start_slot(Slot& s, std::shared_ptr<GenJob> job);
+    void finish_slot(Slot& s, bool ok, const char* err);
+    bool step();
+    void emit(Slot& s, llama_token tok);
+    bool truncate(Slot& s, size_t keep);
+    bool restore_state(Slot& s, const GenRequest& req);
+    void resync_aborted(const std::vector<Slot*>& order);
+    bool shift_context(Slot& s);
+    bool decode_plain(Slot& s, const std::vector<llama_token>& toks, size_t from);
+    void apply_threads(const ThreadConfig& cfg);
+    void stop_thread();
+    void park_context(size_t next_bytes);
+    void unload_locked();
+    llama_context* new_context(const llama_context_params& cp);
+
+    llama_model*         model_ = nullptr;
+    std::string          model_path_;
+    llama_context*       ctx_   = nullptr;
+    size_t               ctx_bytes_ = 0;       // ước lượng KV của ctx_
+    ContextPool          ctx_pool_;            // context rảnh của model_, cùng KV
+    const llama_vocab*   vocab_ = nullptr;
+    llama_context_params cparams_{};
+    Params               params_;
+    llama_batch          batch_{};
+    bool                 can_shift_ = false;   // memory dịch được vị trí (llama_memory_seq_add)
+
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::vector<std::unique_ptr<std::mutex>> leases_;   // chỉ thêm, không xoá: lease có thể đang giữ
+
+    // vòng đời context: load_model / configure / unload giữ độc quyền; submit / with_slot /
+    // cancel_all / lease giữ chung, nên không thấy ctx_ / slots_ / leases_ đang được thay
+    mutable std::shared_mutex           life_mu_;
+
+    // hàng chờ + cờ dừng; ctx_mu_ được scheduler giữ trong suốt một vòng decode/sample
+    mutable std::mutex                  mu_;
+    std::condition_variable             cv_;
+    std::deque<std::shared_ptr<GenJob>> queue_;
+    uint64_t                            next_order_ = 0;
+    bool                                stop_ = false;
+    std::mutex                          ctx_mu_;
+    std::atomic<int>                    slot_waiters_{0};   // with_slot đang chờ: scheduler nhường lượt
+    std::thread                         thread_;
+
+    // trạng thái cho abort_cb, chỉ scheduler ghi (trước llama_decode)
+    std::vector<const GenJob*> batch_prefill_jobs_;
+    bool                       batch_bg_only_ = false;
+    std::atomic<bool>          interactive_waiting_{false};
+    std::atomic<bool>          stopping_{false};
+
+    // threadpool: chỉ thread scheduler tạo / đổi (ggml gắn affinity cho luồng tạo pool)
+    ThreadPools      pools_;
+    ThreadConfig     threads_pending_;           // theo mu_
+    bool             threads_dirty_ = false;     // theo mu_
+    int              threads_batch_cur_ = 0;     // n_threads_batch đang đặt cho context
+    std::atomic<int> n_threads_decode_{0};
+    std::atomic<int> n_threads_prefill_{0};
+
+    std::atomic<int> spec_max_draft_{6};
+    GenStats         totals_;
+};
@@ -0,0 +1,246 @@
+// app/src/main/cpp/fast_sampler.cpp
+#include "fast_sampler.h"
+#include "vec_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using Clock = std::chrono::steady_clock;
+
+FastSampler::FastSampler(int n_vocab, const FastSamplerParams& p)
+    : n_vocab_(std::max(0, n_vocab)), p_(p), rng_(p.seed) {
+    p_.penalty_last_n = std::max(0, p_.penalty_last_n);
+    history_.assign((size_t)p_.penalty_last_n, 0);
+}
+
+bool FastSampler::penalties_on() const {
+    return p_.penalty_last_n > 0 &&
+           (p_.penalty_repeat != 1.f || p_.penalty_freq != 0.f || p_.penalty_present != 0.f);
+}
+
+void FastSampler::accept(llama_token tok) {
+    if (!penalties_on()) return;
+    const size_t cap = history_.size();
+    if (hist_len_ == cap) {
+        const llama_token old = history_[hist_pos_];
+        auto it = counts_.find(old);
+        if (it != counts_.end() && --it->second == 0) counts_.erase(it);
+    } else {
+        ++hist_len_;
+    }
+    history_[hist_pos_] = tok;
+    hist_pos_ = (hist_pos_ + 1) % cap;
+    ++counts_[tok];
+}
+
+void FastSampler::reset() {
+    hist_pos_ = 0;
+    hist_len_ = 0;
+    counts_.clear();
+    rng_.seed(p_.seed);
+}
+
+static inline float penalize(float logit, int count, const FastSamplerParams& p) {
+    logit = logit <= 0.f ? logit * p.penalty_repeat : logit / p.penalty_repeat;
+    return logit - (float)count * p.penalty_freq - (count > 0 ? p.penalty_present : 0.f);
+}
+
+llama_token FastSampler::sample(float* logits) {
+    const auto t0 = Clock::now();
+    const size_t n = (size_t)n_vocab_;
+
+    // penalties chỉ chạm các token trong cửa sổ; giá trị gốc được trả lại sau khi chọn
+    saved_.clear();
+    if (penalties_on()) {
+        for (const auto& kv : counts_) {
+            if (kv.first < 0 || (size_t)kv.first >= n) continue;
+            saved_.emplace_back(kv.first, logits[kv.first]);
+            logits[kv.first] = penalize(logits[kv.first], kv.second, p_);
+        }
+    }
+    const int32_t id = p_.exact ? select_exact(logits, n) : select(logits, n);
+    for (const auto& s : saved_) logits[s.first] = s.second;
+
+    sample_us_ += std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+    ++n_sample_;
+    return id;
+}
+
+void FastSampler::apply(llama_token_data_array* cur_p) {
+    if (!cur_p || cur_p->size == 0) return;
+    const auto t0 = Clock::now();
+    const size_t n = cur_p->size;
+    scratch_.resize(n);
+    const bool pen = penalties_on();
+    for (size_t i = 0; i < n; ++i) {
+        float l = cur_p->data[i].logit;
+        if (pen) {
+            auto it = counts_.find(cur_p->data[i].id);
+            if (it != counts_.end()) l = penalize(l, it->second, p_);
+        }
+        scratch_[i] = l;
+    }
+    cur_p->selected = p_.exact ? select_exact(scratch_.data(), n) : select(scratch_.data(), n);
+    sample_us_ += std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+    ++n_sample_;
+}
+
+// Chọn theo phân phối exp((l - max) / temp) trên n_keep ứng viên đầu của order (đã sắp xếp giảm dần).
+// Cả hai đường dùng chung hàm này nên cùng nucleus + cùng seed cho cùng token.
+int32_t FastSampler::draw(const float* logits, const int32_t* order, size_t n_keep, float max_logit) {
+    if (n_keep <= 1) return order[0];
+    const double inv_t = 1.0 / (double)p_.temp;
+    double sum = 0.0;
+    for (size_t i = 0; i < n_keep; ++i) sum += std::exp(((double)logits[order[i]] - max_logit) * inv_t);
+    const double u = (double)rng_() / 4294967296.0 * sum;
+    double acc = 0.0;
+    for (size_t i = 0; i < n_keep; ++i) {
+        acc += std::exp(((double)logits[order[i]] - max_logit) * inv_t);
+        if (u < acc) return order[i];
+    }
+    return order[n_keep - 1];
+}
+
+static inline int32_t first_index_of(const float* v, size_t n, float x) {
+    for (size_t i = 0; i < n; ++i) {
+        if (v[i] == x) return (int32_t)i;
+    }
+    return 0;
+}
+
+int32_t FastSampler::select(const float* logits, size_t n) {
+    if (n == 0) return 0;
+    const float m = veck::max_f32(logits, n);
+    if (p_.temp <= 0.f) return first_index_of(logits, n, m);   // như greedy của llama: max đầu tiên
+
+    // thứ tự giảm dần theo logit, cùng logit thì id nhỏ trước (giống select_exact)
+    auto cmp = [logits](int32_t a, int32_t b) {
+        return logits[a] > logits[b] || (logits[a] == logits[b] && a < b);
+    };
+    cand_.resize(n);
+
+    if (p_.top_p >= 1.f) {
+        ++n_full_sort_;
+        for (size_t i = 0; i < n; ++i) cand_[i] = (int32_t)i;
+        std::sort(cand_.begin(), cand_.end(), cmp);
+        return draw(logits, cand_.data(), n, m);
+    }
+
+    const double target = (double)p_.top_p * veck::sum_exp_f32(logits, n, m);
+    const size_t n_near = veck::select_ge(logits, n, m - kGatherNats, cand_.data());
+
+    // Cộng dồn xác suất theo thứ tự trên [from, to); true khi đủ top_p (n_keep = số token giữ lại)
+    double cum = 0.0;
+    size_t n_keep = 0;
+    auto walk = [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            cum += std::exp(logits[cand_[i]] - m);
+            if (cum >= target) {
+                n_keep = i + 1;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // 1) top-k trong các token gần max, rồi 2) nới k gấp 4 mỗi lần (phân phối phẳng): mỗi bước
+    //    nth_element trên phần chưa chọn và chỉ sắp xếp đoạn vừa chọn
+    const auto first = cand_.begin();
+    size_t lo = 0, hi = std::min(n_near, (size_t)kTopK);
+    while (lo < n_near) {
+        if (hi < n_near) std::nth_element(first + (long)lo, first + (long)hi, first + (long)n_near, cmp);
+        std::sort(first + (long)lo, first + (long)hi, cmp);
+        if (walk(lo, hi)) return draw(logits, cand_.data(), n_keep, m);
+        lo = hi;
+        hi = std::min(n_near, hi * 4);
+    }
+
+    // 3) cả vocab (top_p rất sát 1)
+    ++n_full_sort_;
+    const float thr = m - kGatherNats;
+    size_t j = n_near;
+    for (size_t i = 0; i < n; ++i) {
+        if (logits[i] < thr) cand_[j++] = (int32_t)i;
+    }
+    std::sort(cand_.begin() + (long)n_near, cand_.begin() + (long)j, cmp);
+    if (walk(n_near, j)) return draw(logits, cand_.data(), n_keep, m);
+    return draw(logits, cand_.data(), j, m);   // làm tròn: tổng chưa chạm target, giữ tất cả
+}
+
+int32_t FastSampler::select_exact(const float* logits, size_t n) {
+    if (n == 0) return 0;
+    float m = logits[0];
+    for (size_t i = 1; i < n; ++i) m = std::max(m, logits[i]);
+    if (p_.temp <= 0.f) return first_index_of(logits, n, m);
+
+    ++n_full_sort_;
+    cand_.resize(n);
+    for (size_t i = 0; i < n; ++i) cand_[i] = (int32_t)i;
+    std::sort(cand_.begin(), cand_.end(), [logits](int32_t a, int32_t b) {
+        return logits[a] > logits[b] || (logits[a] == logits[b] && a < b);
+    });
+    if (p_.top_p >= 1.f) return draw(logits, cand_.data(), n, m);
+
+    double z = 0.0;
+    for (size_t i = 0; i < n; ++i) z += std::exp((double)logits[i] - m);
+    const double target = (double)p_.top_p * z;
+    double cum = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        cum += std::exp((double)logits[cand_[i]] - m);
+        if (cum >= target) return draw(logits, cand_.data(), i + 1, m);
+    }
+    return draw(logits, cand_.data(), n, m);
+}
+
+// --------- llama_sampler ---------
+
+static const char* fs_name(const llama_sampler* /*smpl*/) { return "fast"; }
+
+static void fs_accept(llama_sampler* smpl, llama_token tok) {
+    static_cast<FastSampler*>(smpl->ctx)->accept(tok);
+}
+
+static void fs_apply(llama_sampler* smpl, llama_token_data_array* cur_p) {
+    static_cast<FastSampler*>(smpl->ctx)->apply(cur_p);
+}
+
+static void fs_reset(llama_sampler* smpl) {
+    static_cast<FastSampler*>(smpl->ctx)->reset();
+}
+
+static llama_sampler* fs_clone(const llama_sampler* smpl);
+
+static void fs_free(llama_sampler* smpl) {
+    delete static_cast<FastSampler*>(smpl->ctx);
+}
+
+static const llama_sampler_i g_fast_sampler_i = {
+    /* .name   = */ fs_name,
+    /* .accept = */ fs_accept,
+    /* .apply  = */ fs_apply,
+    /* .reset  = */ fs_reset,
+    /* .clone  = */ fs_clone,
+    /* .free   = */ fs_free,
+};
+
+static llama_sampler* fs_clone(const llama_sampler* smpl) {
+    return llama_sampler_init(&g_fast_sampler_i, new FastSampler(*static_cast<const FastSampler*>(smpl->ctx)));
+}
+
+llama_sampler* fast_sampler_init(int n_vocab, const FastSamplerParams& p) {
+    return llama_sampler_init(&g_fast_sampler_i, new FastSampler(n_vocab, p));
+}
+
+FastSampler* fast_sampler_get(llama_sampler* smpl) {
+    return smpl && smpl->iface == &g_fast_sampler_i ? static_cast<FastSampler*>(smpl->ctx) : nullptr;
+}
+
+llama_token fast_sampler_sample(llama_sampler* smpl, llama_context* ctx, int32_t idx) {
+    FastSampler* fs = fast_sampler_get(smpl);
+    float* logits = fs ? llama_get_logits_ith(ctx, idx) : nullptr;
+    if (!logits) return llama_sampler_sample(smpl, ctx, idx);
+    const llama_token tok = fs->sample(logits);
+    fs->accept(tok);
+    return tok;
+}
@@ -0,0 +1,80 @@
+// app/src/main/cpp/fast_sampler.h
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "llama.h"
+
+// Sampler thay cho chain penalties -> top_p -> temp -> dist (greedy khi temp <= 0) của llama.
+// Với vocab ~151k, top_p của llama softmax + sắp xếp cả vector logits mỗi token. Ở đây:
+//   - penalties cập nhật dần khi accept (đếm token trong cửa sổ last_n), chỉ sửa <= last_n logits;
+//   - max và tổng exp chạy SIMD trên logits gốc, không dựng mảng llama_token_data;
+//   - chỉ lấy các token cách max <= kGatherNats, chọn top-k bằng nth_element rồi mới sắp xếp
+//     phần đó; nucleus chưa đủ top_p thì nới k (x4) rồi tới cả vocab, nên kết quả giống đường
+//     đầy đủ (chỉ khác làm tròn ở ranh giới top_p khi phân phối rất phẳng).
+// exact = true: đường tham chiếu (sắp xếp cả vocab, exp double) để kiểm tra tương đương.
+struct FastSamplerParams {
+    float    temp            = 0.f;     // <= 0: greedy
+    float    top_p           = 0.95f;   // >= 1: không cắt
+    int      penalty_last_n  = 64;      // số token sinh gần nhất được tính penalty
+    float    penalty_repeat  = 1.0f;    // 1 = tắt; logit > 0 chia, <= 0 nhân (như llama)
+    float    penalty_freq    = 0.f;
+    float    penalty_present = 0.f;
+    uint32_t seed            = 0;
+    bool     exact           = false;
+};
+
+class FastSampler {
+public:
+    FastSampler(int n_vocab, const FastSamplerParams& p);
+
+    // Chọn token từ logits (n_vocab phần tử). Penalties được ghi tạm vào logits rồi trả lại.
+    llama_token sample(float* logits);
+    // Cho llama_sampler_apply: đặt cur_p->selected (mảng tuỳ ý, không cần theo id)
+    void apply(llama_token_data_array* cur_p);
+    void accept(llama_token tok);
+    void reset();
+
+    const FastSamplerParams& params() const { return p_; }
+    double sample_ms() const { return sample_us_ / 1000.0; }
+    int    n_sample() const { return n_sample_; }
+    int    n_full_sort() const { return n_full_sort_; }   // số lần phải sắp xếp cả vocab
+
+    static constexpr float kGatherNats = 16.f;   // token thấp hơn max quá mức này: p < 1.1e-7 * p_max
+    static constexpr int   kTopK       = 256;    // số ứng viên sắp xếp ở bước đầu (nucleus thường < 100)
+
+private:
+    bool penalties_on() const;
+    // logits đã áp penalties; trả về vị trí được chọn trong [0, n)
+    int32_t select(const float* logits, size_t n);
+    int32_t select_exact(const float* logits, size_t n);
+    int32_t draw(const float* logits, const int32_t* order, size_t n_keep, float max_logit);
+
+    int               n_vocab_;
+    FastSamplerParams p_;
+    std::mt19937      rng_;
+
+    std::vector<llama_token>             history_;   // vòng last_n token
+    size_t                               hist_pos_ = 0;
+    size_t                               hist_len_ = 0;
+    std::unordered_map<llama_token, int> counts_;
+
+    std::vector<int32_t>                 cand_;      // chỉ số ứng viên (tái sử dụng giữa các token)
+    std::vector<float>                   scratch_;   // logits của mảng llama_token_data (apply)
+    std::vector<std::pair<llama_token, float>> saved_;
+
+    double sample_us_   = 0;
+    int    n_sample_    = 0;
+    int    n_full_sort_ = 0;
+};
+
+// llama_sampler bọc FastSampler (dùng được với llama_sampler_sample / chain)
+llama_sampler* fast_sampler_init(int n_vocab, const FastSamplerParams& p);
+// nullptr nếu smpl không phải fast sampler
+FastSampler*   fast_sampler_get(llama_sampler* smpl);
+// Lấy logits dòng idx, chọn và accept token mà không dựng mảng llama_token_data n_vocab phần tử.
+// smpl khác loại thì dùng llama_sampler_sample.
+llama_token    fast_sampler_sample(llama_sampler* smpl, llama_context* ctx, int32_t idx);
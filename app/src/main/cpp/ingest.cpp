@@ -0,0 +1,230 @@
+// app/src/main/cpp/ingest.cpp
+#include "ingest.h"
+#include "bridge_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// --------- Chunking ---------
+
+static size_t utf8_len(unsigned char c) {
+    if (c < 0x80)           return 1;
+    if ((c & 0xE0) == 0xC0) return 2;
+    if ((c & 0xF0) == 0xE0) return 3;
+    if ((c & 0xF8) == 0xF0) return 4;
+    return 1;   // byte hỏng: coi như 1 ký tự
+}
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+static std::string trimmed(const std::string& s, size_t b, size_t e) {
+    while (b < e && is_space(s[b]))     ++b;
+    while (e > b && is_space(s[e - 1])) --e;
+    return s.substr(b, e - b);
+}
+
+std::vector<std::string> chunk_utf8(const std::string& text, int max_chars, int overlap_chars) {
+    std::vector<std::string> out;
+    if (max_chars <= 0) {
+        std::string t = trimmed(text, 0, text.size());
+        if (!t.empty()) out.push_back(std::move(t));
+        return out;
+    }
+    overlap_chars = std::max(0, std::min(overlap_chars, max_chars / 2));
+
+    // offset byte của từng code point (+ phần tử cuối = text.size())
+    std::vector<size_t> cp;
+    cp.reserve(text.size() + 1);
+    for (size_t i = 0; i < text.size(); i += utf8_len((unsigned char)text[i])) cp.push_back(i);
+    cp.push_back(text.size());
+    const size_t n = cp.size() - 1;
+
+    // Điểm ngắt tốt nhất trong (lo, hi]: sau '\n' > sau dấu kết câu > sau khoảng trắng
+    auto best_break = [&](size_t lo, size_t hi) -> size_t {
+        size_t space = 0, sentence = 0;
+        for (size_t i = hi; i > lo; --i) {
+            const char prev = text[cp[i - 1]];
+            if (prev == '\n') return i;
+            if (!sentence && is_space(prev) && i >= 2) {
+                const char p2 = text[cp[i - 2]];
+                if (p2 == '.' || p2 == '?' || p2 == '!' || p2 == ';') sentence = i;
+            }
+            if (!space && is_space(prev)) space = i;
+        }
+        return sentence ? sentence : space ? space : hi;
+    };
+
+    size_t start = 0;
+    while (start < n) {
+        size_t end = std::min(n, start + (size_t)max_chars);
+        if (end < n) end = best_break(start + (size_t)max_chars * 3 / 4, end);
+
+        std::string chunk = trimmed(text, cp[start], cp[end]);
+        if (!chunk.empty()) out.push_back(std::move(chunk));
+        if (end >= n) break;
+
+        // Lùi overlap ký tự rồi tiến tới đầu từ kế tiếp để không mở đầu giữa một từ
+        size_t next = end > (size_t)overlap_chars ? end - (size_t)overlap_chars : 0;
+        next = std::max(next, start + 1);
+        if (overlap_chars > 0) {
+            size_t i = next;
+            while (i < end && !is_space(text[cp[i]])) ++i;
+            if (i < end) next = i;
+        }
+        start = next;
+    }
+    return out;
+}
+
+// --------- Pipeline ---------
+
+namespace {
+
+struct PackedBatch {
+    std::vector<std::vector<llama_token>> toks;   // mỗi phần tử là một seq
+    std::vector<size_t>                   idx;    // chỉ số đoạn tương ứng
+    int                                   n_tokens = 0;
+};
+
+// Hàng đợi có giới hạn giữa thread tokenize và thread decode
+class BatchQueue {
+public:
+    explicit BatchQueue(size_t cap) : cap_(cap) {}
+
+    bool push(PackedBatch&& b) {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&] { return q_.size() < cap_ || closed_; });
+        if (closed_) return false;
+        q_.push_back(std::move(b));
+        cv_.notify_all();
+        return true;
+    }
+
+    // false khi hàng đợi đã đóng và rỗng
+    bool pop(PackedBatch& b) {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&] { return !q_.empty() || closed_; });
+        if (q_.empty()) return false;
+        b = std::move(q_.front());
+        q_.pop_front();
+        cv_.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lk(mu_);
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+private:
+    std::mutex              mu_;
+    std::condition_variable cv_;
+    std::deque<PackedBatch> q_;
+    size_t                  cap_;
+    bool                    closed_ = false;
+};
+
+} // namespace
+
+bool IngestPipeline::run(const std::vector<std::string>& chunks, const Sink& sink,
+                         const Progress& progress, Stats* st_out) {
+    Stats st;
+    if (!emb_.ready() || chunks.empty()) {
+        if (st_out) *st_out = st;
+        return emb_.ready();
+    }
+
+    const int n_batch = emb_.n_batch();
+    const int n_seq   = emb_.n_seq_max();
+    const int dim     = emb_.dim();
+
+    BatchQueue queue(2);
+    std::atomic<bool> stop{false};
+
+    // Stage 1: tokenize + gom đoạn thành batch, chạy song song với decode
+    std::thread producer([&] {
+        PackedBatch cur;
+        for (size_t i = 0; i < chunks.size() && !stop.load(std::memory_order_relaxed); ++i) {
+            std::vector<llama_token> t = emb_.tokenize(chunks[i]);
+            if (t.empty()) continue;
+            if (!cur.toks.empty() &&
+                ((int)cur.toks.size() >= n_seq || cur.n_tokens + (int)t.size() > n_batch)) {
+                if (!queue.push(std::move(cur))) return;
+                cur = PackedBatch();
+            }
+            cur.n_tokens += (int)t.size();
+            cur.toks.push_back(std::move(t));
+            cur.idx.push_back(i);
+        }
+        if (!cur.toks.empty()) queue.push(std::move(cur));
+        queue.close();
+    });
+
+    llama_batch batch = llama_batch_init(n_batch, /*embd*/0, /*n_seq_max*/1);
+    std::vector<float> vecs;
+    bool ok = true;
+
+    const auto t0 = std::chrono::steady_clock::now();
+    PackedBatch pb;
+    while (queue.pop(pb)) {
+        // Stage 2: decode mọi seq trong một lần gọi
+        batch.n_tokens = 0;
+        std::vector<int> first(pb.toks.size());
+        for (size_t s = 0; s < pb.toks.size(); ++s) {
+            first[s] = batch.n_tokens;
+            for (size_t j = 0; j < pb.toks[s].size(); ++j) {
+                const int k = batch.n_tokens++;
+                batch.token[k]     = pb.toks[s][j];
+                batch.pos[k]       = (llama_pos)j;
+                batch.n_seq_id[k]  = 1;
+                batch.seq_id[k][0] = (llama_seq_id)s;
+                batch.logits[k]    = true;
+            }
+        }
+
+        emb_.clear_memory();
+        const int rc = llama_decode(emb_.ctx(), batch);
+        if (rc != 0) {
+            LOGE("ingest: decode failed (%d)", rc);
+            ok = false;
+            break;
+        }
+
+        // Stage 3: embedding theo từng seq
+        vecs.resize(pb.toks.size() * (size_t)dim);
+        for (size_t s = 0; s < pb.toks.size() && ok; ++s) {
+            ok = emb_.read_pooled((llama_seq_id)s, first[s], (int)pb.toks[s].size(), &vecs[s * (size_t)dim]);
+        }
+        if (!ok || !sink(vecs.data(), pb.idx.data(), pb.idx.size())) {
+            ok = false;
+            break;
+        }
+
+        st.chunks  += pb.toks.size();
+        st.tokens  += (size_t)pb.n_tokens;
+        st.batches += 1;
+        st.seconds  = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (progress && !progress(st, chunks.size())) {
+            LOGI("ingest: cancelled at %zu/%zu", st.chunks, chunks.size());
+            ok = false;
+            break;
+        }
+    }
+
+    stop.store(true, std::memory_order_relaxed);
+    queue.close();
+    producer.join();
+    llama_batch_free(batch);
+
+    st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    LOGI("ingest: %zu chunks, %zu tokens, %zu batches in %.2fs (%.1f chunks/s)",
+         st.chunks, st.tokens, st.batches, st.seconds, st.chunks_per_sec());
+    if (st_out) *st_out = st;
+    return ok;
+}
@@ -0,0 +1,43 @@
+// app/src/main/cpp/ingest.h
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "embedder.h"
+
+// Cắt văn bản thành đoạn theo số code point UTF-8 (không bao giờ cắt giữa một ký tự),
+// ưu tiên ngắt ở xuống dòng / cuối câu / khoảng trắng; các đoạn liền nhau chồng lấn overlap.
+// max_chars <= 0: trả nguyên văn bản (đã trim).
+std::vector<std::string> chunk_utf8(const std::string& text, int max_chars, int overlap_chars);
+
+// Pipeline nạp tài liệu: một thread tokenize + đóng gói batch kế tiếp trong khi thread gọi
+// decode batch hiện tại. Mỗi batch chứa nhiều đoạn, mỗi đoạn một seq_id riêng
+// (tối đa n_seq_max đoạn và n_batch token), embedding đọc ra theo từng seq.
+class IngestPipeline {
+public:
+    struct Stats {
+        size_t chunks  = 0;
+        size_t tokens  = 0;
+        size_t batches = 0;
+        double seconds = 0;
+        float chunks_per_sec() const { return seconds > 0 ? (float)(chunks / seconds) : 0.f; }
+    };
+
+    // Nhận embedding (đã normalize) của một batch: n vector liền nhau, idx[i] = chỉ số đoạn.
+    // Trả false để dừng.
+    using Sink = std::function<bool(const float* vecs, const size_t* idx, size_t n)>;
+    // Gọi sau mỗi batch; trả false để huỷ.
+    using Progress = std::function<bool(const Stats& st, size_t total)>;
+
+    explicit IngestPipeline(Embedder& embedder) : emb_(embedder) {}
+
+    // Chạy trên thread gọi (Sink/Progress cũng được gọi trên thread này).
+    // false nếu decode lỗi hoặc bị huỷ; st vẫn phản ánh phần đã xong.
+    bool run(const std::vector<std::string>& chunks, const Sink& sink, const Progress& progress, Stats* st);
+
+private:
+    Embedder& emb_;
+};
@@ -0,0 +1,666 @@
+// app/src/main/cpp/ivf_index.cpp
+#include "ivf_index.h"
+#include "vec_kernels.h"
+#include "bridge_log.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <random>
+#include <unordered_set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// --------- File format (little-endian) ---------
+
+static constexpr char     kQuantMagic[4] = { 'R', 'A', 'G', 'Q' };
+static constexpr char     kSegMagic[4]   = { 'R', 'A', 'G', 'S' };
+static constexpr uint64_t kPage          = 4096;
+
+struct QuantHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t nlist;
+    uint32_t m;
+    uint32_t ksub;
+    uint64_t tag;            // định danh quantizer; segment phải khớp tag
+    uint64_t off_centroids;  // nlist * dim float
+    uint64_t off_codebooks;  // m * ksub * dsub float
+};
+
+struct SegHeader {
+    char     magic[4];
+    uint32_t version;
+    uint64_t tag;
+    uint32_t nlist;
+    uint32_t m;
+    uint64_t n;
+    int64_t  id_end;         // id lớn nhất + 1 (để append không phải quét ids)
+    uint64_t off_lists;      // (nlist + 1) uint64: vị trí bắt đầu mỗi cụm
+    uint64_t off_ids;        // n int64, theo thứ tự cụm
+    uint64_t off_codes;      // n * m uint8
+    uint32_t dim;
+    uint32_t replaces_below; // segment gộp (compact): mọi segment số nhỏ hơn đã nằm trong segment này
+    uint64_t off_raw;        // n * dim int8 (bản lượng tử hoá để re-rank)
+    uint64_t off_raw_scale;  // n float
+    uint64_t off_text_offs;  // (n + 1) uint64
+    uint64_t off_text;       // blob UTF-8
+};
+
+static uint64_t page_align(uint64_t v) { return (v + kPage - 1) / kPage * kPage; }
+
+struct IvfPqIndex::Quantizer {
+    MappedFile   file;
+    QuantHeader  hdr{};
+    const float* centroids = nullptr;
+    const float* codebooks = nullptr;
+    int dsub() const { return (int)(hdr.dim / hdr.m); }
+};
+
+struct IvfPqIndex::Segment {
+    MappedFile      file;
+    std::string     path;
+    uint32_t        no = 0;
+    SegHeader       hdr{};
+    const uint64_t* lists     = nullptr;
+    const int64_t*  ids       = nullptr;
+    const uint8_t*  codes     = nullptr;
+    const int8_t*   raw       = nullptr;
+    const float*    raw_scale = nullptr;
+    const uint64_t* text_offs = nullptr;
+    const char*     text      = nullptr;
+    std::string text_at(uint64_t p) const {
+        return std::string(text + text_offs[p], (size_t)(text_offs[p + 1] - text_offs[p]));
+    }
+};
+
+// --------- Training / encoding ---------
+
+static std::vector<float> sq_norms(const float* cents, int k, int d) {
+    std::vector<float> n((size_t)k);
+    for (int c = 0; c < k; ++c) n[(size_t)c] = veck::dot_f32(cents + (size_t)c * d, cents + (size_t)c * d, (size_t)d);
+    return n;
+}
+
+// argmin ||x - c||^2 = argmin (||c||^2 - 2 <x, c>)
+static int nearest_l2(const float* x, const float* cents, const float* cnorms, int k, int d) {
+    int best = 0;
+    float bd = FLT_MAX;
+    for (int c = 0; c < k; ++c) {
+        const float dist = cnorms[c] - 2.f * veck::dot_f32(x, cents + (size_t)c * d, (size_t)d);
+        if (dist < bd) { bd = dist; best = c; }
+    }
+    return best;
+}
+
+// k-means L2 đơn giản (Lloyd); cụm rỗng được gieo lại bằng điểm ngẫu nhiên
+static std::vector<float> kmeans(const float* x, size_t n, int d, int k, int iters, std::mt19937& rng) {
+    std::vector<float> cents((size_t)k * d);
+    std::uniform_int_distribution<size_t> pick(0, n - 1);
+    for (int c = 0; c < k; ++c) {
+        memcpy(&cents[(size_t)c * d], x + pick(rng) * d, (size_t)d * sizeof(float));
+    }
+
+    std::vector<int>    assign(n);
+    std::vector<float>  sums((size_t)k * d);
+    std::vector<size_t> counts((size_t)k);
+    for (int it = 0; it < iters; ++it) {
+        const std::vector<float> cn = sq_norms(cents.data(), k, d);
+        for (size_t i = 0; i < n; ++i) assign[i] = nearest_l2(x + i * d, cents.data(), cn.data(), k, d);
+
+        std::fill(sums.begin(), sums.end(), 0.f);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (size_t i = 0; i < n; ++i) {
+            float* s = &sums[(size_t)assign[i] * d];
+            for (int j = 0; j < d; ++j) s[j] += x[i * d + j];
+            ++counts[(size_t)assign[i]];
+        }
+        for (int c = 0; c < k; ++c) {
+            float* dst = &cents[(size_t)c * d];
+            if (counts[(size_t)c] == 0) {
+                memcpy(dst, x + pick(rng) * d, (size_t)d * sizeof(float));
+                continue;
+            }
+            const float inv = 1.f / (float)counts[(size_t)c];
+            for (int j = 0; j < d; ++j) dst[j] = sums[(size_t)c * d + j] * inv;
+        }
+    }
+    return cents;
+}
+
+// Gán cụm thô + mã PQ cho phần dư của từng vector; kèm bản int8 để re-rank
+static void encode(const float* centroids, const float* codebooks, int dim, int nlist, int m,
+                   const float* vecs, size_t n, std::vector<uint32_t>& list_of, std::vector<uint8_t>& codes,
+                   std::vector<int8_t>& raw, std::vector<float>& raw_scale) {
+    const int dsub = dim / m;
+    list_of.resize(n);
+    codes.resize(n * (size_t)m);
+    raw.resize(n * (size_t)dim);
+    raw_scale.resize(n);
+
+    const std::vector<float> cn = sq_norms(centroids, nlist, dim);
+    std::vector<std::vector<float>> cbn((size_t)m);
+    for (int s = 0; s < m; ++s) cbn[(size_t)s] = sq_norms(codebooks + (size_t)s * IvfPqIndex::kKsub * dsub, IvfPqIndex::kKsub, dsub);
+
+    std::vector<float> resid((size_t)dim);
+    for (size_t i = 0; i < n; ++i) {
+        const float* v = vecs + i * dim;
+        const int c = nearest_l2(v, centroids, cn.data(), nlist, dim);
+        list_of[i] = (uint32_t)c;
+        for (int j = 0; j < dim; ++j) resid[j] = v[j] - centroids[(size_t)c * dim + j];
+        for (int s = 0; s < m; ++s) {
+            const float* cb = codebooks + (size_t)s * IvfPqIndex::kKsub * dsub;
+            codes[i * m + s] = (uint8_t)nearest_l2(&resid[(size_t)s * dsub], cb, cbn[(size_t)s].data(), IvfPqIndex::kKsub, dsub);
+        }
+        raw_scale[i] = veck::quantize_i8(v, &raw[i * dim], (size_t)dim);
+    }
+}
+
+// --------- Writers ---------
+
+static bool write_at(FILE* f, uint64_t off, const void* p, size_t bytes) {
+    if (bytes == 0) return true;
+    return fseeko(f, (off_t)off, SEEK_SET) == 0 && fwrite(p, 1, bytes, f) == bytes;
+}
+
+// Ghi file qua .tmp rồi rename để reader không bao giờ thấy file ghi dở
+template <typename Fn>
+static bool write_atomic(const std::string& path, Fn&& fill) {
+    const std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fill(f);
+    ok = (fflush(f) == 0) && ok;
+    if (ok) fsync(fileno(f));
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    // rename chỉ bền sau khi thư mục được fsync
+    const size_t slash = path.find_last_of('/');
+    const int dfd = ::open(slash == std::string::npos ? "." : path.substr(0, slash).c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        ::close(dfd);
+    }
+    return true;
+}
+
+static std::string seg_path(const std::string& dir, uint32_t no) {
+    char name[32];
+    snprintf(name, sizeof(name), "seg_%06u.bin", no);
+    return dir + "/" + name;
+}
+
+struct SegEntry {
+    uint32_t       list;
+    int64_t        id;
+    const uint8_t* code;
+    const int8_t*  raw;
+    float          raw_scale;
+    std::string    text;
+};
+
+static bool write_segment(const std::string& path, uint64_t tag, int nlist, int m, int dim, std::vector<SegEntry>& entries,
+                          uint32_t replaces_below = 0) {
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const SegEntry& a, const SegEntry& b) { return a.list < b.list; });
+    const uint64_t n = entries.size();
+
+    std::vector<uint64_t> lists((size_t)nlist + 1, 0);
+    for (const auto& e : entries) ++lists[e.list + 1];
+    for (int c = 0; c < nlist; ++c) lists[(size_t)c + 1] += lists[(size_t)c];
+
+    std::vector<int64_t>  ids(n);
+    std::vector<uint8_t>  codes(n * (uint64_t)m);
+    std::vector<int8_t>   raw(n * (uint64_t)dim);
+    std::vector<float>    raw_scale(n);
+    std::vector<uint64_t> text_offs(n + 1, 0);
+    int64_t id_end = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        ids[i] = entries[i].id;
+        id_end = std::max(id_end, ids[i] + 1);
+        memcpy(&codes[i * m], entries[i].code, (size_t)m);
+        memcpy(&raw[i * dim], entries[i].raw, (size_t)dim);
+        raw_scale[i] = entries[i].raw_scale;
+        text_offs[i + 1] = text_offs[i] + entries[i].text.size();
+    }
+
+    SegHeader h{};
+    memcpy(h.magic, kSegMagic, 4);
+    h.version       = IvfPqIndex::kVersion;
+    h.tag           = tag;
+    h.nlist         = (uint32_t)nlist;
+    h.m             = (uint32_t)m;
+    h.n             = n;
+    h.id_end        = id_end;
+    h.off_lists     = kPage;
+    h.off_ids       = page_align(h.off_lists + lists.size() * sizeof(uint64_t));
+    h.off_codes     = page_align(h.off_ids + n * sizeof(int64_t));
+    h.dim           = (uint32_t)dim;
+    h.replaces_below = replaces_below;
+    h.off_raw       = page_align(h.off_codes + codes.size());
+    h.off_raw_scale = page_align(h.off_raw + raw.size());
+    h.off_text_offs = page_align(h.off_raw_scale + raw_scale.size() * sizeof(float));
+    h.off_text      = page_align(h.off_text_offs + text_offs.size() * sizeof(uint64_t));
+
+    return write_atomic(path, [&](FILE* f) {
+        bool ok = write_at(f, 0, &h, sizeof(h))
+               && write_at(f, h.off_lists, lists.data(), lists.size() * sizeof(uint64_t))
+               && write_at(f, h.off_ids, ids.data(), ids.size() * sizeof(int64_t))
+               && write_at(f, h.off_codes, codes.data(), codes.size())
+               && write_at(f, h.off_raw, raw.data(), raw.size())
+               && write_at(f, h.off_raw_scale, raw_scale.data(), raw_scale.size() * sizeof(float))
+               && write_at(f, h.off_text_offs, text_offs.data(), text_offs.size() * sizeof(uint64_t));
+        if (fseeko(f, (off_t)h.off_text, SEEK_SET) != 0) return false;
+        for (uint64_t i = 0; ok && i < n; ++i) {
+            const auto& t = entries[i].text;
+            ok = t.empty() || fwrite(t.data(), 1, t.size(), f) == t.size();
+        }
+        return ok;
+    });
+}
+
+// --------- Build / open ---------
+
+IvfPqIndex::IvfPqIndex()  = default;
+IvfPqIndex::~IvfPqIndex() = default;
+
+bool IvfPqIndex::build(const std::string& dir, const float* vecs, const int64_t* ids,
+                       const std::vector<std::string>& texts, size_t n, int dim, const Params& p) {
+    if (n == 0 || dim <= 0) return false;
+    int m = p.m > 0 ? p.m : std::max(1, dim / 8);
+    while (dim % m != 0) --m;
+    const int nlist = std::max(1, std::min<int>((int)n,
+                          p.nlist > 0 ? p.nlist : std::min(1024, (int)(4.0 * std::sqrt((double)n)))));
+    const int dsub  = dim / m;
+
+    mkdir(dir.c_str(), 0700);
+
+    // Huấn luyện trên mẫu con để giữ thời gian build có giới hạn
+    std::mt19937 rng(1234);
+    const size_t n_train = std::min(n, std::max<size_t>((size_t)nlist * 32, (size_t)kKsub * 32));
+    std::vector<float> train(n_train * (size_t)dim);
+    {
+        std::vector<size_t> perm(n);
+        for (size_t i = 0; i < n; ++i) perm[i] = i;
+        std::shuffle(perm.begin(), perm.end(), rng);
+        for (size_t i = 0; i < n_train; ++i) memcpy(&train[i * dim], vecs + perm[i] * dim, (size_t)dim * sizeof(float));
+    }
+
+    const std::vector<float> centroids = kmeans(train.data(), n_train, dim, nlist, p.train_iter, rng);
+
+    // Codebook PQ huấn luyện trên phần dư, từng sub-space một
+    std::vector<float> codebooks((size_t)m * kKsub * dsub);
+    {
+        std::vector<float> resid(n_train * (size_t)dim);
+        const std::vector<float> cn = sq_norms(centroids.data(), nlist, dim);
+        for (size_t i = 0; i < n_train; ++i) {
+            const float* v = &train[i * dim];
+            const int c = nearest_l2(v, centroids.data(), cn.data(), nlist, dim);
+            for (int j = 0; j < dim; ++j) resid[i * dim + j] = v[j] - centroids[(size_t)c * dim + j];
+        }
+        std::vector<float> sub(n_train * (size_t)dsub);
+        for (int s = 0; s < m; ++s) {
+            for (size_t i = 0; i < n_train; ++i) {
+                memcpy(&sub[i * dsub], &resid[i * dim + (size_t)s * dsub], (size_t)dsub * sizeof(float));
+            }
+            const int k = std::min<int>(kKsub, (int)n_train);
+            std::vector<float> cb = kmeans(sub.data(), n_train, dsub, k, p.train_iter, rng);
+            cb.resize((size_t)kKsub * dsub, 0.f);
+            // khi n_train < 256 các mã dư lặp lại centroid đầu, không bao giờ được chọn tốt hơn
+            for (int c = k; c < kKsub; ++c) memcpy(&cb[(size_t)c * dsub], cb.data(), (size_t)dsub * sizeof(float));
+            memcpy(&codebooks[(size_t)s * kKsub * dsub], cb.data(), cb.size() * sizeof(float));
+        }
+    }
+
+    QuantHeader qh{};
+    memcpy(qh.magic, kQuantMagic, 4);
+    qh.version       = kVersion;
+    qh.dim           = (uint32_t)dim;
+    qh.nlist         = (uint32_t)nlist;
+    qh.m             = (uint32_t)m;
+    qh.ksub          = kKsub;
+    qh.tag           = ((uint64_t)std::random_device{}() << 32) ^ (uint64_t)time(nullptr);
+    qh.off_centroids = kPage;
+    qh.off_codebooks = page_align(qh.off_centroids + centroids.size() * sizeof(float));
+
+    // Xoá segment cũ (nếu build lại) trước khi ghi quantizer mới
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* e = readdir(d)) {
+            if (strncmp(e->d_name, "seg_", 4) == 0) unlink((dir + "/" + e->d_name).c_str());
+        }
+        closedir(d);
+    }
+
+    const bool qok = write_atomic(dir + "/quantizer.bin", [&](FILE* f) {
+        return write_at(f, 0, &qh, sizeof(qh))
+            && write_at(f, qh.off_centroids, centroids.data(), centroids.size() * sizeof(float))
+            && write_at(f, qh.off_codebooks, codebooks.data(), codebooks.size() * sizeof(float));
+    });
+    if (!qok) return false;
+
+    std::vector<uint32_t> list_of;
+    std::vector<uint8_t>  codes;
+    std::vector<int8_t>   raw;
+    std::vector<float>    raw_scale;
+    encode(centroids.data(), codebooks.data(), dim, nlist, m, vecs, n, list_of, codes, raw, raw_scale);
+
+    std::vector<SegEntry> entries(n);
+    for (size_t i = 0; i < n; ++i) {
+        entries[i] = { list_of[i], ids ? ids[i] : (int64_t)i, &codes[i * m], &raw[i * dim], raw_scale[i],
+                       i < texts.size() ? texts[i] : std::string() };
+    }
+    const bool ok = write_segment(seg_path(dir, 0), qh.tag, nlist, m, dim, entries);
+    LOGI("IvfPqIndex::build: n=%zu dim=%d nlist=%d m=%d -> %s", n, dim, nlist, m, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// [off, off + count * elem) nằm trong file và off căn theo align (không tràn số)
+static bool in_file(uint64_t off, uint64_t count, uint64_t elem, uint64_t file_size, uint64_t align) {
+    if (off % align != 0 || off > file_size) return false;
+    return count <= (file_size - off) / elem;
+}
+
+static bool monotonic(const uint64_t* v, uint64_t n, uint64_t last) {
+    if (v[0] != 0) return false;
+    for (uint64_t i = 0; i < n; ++i) {
+        if (v[i + 1] < v[i]) return false;
+    }
+    return v[n] == last;
+}
+
+static bool map_segment(const std::string& path, const QuantHeader& q, IvfPqIndex::Segment& s);
+
+bool IvfPqIndex::open(const std::string& dir) {
+    close();
+
+    auto q = std::make_unique<Quantizer>();
+    if (!q->file.open(dir + "/quantizer.bin") || q->file.size() < sizeof(QuantHeader)) return false;
+    memcpy(&q->hdr, q->file.data(), sizeof(QuantHeader));
+    const QuantHeader& h = q->hdr;
+    const uint64_t qsize = q->file.size();
+    if (memcmp(h.magic, kQuantMagic, 4) != 0 || h.version != kVersion || h.ksub != kKsub ||
+        h.dim == 0 || h.nlist == 0 || h.m == 0 || h.dim % h.m != 0 ||
+        !in_file(h.off_centroids, (uint64_t)h.nlist * h.dim, sizeof(float), qsize, sizeof(float)) ||
+        !in_file(h.off_codebooks, (uint64_t)h.m * kKsub * (h.dim / h.m), sizeof(float), qsize, sizeof(float))) {
+        LOGE("IvfPqIndex: bad quantizer in %s", dir.c_str());
+        return false;
+    }
+    q->centroids = (const float*)(q->file.data() + h.off_centroids);
+    q->codebooks = (const float*)(q->file.data() + h.off_codebooks);
+
+    std::vector<std::string> names;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* e = readdir(d)) {
+            const size_t len = strlen(e->d_name);
+            if (strncmp(e->d_name, "seg_", 4) == 0 && len > 4 && strcmp(e->d_name + len - 4, ".bin") == 0) {
+                names.emplace_back(e->d_name);
+            }
+        }
+        closedir(d);
+    }
+    std::sort(names.begin(), names.end());
+
+    uint32_t replaced = 0;
+    for (const auto& name : names) {
+        auto s = std::make_unique<Segment>();
+        s->no = (uint32_t)strtoul(name.c_str() + 4, nullptr, 10);
+        next_seg_no_ = std::max(next_seg_no_, s->no + 1);
+        if (!map_segment(dir + "/" + name, h, *s)) {
+            LOGE("IvfPqIndex: skip invalid segment %s", name.c_str());
+            continue;
+        }
+        replaced = std::max(replaced, s->hdr.replaces_below);
+        segs_.push_back(std::move(s));
+    }
+    // compact() bị ngắt sau khi ghi segment gộp nhưng trước khi xoá segment cũ: segment gộp thắng
+    for (auto it = segs_.begin(); it != segs_.end();) {
+        if ((*it)->no < replaced) {
+            LOGI("IvfPqIndex: removing merged segment %s", (*it)->path.c_str());
+            unlink((*it)->path.c_str());
+            it = segs_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    dir_ = dir;
+    q_   = std::move(q);
+    LOGI("IvfPqIndex::open: %s (segments=%zu, n=%zu)", dir.c_str(), segs_.size(), size());
+    return true;
+}
+
+// Kiểm tra mọi section nằm trong file (segment ghi dở / hỏng bị bỏ qua, không đọc tràn)
+static bool map_segment(const std::string& path, const QuantHeader& q, IvfPqIndex::Segment& s) {
+    if (!s.file.open(path) || s.file.size() < sizeof(SegHeader)) return false;
+    memcpy(&s.hdr, s.file.data(), sizeof(SegHeader));
+    const SegHeader& h = s.hdr;
+    const uint64_t size = s.file.size();
+    if (memcmp(h.magic, kSegMagic, 4) != 0 || h.version != IvfPqIndex::kVersion || h.tag != q.tag ||
+        h.nlist != q.nlist || h.m != q.m || h.dim != q.dim ||
+        !in_file(h.off_lists, (uint64_t)h.nlist + 1, sizeof(uint64_t), size, sizeof(uint64_t)) ||
+        !in_file(h.off_ids, h.n, sizeof(int64_t), size, sizeof(int64_t)) ||
+        !in_file(h.off_codes, h.n, h.m, size, 1) ||
+        !in_file(h.off_raw, h.n, h.dim, size, 1) ||
+        !in_file(h.off_raw_scale, h.n, sizeof(float), size, sizeof(float)) ||
+        h.n == UINT64_MAX || !in_file(h.off_text_offs, h.n + 1, sizeof(uint64_t), size, sizeof(uint64_t)) ||
+        h.off_text > size) {
+        return false;
+    }
+    const uint8_t* base = s.file.data();
+    s.path      = path;
+    s.lists     = (const uint64_t*)(base + h.off_lists);
+    s.ids       = (const int64_t*) (base + h.off_ids);
+    s.codes     = base + h.off_codes;
+    s.raw       = (const int8_t*)(base + h.off_raw);
+    s.raw_scale = (const float*) (base + h.off_raw_scale);
+    s.text_offs = (const uint64_t*)(base + h.off_text_offs);
+    s.text      = (const char*)(base + h.off_text);
+    if (!monotonic(s.lists, h.nlist, h.n) || !monotonic(s.text_offs, h.n, s.text_offs[h.n]) ||
+        s.text_offs[h.n] > size - h.off_text) {
+        return false;
+    }
+    s.file.advise_random();
+    return true;
+}
+
+void IvfPqIndex::close() {
+    text_loc_.clear();
+    segs_.clear();
+    q_.reset();
+    dir_.clear();
+    next_seg_no_ = 0;
+}
+
+int IvfPqIndex::dim() const { return q_ ? (int)q_->hdr.dim : 0; }
+
+size_t IvfPqIndex::size() const {
+    size_t n = 0;
+    for (const auto& s : segs_) n += (size_t)s->hdr.n;
+    return n;
+}
+
+int64_t IvfPqIndex::next_id() const {
+    int64_t next = 0;
+    for (const auto& s : segs_) next = std::max(next, s->hdr.id_end);
+    return next;
+}
+
+// --------- Append / compact ---------
+
+bool IvfPqIndex::append(const float* vecs, const int64_t* ids,
+                        const std::vector<std::string>& texts, size_t n) {
+    if (!q_ || n == 0) return q_ != nullptr;
+    const QuantHeader& h = q_->hdr;
+
+    std::vector<uint32_t> list_of;
+    std::vector<uint8_t>  codes;
+    std::vector<int8_t>   raw;
+    std::vector<float>    raw_scale;
+    encode(q_->centroids, q_->codebooks, (int)h.dim, (int)h.nlist, (int)h.m, vecs, n, list_of, codes, raw, raw_scale);
+
+    std::vector<SegEntry> entries(n);
+    for (size_t i = 0; i < n; ++i) {
+        entries[i] = { list_of[i], ids[i], &codes[i * h.m], &raw[i * h.dim], raw_scale[i],
+                       i < texts.size() ? texts[i] : std::string() };
+    }
+
+    const std::string path = seg_path(dir_, next_seg_no_);
+    if (!write_segment(path, h.tag, (int)h.nlist, (int)h.m, (int)h.dim, entries)) return false;
+
+    auto s = std::make_unique<Segment>();
+    s->no = next_seg_no_;
+    if (!map_segment(path, h, *s)) return false;
+    ++next_seg_no_;
+    segs_.push_back(std::move(s));
+    text_loc_.clear();
+    return true;
+}
+
+bool IvfPqIndex::compact() {
+    if (!q_ || segs_.size() <= 1) return q_ != nullptr;
+    const QuantHeader& h = q_->hdr;
+
+    // id có trong nhiều segment (append lại id cũ): giữ bản trong segment mới nhất
+    std::vector<SegEntry> entries;
+    entries.reserve(size());
+    std::unordered_set<int64_t> seen;
+    seen.reserve(size());
+    for (auto it = segs_.rbegin(); it != segs_.rend(); ++it) {
+        const Segment* s = it->get();
+        for (uint32_t c = 0; c < h.nlist; ++c) {
+            for (uint64_t p = s->lists[c]; p < s->lists[c + 1]; ++p) {
+                if (!seen.insert(s->ids[p]).second) continue;
+                entries.push_back({ c, s->ids[p], s->codes + p * h.m, s->raw + p * h.dim, s->raw_scale[p], s->text_at(p) });
+            }
+        }
+    }
+
+    // Segment gộp ghi nguyên tử (tmp + fsync + rename) và ghi nhận thay cho mọi segment số nhỏ hơn;
+    // chết giữa chừng thì open() xoá nốt segment cũ
+    const std::string path = seg_path(dir_, next_seg_no_);
+    if (!write_segment(path, h.tag, (int)h.nlist, (int)h.m, (int)h.dim, entries, next_seg_no_)) return false;
+
+    auto merged = std::make_unique<Segment>();
+    merged->no = next_seg_no_;
+    if (!map_segment(path, h, *merged)) return false;
+    for (const auto& s : segs_) unlink(s->path.c_str());
+    text_loc_.clear();
+    segs_.clear();
+    segs_.push_back(std::move(merged));
+    ++next_seg_no_;
+    return true;
+}
+
+// --------- Text ---------
+
+void IvfPqIndex::for_each_text(const std::function<void(int64_t, const char*, size_t)>& fn) const {
+    for (const auto& s : segs_) {
+        for (uint64_t p = 0; p < s->hdr.n; ++p) {
+            fn(s->ids[p], s->text + s->text_offs[p], (size_t)(s->text_offs[p + 1] - s->text_offs[p]));
+        }
+    }
+}
+
+bool IvfPqIndex::text_of(int64_t id, std::string* out) {
+    if (text_loc_.empty()) {
+        text_loc_.reserve(size());
+        for (const auto& s : segs_) {
+            for (uint64_t p = 0; p < s->hdr.n; ++p) text_loc_[s->ids[p]] = { s.get(), p };
+        }
+    }
+    auto it = text_loc_.find(id);
+    if (it == text_loc_.end()) return false;
+    *out = it->second.first->text_at(it->second.second);
+    return true;
+}
+
+// --------- Search ---------
+
+std::vector<IvfPqIndex::Hit> IvfPqIndex::search(const float* query, size_t k, const QueryParams& qp) const {
+    if (!q_ || k == 0) return {};
+    const QuantHeader& h = q_->hdr;
+    const int dim = (int)h.dim, m = (int)h.m, dsub = q_->dsub(), nlist = (int)h.nlist;
+
+    std::vector<float> q(query, query + dim);
+    veck::normalize(q.data(), (size_t)dim);
+
+    // <q, x> ~ <q, c_list> + sum_s <q_s, codebook_s[code_s]>; LUT không phụ thuộc cụm
+    std::vector<std::pair<float, int>> coarse((size_t)nlist);
+    for (int c = 0; c < nlist; ++c) {
+        coarse[(size_t)c] = { veck::dot_f32(q.data(), q_->centroids + (size_t)c * dim, (size_t)dim), c };
+    }
+    const int nprobe = std::max(1, std::min(qp.nprobe, nlist));
+    std::partial_sort(coarse.begin(), coarse.begin() + nprobe, coarse.end(),
+                      [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; });
+
+    std::vector<float> lut((size_t)m * kKsub);
+    for (int s = 0; s < m; ++s) {
+        const float* cb = q_->codebooks + (size_t)s * kKsub * dsub;
+        for (int j = 0; j < kKsub; ++j) {
+            lut[(size_t)s * kKsub + j] = veck::dot_f32(&q[(size_t)s * dsub], cb + (size_t)j * dsub, (size_t)dsub);
+        }
+    }
+
+    struct Cand { float score; const Segment* seg; uint64_t pos; };
+    auto cmp = [](const Cand& a, const Cand& b) { return a.score > b.score; };
+    const size_t n_cand = qp.refine > 0 ? k * (size_t)qp.refine : k;
+    std::vector<Cand> heap;
+    heap.reserve(n_cand + 1);
+
+    size_t scanned = 0;
+    for (int pi = 0; pi < nprobe; ++pi) {
+        const float base = coarse[(size_t)pi].first;
+        const int   c    = coarse[(size_t)pi].second;
+        for (const auto& seg : segs_) {
+            const uint64_t b = seg->lists[c], e = seg->lists[c + 1];
+            for (uint64_t p = b; p < e; ++p) {
+                const uint8_t* code = seg->codes + p * m;
+                float score = base;
+                for (int s = 0; s < m; ++s) score += lut[(size_t)s * kKsub + code[s]];
+
+                if (heap.size() < n_cand) {
+                    heap.push_back({ score, seg.get(), p });
+                    std::push_heap(heap.begin(), heap.end(), cmp);
+                } else if (score > heap.front().score) {
+                    std::pop_heap(heap.begin(), heap.end(), cmp);
+                    heap.back() = { score, seg.get(), p };
+                    std::push_heap(heap.begin(), heap.end(), cmp);
+                }
+            }
+            scanned += (size_t)(e - b);
+        }
+        if (qp.max_codes > 0 && scanned >= qp.max_codes) break;
+    }
+
+    // Re-rank: chấm lại ứng viên bằng tích vô hướng int8 (lượng tử theo hàng)
+    if (qp.refine > 0 && !heap.empty()) {
+        std::vector<int8_t> qi((size_t)dim);
+        const float qscale = veck::quantize_i8(q.data(), qi.data(), (size_t)dim);
+        for (auto& c : heap) {
+            const int32_t dot = veck::dot_i8(qi.data(), c.seg->raw + c.pos * dim, (size_t)dim);
+            c.score = (float)dot * qscale * c.seg->raw_scale[c.pos];
+        }
+        std::make_heap(heap.begin(), heap.end(), cmp);
+        while (heap.size() > k) {
+            std::pop_heap(heap.begin(), heap.end(), cmp);
+            heap.pop_back();
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), cmp);
+    std::vector<Hit> out;
+    out.reserve(heap.size());
+    for (const auto& c : heap) {
+        out.push_back({ c.seg->ids[c.pos], c.score, c.seg->text_at(c.pos) });
+    }
+    return out;
+}
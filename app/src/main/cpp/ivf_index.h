@@ -0,0 +1,93 @@
+// app/src/main/cpp/ivf_index.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Index ANN trên đĩa: IVF (cụm thô) + PQ (mã hoá phần dư), mở bằng mmap.
+//
+// Thư mục index:
+//   quantizer.bin   centroid thô + codebook PQ (huấn luyện một lần)
+//   seg_NNNNNN.bin  các segment bất biến; mỗi lần append ghi thêm một segment,
+//                   compact() gộp tất cả thành một (không huấn luyện lại); header của segment
+//                   gộp ghi số segment nó thay thế nên compact bị ngắt không để lại bản trùng
+//
+// Segment lưu thêm bản int8 của từng vector để re-rank ứng viên PQ.
+// Mọi section trong file được căn theo trang để mmap chỉ nạp phần được chạm tới;
+// open() chỉ đọc header và bảng offset (cụm, text) để kiểm tra segment, không chạm tới ids.
+// append() cần id mới (next_id()); id trùng giữa các segment chỉ được gộp ở compact() (bản trong
+// segment mới nhất thắng).
+class IvfPqIndex {
+public:
+    static constexpr uint32_t kVersion = 1;
+    static constexpr int      kKsub    = 256;   // số centroid mỗi sub-quantizer (mã 1 byte)
+
+    struct Params {
+        int nlist      = 0;    // 0 = tự chọn ~ 4*sqrt(n), tối đa 1024
+        int m          = 0;    // số sub-quantizer; 0 = dim/8 (phải chia hết dim)
+        int train_iter = 8;
+    };
+
+    struct QueryParams {
+        int    nprobe    = 8;     // số cụm quét: tăng recall, tăng độ trễ
+        size_t max_codes = 0;     // giới hạn số mã quét (0 = không giới hạn)
+        int    refine    = 4;     // re-rank k*refine ứng viên PQ bằng vector int8; 0 = chỉ PQ
+    };
+
+    struct Hit {
+        int64_t     id;
+        float       score;    // xấp xỉ cosine
+        std::string text;
+    };
+
+    IvfPqIndex();
+    ~IvfPqIndex();
+
+    IvfPqIndex(const IvfPqIndex&) = delete;
+    IvfPqIndex& operator=(const IvfPqIndex&) = delete;
+
+    // Huấn luyện quantizer từ n vector (đã normalize) và ghi segment đầu tiên
+    static bool build(const std::string& dir, const float* vecs, const int64_t* ids,
+                      const std::vector<std::string>& texts, size_t n, int dim, const Params& p);
+
+    bool open(const std::string& dir);
+    void close();
+    bool is_open() const { return q_ != nullptr; }
+
+    // Mã hoá vector mới bằng quantizer hiện có và ghi thành segment mới
+    bool append(const float* vecs, const int64_t* ids,
+                const std::vector<std::string>& texts, size_t n);
+
+    // Gộp mọi segment thành một
+    bool compact();
+
+    std::vector<Hit> search(const float* query, size_t k, const QueryParams& qp) const;
+
+    // Duyệt (id, text) của mọi vector, theo thứ tự lưu trên đĩa
+    void for_each_text(const std::function<void(int64_t id, const char* text, size_t len)>& fn) const;
+    // Nội dung theo id; lần gọi đầu sau open/append/compact dựng bảng id -> vị trí (O(n)).
+    bool text_of(int64_t id, std::string* out);
+
+    int    dim()        const;
+    size_t size()       const;
+    size_t n_segments() const { return segs_.size(); }
+    int64_t next_id()   const;   // id lớn nhất + 1
+
+    struct Quantizer;
+    struct Segment;
+
+private:
+    std::string dir_;
+    std::unique_ptr<Quantizer>            q_;
+    std::vector<std::unique_ptr<Segment>> segs_;
+    uint32_t next_seg_no_ = 0;
+    std::unordered_map<int64_t, std::pair<const Segment*, uint64_t>> text_loc_;
+};
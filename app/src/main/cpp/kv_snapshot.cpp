@@ -0,0 +1,253 @@
+// app/src/main/cpp/kv_snapshot.cpp
+#include "kv_snapshot.h"
+#include "bridge_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// --------- File format (little-endian) ---------
+//
+// SnapHeader | key | system | rendered | n_msgs x (u32 role_len, u32 content_len, role, content)
+//            | tokens (int32 x n_tokens) | pad tới 64 | state
+
+static constexpr char kSnapMagic[4] = { 'R', 'A', 'G', 'K' };
+
+struct SnapHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t n_msgs;
+    uint32_t n_tokens;
+    uint64_t key_len;
+    uint64_t system_len;
+    uint64_t rendered_len;
+    uint64_t off_state;
+    uint64_t state_size;
+};
+
+static bool put(FILE* f, const void* p, size_t n) { return n == 0 || fwrite(p, 1, n, f) == n; }
+
+static bool write_snapshot(const std::string& path, const KvSnapshot& s) {
+    SnapHeader h{};
+    memcpy(h.magic, kSnapMagic, 4);
+    h.version      = KvSnapshotStore::kVersion;
+    h.n_msgs       = (uint32_t)std::min(s.roles.size(), s.contents.size());
+    h.n_tokens     = (uint32_t)s.tokens.size();
+    h.key_len      = s.key.size();
+    h.system_len   = s.system.size();
+    h.rendered_len = s.rendered.size();
+    h.state_size   = s.state.size();
+
+    uint64_t off = sizeof(h) + h.key_len + h.system_len + h.rendered_len;
+    for (uint32_t i = 0; i < h.n_msgs; ++i) off += 8 + s.roles[i].size() + s.contents[i].size();
+    off += (uint64_t)h.n_tokens * sizeof(int32_t);
+    h.off_state = (off + 63) / 64 * 64;
+    const size_t pad = (size_t)(h.off_state - off);
+
+    const std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+
+    static const char zeros[64] = {};
+    bool ok = put(f, &h, sizeof(h)) && put(f, s.key.data(), s.key.size()) &&
+              put(f, s.system.data(), s.system.size()) && put(f, s.rendered.data(), s.rendered.size());
+    for (uint32_t i = 0; ok && i < h.n_msgs; ++i) {
+        const uint32_t lens[2] = { (uint32_t)s.roles[i].size(), (uint32_t)s.contents[i].size() };
+        ok = put(f, lens, sizeof(lens)) && put(f, s.roles[i].data(), lens[0]) && put(f, s.contents[i].data(), lens[1]);
+    }
+    ok = ok && put(f, s.tokens.data(), s.tokens.size() * sizeof(int32_t)) && put(f, zeros, pad) &&
+         put(f, s.state.data(), s.state.size());
+
+    ok = (fflush(f) == 0) && ok;
+    if (ok) fsync(fileno(f));
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// --------- Store ---------
+
+bool KvSnapshotStore::open(const std::string& dir, uint64_t budget_bytes) {
+    close();
+    if (dir.empty()) return false;
+    mkdir(dir.c_str(), 0700);
+    struct stat st{};
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        LOGE("KvSnapshotStore: cannot use %s", dir.c_str());
+        return false;
+    }
+    dir_    = dir;
+    budget_ = budget_bytes;
+    stop_   = false;
+    writer_ = std::thread([this] { writer_loop(); });
+    evict(std::string());
+    return true;
+}
+
+void KvSnapshotStore::close() {
+    if (!writer_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+    dir_.clear();
+}
+
+std::string KvSnapshotStore::path_of(const std::string& name) const {
+    std::string safe;
+    for (char c : name) {
+        const bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+        safe += ok ? c : '_';
+    }
+    return dir_ + "/" + safe + ".kvs";
+}
+
+void KvSnapshotStore::save_async(const std::string& name, KvSnapshot&& snap) {
+    if (!is_open()) return;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        pending_[name] = std::move(snap);
+    }
+    cv_.notify_all();
+}
+
+void KvSnapshotStore::flush() {
+    std::unique_lock<std::mutex> lk(mu_);
+    cv_.wait(lk, [&] { return (pending_.empty() && !busy_) || !writer_.joinable(); });
+}
+
+void KvSnapshotStore::writer_loop() {
+    std::unique_lock<std::mutex> lk(mu_);
+    for (;;) {
+        cv_.wait(lk, [&] { return !pending_.empty() || stop_; });
+        if (pending_.empty()) break;   // stop_ và đã ghi hết
+
+        auto node = pending_.extract(pending_.begin());
+        busy_ = true;
+        lk.unlock();
+
+        const std::string path = path_of(node.key());
+        const auto t0 = std::chrono::steady_clock::now();
+        if (write_snapshot(path, node.mapped())) {
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            LOGI("KvSnapshotStore: wrote %s (%zu tokens, %zu KB state, %.0f ms)", node.key().c_str(),
+                 node.mapped().tokens.size(), node.mapped().state.size() / 1024, ms);
+            evict(path);
+        } else {
+            LOGE("KvSnapshotStore: failed to write %s", path.c_str());
+        }
+
+        lk.lock();
+        busy_ = false;
+        cv_.notify_all();
+    }
+}
+
+// LRU theo mtime: xoá file cũ nhất cho tới khi tổng <= budget (không xoá keep_path)
+void KvSnapshotStore::evict(const std::string& keep_path) {
+    struct Entry {
+        std::string path;
+        uint64_t    size;
+        int64_t     mtime_ns;
+    };
+    std::vector<Entry> files;
+    uint64_t total = 0;
+    if (DIR* d = opendir(dir_.c_str())) {
+        while (dirent* e = readdir(d)) {
+            const size_t len = strlen(e->d_name);
+            if (len < 5 || strcmp(e->d_name + len - 4, ".kvs") != 0) continue;
+            const std::string p = dir_ + "/" + e->d_name;
+            struct stat st{};
+            if (stat(p.c_str(), &st) != 0) continue;
+            files.push_back({ p, (uint64_t)st.st_size, (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec });
+            total += (uint64_t)st.st_size;
+        }
+        closedir(d);
+    }
+    if (total <= budget_) return;
+
+    std::sort(files.begin(), files.end(), [](const Entry& a, const Entry& b) { return a.mtime_ns < b.mtime_ns; });
+    for (const auto& f : files) {
+        if (total <= budget_) break;
+        if (f.path == keep_path) continue;
+        if (unlink(f.path.c_str()) == 0) {
+            total -= f.size;
+            LOGI("KvSnapshotStore: evicted %s (%llu KB)", f.path.c_str(), (unsigned long long)(f.size / 1024));
+        }
+    }
+}
+
+bool KvSnapshotStore::load(const std::string& name, const std::string& key, Loaded* out, bool with_state) {
+    if (!is_open()) return false;
+    flush();   // bản đang chờ ghi là bản mới nhất
+
+    const std::string path = path_of(name);
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(SnapHeader)) return false;
+
+    SnapHeader h;
+    memcpy(&h, file.data(), sizeof(h));
+    if (memcmp(h.magic, kSnapMagic, 4) != 0 || h.version != kVersion ||
+        h.off_state > file.size() || h.state_size > file.size() - h.off_state) {
+        LOGE("KvSnapshotStore: bad snapshot %s", path.c_str());
+        return false;
+    }
+
+    const uint8_t* p   = file.data() + sizeof(h);
+    const uint8_t* end = file.data() + h.off_state;
+    auto take = [&](std::string& s, uint64_t n) {
+        if ((uint64_t)(end - p) < n) return false;
+        s.assign((const char*)p, (size_t)n);
+        p += n;
+        return true;
+    };
+
+    KvSnapshot& m = out->meta;
+    if (!take(m.key, h.key_len)) return false;
+    if (m.key != key) {
+        LOGI("KvSnapshotStore: %s was written for another model/context, ignored", name.c_str());
+        return false;
+    }
+    if (!take(m.system, h.system_len) || !take(m.rendered, h.rendered_len)) return false;
+
+    m.roles.resize(h.n_msgs);
+    m.contents.resize(h.n_msgs);
+    for (uint32_t i = 0; i < h.n_msgs; ++i) {
+        uint32_t lens[2];
+        if ((size_t)(end - p) < sizeof(lens)) return false;
+        memcpy(lens, p, sizeof(lens));
+        p += sizeof(lens);
+        if (!take(m.roles[i], lens[0]) || !take(m.contents[i], lens[1])) return false;
+    }
+    if ((uint64_t)(end - p) < (uint64_t)h.n_tokens * sizeof(int32_t)) return false;
+    m.tokens.resize(h.n_tokens);
+    memcpy(m.tokens.data(), p, m.tokens.size() * sizeof(int32_t));
+
+    if (with_state) {
+        out->state      = file.data() + h.off_state;
+        out->state_size = (size_t)h.state_size;
+        out->file       = std::move(file);
+    }
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);   // đánh dấu mới dùng cho LRU
+    return true;
+}
+
+void KvSnapshotStore::remove(const std::string& name) {
+    if (!is_open()) return;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        pending_.erase(name);
+    }
+    flush();
+    unlink(path_of(name).c_str());
+}
@@ -0,0 +1,72 @@
+// app/src/main/cpp/kv_snapshot.h
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Snapshot một hội thoại: transcript + token + dữ liệu KV của seq (llama_state_seq_get_data_ext).
+// key = sha256 model + tham số context; snapshot khác key không bao giờ được nạp lại.
+struct KvSnapshot {
+    std::string              key;
+    std::string              system;
+    std::vector<std::string> roles;
+    std::vector<std::string> contents;
+    std::vector<int32_t>     tokens;
+    std::string              rendered;
+    std::vector<uint8_t>     state;     // chỉ dùng khi ghi; khi đọc xem KvSnapshotStore::Loaded
+};
+
+// Thư mục snapshot <dir>/<name>.kvs.
+// save_async() trả về ngay; một thread ghi (tmp + rename) rồi xoá snapshot cũ nhất (theo mtime)
+// cho tới khi tổng dung lượng <= budget. load() chạm mtime để snapshot đang dùng không bị xoá.
+class KvSnapshotStore {
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    // Snapshot đã đọc: state trỏ thẳng vào vùng mmap, không copy
+    struct Loaded {
+        KvSnapshot     meta;
+        MappedFile     file;
+        const uint8_t* state      = nullptr;
+        size_t         state_size = 0;
+    };
+
+    KvSnapshotStore() = default;
+    ~KvSnapshotStore() { close(); }
+
+    KvSnapshotStore(const KvSnapshotStore&) = delete;
+    KvSnapshotStore& operator=(const KvSnapshotStore&) = delete;
+
+    bool open(const std::string& dir, uint64_t budget_bytes);
+    void close();     // ghi nốt hàng đợi rồi dừng thread
+    bool is_open() const { return !dir_.empty(); }
+
+    // name chỉ gồm [A-Za-z0-9_-]; snapshot mới hơn cùng name thay thế bản đang chờ ghi
+    void save_async(const std::string& name, KvSnapshot&& snap);
+    // false nếu không có, hỏng, hoặc khác key. with_state = false chỉ đọc transcript.
+    bool load(const std::string& name, const std::string& key, Loaded* out, bool with_state);
+    void remove(const std::string& name);
+    void flush();     // chờ hàng đợi ghi trống
+
+private:
+    std::string path_of(const std::string& name) const;
+    void writer_loop();
+    void evict(const std::string& keep_path);
+
+    std::string                                 dir_;
+    uint64_t                                    budget_ = 0;
+    std::thread                                 writer_;
+    std::mutex                                  mu_;
+    std::condition_variable                     cv_;
+    std::unordered_map<std::string, KvSnapshot> pending_;
+    bool                                        busy_ = false;
+    bool                                        stop_ = false;
+};
@@ -0,0 +1,46 @@
+// app/src/main/cpp/latency_histogram.cpp
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+static double bucket_upper(int i) {
+    return LatencyHistogram::kMinMs * std::exp2((double)(i + 1) / LatencyHistogram::kPerOctave);
+}
+
+void LatencyHistogram::record(double ms, uint32_t n) {
+    if (n == 0) return;
+    ms = std::max(0.0, ms);
+    int i = 0;
+    if (ms > kMinMs) {
+        i = (int)std::floor(std::log2(ms / kMinMs) * kPerOctave);
+        i = std::min(std::max(i, 0), kBuckets - 1);
+    }
+    buckets_[(size_t)i] += n;
+    count_  += n;
+    sum_ms_ += ms * n;
+    max_ms_  = std::max(max_ms_, ms);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& o) {
+    for (size_t i = 0; i < buckets_.size(); ++i) buckets_[i] += o.buckets_[i];
+    count_  += o.count_;
+    sum_ms_ += o.sum_ms_;
+    max_ms_  = std::max(max_ms_, o.max_ms_);
+}
+
+void LatencyHistogram::clear() {
+    *this = LatencyHistogram();
+}
+
+double LatencyHistogram::percentile(double q) const {
+    if (count_ == 0) return 0.0;
+    q = std::min(1.0, std::max(0.0, q));
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * (double)count_));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += buckets_[(size_t)i];
+        if (seen >= rank) return i == kBuckets - 1 ? max_ms_ : std::min(bucket_upper(i), max_ms_);
+    }
+    return max_ms_;
+}
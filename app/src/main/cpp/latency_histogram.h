@@ -0,0 +1,30 @@
+// app/src/main/cpp/latency_histogram.h
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Histogram độ trễ (ms) với bucket hình học: 8 bucket mỗi lần gấp đôi từ 0.02 ms tới ~5 s,
+// sai số percentile ~9%. Ghi O(1), kích thước cố định nên copy / cộng dồn giữa request rẻ.
+class LatencyHistogram {
+public:
+    static constexpr int    kPerOctave = 8;
+    static constexpr int    kBuckets   = 18 * kPerOctave + 1;   // bucket cuối: tràn
+    static constexpr double kMinMs     = 0.02;
+
+    void record(double ms, uint32_t n = 1);
+    void merge(const LatencyHistogram& o);
+    void clear();
+
+    uint64_t count() const { return count_; }
+    double   max_ms() const { return max_ms_; }
+    double   mean_ms() const { return count_ ? sum_ms_ / (double)count_ : 0.0; }
+    // q trong [0, 1]; trả về cận trên của bucket chứa phân vị (0 nếu rỗng)
+    double   percentile(double q) const;
+
+private:
+    std::array<uint32_t, kBuckets> buckets_{};
+    uint64_t count_  = 0;
+    double   sum_ms_ = 0;
+    double   max_ms_ = 0;
+};
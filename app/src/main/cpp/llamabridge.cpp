@@ -3,493 +3,1367 @@
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <android/log.h>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <cassert>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "llama.h"   // third_party/llama/llama.h
-
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO , "llamabridge", __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "llamabridge", __VA_ARGS__)
+#include "bridge_log.h"
+#include "chat_prompt.h"
+#include "chunk_kv_cache.h"
+#include "cpu_threads.h"
+#include "engine.h"
+#include "kv_snapshot.h"
+#include "memory_planner.h"
+#include "thread_tuner.h"
+#include "token_stream.h"
 
 // --------- Globals ---------
-static llama_model*         g_model   = nullptr;
-static llama_context*       g_ctx     = nullptr;
-static const llama_vocab*   g_vocab   = nullptr;
-static llama_sampler*       g_smpl    = nullptr;
-static llama_context_params g_cparams;
-static bool                 g_inited  = false;
-static std::atomic<bool>    g_cancel_requested(false);
+// Model, context và vòng sinh nằm trong engine; JNI chỉ giữ một engine cho cả app.
+static InferenceEngine g_engine;
+static bool            g_inited = false;
+// init / prepareContext / release: đổi model hoặc context của g_engine
+static std::mutex      g_init_mutex;
+
+// Slot của engine dành cho hội thoại / infer (giữ KV giữa các lượt, khởi động sẵn prefix)
+static constexpr int kChatSeq = 0;
+// Số slot mặc định: chat + một việc nền; mỗi slot thêm tốn một KV n_ctx
+static constexpr int kDefaultSeqs = 2;
+
+// Context shift khi câu trả lời vượt n_ctx (setContextShift)
+static bool g_ctx_shift = true;
+
+// Speculative decoding kiểu prompt lookup (setSpeculative); giữ lại cho lần init sau
+static bool g_spec_enabled   = true;
+static int  g_spec_max_draft = 6;
+
+// Phạt lặp cho các request chat / infer (setRepeatPenalty): penalty 1.10 trên 64 token vừa sinh
+static float g_repeat_penalty = 1.10f;
+static int   g_repeat_last_n  = 64;
+
+// Số luồng decode / prefill đã chọn (setThreads / autotuneThreads), giữ cho lần init sau khi
+// init được gọi với nThreads <= 0; n_decode = 0: theo topology CPU
+static ThreadConfig g_threads{ 0, 0 };
+
+// Kiểu KV cache cho lần init sau (setKvCacheType)
+static ggml_type g_type_k = GGML_TYPE_F16;
+static ggml_type g_type_v = GGML_TYPE_F16;
+
+// Trần KV của pool context (setContextBudget) và của planner bộ nhớ (setMemoryBudget:
+// < 0 tắt planner, 0 theo MemAvailable, > 0 trần byte cho KV + compute)
+static size_t  g_ctx_budget = 0;
+static int64_t g_mem_budget = 0;
+// budget của lần lập kế hoạch gần nhất (UINT64_MAX = planner tắt)
+static uint64_t g_plan_budget = UINT64_MAX;
+// Báo cáo của lần lập kế hoạch gần nhất (memoryPlan)
+static std::mutex  g_mem_plan_mutex;
+static std::string g_mem_plan;
+
+// Số liệu một request: của engine + phần dựng prompt phía bridge
+struct RequestMetrics {
+    GenStats     stats;
+    PromptTiming prompt;
+    int          n_prompt = 0;
+};
+// Số liệu của request interactive gần nhất (generationStats / generationMetrics)
+static std::mutex     g_last_gen_mutex;
+static RequestMetrics g_last_gen;
+
+// Request tạo qua newRequestId / generate, để cancelRequest huỷ được từng request
+struct PendingRequest {
+    std::shared_ptr<GenJob> job;
+    bool                    cancelled = false;
+};
+static std::mutex                                  g_req_mutex;
+static std::unordered_map<jlong, PendingRequest>   g_requests;
+static jlong                                       g_next_req_id = 1;
+
+// Snapshot KV của các hội thoại có tên (configureSnapshots / openConversation)
+static KvSnapshotStore g_snapshots;
+static std::string     g_model_sha256;
+
+// KV dựng sẵn của các đoạn tài liệu cho generateRag (configureChunkCache)
+static ChunkKvCache g_chunks;
+
+static const char* kSystemPrompt = "You are a helpful AI assistant.";
 
 // --------- Helpers ---------
 
-// Build a chat-formatted prompt using the model's chat template (GGUF metadata)
-static std::string apply_chat_template(llama_model* model, const std::string& user_msg, const char* sys_msg_opt) {
-    std::vector<llama_chat_message> msgs;
-    if (sys_msg_opt && sys_msg_opt[0]) {
-        llama_chat_message msys{ "system", sys_msg_opt };
-        msgs.push_back(msys);
-    }
-    llama_chat_message muser{ "user", user_msg.c_str() };
-    msgs.push_back(muser);
-
-    // Lấy template mặc định từ model; có thể null nếu GGUF không có
-    const char* tmpl = llama_model_chat_template(model, /*name*/ nullptr);
-
-    // buffer tăng dần
-    size_t cap = std::max<size_t>(user_msg.size() * 2 + 256, 64 * 1024);
-    for (int tries = 0; tries < 6; ++tries) {
-        std::vector<char> buf(cap);
-        int n = llama_chat_apply_template(
-                /*tmpl*/ tmpl,                 // <- đúng chữ ký 6 tham số
-                /*chat*/ msgs.data(),
-                /*n_msg*/ (size_t)msgs.size(),
-                /*add_ass*/ true,
-                /*buf*/ buf.data(),
-                /*length*/ (int32_t)buf.size()
-        );
-        if (n >= 0 && (size_t)n <= buf.size()) {
-            return std::string(buf.data(), (size_t)n);
-        }
-        cap *= 2;
-    }
-
-    // Fallback khi không có template: cực tối giản
-    std::string fb;
-    if (sys_msg_opt && sys_msg_opt[0]) {
-        fb += "System: ";
-        fb += sys_msg_opt;
-        fb += "\n";
-    }
-    fb += "User: ";
-    fb += user_msg;
-    fb += "\nAssistant:";
-    return fb;
-}
-
-// Detokenize: không render special tokens
-static std::string detok(const std::vector<llama_token>& toks) {
-    if (!g_vocab || toks.empty()) return {};
-    std::string out; out.reserve(toks.size() * 4);
-    char buf[256];
-    for (llama_token t : toks) {
-        const int n = llama_token_to_piece(
-                g_vocab, t, buf, (int)sizeof(buf),
-                /*lstrip*/ 0,
-                /*special*/ false
-        );
-        if (n > 0) out.append(buf, n);
-    }
-    return out;
+// Cấu hình speculative / phạt lặp hiện tại cho request một lượt
+static void apply_turn_defaults(GenRequest& req, RequestMetrics& m) {
+    req.speculative    = g_spec_enabled;
+    req.repeat_penalty = g_repeat_penalty;
+    req.repeat_last_n  = g_repeat_last_n;
+    m.n_prompt         = (int)req.prompt.size();
 }
 
-static std::string token_to_piece(llama_token tok) {
-    if (!g_vocab) return {};
-    std::vector<char> buf(32);
-    for (int attempt = 0; attempt < 5; ++attempt) {
-        const int n = llama_token_to_piece(
-                g_vocab,
-                tok,
-                buf.data(),
-                (int)buf.size(),
-                /*lstrip*/ 0,
-                /*special*/ false
-        );
-        if (n >= 0 && n < (int)buf.size()) {
-            return std::string(buf.data(), (size_t)n);
-        }
-        if (n < 0) break;
-        buf.resize((size_t)n + 1);
-    }
-    return {};
+// Request một lượt với system prompt mặc định và cấu hình speculative / context shift / phạt lặp hiện tại
+static GenRequest default_turn_request(const std::string& user_prompt, int maxTokens, float temp, float topP,
+                                       RequestMetrics& m) {
+    GenRequest req = single_turn_request(g_engine, user_prompt, kSystemPrompt, maxTokens, temp, topP,
+                                         g_ctx_shift, &m.prompt);
+    apply_turn_defaults(req, m);
+    return req;
 }
 
-// Sampler chain
-static llama_sampler* make_sampler(float topP, float temp) {
-    llama_sampler_chain_params sp = llama_sampler_chain_default_params();
-    sp.no_perf = true;
+// Chạy fn, cộng thời gian chạy (ms) vào acc
+template <class Fn>
+static auto timed_ms(double& acc, Fn&& fn) {
+    const auto t0 = std::chrono::steady_clock::now();
+    auto r = fn();
+    acc += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return r;
+}
 
-    llama_sampler* smpl = llama_sampler_chain_init(sp);
+// Thứ tự phần tử khớp LlamaBridge.GenerationMetrics
+static constexpr size_t kMetricsLen = 25;
+static std::array<double, kMetricsLen> metrics_values(const RequestMetrics& m) {
+    const GenStats& st = m.stats;
+    const llama_context_params& cp = g_engine.cparams();
+    const double decode_ms = std::max(0.0, st.seconds * 1000.0 - st.prefill_ms);
+    return {
+        m.prompt.template_ms,
+        m.prompt.tokenize_ms,
+        (double)m.n_prompt,
+        (double)st.n_reused,
+        (double)st.n_prefill,
+        st.prefill_ms,
+        st.ttft_ms,
+        (double)st.tokens,
+        decode_ms,
+        st.token_ms.percentile(0.50),
+        st.token_ms.percentile(0.95),
+        st.token_ms.percentile(0.99),
+        st.sample_ms,
+        (double)st.kv_used,
+        (double)g_engine.n_ctx_seq(),
+        (double)st.ctx_shifts,
+        (double)st.aborts,
+        st.cancelled ? 1.0 : 0.0,
+        (double)st.drafted,
+        (double)st.accepted,
+        (double)g_engine.n_threads_decode(),
+        (double)g_engine.n_threads_prefill(),
+        (double)cp.n_seq_max,
+        (double)cp.n_batch,
+        (double)st.n_restored,
+    };
+}
 
-    // (tuỳ chọn) giảm lặp: bật nếu cần, theo chữ ký hiện tại (last_n, repeat, freq, present)
-    // llama_sampler_chain_add(smpl, llama_sampler_init_penalties(64, 1.10f, 0.0f, 0.0f));
+// Lấy số liệu của job vừa xong; request interactive được giữ lại cho generationMetrics
+static void record_metrics(RequestMetrics& m, const GenJob& job, bool interactive) {
+    m.stats = job.stats();
+    if (!interactive) return;
+    std::lock_guard<std::mutex> lock(g_last_gen_mutex);
+    g_last_gen = m;
+}
 
-    llama_sampler_chain_add(smpl, llama_sampler_init_top_p((topP > 0.f && topP <= 1.f) ? topP : 0.95f, /*min_keep*/ 1));
+// Như record_metrics và giao cho sink (trước completed / error)
+static void report_metrics(RequestMetrics& m, const GenJob& job, StreamSink& sink, bool interactive) {
+    record_metrics(m, job, interactive);
+    const auto v = metrics_values(m);
+    sink.metrics(v.data(), v.size());
+}
 
-    if (temp <= 0.0f) {
-        llama_sampler_chain_add(smpl, llama_sampler_init_greedy());     // tất định
-    } else {
-        llama_sampler_chain_add(smpl, llama_sampler_init_temp(temp));
-        llama_sampler_chain_add(smpl, llama_sampler_init_dist(/*seed*/ 0));
+// Chuyển tiến độ prefill và văn bản của job sang sink trên thread gọi cho tới khi job kết thúc.
+// Sink từ chối (Kotlin dừng / exception) thì huỷ job. false nếu job lỗi hoặc sink từ chối.
+static bool pump_job(GenJob& job, StreamSink& sink) {
+    std::string text;
+    PrefillProgress prog;
+    bool sink_ok = true;
+    while (job.wait_output(&text, &prog)) {
+        if (sink_ok && prog.total > 0 && !sink.progress(prog.done, prog.total)) {
+            sink_ok = false;
+            job.cancel();
+        }
+        if (sink_ok && !text.empty() && !sink.write(text.data(), text.size())) {
+            sink_ok = false;
+            job.cancel();
+        }
+        text.clear();
     }
-    return smpl;
+    if (sink_ok) sink_ok = sink.flush();
+    return sink_ok && job.ok();
 }
 
-// Clamp: giữ prefix (system/header) + phần đuôi câu hỏi hiện tại
-static void clamp_with_keep(std::vector<llama_token>& ptok, int n_ctx_total, int reserve, int n_keep_prefix) {
-    const int n_avail = std::max(0, n_ctx_total - reserve);
-    if ((int)ptok.size() <= n_avail) return;
+// Prefill sẵn phần system/template cố định vào slot chat để request đầu tiên không phải trả phí này
+static void kv_warm_prefix(const char* sys_msg) {
+    GenRequest req;
+    req.prompt = system_prefix(g_engine.model(), sys_msg);
+    if (req.prompt.empty()) return;
+    req.max_tokens = 0;
+    req.seq        = kChatSeq;
+
+    auto lease = g_engine.lease(kChatSeq);
+    auto job   = g_engine.submit(std::move(req));
+    std::string ignored;
+    while (job && job->wait_output(&ignored)) {}
+    if (job && job->ok()) LOGI("kv_warm_prefix: done");
+}
 
-    n_keep_prefix = std::max(0, std::min(n_keep_prefix, (int)ptok.size()));
-    if (n_keep_prefix >= n_avail) { ptok.resize(n_avail); return; }
+// Trần của pool context: setContextBudget, không vượt budget của planner, trừ context phụ của
+// g_chunks (cùng n_ctx / kiểu KV với context đang dùng). Gọi khi giữ g_init_mutex.
+static size_t pool_budget() {
+    uint64_t budget = std::min<uint64_t>(g_ctx_budget, g_plan_budget);
+    if (g_chunks.is_open() && g_engine.is_loaded()) {
+        const llama_context_params& cp = g_engine.cparams();
+        const uint64_t aux = estimate_aux_context_bytes(
+            g_engine.model(), g_engine.n_ctx_seq(), cp.type_k, cp.type_v, ChunkKvCache::kWorkspaceBatch,
+            cp.flash_attn_type == LLAMA_FLASH_ATTN_TYPE_ENABLED);
+        budget = budget > aux ? budget - aux : 0;
+    }
+    return (size_t)budget;
+}
 
-    const int n_tail = n_avail - n_keep_prefix;
-    std::vector<llama_token> kept;
-    kept.reserve(n_avail);
-    kept.insert(kept.end(), ptok.begin(), ptok.begin() + n_keep_prefix);
-    kept.insert(kept.end(), ptok.end() - n_tail, ptok.end());
-    ptok.swap(kept);
+// Chọn n_ctx / kiểu KV / flash attention / n_ubatch vừa bộ nhớ hiện có (nếu planner bật).
+// p.n_ctx_seq và p.type_k / type_v là mức mong muốn, planner chỉ hạ xuống. Gọi khi giữ
+// g_init_mutex, model đã nạp; trả về tổng KV + compute dự kiến của context engine, không gồm
+// context phụ của g_chunks (0 nếu planner tắt).
+static uint64_t plan_params(InferenceEngine::Params& p, bool record) {
+    if (g_mem_budget < 0) {
+        g_plan_budget = UINT64_MAX;
+        return 0;
+    }
+    MemoryRequest req;
+    req.n_ctx_seq = p.n_ctx_seq;
+    req.n_seq     = p.n_seq;
+    req.n_batch   = p.n_batch;
+    req.type_k    = p.type_k;
+    req.type_v    = p.type_v;
+    req.budget    = (uint64_t)g_mem_budget;
+    // context phụ ghép KV đoạn nằm ngoài engine nhưng cùng budget
+    if (g_chunks.is_open()) req.aux_ubatch = ChunkKvCache::kWorkspaceBatch;
+    const MemoryPlan plan = plan_memory(g_engine.model(), req, read_meminfo(), g_engine.context_bytes());
+    if (record) {
+        LOGI("memory plan:\n%s", plan.report.c_str());
+        std::lock_guard<std::mutex> lock(g_mem_plan_mutex);
+        g_mem_plan = plan.report;
+    }
+    p.n_ctx_seq  = plan.n_ctx_seq;
+    p.n_batch    = plan.n_batch;
+    p.n_ubatch   = plan.n_ubatch;
+    p.type_k     = plan.type_k;
+    p.type_v     = plan.type_v;
+    p.flash_attn = plan.flash_attn;
+    // context giữ sẵn không được chiếm phần bộ nhớ planner đã tính cho context mới
+    g_plan_budget = plan.budget;
+    g_engine.set_context_budget(pool_budget());
+    return plan.kv_bytes + plan.compute_bytes;
 }
 
 // --------- JNI: init ---------
+// Cùng model đang nạp: engine chỉ đổi context (lấy từ pool nếu đã dựng), không đọc lại GGUF
+static jboolean init_engine(JNIEnv* env, jstring jModelPath, jint nCtx, jint nThreads, jint nSeq) {
+    const char* cpath = env->GetStringUTFChars(jModelPath, nullptr);
+    const std::string path = cpath ? cpath : "";
+    env->ReleaseStringUTFChars(jModelPath, cpath);
+
+    std::lock_guard<std::mutex> lock(g_init_mutex);
+    if (!g_inited) {
+        llama_backend_init();
+        g_inited = true;
+    }
+
+    // nThreads > 0: dùng cho cả decode lẫn prefill như trước; <= 0: cấu hình đã tune hoặc theo
+    // topology (decode trên lõi lớn, prefill trên mọi lõi lớn)
+    ThreadConfig threads = g_threads.n_decode > 0 ? g_threads : default_thread_config(cpu_topology());
+    if (nThreads > 0) threads = { (int)nThreads, (int)nThreads };
+
+    InferenceEngine::Params p;
+    p.n_seq           = (int)nSeq;
+    p.n_ctx_seq       = (int)nCtx;
+    p.n_threads       = threads.n_decode;
+    p.n_threads_batch = threads.n_prefill;
+    p.spec_max_draft  = g_spec_enabled ? g_spec_max_draft : 0;
+    p.type_k          = g_type_k;
+    p.type_v          = g_type_v;
+
+    // model trước (metadata cho planner), context sau. Context phụ của g_chunks giữ model cũ:
+    // giải phóng trước khi engine đổi / giải phóng model. Lượt chat đang chạy (phía Java chỉ huỷ
+    // bất đồng bộ) được huỷ và chờ kết thúc qua lease slot chat trước khi context bị thay.
+    g_engine.cancel_all(GenPriority::Interactive);
+    {
+        auto lease = g_engine.lease(kChatSeq);
+        g_chunks.detach();
+        bool ok = g_engine.load_model(path);
+        if (ok) {
+            plan_params(p, /*record*/ true);
+            ok = g_engine.configure(p);
+        }
+        if (!ok) {
+            g_engine.unload();
+            llama_backend_free();
+            g_inited = false;
+            return JNI_FALSE;
+        }
+    }
+    g_engine.set_context_budget(pool_budget());   // context phụ theo n_ctx / kiểu KV mới
+    g_chunks.attach();
+    g_chunks.prepare(g_engine);
+
+    kv_warm_prefix(kSystemPrompt);
+
+    LOGI("Model & context ready (n_ctx/seq=%d, n_seq=%d, n_threads=%d/%d)",
+         g_engine.n_ctx_seq(), (int)nSeq, threads.n_decode, threads.n_prefill);
+    return JNI_TRUE;
+}
+
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_example_ragapp_LlamaBridge_init(
         JNIEnv* env, jclass /*clazz*/,
         jstring jModelPath, jint nCtx, jint nThreads) {
+    return init_engine(env, jModelPath, nCtx, nThreads, kDefaultSeqs);
+}
 
-    if (g_smpl)  { llama_sampler_free(g_smpl);  g_smpl  = nullptr; }
-    if (g_ctx)   { llama_free(g_ctx);           g_ctx   = nullptr; }
-    if (g_model) { llama_model_free(g_model);   g_model = nullptr; }
-    g_vocab  = nullptr;
+// Như init nhưng chọn số slot song song (mỗi slot một KV nCtx)
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_initEngine(
+        JNIEnv* env, jclass /*clazz*/,
+        jstring jModelPath, jint nCtx, jint nThreads, jint nSeq) {
+    return init_engine(env, jModelPath, nCtx, nThreads, nSeq);
+}
 
-    const char* cpath = env->GetStringUTFChars(jModelPath, nullptr);
+// --------- JNI: infer ---------
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_ragapp_LlamaBridge_infer(
+        JNIEnv* env, jclass /*clazz*/,
+        jstring jPrompt, jint maxTokens, jfloat temp, jfloat topP) {
+    if (!g_engine.is_loaded() || !g_inited) {
+        return env->NewStringUTF("(init() not called)");
+    }
 
-    llama_backend_init();
-    g_inited = true;
+    const char* cprompt = env->GetStringUTFChars(jPrompt, nullptr);
+    std::string user_prompt(cprompt ? cprompt : "");
+    env->ReleaseStringUTFChars(jPrompt, cprompt);
 
-    llama_model_params mparams = llama_model_default_params();
-    mparams.use_mmap  = true;
-    mparams.use_mlock = false;
+    RequestMetrics metrics;
+    GenRequest req = default_turn_request(user_prompt, (int)maxTokens, temp, topP, metrics);
+    if (req.prompt.empty()) return env->NewStringUTF("");
+    req.seq = kChatSeq;
 
-    g_cparams = llama_context_default_params();
-    g_cparams.n_ctx             = (uint32_t)nCtx;
-    g_cparams.n_threads         = (int32_t)nThreads;
-    g_cparams.n_threads_batch   = (int32_t)nThreads;
+    // Slot chat: dùng lại prefix đã warm (phần hậu tố khác với KV mới phải prefill)
+    auto lease = g_engine.lease(kChatSeq);
+    auto job   = g_engine.submit(std::move(req));
+    if (!job) return env->NewStringUTF("(decode prefill failed)");
 
-    g_cancel_requested.store(false);
+    std::string text, piece;
+    while (job->wait_output(&piece)) {
+        text += piece;
+        piece.clear();
+    }
+    record_metrics(metrics, *job, /*interactive*/ true);
+    if (!job->ok()) LOGE("infer: %s", job->error().c_str());
+    return env->NewStringUTF(text.c_str());
+}
 
-    LOGI("Loading model: %s", cpath);
-    g_model = llama_model_load_from_file(cpath, mparams);
-    env->ReleaseStringUTFChars(jModelPath, cpath);
+// Method có cài đặt mặc định phía Kotlin (có thể vắng ở callback cũ): null nếu không có
+static jmethodID optional_method(JNIEnv* env, jclass cls, const char* name, const char* sig) {
+    jmethodID m = env->GetMethodID(cls, name, sig);
+    if (!m) env->ExceptionClear();
+    return m;
+}
 
-    if (!g_model) {
-        LOGE("Failed to load model");
-        llama_backend_free();
-        g_inited = false;
-        return JNI_FALSE;
+// onPrefill(done, total); false nếu phía Kotlin ném exception
+static bool call_prefill(JNIEnv* env, jobject callback, jmethodID onPrefill, int done, int total) {
+    if (!onPrefill) return true;
+    env->CallVoidMethod(callback, onPrefill, (jint)done, (jint)total);
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        return false;
     }
+    return true;
+}
 
-    g_ctx = llama_init_from_model(g_model, g_cparams);
-    if (!g_ctx) {
-        LOGE("Failed to create context");
-        llama_model_free(g_model); g_model = nullptr;
-        llama_backend_free();
-        g_inited = false;
-        return JNI_FALSE;
+// onMetrics(DoubleArray) nếu callback có cài đặt
+static void call_metrics(JNIEnv* env, jobject callback, jmethodID onMetrics, const double* values, size_t n) {
+    if (!onMetrics) return;
+    jdoubleArray arr = env->NewDoubleArray((jsize)n);
+    if (!arr) {
+        env->ExceptionClear();
+        return;
     }
+    env->SetDoubleArrayRegion(arr, 0, (jsize)n, values);
+    env->CallVoidMethod(callback, onMetrics, arr);
+    env->DeleteLocalRef(arr);
+    if (env->ExceptionCheck()) env->ExceptionClear();
+}
 
-    g_vocab = llama_model_get_vocab(g_model);
+// Bọc LlamaBridge.TokenCallback: giữ global ref + method id trong suốt một lần suy luận.
+// Một upcall + một String cho mỗi lần write; dùng ring (JniRingSink) khi cần ít overhead.
+struct JniTokenCallback : StreamSink {
+    JNIEnv*   env         = nullptr;
+    jobject   callback    = nullptr;
+    jmethodID onToken     = nullptr;
+    jmethodID onCompleted = nullptr;
+    jmethodID onError     = nullptr;
+    jmethodID onPrefill   = nullptr;   // tuỳ chọn
+    jmethodID onMetrics   = nullptr;   // tuỳ chọn
+
+    bool bind(JNIEnv* e, jobject jCallback) {
+        env = e;
+        if (!jCallback) return false;
+        callback = env->NewGlobalRef(jCallback);
+        if (!callback) return false;
+
+        jclass cbClass = env->GetObjectClass(callback);
+        if (!cbClass) return false;
+        onToken     = env->GetMethodID(cbClass, "onToken", "(Ljava/lang/String;)V");
+        onCompleted = env->GetMethodID(cbClass, "onCompleted", "()V");
+        onError     = env->GetMethodID(cbClass, "onError", "(Ljava/lang/String;)V");
+        onPrefill   = optional_method(env, cbClass, "onPrefill", "(II)V");
+        onMetrics   = optional_method(env, cbClass, "onMetrics", "([D)V");
+        env->DeleteLocalRef(cbClass);
+
+        if (!onToken || !onCompleted || !onError) {
+            error("Callback methods missing");
+            return false;
+        }
+        return true;
+    }
 
-    if (g_smpl) llama_sampler_free(g_smpl);
-    g_smpl = make_sampler(/*topP*/0.95f, /*temp*/0.0f);
+    // false nếu phía Kotlin ném exception
+    bool write(const char* s, size_t n) override {
+        const std::string piece(s, n);
+        jstring jPiece = env->NewStringUTF(piece.c_str());
+        env->CallVoidMethod(callback, onToken, jPiece);
+        env->DeleteLocalRef(jPiece);
+        if (env->ExceptionCheck()) {
+            env->ExceptionClear();
+            return false;
+        }
+        return true;
+    }
 
-    LOGI("Model & context ready (n_ctx=%u, n_threads=%d)",
-         (unsigned)llama_n_ctx(g_ctx), (int)nThreads);
-    return JNI_TRUE;
-}
+    bool progress(int done, int total) override {
+        return call_prefill(env, callback, onPrefill, done, total);
+    }
 
-// --------- JNI: infer ---------
-extern "C" JNIEXPORT jstring JNICALL
-Java_com_example_ragapp_LlamaBridge_infer(
-        JNIEnv* env, jclass /*clazz*/,
-        jstring jPrompt, jint maxTokens, jfloat temp, jfloat topP) {
-    if (!g_model || !g_vocab || !g_inited) {
-        return env->NewStringUTF("(init() not called)");
+    void metrics(const double* values, size_t n) override {
+        call_metrics(env, callback, onMetrics, values, n);
     }
 
-    g_cancel_requested.store(false);
+    void completed() override {
+        env->CallVoidMethod(callback, onCompleted);
+    }
 
-    // Reset context per call (đơn giản & an toàn)
-    if (g_ctx) { llama_free(g_ctx); g_ctx = nullptr; }
-    g_ctx = llama_init_from_model(g_model, g_cparams);
-    if (!g_ctx) {
-        LOGE("Failed to recreate context before infer");
-        return env->NewStringUTF("(failed to recreate context)");
+    void error(const char* msg) override {
+        if (!onError) return;
+        jstring jMsg = env->NewStringUTF(msg ? msg : "");
+        env->CallVoidMethod(callback, onError, jMsg);
+        env->DeleteLocalRef(jMsg);
     }
 
-    // 0) Build chat-formatted prompt
-    const char* cprompt = env->GetStringUTFChars(jPrompt, nullptr);
-    std::string user_prompt(cprompt ? cprompt : "");
-    env->ReleaseStringUTFChars(jPrompt, cprompt);
+    ~JniTokenCallback() override {
+        if (callback) env->DeleteGlobalRef(callback);
+    }
+};
+
+// Bọc LlamaBridge.StreamCallback + direct ByteBuffer: văn bản được ghi vào ring và
+// chỉ upcall onBytes(offset, length) theo lô (ngưỡng thời gian / số byte).
+struct JniRingSink : StreamSink {
+    JNIEnv*   env         = nullptr;
+    jobject   callback    = nullptr;
+    jmethodID onBytes     = nullptr;
+    jmethodID onCompleted = nullptr;
+    jmethodID onError     = nullptr;
+    jmethodID onPrefill   = nullptr;   // tuỳ chọn
+    jmethodID onMetrics   = nullptr;   // tuỳ chọn
+    std::unique_ptr<ByteRing> ring;
+
+    bool bind(JNIEnv* e, jobject jCallback, jobject jRing, int flush_ms, int flush_bytes) {
+        env = e;
+        if (!jCallback) return false;
+        callback = env->NewGlobalRef(jCallback);
+        if (!callback) return false;
+
+        jclass cbClass = env->GetObjectClass(callback);
+        if (!cbClass) return false;
+        onBytes     = env->GetMethodID(cbClass, "onBytes", "(II)Z");
+        onCompleted = env->GetMethodID(cbClass, "onCompleted", "()V");
+        onError     = env->GetMethodID(cbClass, "onError", "(Ljava/lang/String;)V");
+        onPrefill   = optional_method(env, cbClass, "onPrefill", "(II)V");
+        onMetrics   = optional_method(env, cbClass, "onMetrics", "([D)V");
+        env->DeleteLocalRef(cbClass);
+        if (!onBytes || !onCompleted || !onError) {
+            error("Callback methods missing");
+            return false;
+        }
 
-    const char* kSystem = "You are a helpful AI assistant.";
-    const std::string prompt_templ = apply_chat_template(g_model, user_prompt, kSystem);
-
-    // 1) Tokenize (add_special=false vì template đã có special; parse_special=true để nhận diện token đặc biệt)
-    std::vector<llama_token> ptok(prompt_templ.size() + 8);
-    int n_inp = llama_tokenize(
-            g_vocab,
-            prompt_templ.c_str(), (int)prompt_templ.size(),
-            ptok.data(), (int)ptok.size(),
-            /*add_special*/ false,
-            /*parse_special*/ true
-    );
-    if (n_inp < 0) n_inp = 0;
-    ptok.resize(n_inp);
-    if (ptok.empty()) return env->NewStringUTF("");
-
-    // 1b) Clamp to ctx with keep-prefix
-    const int n_ctx_total = (int)llama_n_ctx(g_ctx);
-    const int reserve     = std::max<int>(std::max(32, (int)maxTokens), 64);
-    const int n_keep_prefix = std::min<int>(256, (int)ptok.size()); // giữ phần system/header
-    clamp_with_keep(ptok, n_ctx_total, reserve, n_keep_prefix);
-
-    // 2) Prefill
-    llama_batch batch = llama_batch_init((int32_t)ptok.size(), /*embd*/0, /*n_seq_max*/1);
-    for (int i = 0; i < (int)ptok.size(); ++i) {
-        batch.token[i]     = ptok[i];
-        batch.pos[i]       = i;
-        batch.n_seq_id[i]  = 1;
-        batch.seq_id[i][0] = 0;
-        batch.logits[i]    = (i == (int)ptok.size() - 1);
-    }
-    batch.n_tokens = (int32_t)ptok.size();
-
-    if (llama_decode(g_ctx, batch) != 0) {
-        LOGE("decode prefill failed (n_inp=%d, n_ctx=%d, reserve=%d)",
-             (int)ptok.size(), n_ctx_total, reserve);
-        llama_batch_free(batch);
-        return env->NewStringUTF("(decode prefill failed)");
-    }
-
-    // 3) (Re)build sampler theo tham số runtime
-    if (g_smpl) { llama_sampler_free(g_smpl); g_smpl = nullptr; }
-    g_smpl = make_sampler(topP, temp);
-
-    // 4) Generate
-    std::vector<llama_token> out; out.reserve((size_t)std::max(0, (int)maxTokens));
-    int n_past = (int)ptok.size();
-    int i_last = batch.n_tokens - 1;
-
-    for (int step = 0; step < (int)maxTokens; ++step) {
-        const llama_token tok = llama_sampler_sample(g_smpl, g_ctx, i_last);
-
-        if (llama_vocab_is_eog(g_vocab, tok)) break; // EOS/EOT/…
-
-        out.push_back(tok);
-        llama_sampler_accept(g_smpl, tok); // cập nhật penalties/grammar nếu có
-
-        llama_batch stepb = llama_batch_init(1, 0, 1);
-        stepb.token[0]     = tok;
-        stepb.pos[0]       = n_past;
-        stepb.n_seq_id[0]  = 1;
-        stepb.seq_id[0][0] = 0;
-        stepb.logits[0]    = true;
-        stepb.n_tokens     = 1;
-
-        if (llama_decode(g_ctx, stepb) != 0) {
-            LOGE("decode step failed at %d (n_past=%d)", step, n_past);
-            llama_batch_free(stepb);
-            break;
+        auto* base = jRing ? (uint8_t*)env->GetDirectBufferAddress(jRing) : nullptr;
+        const jlong cap = jRing ? env->GetDirectBufferCapacity(jRing) : 0;
+        if (!base || cap < 64) {
+            error("Ring phải là direct ByteBuffer >= 64 byte");
+            return false;
         }
-        llama_batch_free(stepb);
+        ring = std::make_unique<ByteRing>(base, (size_t)cap, flush_ms, (size_t)std::max(1, flush_bytes),
+                                          [this](size_t offset, size_t len) {
+            const jboolean go = env->CallBooleanMethod(callback, onBytes, (jint)offset, (jint)len);
+            if (env->ExceptionCheck()) {
+                env->ExceptionClear();
+                return false;
+            }
+            return go == JNI_TRUE;
+        });
+        return true;
+    }
+
+    bool write(const char* s, size_t n) override { return ring->write(s, n); }
+    bool flush() override { return ring->flush(); }
+    bool progress(int done, int total) override {
+        return call_prefill(env, callback, onPrefill, done, total);
+    }
 
-        n_past += 1;
-        i_last  = 0;
+    void metrics(const double* values, size_t n) override {
+        call_metrics(env, callback, onMetrics, values, n);
     }
 
-    llama_batch_free(batch);
+    void completed() override {
+        if (ring) LOGI("ring stream: %llu bytes in %llu upcalls",
+                       (unsigned long long)ring->bytes_total(), (unsigned long long)ring->batches());
+        env->CallVoidMethod(callback, onCompleted);
+    }
 
-    const std::string text = detok(out);
-    return env->NewStringUTF(text.c_str());
-}
+    void error(const char* msg) override {
+        if (!onError) return;
+        jstring jMsg = env->NewStringUTF(msg ? msg : "");
+        env->CallVoidMethod(callback, onError, jMsg);
+        env->DeleteLocalRef(jMsg);
+    }
+
+    ~JniRingSink() override {
+        if (callback) env->DeleteGlobalRef(callback);
+    }
+};
 
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_example_ragapp_LlamaBridge_inferStreaming(
         JNIEnv* env, jclass /*clazz*/,
         jstring jPrompt, jint maxTokens, jfloat temp, jfloat topP, jobject jCallback) {
 
-    if (!g_model || !g_vocab || !g_inited || jCallback == nullptr) {
+    if (!g_engine.is_loaded() || !g_inited || jCallback == nullptr) {
         return JNI_FALSE;
     }
 
-    g_cancel_requested.store(false);
+    JniTokenCallback cb;
+    if (!cb.bind(env, jCallback)) {
+        return JNI_FALSE;
+    }
+
+    const char* cprompt = env->GetStringUTFChars(jPrompt, nullptr);
+    std::string user_prompt(cprompt ? cprompt : "");
+    env->ReleaseStringUTFChars(jPrompt, cprompt);
 
-    jobject callback = env->NewGlobalRef(jCallback);
-    if (!callback) {
+    RequestMetrics metrics;
+    GenRequest req = default_turn_request(user_prompt, (int)maxTokens, temp, topP, metrics);
+    if (req.prompt.empty()) {
+        cb.error("Prompt trống");
         return JNI_FALSE;
     }
+    req.seq = kChatSeq;
 
-    jclass cbClass = env->GetObjectClass(callback);
-    if (!cbClass) {
-        env->DeleteGlobalRef(callback);
+    auto lease = g_engine.lease(kChatSeq);
+    auto job   = g_engine.submit(std::move(req));
+    if (!job) {
+        cb.error("decode prefill thất bại");
+        return JNI_FALSE;
+    }
+    const bool ok = pump_job(*job, cb);
+    report_metrics(metrics, *job, cb, /*interactive*/ true);
+    if (!ok) {
+        cb.error("Suy luận bị gián đoạn");
         return JNI_FALSE;
     }
 
-    jmethodID onToken     = env->GetMethodID(cbClass, "onToken", "(Ljava/lang/String;)V");
-    jmethodID onCompleted = env->GetMethodID(cbClass, "onCompleted", "()V");
-    jmethodID onError     = env->GetMethodID(cbClass, "onError", "(Ljava/lang/String;)V");
+    if (!job->cancelled()) {
+        cb.completed();
+    }
+    return JNI_TRUE;
+}
 
-    auto sendError = [&](const char* msg) {
-        if (!onError) return;
-        jstring jMsg = env->NewStringUTF(msg ? msg : "");
-        env->CallVoidMethod(callback, onError, jMsg);
-        env->DeleteLocalRef(jMsg);
-    };
+// --------- Conversations ---------
+//
+// Một Conversation giữ danh sách message và chuỗi token tương ứng (đúng như đã
+// nằm trong KV khi nó là hội thoại đang hoạt động). Mỗi lượt mới chỉ render
+// phần chênh lệch của template và prefill phần đó; token assistant vừa sinh
+// được giữ nguyên trong KV nên lượt sau không phải prefill lại.
+
+struct Conversation {
+    std::string              system;
+    std::vector<std::string> roles;
+    std::vector<std::string> contents;
+
+    std::vector<llama_token> tokens;    // token của transcript đã nằm trong KV
+    std::string              rendered;  // văn bản tương ứng với tokens
+    std::string              session;   // tên snapshot trên đĩa; rỗng = không lưu
+
+    std::vector<llama_chat_message> messages(size_t first_turn = 0) const {
+        std::vector<llama_chat_message> msgs;
+        if (!system.empty()) msgs.push_back({ "system", system.c_str() });
+        for (size_t i = first_turn; i < roles.size(); ++i) {
+            msgs.push_back({ roles[i].c_str(), contents[i].c_str() });
+        }
+        return msgs;
+    }
+
+    void clear() {
+        roles.clear();
+        contents.clear();
+        tokens.clear();
+        rendered.clear();
+    }
+};
+
+static std::mutex g_conv_mutex;
+static std::unordered_map<jlong, std::shared_ptr<Conversation>> g_convs;
+static jlong g_next_conv_id = 1;
+
+static std::shared_ptr<Conversation> find_conversation(jlong handle) {
+    std::lock_guard<std::mutex> lock(g_conv_mutex);
+    auto it = g_convs.find(handle);
+    return it == g_convs.end() ? nullptr : it->second;
+}
+
+static std::string render_conversation(const Conversation& conv, size_t first_turn) {
+    const auto msgs = conv.messages(first_turn);
+    std::string out = render_chat(g_engine.model(), msgs, /*add_ass*/ true);
+    return out.empty() ? render_plain(msgs, /*add_ass*/ true) : out;
+}
 
-    auto cleanup = [&]() {
-        if (cbClass) {
-            env->DeleteLocalRef(cbClass);
-            cbClass = nullptr;
+// Dựng token cho lượt mới (user message đã được thêm vào conv).
+// Đường nhanh: template mới là phần mở rộng của văn bản đã render -> chỉ tokenize
+// phần đuôi. Nếu không (template viết lại lịch sử, hoặc vượt n_ctx) thì render lại
+// toàn bộ, bỏ dần các lượt cũ nhất cho tới khi vừa context.
+static void conversation_prepare_turn(Conversation& conv, int n_ctx_total, int reserve, int n_keep,
+                                      PromptTiming& timing) {
+    const std::string full = timed_ms(timing.template_ms, [&] { return render_conversation(conv, 0); });
+
+    if (!conv.tokens.empty() && full.size() > conv.rendered.size() &&
+        full.compare(0, conv.rendered.size(), conv.rendered) == 0) {
+        const std::vector<llama_token> delta = timed_ms(timing.tokenize_ms, [&] {
+            return tokenize_templated(g_engine.vocab(), full.substr(conv.rendered.size()));
+        });
+        if ((int)(conv.tokens.size() + delta.size()) + reserve <= n_ctx_total) {
+            conv.tokens.insert(conv.tokens.end(), delta.begin(), delta.end());
+            conv.rendered = full;
+            return;
         }
-        env->DeleteGlobalRef(callback);
-    };
+    }
+
+    // Giữ lượt user mới nhất; bỏ từng cặp lượt cũ nhất khi vượt context
+    size_t first_turn = 0;
+    std::string text = full;
+    std::vector<llama_token> toks = timed_ms(timing.tokenize_ms, [&] { return tokenize_templated(g_engine.vocab(), text); });
+    while ((int)toks.size() + reserve > n_ctx_total && first_turn + 2 < conv.roles.size()) {
+        first_turn += 2;
+        text = timed_ms(timing.template_ms, [&] { return render_conversation(conv, first_turn); });
+        toks = timed_ms(timing.tokenize_ms, [&] { return tokenize_templated(g_engine.vocab(), text); });
+    }
+    if (first_turn > 0) {
+        conv.roles.erase(conv.roles.begin(), conv.roles.begin() + (long)first_turn);
+        conv.contents.erase(conv.contents.begin(), conv.contents.begin() + (long)first_turn);
+        LOGI("conversation: dropped %zu oldest messages to fit n_ctx=%d", first_turn, n_ctx_total);
+    }
+    clamp_with_keep(toks, n_ctx_total, reserve, n_keep);
+
+    conv.tokens.swap(toks);
+    conv.rendered.swap(text);
+}
+
+// Snapshot chỉ hợp lệ với đúng model và cấu hình KV đã tạo ra nó; blob của context nhiều stream
+// ghi số stream (= n_seq) nên số slot cũng thuộc khoá
+static std::string snapshot_key() {
+    const llama_context_params& cp = g_engine.cparams();
+    char buf[128];
+    snprintf(buf, sizeof(buf), "|n_ctx=%d|n_seq=%d|type_k=%d|type_v=%d|fa=%d",
+             g_engine.n_ctx_seq(), (int)cp.n_seq_max, (int)cp.type_k, (int)cp.type_v, (int)cp.flash_attn_type);
+    return g_model_sha256 + buf;
+}
+
+static bool snapshots_enabled(const Conversation& conv) {
+    return !conv.session.empty() && g_snapshots.is_open() && !g_model_sha256.empty();
+}
+
+// Nếu slot chat không còn chứa hội thoại này (app vừa khởi động lại, đổi preset, infer vừa chạy)
+// thì nạp thẳng KV từ snapshot thay cho prefill lại toàn bộ transcript. Gọi khi giữ lease kChatSeq.
+static void conversation_restore_kv(const Conversation& conv) {
+    if (!snapshots_enabled(conv) || conv.tokens.empty()) return;
+    bool resident = false;
+    g_engine.with_slot(kChatSeq, [&](llama_context*, std::vector<llama_token>& kv) {
+        resident = kv.size() >= conv.tokens.size() &&
+                   std::equal(conv.tokens.begin(), conv.tokens.end(), kv.begin());
+    });
+    if (resident) return;
+
+    // đọc file ngoài with_slot để không chặn scheduler
+    KvSnapshotStore::Loaded snap;
+    if (!g_snapshots.load(conv.session, snapshot_key(), &snap, /*with_state*/ true)) return;
+    if (snap.meta.tokens.size() != conv.tokens.size() ||
+        !std::equal(conv.tokens.begin(), conv.tokens.end(), snap.meta.tokens.begin())) {
+        return;
+    }
 
-    if (!onToken || !onCompleted || !onError) {
-        sendError("Callback methods missing");
-        cleanup();
+    g_engine.with_slot(kChatSeq, [&](llama_context* ctx, std::vector<llama_token>& kv) {
+        kv.clear();
+        if (!seq_state_load(ctx, kChatSeq, snap.state, snap.state_size, 0, conv.tokens.size())) {
+            LOGE("conversation: snapshot %s could not be restored, falling back to prefill", conv.session.c_str());
+            return;
+        }
+        kv = conv.tokens;
+        LOGI("conversation: restored %zu tokens of KV from snapshot %s", kv.size(), conv.session.c_str());
+    });
+}
+
+// Chụp KV của slot chat (đồng bộ, chỉ copy bộ nhớ) rồi giao cho thread ghi của g_snapshots
+static void conversation_snapshot_async(const Conversation& conv) {
+    if (!snapshots_enabled(conv) || conv.tokens.empty()) return;
+
+    KvSnapshot snap;
+    bool ok = false;
+    g_engine.with_slot(kChatSeq, [&](llama_context* ctx, std::vector<llama_token>& kv) {
+        if (kv != conv.tokens) return;
+        snap.state.resize(llama_state_seq_get_size_ext(ctx, kChatSeq, /*flags*/ 0));
+        ok = !snap.state.empty() &&
+             llama_state_seq_get_data_ext(ctx, snap.state.data(), snap.state.size(), kChatSeq, /*flags*/ 0) != 0;
+    });
+    if (!ok) return;
+    snap.key      = snapshot_key();
+    snap.system   = conv.system;
+    snap.roles    = conv.roles;
+    snap.contents = conv.contents;
+    snap.tokens.assign(conv.tokens.begin(), conv.tokens.end());
+    snap.rendered = conv.rendered;
+    g_snapshots.save_async(conv.session, std::move(snap));
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_configureSnapshots(
+        JNIEnv* env, jclass /*clazz*/, jstring jDir, jstring jModelSha256, jlong budgetBytes) {
+    const char* cdir = env->GetStringUTFChars(jDir, nullptr);
+    const char* csha = env->GetStringUTFChars(jModelSha256, nullptr);
+    const std::string dir = cdir ? cdir : "";
+    g_model_sha256 = csha ? csha : "";
+    env->ReleaseStringUTFChars(jDir, cdir);
+    env->ReleaseStringUTFChars(jModelSha256, csha);
+    return g_snapshots.open(dir, (uint64_t)std::max<jlong>(0, budgetBytes)) ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_configureChunkCache(
+        JNIEnv* env, jclass /*clazz*/, jstring jDir, jstring jModelSha256, jlong memBudgetBytes,
+        jlong diskBudgetBytes, jint minUses) {
+    const char* cdir = env->GetStringUTFChars(jDir, nullptr);
+    const char* csha = env->GetStringUTFChars(jModelSha256, nullptr);
+    const std::string dir = cdir ? cdir : "";
+    const std::string sha = csha ? csha : "";
+    env->ReleaseStringUTFChars(jDir, cdir);
+    env->ReleaseStringUTFChars(jModelSha256, csha);
+    if (!g_chunks.open(dir, sha, (uint64_t)std::max<jlong>(0, memBudgetBytes),
+                       (uint64_t)std::max<jlong>(0, diskBudgetBytes), (int)minUses)) {
         return JNI_FALSE;
     }
+    std::lock_guard<std::mutex> lock(g_init_mutex);
+    if (g_engine.is_loaded()) {
+        g_engine.set_context_budget(pool_budget());
+        g_chunks.prepare(g_engine);
+    }
+    return JNI_TRUE;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_ragapp_LlamaBridge_createConversation(
+        JNIEnv* env, jclass /*clazz*/, jstring jSystemPrompt) {
+    auto conv = std::make_shared<Conversation>();
+    if (jSystemPrompt) {
+        const char* csys = env->GetStringUTFChars(jSystemPrompt, nullptr);
+        conv->system = csys ? csys : "";
+        env->ReleaseStringUTFChars(jSystemPrompt, csys);
+    } else {
+        conv->system = kSystemPrompt;
+    }
+
+    std::lock_guard<std::mutex> lock(g_conv_mutex);
+    const jlong handle = g_next_conv_id++;
+    g_convs[handle] = std::move(conv);
+    return handle;
+}
+
+// Hội thoại gắn với snapshot tên session: nạp lại transcript (KV nạp lười ở lượt kế tiếp)
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_ragapp_LlamaBridge_openConversation(
+        JNIEnv* env, jclass /*clazz*/, jstring jSession, jstring jSystemPrompt) {
+    auto conv = std::make_shared<Conversation>();
+    const char* csession = env->GetStringUTFChars(jSession, nullptr);
+    conv->session = csession ? csession : "";
+    env->ReleaseStringUTFChars(jSession, csession);
+    if (jSystemPrompt) {
+        const char* csys = env->GetStringUTFChars(jSystemPrompt, nullptr);
+        conv->system = csys ? csys : "";
+        env->ReleaseStringUTFChars(jSystemPrompt, csys);
+    } else {
+        conv->system = kSystemPrompt;
+    }
+
+    KvSnapshotStore::Loaded snap;
+    if (g_engine.is_loaded() && snapshots_enabled(*conv) &&
+        g_snapshots.load(conv->session, snapshot_key(), &snap, /*with_state*/ false) &&
+        snap.meta.system == conv->system) {
+        conv->roles    = std::move(snap.meta.roles);
+        conv->contents = std::move(snap.meta.contents);
+        conv->tokens.assign(snap.meta.tokens.begin(), snap.meta.tokens.end());
+        conv->rendered = std::move(snap.meta.rendered);
+        LOGI("openConversation: %s resumed (%zu messages)", conv->session.c_str(), conv->roles.size());
+    }
+
+    std::lock_guard<std::mutex> lock(g_conv_mutex);
+    const jlong handle = g_next_conv_id++;
+    g_convs[handle] = std::move(conv);
+    return handle;
+}
+
+// [role0, content0, role1, content1, ...] để dựng lại giao diện sau khi khôi phục
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_example_ragapp_LlamaBridge_conversationMessages(
+        JNIEnv* env, jclass /*clazz*/, jlong handle) {
+    std::shared_ptr<Conversation> conv = find_conversation(handle);
+    jclass strClass = env->FindClass("java/lang/String");
+    if (!strClass) return nullptr;
+    const size_t n = conv ? std::min(conv->roles.size(), conv->contents.size()) : 0;
+    jobjectArray out = env->NewObjectArray((jsize)(n * 2), strClass, nullptr);
+    for (size_t i = 0; out && i < n; ++i) {
+        jstring jRole    = env->NewStringUTF(conv->roles[i].c_str());
+        jstring jContent = env->NewStringUTF(conv->contents[i].c_str());
+        env->SetObjectArrayElement(out, (jsize)(2 * i), jRole);
+        env->SetObjectArrayElement(out, (jsize)(2 * i + 1), jContent);
+        env->DeleteLocalRef(jRole);
+        env->DeleteLocalRef(jContent);
+    }
+    env->DeleteLocalRef(strClass);
+    return out;
+}
+
+// Một lượt hội thoại: thêm message user, prefill phần chênh lệch, sinh vào sink.
+// Giữ lease slot chat suốt lượt để KV từ lúc khôi phục tới lúc chụp snapshot không bị đổi.
+static bool conversation_turn(JNIEnv* env, jlong handle, jstring jMessage, int maxTokens,
+                              float temp, float topP, StreamSink& sink) {
+    std::shared_ptr<Conversation> conv = find_conversation(handle);
+    if (!conv) {
+        sink.error("Hội thoại không tồn tại");
+        return false;
+    }
+
+    const char* cmsg = env->GetStringUTFChars(jMessage, nullptr);
+    std::string user_msg(cmsg ? cmsg : "");
+    env->ReleaseStringUTFChars(jMessage, cmsg);
+    if (user_msg.empty()) {
+        sink.error("Prompt trống");
+        return false;
+    }
+
+    auto lease = g_engine.lease(kChatSeq);
+    conversation_restore_kv(*conv);
+    conv->roles.emplace_back("user");
+    conv->contents.push_back(std::move(user_msg));
+
+    const int n_ctx_total = g_engine.n_ctx_seq();
+    RequestMetrics metrics;
+    const int n_keep = timed_ms(metrics.prompt.template_ms, [&] {
+        return keep_prefix_len(g_engine.model(), conv->system.c_str(), (size_t)n_ctx_total);
+    });
+    conversation_prepare_turn(*conv, n_ctx_total, answer_reserve(maxTokens, n_ctx_total, g_ctx_shift), n_keep,
+                              metrics.prompt);
+    metrics.n_prompt = (int)conv->tokens.size();
+
+    GenRequest req;
+    req.prompt         = conv->tokens;
+    req.max_tokens     = maxTokens;
+    req.temp           = temp;
+    req.top_p          = topP;
+    req.seq            = kChatSeq;
+    req.speculative    = g_spec_enabled;
+    req.context_shift  = g_ctx_shift;
+    req.repeat_penalty = g_repeat_penalty;
+    req.repeat_last_n  = g_repeat_last_n;
+    req.n_keep         = n_keep;
+    auto job = g_engine.submit(std::move(req));
+    if (!job) {
+        conv->clear();
+        sink.error("decode prefill thất bại");
+        return false;
+    }
+
+    const bool ok = pump_job(*job, sink);
+    report_metrics(metrics, *job, sink, /*interactive*/ true);
+
+    // Ghi lại lượt assistant (kể cả khi bị huỷ giữa chừng) để lượt sau khớp KV: token cuối chưa
+    // vào KV (huỷ ngay sau khi sample) không được tính vào lịch sử dù đã giao cho sink
+    const std::vector<llama_token>& gen = job->generated();
+    const std::string answer = detok(g_engine.vocab(),
+                                     std::vector<llama_token>(gen.begin(), gen.end() - (long)job->n_uncommitted()));
+    conv->roles.emplace_back("assistant");
+    conv->contents.push_back(answer);
+    g_engine.with_slot(kChatSeq, [&](llama_context*, std::vector<llama_token>& kv) { conv->tokens = kv; });
+    conv->rendered += answer;
+    conversation_snapshot_async(*conv);
+
+    if (!ok) {
+        sink.error("Suy luận bị gián đoạn");
+        return false;
+    }
+    if (!job->cancelled()) {
+        sink.completed();
+    }
+    return true;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_conversationSend(
+        JNIEnv* env, jclass /*clazz*/,
+        jlong handle, jstring jMessage, jint maxTokens, jfloat temp, jfloat topP, jobject jCallback) {
 
-    if (g_ctx) {
-        llama_free(g_ctx);
-        g_ctx = nullptr;
+    if (!g_engine.is_loaded() || !g_inited || jCallback == nullptr) {
+        return JNI_FALSE;
     }
-    g_ctx = llama_init_from_model(g_model, g_cparams);
-    if (!g_ctx) {
-        sendError("Không thể tạo context");
-        cleanup();
+
+    JniTokenCallback cb;
+    if (!cb.bind(env, jCallback)) {
         return JNI_FALSE;
     }
+    return conversation_turn(env, handle, jMessage, (int)maxTokens, temp, topP, cb) ? JNI_TRUE : JNI_FALSE;
+}
 
-    const char* cprompt = env->GetStringUTFChars(jPrompt, nullptr);
-    std::string user_prompt(cprompt ? cprompt : "");
-    env->ReleaseStringUTFChars(jPrompt, cprompt);
+// Như conversationSend nhưng văn bản đi qua ring ByteBuffer, upcall theo lô
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_conversationSendStream(
+        JNIEnv* env, jclass /*clazz*/,
+        jlong handle, jstring jMessage, jint maxTokens, jfloat temp, jfloat topP,
+        jobject jRing, jint flushMs, jint flushBytes, jobject jCallback) {
 
-    const char* kSystem = "You are a helpful AI assistant.";
-    const std::string prompt_templ = apply_chat_template(g_model, user_prompt, kSystem);
-
-    std::vector<llama_token> ptok(prompt_templ.size() + 8);
-    int n_inp = llama_tokenize(
-            g_vocab,
-            prompt_templ.c_str(), (int)prompt_templ.size(),
-            ptok.data(), (int)ptok.size(),
-            /*add_special*/ false,
-            /*parse_special*/ true
-    );
-    if (n_inp < 0) n_inp = 0;
-    ptok.resize(n_inp);
-    if (ptok.empty()) {
-        sendError("Prompt trống");
-        cleanup();
+    if (!g_engine.is_loaded() || !g_inited || jCallback == nullptr) {
         return JNI_FALSE;
     }
 
-    const int n_ctx_total = (int)llama_n_ctx(g_ctx);
-    const int reserve     = std::max<int>(std::max(32, (int)maxTokens), 64);
-    const int n_keep_prefix = std::min<int>(256, (int)ptok.size());
-    clamp_with_keep(ptok, n_ctx_total, reserve, n_keep_prefix);
+    JniRingSink sink;
+    if (!sink.bind(env, jCallback, jRing, (int)flushMs, (int)flushBytes)) {
+        return JNI_FALSE;
+    }
+    return conversation_turn(env, handle, jMessage, (int)maxTokens, temp, topP, sink) ? JNI_TRUE : JNI_FALSE;
+}
 
-    llama_batch batch = llama_batch_init((int32_t)ptok.size(), /*embd*/0, /*n_seq_max*/1);
-    for (int i = 0; i < (int)ptok.size(); ++i) {
-        batch.token[i]     = ptok[i];
-        batch.pos[i]       = i;
-        batch.n_seq_id[i]  = 1;
-        batch.seq_id[i][0] = 0;
-        batch.logits[i]    = (i == (int)ptok.size() - 1);
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_resetConversation(
+        JNIEnv*, jclass /*clazz*/, jlong handle) {
+    if (auto conv = find_conversation(handle)) {
+        conv->clear();
+        if (!conv->session.empty()) g_snapshots.remove(conv->session);
     }
-    batch.n_tokens = (int32_t)ptok.size();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_releaseConversation(
+        JNIEnv*, jclass /*clazz*/, jlong handle) {
+    std::lock_guard<std::mutex> lock(g_conv_mutex);
+    g_convs.erase(handle);
+}
+
+// --------- JNI: requests song song ---------
 
-    if (llama_decode(g_ctx, batch) != 0) {
-        llama_batch_free(batch);
-        sendError("decode prefill thất bại");
-        cleanup();
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_ragapp_LlamaBridge_newRequestId(
+        JNIEnv*, jclass /*clazz*/) {
+    std::lock_guard<std::mutex> lock(g_req_mutex);
+    const jlong id = g_next_req_id++;
+    g_requests[id] = {};
+    return id;
+}
+
+// Phần chung của generate / generateRag: submit, đăng ký requestId để huỷ, chuyển kết quả sang cb
+static jboolean run_request(jlong requestId, GenRequest req, RequestMetrics& metrics, bool background,
+                            JniTokenCallback& cb) {
+    if (req.prompt.empty()) {
+        cb.error("Prompt trống");
         return JNI_FALSE;
     }
+    req.priority = background ? GenPriority::Background : GenPriority::Interactive;
 
-    if (g_smpl) {
-        llama_sampler_free(g_smpl);
-        g_smpl = nullptr;
+    auto job = g_engine.submit(std::move(req));
+    if (!job) {
+        cb.error("decode prefill thất bại");
+        return JNI_FALSE;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_req_mutex);
+        PendingRequest& pr = g_requests[requestId];
+        if (pr.cancelled) job->cancel();
+        pr.job = job;
     }
-    g_smpl = make_sampler(topP, temp);
 
-    int n_past = (int)ptok.size();
-    int i_last = batch.n_tokens - 1;
-    bool had_error = false;
+    const bool ok = pump_job(*job, cb);
+    {
+        std::lock_guard<std::mutex> lock(g_req_mutex);
+        g_requests.erase(requestId);
+    }
+    report_metrics(metrics, *job, cb, /*interactive*/ !background);
+    if (!ok) {
+        cb.error(job->error().empty() ? "Suy luận bị gián đoạn" : job->error().c_str());
+        return JNI_FALSE;
+    }
+    if (!job->cancelled()) {
+        cb.completed();
+    }
+    return JNI_TRUE;
+}
 
-    for (int step = 0; step < (int)maxTokens && !g_cancel_requested.load(); ++step) {
-        const llama_token tok = llama_sampler_sample(g_smpl, g_ctx, i_last);
+// Một request độc lập (không gắn hội thoại) trên slot engine tự chọn; chặn thread gọi tới khi
+// xong, callback chạy trên thread gọi. Nhiều thread gọi cùng lúc được gom chung batch.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_generate(
+        JNIEnv* env, jclass /*clazz*/,
+        jlong requestId, jstring jPrompt, jint maxTokens, jfloat temp, jfloat topP,
+        jboolean background, jobject jCallback) {
 
-        if (llama_vocab_is_eog(g_vocab, tok)) break;
+    if (!g_engine.is_loaded() || !g_inited || jCallback == nullptr) {
+        return JNI_FALSE;
+    }
 
-        llama_sampler_accept(g_smpl, tok);
+    JniTokenCallback cb;
+    if (!cb.bind(env, jCallback)) {
+        return JNI_FALSE;
+    }
 
-        const std::string piece = token_to_piece(tok);
-        jstring jPiece = env->NewStringUTF(piece.c_str());
-        env->CallVoidMethod(callback, onToken, jPiece);
-        env->DeleteLocalRef(jPiece);
-        if (env->ExceptionCheck()) {
-            env->ExceptionClear();
-            had_error = true;
-            break;
-        }
+    const char* cprompt = env->GetStringUTFChars(jPrompt, nullptr);
+    std::string user_prompt(cprompt ? cprompt : "");
+    env->ReleaseStringUTFChars(jPrompt, cprompt);
 
-        llama_batch stepb = llama_batch_init(1, 0, 1);
-        stepb.token[0]     = tok;
-        stepb.pos[0]       = n_past;
-        stepb.n_seq_id[0]  = 1;
-        stepb.seq_id[0][0] = 0;
-        stepb.logits[0]    = true;
-        stepb.n_tokens     = 1;
-
-        if (llama_decode(g_ctx, stepb) != 0) {
-            llama_batch_free(stepb);
-            had_error = true;
-            break;
-        }
-        llama_batch_free(stepb);
+    RequestMetrics metrics;
+    GenRequest req = default_turn_request(user_prompt, (int)maxTokens, temp, topP, metrics);
+    return run_request(requestId, std::move(req), metrics, background, cb);
+}
 
-        n_past += 1;
-        i_last  = 0;
+static std::vector<std::string> java_strings(JNIEnv* env, jobjectArray arr) {
+    std::vector<std::string> out;
+    if (!arr) return out;
+    const jsize n = env->GetArrayLength(arr);
+    out.reserve((size_t)n);
+    for (jsize i = 0; i < n; ++i) {
+        auto js = (jstring)env->GetObjectArrayElement(arr, i);
+        const char* c = js ? env->GetStringUTFChars(js, nullptr) : nullptr;
+        out.emplace_back(c ? c : "");
+        if (c) env->ReleaseStringUTFChars(js, c);
+        env->DeleteLocalRef(js);
     }
+    return out;
+}
 
-    llama_batch_free(batch);
+// Như generate cho prompt RAG: system prompt | các đoạn | câu hỏi. Prefix + chuỗi đoạn đầu đã có
+// KV dựng sẵn được nạp thay cho prefill; đoạn được truy hồi đủ lượt thì dựng KV bằng request nền.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_generateRag(
+        JNIEnv* env, jclass /*clazz*/,
+        jlong requestId, jobjectArray jPassages, jstring jQuestion, jint maxTokens, jfloat temp, jfloat topP,
+        jboolean background, jobject jCallback) {
 
-    if (had_error) {
-        sendError("Suy luận bị gián đoạn");
-        cleanup();
+    if (!g_engine.is_loaded() || !g_inited || jCallback == nullptr) {
         return JNI_FALSE;
     }
 
-    if (!g_cancel_requested.load()) {
-        env->CallVoidMethod(callback, onCompleted);
+    JniTokenCallback cb;
+    if (!cb.bind(env, jCallback)) {
+        return JNI_FALSE;
     }
 
-    cleanup();
-    return JNI_TRUE;
+    const std::vector<std::string> passages = java_strings(env, jPassages);
+    const char* cq = env->GetStringUTFChars(jQuestion, nullptr);
+    const std::string question(cq ? cq : "");
+    env->ReleaseStringUTFChars(jQuestion, cq);
+
+    RequestMetrics metrics;
+    const int n_ctx_total = g_engine.n_ctx_seq();
+    const RagPrompt rp = rag_prompt(g_engine.model(), kSystemPrompt, passages, question, n_ctx_total,
+                                    answer_reserve((int)maxTokens, n_ctx_total, g_ctx_shift), &metrics.prompt);
+    GenRequest req;
+    req.prompt        = rp.tokens;
+    req.max_tokens    = (int)maxTokens;
+    req.temp          = temp;
+    req.top_p         = topP;
+    req.context_shift = g_ctx_shift;
+    req.n_keep        = (int)rp.n_prefix;
+    apply_turn_defaults(req, metrics);
+
+    if (g_chunks.is_open() && !req.prompt.empty()) {
+        // KV của prefix là chính xác; các đoạn được tính riêng (không thấy đoạn trước)
+        ChunkKvCache::Assembled kv;
+        if (g_chunks.assemble(g_engine, rp, &kv)) {
+            req.state         = kv.state;
+            req.n_state       = kv.n_tokens;
+            req.n_state_exact = rp.n_prefix;
+            req.state_id      = kv.id;
+        }
+        for (size_t i : g_chunks.note_uses(g_engine, rp)) {
+            g_engine.submit(g_chunks.build_request(g_engine, rp, i));
+        }
+    }
+    return run_request(requestId, std::move(req), metrics, background, cb);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_cancelRequest(
+        JNIEnv*, jclass /*clazz*/, jlong requestId) {
+    std::lock_guard<std::mutex> lock(g_req_mutex);
+    auto it = g_requests.find(requestId);
+    if (it == g_requests.end()) return;
+    it->second.cancelled = true;
+    if (it->second.job) it->second.job->cancel();
+}
+
+// [tokens sinh ra, giây bận, tok/s tổng, số lần decode] cộng dồn của engine từ lúc init
+extern "C" JNIEXPORT jfloatArray JNICALL
+Java_com_example_ragapp_LlamaBridge_engineStats(
+        JNIEnv* env, jclass /*clazz*/) {
+    const GenStats st = g_engine.totals();
+    const jfloat v[4] = {
+        (jfloat)st.tokens,
+        (jfloat)st.seconds,
+        (jfloat)(st.seconds > 0 ? st.tokens / st.seconds : 0.0),
+        (jfloat)st.decode_calls,
+    };
+    jfloatArray arr = env->NewFloatArray(4);
+    if (arr) env->SetFloatArrayRegion(arr, 0, 4, v);
+    return arr;
 }
 
 // --------- JNI: release ---------
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_ragapp_LlamaBridge_release(
         JNIEnv*, jclass /*clazz*/) {
-    if (g_smpl)  { llama_sampler_free(g_smpl);  g_smpl  = nullptr; }
-    if (g_ctx)   { llama_free(g_ctx);           g_ctx   = nullptr; }
-    if (g_model) { llama_model_free(g_model);   g_model = nullptr; }
-    g_vocab = nullptr;
+    g_snapshots.flush();
+    g_chunks.flush();
+    std::lock_guard<std::mutex> lock(g_init_mutex);
+    g_chunks.detach();
+    g_engine.unload();
 
     if (g_inited) {
         llama_backend_free();
         g_inited = false;
     }
-    g_cancel_requested.store(false);
 }
 
+// Huỷ các request interactive (chat); việc nền vẫn chạy tiếp
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_ragapp_LlamaBridge_cancel(
         JNIEnv*, jclass /*clazz*/) {
-    g_cancel_requested.store(true);
-    if (g_smpl) {
-        llama_sampler_reset(g_smpl);
+    g_engine.cancel_all(GenPriority::Interactive);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_setSpeculative(
+        JNIEnv*, jclass /*clazz*/, jboolean enabled, jint maxDraft) {
+    g_spec_enabled   = enabled == JNI_TRUE;
+    g_spec_max_draft = std::max(1, std::min((int)maxDraft, InferenceEngine::kSpecDraftCap));
+    g_engine.set_speculative(g_spec_enabled ? g_spec_max_draft : 0);
+}
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_setContextShift(
+        JNIEnv*, jclass /*clazz*/, jboolean enabled) {
+    g_ctx_shift = enabled == JNI_TRUE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_setRepeatPenalty(
+        JNIEnv*, jclass /*clazz*/, jfloat penalty, jint lastN) {
+    g_repeat_penalty = penalty > 0.f ? (float)penalty : 1.f;
+    g_repeat_last_n  = std::max(0, std::min((int)lastN, 4096));
+}
+
+// --------- JNI: luồng CPU ---------
+
+// [luồng decode, luồng prefill, số CPU, số lõi lớn]; hai số đầu là của engine đang chạy,
+// hoặc cấu hình mặc định nếu chưa init
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_example_ragapp_LlamaBridge_threadConfig(
+        JNIEnv* env, jclass /*clazz*/) {
+    const std::vector<CpuInfo> cpus = cpu_topology();
+    ThreadConfig cur = g_threads.n_decode > 0 ? g_threads : default_thread_config(cpus);
+    if (g_engine.is_loaded()) cur = { g_engine.n_threads_decode(), g_engine.n_threads_prefill() };
+    const jint v[4] = { cur.n_decode, cur.n_prefill, (jint)cpus.size(), big_core_count(cpus) };
+    jintArray arr = env->NewIntArray(4);
+    if (arr) env->SetIntArrayRegion(arr, 0, 4, v);
+    return arr;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_setThreads(
+        JNIEnv*, jclass /*clazz*/, jint nDecode, jint nPrefill) {
+    if (nDecode <= 0 || nPrefill <= 0) return JNI_FALSE;
+    g_threads = { (int)nDecode, (int)nPrefill };
+    if (g_engine.is_loaded()) g_engine.set_threads((int)nDecode, (int)nPrefill);
+    return JNI_TRUE;
+}
+
+// Micro-benchmark các cấu hình luồng trên model đang load (chạy nền trên slot cuối, chat vẫn
+// được ưu tiên), áp dụng cấu hình tốt nhất. Trả về [decode, prefill]; mảng rỗng nếu không đo được.
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_example_ragapp_LlamaBridge_autotuneThreads(
+        JNIEnv* env, jclass /*clazz*/) {
+    jintArray empty = env->NewIntArray(0);
+    if (!g_engine.is_loaded() || !g_inited) return empty;
+
+    // probe ~256 token kiểu passage RAG; decode 32 token
+    std::string text;
+    while (text.size() < 1200) {
+        text += "Tài liệu được chia thành các đoạn, nhúng vector và lưu trong chỉ mục cục bộ. "
+                "Documents are chunked, embedded and stored in a local vector index. ";
+    }
+    std::vector<llama_token> probe = tokenize_templated(g_engine.vocab(), text);
+    if ((int)probe.size() > std::min(256, g_engine.n_ctx_seq() / 2)) {
+        probe.resize((size_t)std::min(256, g_engine.n_ctx_seq() / 2));
+    }
+
+    const ThreadTuneResult res = autotune_threads(g_engine, g_engine.n_seq() - 1, probe, /*n_decode*/ 32,
+                                                  thread_candidates(cpu_topology()));
+    if (!res.ok) return empty;
+    g_threads = res.best;
+    const jint v[2] = { res.best.n_decode, res.best.n_prefill };
+    jintArray arr = env->NewIntArray(2);
+    if (arr) env->SetIntArrayRegion(arr, 0, 2, v);
+    return arr;
+}
+
+// --------- JNI: context pool ---------
+
+// Trần bộ nhớ KV cho context đang dùng + các context dựng sẵn / đã dùng của model hiện tại
+// (context phụ của cache KV đoạn, nếu mở, được trừ ra)
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_setContextBudget(
+        JNIEnv*, jclass /*clazz*/, jlong bytes) {
+    std::lock_guard<std::mutex> lock(g_init_mutex);
+    g_ctx_budget = (size_t)std::max<jlong>(0, bytes);
+    g_engine.set_context_budget(pool_budget());
+}
+
+// Dựng sẵn context nCtx (cùng số slot / luồng / kiểu KV với engine) để init cùng model với nCtx
+// chỉ đổi context. false nếu chưa init hoặc vượt budget.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_prepareContext(
+        JNIEnv*, jclass /*clazz*/, jint nCtx) {
+    std::lock_guard<std::mutex> lock(g_init_mutex);
+    if (!g_engine.is_loaded()) return JNI_FALSE;
+    InferenceEngine::Params p = g_engine.params();
+    p.n_ctx_seq = (int)nCtx;
+    p.type_k    = g_type_k;
+    p.type_v    = g_type_v;
+    plan_params(p, /*record*/ false);
+    return g_engine.prepare_context(p) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Kiểu KV cache (giá trị ggml_type: 1 = F16, 8 = Q8_0...) cho các lần init / prepareContext sau
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_setKvCacheType(
+        JNIEnv*, jclass /*clazz*/, jint typeK, jint typeV) {
+    g_type_k = (ggml_type)typeK;
+    g_type_v = (ggml_type)typeV;
+}
+
+// --------- JNI: bộ nhớ ---------
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_setMemoryBudget(
+        JNIEnv*, jclass /*clazz*/, jlong bytes) {
+    g_mem_budget = (int64_t)bytes;
+}
+
+// Báo cáo của planner ở lần init gần nhất (bộ nhớ, các bước đã thử, cấu hình chọn)
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_ragapp_LlamaBridge_memoryPlan(
+        JNIEnv* env, jclass /*clazz*/) {
+    std::lock_guard<std::mutex> lock(g_mem_plan_mutex);
+    return env->NewStringUTF(g_mem_plan.c_str());
+}
+
+// Mức của ComponentCallbacks2.onTrimMemory
+static constexpr int kTrimRunningCritical = 15;
+static constexpr int kTrimModerate        = 60;
+
+// Phản ứng với onTrimMemory: mọi mức giải phóng context giữ sẵn, KV đoạn giữ trong RAM và ghi xong
+// snapshot KV đang chờ; RUNNING_CRITICAL / MODERATE / COMPLETE lập lại kế hoạch với bộ nhớ còn lại
+// và thu nhỏ context đang dùng nếu cần: lượt chat đang chạy bị huỷ và kết thúc (giữ lease slot chat
+// trong lúc đổi context), việc nền bị dừng, hội thoại prefill lại ở lượt sau.
+// true nếu context đã được thu nhỏ.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_trimMemory(
+        JNIEnv*, jclass /*clazz*/, jint level) {
+    std::lock_guard<std::mutex> lock(g_init_mutex);
+    if (!g_engine.is_loaded()) return JNI_FALSE;
+    g_engine.trim_contexts();
+    g_chunks.trim();
+    g_snapshots.flush();
+    g_chunks.flush();
+    if (level != kTrimRunningCritical && level < kTrimModerate) return JNI_FALSE;
+
+    const InferenceEngine::Params cur = g_engine.params();
+    const llama_context_params& cp = g_engine.cparams();
+    const uint64_t cur_bytes =
+        estimate_context_bytes(g_engine.model(), cp) +
+        estimate_compute_bytes(g_engine.model(), cur.n_ctx_seq, (int)cp.n_ubatch,
+                               cp.flash_attn_type == LLAMA_FLASH_ATTN_TYPE_ENABLED);
+    InferenceEngine::Params p = cur;
+    const uint64_t new_bytes = plan_params(p, /*record*/ true);
+    if (new_bytes == 0 || new_bytes >= cur_bytes) return JNI_FALSE;
+
+    LOGI("trimMemory(%d): shrinking context %d -> %d tokens (%" PRIu64 " -> %" PRIu64 " MB)", (int)level,
+         cur.n_ctx_seq, p.n_ctx_seq, cur_bytes >> 20, new_bytes >> 20);
+    // lượt hội thoại đang giữ slot chat phải kết thúc (và ghi lịch sử) trước khi context bị thay
+    g_engine.cancel_all(GenPriority::Interactive);
+    auto lease = g_engine.lease(kChatSeq);
+    g_engine.set_context_budget(0);   // context cũ không được giữ lại trong pool
+    const bool ok = g_engine.configure(p);
+    g_engine.set_context_budget(pool_budget());
+    if (!ok) LOGE("trimMemory: configure failed, engine stopped");
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+// Số liệu đầy đủ của request interactive gần nhất, thứ tự như LlamaBridge.GenerationMetrics
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_example_ragapp_LlamaBridge_generationMetrics(
+        JNIEnv* env, jclass /*clazz*/) {
+    RequestMetrics m;
+    {
+        std::lock_guard<std::mutex> lock(g_last_gen_mutex);
+        m = g_last_gen;
     }
+    const auto v = metrics_values(m);
+    jdoubleArray arr = env->NewDoubleArray((jsize)v.size());
+    if (arr) env->SetDoubleArrayRegion(arr, 0, (jsize)v.size(), v.data());
+    return arr;
+}
+
+// [tokens, giây, tok/s, số draft, số draft được nhận, tỉ lệ nhận, số lần decode, số lần dịch context]
+// của lần sinh gần nhất
+extern "C" JNIEXPORT jfloatArray JNICALL
+Java_com_example_ragapp_LlamaBridge_generationStats(
+        JNIEnv* env, jclass /*clazz*/) {
+    GenStats st;
+    {
+        std::lock_guard<std::mutex> lock(g_last_gen_mutex);
+        st = g_last_gen.stats;
+    }
+    const jfloat v[8] = {
+        (jfloat)st.tokens,
+        (jfloat)st.seconds,
+        (jfloat)(st.seconds > 0 ? st.tokens / st.seconds : 0.0),
+        (jfloat)st.drafted,
+        (jfloat)st.accepted,
+        (jfloat)(st.drafted > 0 ? (double)st.accepted / st.drafted : 0.0),
+        (jfloat)st.decode_calls,
+        (jfloat)st.ctx_shifts,
+    };
+    jfloatArray arr = env->NewFloatArray(8);
+    if (arr) env->SetFloatArrayRegion(arr, 0, 8, v);
+    return arr;
 }
@@ -0,0 +1,34 @@
+// app/src/main/cpp/mapped_file.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// mmap chỉ đọc một file; các trang được nạp lười khi truy cập lần đầu
+// (cùng cách use_mmap nạp GGUF).
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& o) noexcept { *this = static_cast<MappedFile&&>(o); }
+    MappedFile& operator=(MappedFile&& o) noexcept;
+
+    bool open(const std::string& path);
+    void close();
+
+    const uint8_t* data() const { return data_; }
+    size_t         size() const { return size_; }
+    bool           valid() const { return data_ != nullptr; }
+
+    // madvise: báo kernel mẫu truy cập (tuần tự / ngẫu nhiên)
+    void advise_sequential() const;
+    void advise_random() const;
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t         size_ = 0;
+};
@@ -0,0 +1,182 @@
+// app/src/main/cpp/memory_planner.cpp
+#include "memory_planner.h"
+#include "context_pool.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+static constexpr uint64_t kMB = 1024 * 1024;
+
+MemInfo read_meminfo() {
+    MemInfo m;
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (!f) return m;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long kb = 0;
+        if (sscanf(line, "MemTotal: %llu kB", &kb) == 1) m.total = kb * 1024;
+        else if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) m.available = kb * 1024;
+    }
+    fclose(f);
+    return m;
+}
+
+uint64_t estimate_compute_bytes(const llama_model* model, int n_ctx_seq, int n_ubatch, bool flash_attn) {
+    if (!model) return 0;
+    const uint64_t n_vocab = (uint64_t)std::max(0, llama_vocab_n_tokens(llama_model_get_vocab(model)));
+    const uint64_t n_embd  = (uint64_t)std::max(0, llama_model_n_embd(model));
+    const uint64_t n_head  = (uint64_t)std::max(1, llama_model_n_head(model));
+    const uint64_t ub      = (uint64_t)std::max(1, n_ubatch);
+
+    uint64_t bytes = ub * n_vocab * 4;   // logits f32 (graph dự trữ cho cả ubatch)
+    bytes += ub * n_embd * 4 * 16;       // activation một layer (FFN ~4-5x n_embd, buffer dùng lại)
+    if (!flash_attn) {
+        bytes += ub * (uint64_t)n_ctx_seq * n_head * 4 * 2;   // KQ + softmax f32
+    }
+    return bytes;
+}
+
+static uint64_t kv_bytes(const llama_model* model, int n_ctx_seq, int n_seq, ggml_type tk, ggml_type tv) {
+    llama_context_params cp = llama_context_default_params();
+    cp.n_ctx  = (uint32_t)(n_ctx_seq * n_seq);
+    cp.type_k = tk;
+    cp.type_v = tv;
+    return estimate_context_bytes(model, cp);
+}
+
+uint64_t estimate_aux_context_bytes(const llama_model* model, int n_ctx_seq, ggml_type type_k, ggml_type type_v,
+                                    int n_ubatch, bool flash_attn) {
+    return kv_bytes(model, n_ctx_seq, 1, type_k, type_v) +
+           estimate_compute_bytes(model, n_ctx_seq, n_ubatch, flash_attn);
+}
+
+static const char* type_name(ggml_type t) {
+    switch (t) {
+        case GGML_TYPE_F32:  return "f32";
+        case GGML_TYPE_F16:  return "f16";
+        case GGML_TYPE_Q8_0: return "q8_0";
+        case GGML_TYPE_Q4_0: return "q4_0";
+        default:             return "?";
+    }
+}
+
+static const char* fa_name(llama_flash_attn_type fa) {
+    return fa == LLAMA_FLASH_ATTN_TYPE_ENABLED ? "on" : fa == LLAMA_FLASH_ATTN_TYPE_DISABLED ? "off" : "auto";
+}
+
+namespace {
+struct Stage {
+    ggml_type             type;        // cho cả K và V (trừ khi request yêu cầu chính xác hơn)
+    llama_flash_attn_type fa;
+    int                   n_ubatch;
+    bool                  shrink_ctx;  // được giảm n_ctx ở bước này
+    int                   ctx_floor;   // 0 = req.n_ctx_seq / 2, -1 = req.min_ctx
+};
+}
+
+MemoryPlan plan_memory(const llama_model* model, const MemoryRequest& req, const MemInfo& mem,
+                       uint64_t resident_bytes) {
+    MemoryPlan plan;
+    plan.n_batch = std::max(32, req.n_batch);
+    const int n_seq   = std::max(1, req.n_seq);
+    const int min_ctx = std::max(256, std::min(req.min_ctx, req.n_ctx_seq));
+    const uint64_t model_bytes = model ? llama_model_size(model) : 0;
+
+    // MemAvailable tính cả page cache của model mmap, nên trừ model ra; chừa ~5% RAM cho hệ thống
+    uint64_t budget = UINT64_MAX;
+    uint64_t headroom = 0;
+    if (mem.available > 0) {
+        headroom = std::max<uint64_t>(128 * kMB, mem.total / 20);
+        const uint64_t usable = mem.available + resident_bytes;
+        budget = usable > model_bytes + headroom ? usable - model_bytes - headroom : 0;
+    }
+    if (req.budget > 0) budget = std::min(budget, req.budget);
+    plan.budget = budget;
+
+    char buf[256];
+    std::string& r = plan.report;
+    snprintf(buf, sizeof(buf),
+             "mem: total=%" PRIu64 "MB available=%" PRIu64 "MB resident_ctx=%" PRIu64 "MB model=%" PRIu64
+             "MB headroom=%" PRIu64 "MB budget=%s\n",
+             mem.total / kMB, mem.available / kMB, resident_bytes / kMB, model_bytes / kMB, headroom / kMB,
+             budget == UINT64_MAX ? "unlimited" : (std::to_string(budget / kMB) + "MB").c_str());
+    r += buf;
+    snprintf(buf, sizeof(buf), "want: n_ctx=%d x %d seq, kv<=%s/%s, n_batch=%d\n", req.n_ctx_seq, n_seq,
+             type_name(req.type_k), type_name(req.type_v), plan.n_batch);
+    r += buf;
+
+    const int ub_max = std::min(plan.n_batch, 512);
+    const std::vector<Stage> stages = {
+        { GGML_TYPE_F16,  LLAMA_FLASH_ATTN_TYPE_AUTO,    ub_max, false, 0 },
+        { GGML_TYPE_F16,  LLAMA_FLASH_ATTN_TYPE_ENABLED, ub_max, false, 0 },
+        { GGML_TYPE_F16,  LLAMA_FLASH_ATTN_TYPE_ENABLED, std::min(ub_max, 256), false, 0 },
+        { GGML_TYPE_Q8_0, LLAMA_FLASH_ATTN_TYPE_ENABLED, std::min(ub_max, 256), false, 0 },
+        { GGML_TYPE_Q8_0, LLAMA_FLASH_ATTN_TYPE_ENABLED, std::min(ub_max, 128), true,  0 },
+        { GGML_TYPE_Q4_0, LLAMA_FLASH_ATTN_TYPE_ENABLED, std::min(ub_max, 64),  true, -1 },
+    };
+    // kiểu KV không chính xác hơn mức request cho phép
+    auto clamp_type = [](ggml_type t, ggml_type limit) {
+        return ggml_row_size(t, 256) > ggml_row_size(limit, 256) ? limit : t;
+    };
+
+    auto evaluate = [&](const Stage& st, int n_ctx, bool log) {
+        const ggml_type tk = clamp_type(st.type, req.type_k);
+        const ggml_type tv = clamp_type(st.type, req.type_v);
+        // V lượng tử chỉ chạy với flash attention
+        const llama_flash_attn_type fa =
+            tv == GGML_TYPE_F16 || tv == GGML_TYPE_F32 ? st.fa : LLAMA_FLASH_ATTN_TYPE_ENABLED;
+        const uint64_t kv = kv_bytes(model, n_ctx, n_seq, tk, tv);
+        // AUTO được tính như tắt: llama có thể không bật flash attention cho model này
+        const uint64_t compute =
+            estimate_compute_bytes(model, n_ctx, st.n_ubatch, fa == LLAMA_FLASH_ATTN_TYPE_ENABLED);
+        // context phụ đổi theo cùng n_ctx / kiểu KV nên cũng nhỏ lại qua các bước
+        const uint64_t aux = req.aux_ubatch > 0
+            ? estimate_aux_context_bytes(model, n_ctx, tk, tv, req.aux_ubatch, fa == LLAMA_FLASH_ATTN_TYPE_ENABLED)
+            : 0;
+        const bool fits = kv + compute + aux <= budget;
+        if (log) {
+            snprintf(buf, sizeof(buf), "try: n_ctx=%d kv=%s/%s fa=%s n_ubatch=%d -> kv=%" PRIu64 "MB compute=%" PRIu64
+                     "MB aux=%" PRIu64 "MB%s\n", n_ctx, type_name(tk), type_name(tv), fa_name(fa), st.n_ubatch,
+                     kv / kMB, compute / kMB, aux / kMB, fits ? " fits" : "");
+            r += buf;
+        }
+        plan.fits          = fits;
+        plan.n_ctx_seq     = n_ctx;
+        plan.n_ubatch      = st.n_ubatch;
+        plan.type_k        = tk;
+        plan.type_v        = tv;
+        plan.flash_attn    = fa;
+        plan.kv_bytes      = kv;
+        plan.compute_bytes = compute;
+        plan.aux_bytes     = aux;
+        return fits;
+    };
+
+    bool done = false;
+    for (const Stage& st : stages) {
+        if (evaluate(st, req.n_ctx_seq, true)) {
+            done = true;
+            break;
+        }
+        if (!st.shrink_ctx) continue;
+        // giảm dần theo bước 256 token; chỉ ghi vào report bước cuối cùng (vừa hoặc chạm sàn)
+        const int floor = st.ctx_floor < 0 ? min_ctx : std::max(min_ctx, req.n_ctx_seq / 2);
+        for (int n = (req.n_ctx_seq - 1) / 256 * 256; n >= floor; n -= 256) {
+            if (evaluate(st, n, false)) {
+                done = true;
+                break;
+            }
+        }
+        evaluate(st, plan.fits ? plan.n_ctx_seq : floor, true);
+        if (done) break;
+    }
+
+    snprintf(buf, sizeof(buf), "plan: n_ctx=%d kv=%s/%s fa=%s n_batch=%d n_ubatch=%d total=%" PRIu64 "MB%s",
+             plan.n_ctx_seq, type_name(plan.type_k), type_name(plan.type_v), fa_name(plan.flash_attn),
+             plan.n_batch, plan.n_ubatch, (plan.kv_bytes + plan.compute_bytes + plan.aux_bytes) / kMB,
+             plan.fits ? "" : " (over budget: smallest configuration)");
+    r += buf;
+    return plan;
+}
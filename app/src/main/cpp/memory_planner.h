@@ -0,0 +1,60 @@
+// app/src/main/cpp/memory_planner.h
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "llama.h"
+
+// Chọn cấu hình context vừa bộ nhớ máy: trên điện thoại 4-6 GB, model ~1 GB cộng KV f16 của
+// context dài và compute buffer (logits n_ubatch x n_vocab, ma trận KQ khi không có flash
+// attention) đủ để bị low-memory killer dừng app.
+
+struct MemInfo {
+    uint64_t total     = 0;   // byte; 0 = không đọc được /proc/meminfo
+    uint64_t available = 0;
+};
+MemInfo read_meminfo();
+
+struct MemoryRequest {
+    int       n_ctx_seq = 2048;            // context mong muốn của mỗi slot
+    int       n_seq     = 2;
+    int       n_batch   = 512;
+    int       min_ctx   = 512;             // không giảm n_ctx dưới mức này
+    ggml_type type_k    = GGML_TYPE_F16;   // kiểu KV chính xác nhất được phép
+    ggml_type type_v    = GGML_TYPE_F16;
+    uint64_t  budget    = 0;               // trần KV + compute (byte); 0 = theo MemAvailable
+    int       aux_ubatch = 0;              // > 0: thêm context phụ cùng n_ctx_seq / kiểu KV (ChunkKvCache)
+};
+
+struct MemoryPlan {
+    bool      fits      = false;           // false: cấu hình nhỏ nhất vẫn vượt budget
+    int       n_ctx_seq = 0;
+    int       n_batch   = 0;
+    int       n_ubatch  = 0;
+    ggml_type type_k    = GGML_TYPE_F16;
+    ggml_type type_v    = GGML_TYPE_F16;
+    llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+
+    uint64_t  budget        = 0;           // UINT64_MAX = không giới hạn
+    uint64_t  kv_bytes      = 0;
+    uint64_t  compute_bytes = 0;
+    uint64_t  aux_bytes     = 0;           // KV + compute của context phụ, đã tính khi so với budget
+    std::string report;                    // các bước đã thử và lý do chọn, để log / hiển thị
+};
+
+// Ước lượng compute buffer của một lần decode n_ubatch token (logits, activation, KQ khi tắt
+// flash attention). Chỉ để so sánh cấu hình, sai số vài chục phần trăm.
+uint64_t estimate_compute_bytes(const llama_model* model, int n_ctx_seq, int n_ubatch, bool flash_attn);
+
+// KV + compute của context phụ một stream n_ctx_seq ô, decode n_ubatch token (context ghép KV
+// đoạn của ChunkKvCache)
+uint64_t estimate_aux_context_bytes(const llama_model* model, int n_ctx_seq, ggml_type type_k, ggml_type type_v,
+                                    int n_ubatch, bool flash_attn);
+
+// Thứ tự đánh đổi, dừng ở bước đầu tiên vừa budget: flash attention (không mất chất lượng),
+// n_ubatch nhỏ hơn (chỉ chậm prefill; với vocab ~150k logits n_ubatch x n_vocab chiếm phần lớn
+// compute buffer), KV q8_0, giảm n_ctx tới một nửa, KV q4_0, giảm n_ctx tới min_ctx.
+// budget tự tính = MemAvailable + resident_bytes (context của engine, sẽ được thay) - model - dự phòng.
+MemoryPlan plan_memory(const llama_model* model, const MemoryRequest& req, const MemInfo& mem,
+                       uint64_t resident_bytes);
@@ -0,0 +1,184 @@
+// app/src/main/cpp/model_verify.cpp
+#include "model_verify.h"
+#include "mapped_file.h"
+#include "sha256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <sys/stat.h>
+
+static constexpr size_t kSlice = 1 << 20;   // báo tiến độ / kiểm tra huỷ sau mỗi 1 MB
+
+FileIdentity file_identity(const std::string& path) {
+    FileIdentity id;
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0) return id;
+    id.ok       = true;
+    id.size     = (uint64_t)st.st_size;
+    id.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    id.inode    = (uint64_t)st.st_ino;
+    return id;
+}
+
+static int resolve_threads(int n_threads, size_t n_jobs) {
+    if (n_threads <= 0) n_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    return (int)std::max<size_t>(1, std::min<size_t>((size_t)n_threads, n_jobs));
+}
+
+static bool hex_equal(const std::string& a, const std::string& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+// Băm các khối [first, last) của data_size byte đầu file đã map bằng n_threads luồng, mỗi luồng lấy khối kế tiếp
+// qua một bộ đếm chung. on_block(i, hex) được gọi trên luồng băm. progress chạy trên luồng gọi.
+// Trả false nếu bị huỷ.
+static bool hash_blocks_parallel(const MappedFile& file, uint64_t data_size, uint64_t block_size, size_t first,
+                                 size_t last, int n_threads, const VerifyProgress& progress, uint64_t* bytes_hashed,
+                                 const std::function<void(size_t, const std::string&)>& on_block) {
+    const uint64_t file_size = std::min<uint64_t>(data_size, file.size());
+    uint64_t total = 0;
+    for (size_t i = first; i < last; ++i) {
+        const uint64_t begin = (uint64_t)i * block_size;
+        total += std::min(block_size, file_size - begin);
+    }
+
+    std::atomic<size_t>   next{ first };
+    std::atomic<uint64_t> done{ 0 };
+    std::atomic<bool>     cancel{ false };
+    std::atomic<int>      running{ 0 };
+    std::mutex              mu;
+    std::condition_variable cv;
+
+    auto worker = [&]() {
+        for (size_t i; !cancel.load(std::memory_order_relaxed) && (i = next.fetch_add(1)) < last;) {
+            const uint64_t begin = (uint64_t)i * block_size;
+            const uint64_t len   = std::min(block_size, file_size - begin);
+            const uint8_t* p     = file.data() + begin;
+            Sha256 h;
+            for (uint64_t off = 0; off < len && !cancel.load(std::memory_order_relaxed); off += kSlice) {
+                const size_t n = (size_t)std::min<uint64_t>(kSlice, len - off);
+                h.update(p + off, n);
+                done.fetch_add(n, std::memory_order_relaxed);
+            }
+            if (cancel.load(std::memory_order_relaxed)) break;
+            on_block(i, h.final_hex());
+        }
+        std::lock_guard<std::mutex> lock(mu);
+        if (--running == 0) cv.notify_all();
+    };
+
+    const int nt = resolve_threads(n_threads, last - first);
+    running = nt;
+    std::vector<std::thread> threads;
+    threads.reserve((size_t)nt);
+    for (int t = 0; t < nt; ++t) threads.emplace_back(worker);
+
+    {
+        std::unique_lock<std::mutex> lock(mu);
+        while (running > 0) {
+            cv.wait_for(lock, std::chrono::milliseconds(50));
+            if (progress && !cancel) {
+                lock.unlock();
+                if (!progress(done.load(), total)) cancel = true;
+                lock.lock();
+            }
+        }
+    }
+    for (auto& t : threads) t.join();
+    if (bytes_hashed) *bytes_hashed = done.load();
+    if (progress && !cancel) progress(total, total);
+    return !cancel;
+}
+
+BlockVerifyResult verify_blocks(const std::string& path, uint64_t expected_size, uint64_t block_size,
+                                const std::vector<std::string>& expected_hex, size_t first_block,
+                                int n_threads, const VerifyProgress& progress) {
+    const auto t0 = std::chrono::steady_clock::now();
+    BlockVerifyResult r;
+    if (block_size == 0 || expected_size == 0) {
+        r.error = "invalid block layout";
+        return r;
+    }
+    r.n_blocks = (size_t)((expected_size + block_size - 1) / block_size);
+    if (expected_hex.size() != r.n_blocks) {
+        r.error = "block list does not match size";
+        return r;
+    }
+    first_block = std::min(first_block, r.n_blocks);
+
+    const FileIdentity id = file_identity(path);
+    if (!id.ok) {
+        r.error = "cannot stat file";
+        return r;
+    }
+
+    // Khối được băm khi nằm trọn trong file thực tế; khối cuối được phép ngắn khi file đúng kích thước
+    std::vector<uint8_t> good(r.n_blocks, 0);
+    for (size_t i = 0; i < first_block; ++i) good[i] = 1;
+    size_t hashable = first_block;
+    while (hashable < r.n_blocks && std::min(expected_size, (uint64_t)(hashable + 1) * block_size) <= id.size) {
+        ++hashable;
+    }
+
+    MappedFile file;
+    if (hashable > first_block) {
+        if (!file.open(path)) {
+            r.error = "cannot map file";
+            return r;
+        }
+        file.advise_sequential();
+    }
+
+    bool finished = true;
+    if (hashable > first_block) {
+        // mỗi khối chỉ một luồng ghi good[i]
+        finished = hash_blocks_parallel(file, expected_size, block_size, first_block, hashable, n_threads,
+                                        progress, &r.bytes_hashed, [&](size_t i, const std::string& hex) {
+            good[i] = hex_equal(hex, expected_hex[i]) ? 1 : 2;
+        });
+    }
+
+    for (size_t i = first_block; i < r.n_blocks; ++i) {
+        // ngoài file: sai; chưa băm vì bị huỷ: không biết
+        if (i >= hashable || good[i] == 2) r.bad.push_back((int)i);
+    }
+    while (r.good_prefix < r.n_blocks && good[r.good_prefix] == 1) ++r.good_prefix;
+    if (!finished) r.error = "cancelled";
+    r.ok = finished && r.bad.empty() && r.good_prefix == r.n_blocks && id.size == expected_size;
+    r.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return r;
+}
+
+std::vector<std::string> hash_blocks(const std::string& path, uint64_t block_size, int n_threads) {
+    MappedFile file;
+    if (block_size == 0 || !file.open(path)) return {};
+    file.advise_sequential();
+    const size_t n = (size_t)((file.size() + block_size - 1) / block_size);
+    std::vector<std::string> out(n);
+    hash_blocks_parallel(file, file.size(), block_size, 0, n, n_threads, nullptr, nullptr,
+                         [&](size_t i, const std::string& hex) { out[i] = hex; });
+    return out;
+}
+
+std::string sha256_file(const std::string& path, const VerifyProgress& progress) {
+    MappedFile file;
+    if (!file.open(path)) return {};
+    file.advise_sequential();
+    Sha256 h;
+    for (size_t off = 0; off < file.size(); off += kSlice * 16) {
+        const size_t n = std::min(kSlice * 16, file.size() - off);
+        h.update(file.data() + off, n);
+        if (progress && !progress(off + n, file.size())) return {};
+    }
+    return h.final_hex();
+}
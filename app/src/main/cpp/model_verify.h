@@ -0,0 +1,48 @@
+// app/src/main/cpp/model_verify.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Kiểm tra file model theo khối: file được chia thành các khối block_size byte (khối cuối có
+// thể ngắn hơn), mỗi khối có SHA-256 riêng trong manifest. Các khối băm song song trên mmap nên
+// thời gian ~ băng thông đọc flash thay vì một luồng SHA; khi .part hỏng giữa chừng, biết được
+// tiền tố khối đúng để copy tiếp từ đó. Đọc qua mmap cũng làm ấm page cache cho lần nạp
+// use_mmap của llama ngay sau đó.
+
+struct FileIdentity {
+    bool     ok       = false;   // false = không stat được (file không tồn tại)
+    uint64_t size     = 0;
+    int64_t  mtime_ns = 0;
+    uint64_t inode    = 0;
+};
+FileIdentity file_identity(const std::string& path);
+
+// (đã xong, tổng); trả false để huỷ. Gọi trên luồng gọi hàm, không phải luồng băm.
+using VerifyProgress = std::function<bool(uint64_t done, uint64_t total)>;
+
+struct BlockVerifyResult {
+    bool             ok          = false;   // mọi khối khớp và kích thước file == expected_size
+    size_t           n_blocks    = 0;
+    size_t           good_prefix = 0;       // số khối đầu liên tiếp đúng (tính cả các khối < first_block)
+    std::vector<int> bad;                   // chỉ số khối sai / thiếu (chưa băm do huỷ thì không có ở đây)
+    uint64_t         bytes_hashed = 0;
+    double           ms           = 0.0;
+    std::string      error;                 // rỗng nếu chạy hết; "cancelled" nếu bị huỷ
+};
+
+// Kiểm các khối [first_block, n_blocks) của path với expected_hex (hex thường/hoa, mỗi khối
+// một chuỗi). Các khối trước first_block được coi là đã kiểm. Khối nằm (một phần) ngoài file
+// thực tế là khối sai. n_threads <= 0: theo số core.
+BlockVerifyResult verify_blocks(const std::string& path, uint64_t expected_size, uint64_t block_size,
+                                const std::vector<std::string>& expected_hex, size_t first_block,
+                                int n_threads, const VerifyProgress& progress = nullptr);
+
+// SHA-256 của từng khối (công cụ đóng gói sinh block_sha256 cho manifest). Rỗng nếu lỗi.
+std::vector<std::string> hash_blocks(const std::string& path, uint64_t block_size, int n_threads);
+
+// SHA-256 cả file (một luồng, qua mmap); rỗng nếu lỗi hoặc bị huỷ.
+std::string sha256_file(const std::string& path, const VerifyProgress& progress = nullptr);
@@ -0,0 +1,53 @@
+// app/src/main/cpp/prompt_lookup.cpp
+#include "prompt_lookup.h"
+
+#include <algorithm>
+
+PromptLookup::PromptLookup(int n_min, int n_max)
+    : n_min_(std::max(1, n_min)), n_max_(std::max(n_min_, n_max)), next_((size_t)n_max_ + 1) {}
+
+uint64_t PromptLookup::hash(size_t end, int n) const {
+    uint64_t h = 1469598103934665603ULL ^ (uint64_t)n;
+    for (size_t i = end - (size_t)n; i < end; ++i) {
+        h ^= (uint32_t)hist_[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void PromptLookup::reset(const std::vector<llama_token>& history) {
+    hist_.clear();
+    for (auto& m : next_) m.clear();
+    hist_.reserve(history.size() + 512);
+    for (llama_token t : history) push(t);
+}
+
+void PromptLookup::push(llama_token t) {
+    // n-gram kết thúc ngay trước t giờ đã có token theo sau (chính là t)
+    const size_t end = hist_.size();
+    for (int n = n_min_; n <= n_max_ && (size_t)n <= end; ++n) {
+        next_[(size_t)n][hash(end, n)] = (uint32_t)end;
+    }
+    hist_.push_back(t);
+}
+
+int PromptLookup::draft(int n_draft, std::vector<llama_token>& out) const {
+    out.clear();
+    const size_t end = hist_.size();
+    for (int n = std::min<int>(n_max_, (int)end); n >= n_min_ && n_draft > 0; --n) {
+        const auto& m  = next_[(size_t)n];
+        const auto  it = m.find(hash(end, n));
+        if (it == m.end()) continue;
+
+        const size_t pos = it->second;
+        // chống va chạm hash: so lại n-gram thật
+        if (!std::equal(hist_.begin() + (long)(pos - (size_t)n), hist_.begin() + (long)pos,
+                        hist_.begin() + (long)(end - (size_t)n))) {
+            continue;
+        }
+        const size_t n_take = std::min((size_t)n_draft, end - pos);
+        out.assign(hist_.begin() + (long)pos, hist_.begin() + (long)(pos + n_take));
+        return (int)out.size();
+    }
+    return 0;
+}
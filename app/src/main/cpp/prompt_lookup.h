@@ -0,0 +1,33 @@
+// app/src/main/cpp/prompt_lookup.h
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "llama.h"
+
+// Nguồn draft cho speculative decoding không cần model phụ ("prompt lookup"):
+// tìm lần xuất hiện gần nhất của n-gram đuôi trong chính ngữ cảnh (system + passage truy hồi +
+// phần đã sinh) rồi đề xuất các token theo sau nó. Câu trả lời RAG hay chép nguyên cụm từ passage
+// nên draft thường khớp dài.
+class PromptLookup {
+public:
+    explicit PromptLookup(int n_min = 2, int n_max = 4);
+
+    void reset(const std::vector<llama_token>& history);
+    void push(llama_token t);
+
+    // Thử n-gram đuôi từ dài tới ngắn; ghi tối đa n_draft token vào out, trả về số token
+    int draft(int n_draft, std::vector<llama_token>& out) const;
+
+private:
+    uint64_t hash(size_t end, int n) const;   // n-gram hist_[end-n, end)
+
+    int n_min_;
+    int n_max_;
+    std::vector<llama_token> hist_;
+    // theo bậc n: hash n-gram -> vị trí token đứng ngay sau lần xuất hiện gần nhất.
+    // n-gram đuôi chỉ được thêm khi có token kế tiếp, nên tra cứu không bao giờ trúng chính nó.
+    std::vector<std::unordered_map<uint64_t, uint32_t>> next_;
+};
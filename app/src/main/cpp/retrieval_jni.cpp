@@ -0,0 +1,454 @@
+// app/src/main/cpp/retrieval_jni.cpp
+// JNI cho phần truy hồi (RAG): embedding + kho vector trong RAM.
+#include <jni.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bm25_index.h"
+#include "embedder.h"
+#include "ingest.h"
+#include "ivf_index.h"
+#include "vector_store.h"
+#include "bridge_log.h"
+
+// --------- Globals ---------
+static std::mutex               g_rag_mutex;
+static Embedder                 g_embedder;
+static VectorStore              g_store;
+static std::vector<std::string> g_doc_texts;   // id tài liệu = index
+static IvfPqIndex               g_index;       // index trên đĩa; khi mở, thay cho g_store
+static Bm25Index                g_lexical;     // BM25 trên cùng tập tài liệu đang dùng (index hoặc kho RAM)
+static bool                     g_lexical_stale = false;   // nguồn tài liệu đổi: dựng lại khi cần
+
+static constexpr int kEmbedCtx    = 512;
+static constexpr int kEmbedSeqMax = 8;     // số đoạn đóng gói chung một batch khi nạp
+static constexpr int kRrfK        = 60;    // hằng số reciprocal-rank fusion
+
+static std::string jstring_to_std(JNIEnv* env, jstring js) {
+    if (!js) return {};
+    const char* c = env->GetStringUTFChars(js, nullptr);
+    std::string s(c ? c : "");
+    env->ReleaseStringUTFChars(js, c);
+    return s;
+}
+
+struct RagHit {
+    int64_t     id;
+    float       score;
+    std::string text;
+};
+
+static jobjectArray to_java_hits(JNIEnv* env, const std::vector<RagHit>& hits) {
+    jclass hitClass = env->FindClass("com/example/ragapp/LlamaBridge$SearchHit");
+    if (!hitClass) return nullptr;
+    jmethodID ctor = env->GetMethodID(hitClass, "<init>", "(JFLjava/lang/String;)V");
+    if (!ctor) {
+        env->DeleteLocalRef(hitClass);
+        return nullptr;
+    }
+
+    jobjectArray out = env->NewObjectArray((jsize)hits.size(), hitClass, nullptr);
+    for (size_t i = 0; out && i < hits.size(); ++i) {
+        jstring jText = env->NewStringUTF(hits[i].text.c_str());
+        jobject hit = env->NewObject(hitClass, ctor, (jlong)hits[i].id, (jfloat)hits[i].score, jText);
+        env->SetObjectArrayElement(out, (jsize)i, hit);
+        env->DeleteLocalRef(hit);
+        env->DeleteLocalRef(jText);
+    }
+    env->DeleteLocalRef(hitClass);
+    return out;
+}
+
+// Gọi khi đang giữ g_rag_mutex
+static std::vector<RagHit> search_locked(const std::string& query, size_t k, const IvfPqIndex::QueryParams& qp) {
+    std::vector<RagHit> out;
+    std::vector<float> qvec;
+    if (!g_embedder.ready() || k == 0 || !g_embedder.embed(query, qvec)) return out;
+
+    if (g_index.is_open()) {
+        for (auto& h : g_index.search(qvec.data(), k, qp)) out.push_back({ h.id, h.score, std::move(h.text) });
+    } else {
+        for (const auto& h : g_store.search(qvec.data(), k)) out.push_back({ h.id, h.score, g_doc_texts[(size_t)h.id] });
+    }
+    return out;
+}
+
+// Gọi khi đang giữ g_rag_mutex
+static void lexical_sync_locked() {
+    if (!g_lexical_stale) return;
+    g_lexical.clear();
+    if (g_index.is_open()) {
+        g_index.for_each_text([](int64_t id, const char* text, size_t len) {
+            g_lexical.add(id, std::string(text, len));
+        });
+    } else {
+        for (size_t i = 0; i < g_doc_texts.size(); ++i) g_lexical.add((int64_t)i, g_doc_texts[i]);
+    }
+    g_lexical_stale = false;
+    LOGI("lexical index rebuilt: %zu docs, %zu terms, %zu KB postings",
+         g_lexical.size(), g_lexical.n_terms(), g_lexical.postings_bytes() / 1024);
+}
+
+static std::string doc_text_locked(int64_t id) {
+    std::string text;
+    if (g_index.is_open()) g_index.text_of(id, &text);
+    else if (id >= 0 && (size_t)id < g_doc_texts.size()) text = g_doc_texts[(size_t)id];
+    return text;
+}
+
+// Reciprocal-rank fusion: score = sum 1 / (kRrfK + hạng) qua danh sách vector và BM25
+static std::vector<RagHit> hybrid_locked(const std::string& query, size_t k, const IvfPqIndex::QueryParams& qp) {
+    const size_t depth = std::max<size_t>(k * 4, 32);
+
+    std::vector<RagHit> dense = search_locked(query, depth, qp);
+    lexical_sync_locked();
+    const std::vector<Bm25Index::Hit> sparse = g_lexical.search(query, depth);
+
+    std::unordered_map<int64_t, size_t> slot;
+    std::vector<RagHit> fused;
+    auto accumulate = [&](int64_t id, size_t rank, std::string* text) {
+        auto it = slot.find(id);
+        if (it == slot.end()) {
+            it = slot.emplace(id, fused.size()).first;
+            fused.push_back({ id, 0.f, text ? std::move(*text) : std::string() });
+        }
+        fused[it->second].score += 1.f / (float)(kRrfK + rank + 1);
+    };
+    for (size_t r = 0; r < dense.size(); ++r)  accumulate(dense[r].id, r, &dense[r].text);
+    for (size_t r = 0; r < sparse.size(); ++r) accumulate(sparse[r].id, r, nullptr);
+
+    const size_t n = std::min(k, fused.size());
+    std::partial_sort(fused.begin(), fused.begin() + n, fused.end(),
+                      [](const RagHit& a, const RagHit& b) { return a.score > b.score; });
+    fused.resize(n);
+    for (auto& h : fused) {
+        if (h.text.empty()) h.text = doc_text_locked(h.id);
+    }
+    return fused;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_initEmbedder(
+        JNIEnv* env, jclass /*clazz*/, jstring jModelPath, jint nThreads) {
+    const std::string path = jstring_to_std(env, jModelPath);
+
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    if (!g_embedder.load(path, (int)nThreads, kEmbedCtx, kEmbedSeqMax)) return JNI_FALSE;
+
+    // Đổi model embedding -> không gian vector khác, bỏ index cũ
+    if (g_store.dim() != g_embedder.dim()) {
+        g_store.reset(g_embedder.dim(), VectorStore::Storage::I8);
+        g_doc_texts.clear();
+        if (!g_index.is_open()) g_lexical_stale = true;
+    }
+    // Index trên đĩa khác số chiều (như openIndex): đóng, search / ingest quay về kho RAM
+    if (g_index.is_open() && g_index.dim() != g_embedder.dim()) {
+        LOGE("initEmbedder: dim mismatch (index=%d, embedder=%d), closing index", g_index.dim(), g_embedder.dim());
+        g_index.close();
+        g_lexical_stale = true;
+    }
+    return JNI_TRUE;
+}
+
+extern "C" JNIEXPORT jfloatArray JNICALL
+Java_com_example_ragapp_LlamaBridge_embed(
+        JNIEnv* env, jclass /*clazz*/, jstring jText) {
+    const std::string text = jstring_to_std(env, jText);
+
+    std::vector<float> vec;
+    {
+        std::lock_guard<std::mutex> lock(g_rag_mutex);
+        if (!g_embedder.ready() || !g_embedder.embed(text, vec)) return nullptr;
+    }
+
+    jfloatArray out = env->NewFloatArray((jsize)vec.size());
+    if (out) env->SetFloatArrayRegion(out, 0, (jsize)vec.size(), vec.data());
+    return out;
+}
+
+static std::vector<std::string> java_strings(JNIEnv* env, jobjectArray arr) {
+    std::vector<std::string> out;
+    if (!arr) return out;
+    const jsize n = env->GetArrayLength(arr);
+    out.reserve((size_t)n);
+    for (jsize i = 0; i < n; ++i) {
+        jstring js = (jstring)env->GetObjectArrayElement(arr, i);
+        out.push_back(jstring_to_std(env, js));
+        env->DeleteLocalRef(js);
+    }
+    return out;
+}
+
+// IngestCallback phía Kotlin; mọi lời gọi diễn ra trên thread JNI đang chạy pipeline
+struct JniIngestCallback {
+    JNIEnv*   env         = nullptr;
+    jobject   callback    = nullptr;
+    jmethodID onProgress  = nullptr;
+    jmethodID onCompleted = nullptr;
+    jmethodID onError     = nullptr;
+
+    bool bind(JNIEnv* e, jobject jCallback) {
+        env = e;
+        if (!jCallback) return false;
+        callback = env->NewGlobalRef(jCallback);
+        if (!callback) return false;
+
+        jclass cbClass = env->GetObjectClass(callback);
+        if (!cbClass) return false;
+        onProgress  = env->GetMethodID(cbClass, "onProgress", "(IIF)Z");
+        onCompleted = env->GetMethodID(cbClass, "onCompleted", "(IF)V");
+        onError     = env->GetMethodID(cbClass, "onError", "(Ljava/lang/String;)V");
+        env->DeleteLocalRef(cbClass);
+        return onProgress && onCompleted && onError;
+    }
+
+    // false = huỷ (Kotlin trả false hoặc ném exception)
+    bool progress(size_t done, size_t total, float cps) {
+        const jboolean go = env->CallBooleanMethod(callback, onProgress, (jint)done, (jint)total, (jfloat)cps);
+        if (env->ExceptionCheck()) {
+            env->ExceptionClear();
+            return false;
+        }
+        return go == JNI_TRUE;
+    }
+
+    void completed(size_t chunks, float cps) {
+        env->CallVoidMethod(callback, onCompleted, (jint)chunks, (jfloat)cps);
+    }
+
+    void error(const char* msg) {
+        jstring jMsg = env->NewStringUTF(msg ? msg : "");
+        env->CallVoidMethod(callback, onError, jMsg);
+        env->DeleteLocalRef(jMsg);
+    }
+
+    ~JniIngestCallback() {
+        if (callback) env->DeleteGlobalRef(callback);
+    }
+};
+
+// Embed các đoạn theo batch rồi thêm vào index đĩa (một segment cho cả lần nạp) hoặc kho RAM.
+// Gọi khi đang giữ g_rag_mutex. Đoạn đã embed xong vẫn được ghi nếu bị huỷ giữa chừng.
+static size_t ingest_locked(std::vector<std::string>& chunks, const IngestPipeline::Progress& progress,
+                            IngestPipeline::Stats* st, bool* ok) {
+    const size_t dim = (size_t)g_embedder.dim();
+    std::vector<float>  pending_vecs;
+    std::vector<size_t> pending_idx;
+
+    IngestPipeline pipeline(g_embedder);
+    *ok = pipeline.run(chunks, [&](const float* vecs, const size_t* idx, size_t n) {
+        pending_vecs.insert(pending_vecs.end(), vecs, vecs + n * dim);
+        pending_idx.insert(pending_idx.end(), idx, idx + n);
+        return true;
+    }, progress, st);
+    if (pending_idx.empty()) return 0;
+
+    std::vector<std::string> texts;
+    texts.reserve(pending_idx.size());
+    for (size_t i : pending_idx) texts.push_back(std::move(chunks[i]));
+
+    // Index trên đĩa đang mở: ghi thành một segment mới (không build lại)
+    if (g_index.is_open()) {
+        const int64_t base = g_index.next_id();
+        std::vector<int64_t> ids(texts.size());
+        for (size_t i = 0; i < ids.size(); ++i) ids[i] = base + (int64_t)i;
+        if (!g_index.append(pending_vecs.data(), ids.data(), texts, texts.size())) {
+            *ok = false;
+            return 0;
+        }
+        if (!g_lexical_stale) {
+            for (size_t i = 0; i < texts.size(); ++i) g_lexical.add(ids[i], texts[i]);
+        }
+        LOGI("ingest: +%zu -> index (total=%zu, segments=%zu)", texts.size(), g_index.size(), g_index.n_segments());
+        return texts.size();
+    }
+
+    size_t added = 0;
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const int64_t id = (int64_t)g_doc_texts.size();
+        if (!g_store.add(&pending_vecs[i * dim], 1, &id)) break;
+        if (!g_lexical_stale) g_lexical.add(id, texts[i]);
+        g_doc_texts.push_back(std::move(texts[i]));
+        ++added;
+    }
+    LOGI("ingest: +%zu (total=%zu)", added, g_store.size());
+    return added;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_ragapp_LlamaBridge_addDocuments(
+        JNIEnv* env, jclass /*clazz*/, jobjectArray jTexts) {
+    std::vector<std::string> texts;
+    for (auto& t : java_strings(env, jTexts)) {
+        if (!t.empty()) texts.push_back(std::move(t));
+    }
+    if (texts.empty()) return 0;
+
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    if (!g_embedder.ready()) return 0;
+    bool ok = false;
+    return (jint)ingest_locked(texts, nullptr, nullptr, &ok);
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_ragapp_LlamaBridge_ingestDocuments(
+        JNIEnv* env, jclass /*clazz*/, jobjectArray jTexts,
+        jint chunkChars, jint overlapChars, jobject jCallback) {
+    JniIngestCallback cb;
+    if (!cb.bind(env, jCallback)) {
+        if (cb.onError) cb.error("Callback methods missing");
+        return 0;
+    }
+
+    std::vector<std::string> chunks;
+    for (const auto& doc : java_strings(env, jTexts)) {
+        for (auto& c : chunk_utf8(doc, (int)chunkChars, (int)overlapChars)) chunks.push_back(std::move(c));
+    }
+
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    if (!g_embedder.ready()) {
+        cb.error("Embedder not initialized");
+        return 0;
+    }
+
+    bool cancelled = false;
+    IngestPipeline::Stats st;
+    bool ok = false;
+    const size_t added = ingest_locked(chunks, [&](const IngestPipeline::Stats& s, size_t total) {
+        if (cb.progress(s.chunks, total, s.chunks_per_sec())) return true;
+        cancelled = true;
+        return false;
+    }, &st, &ok);
+
+    if (ok || cancelled) cb.completed(added, st.chunks_per_sec());
+    else                 cb.error("Ingest failed");
+    return (jint)added;
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_example_ragapp_LlamaBridge_search(
+        JNIEnv* env, jclass /*clazz*/, jstring jQuery, jint k) {
+    const std::string query = jstring_to_std(env, jQuery);
+    std::vector<RagHit> hits;
+    {
+        std::lock_guard<std::mutex> lock(g_rag_mutex);
+        hits = search_locked(query, (size_t)std::max(0, (int)k), IvfPqIndex::QueryParams());
+    }
+    return to_java_hits(env, hits);
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_example_ragapp_LlamaBridge_searchIndex(
+        JNIEnv* env, jclass /*clazz*/, jstring jQuery, jint k, jint nProbe, jint refine) {
+    const std::string query = jstring_to_std(env, jQuery);
+    IvfPqIndex::QueryParams qp;
+    qp.nprobe = std::max(1, (int)nProbe);
+    qp.refine = std::max(0, (int)refine);
+
+    std::vector<RagHit> hits;
+    {
+        std::lock_guard<std::mutex> lock(g_rag_mutex);
+        hits = search_locked(query, (size_t)std::max(0, (int)k), qp);
+    }
+    return to_java_hits(env, hits);
+}
+
+// Vector + BM25, hợp nhất bằng RRF trong một lần gọi JNI
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_example_ragapp_LlamaBridge_hybridSearch(
+        JNIEnv* env, jclass /*clazz*/, jstring jQuery, jint k, jint nProbe, jint refine) {
+    const std::string query = jstring_to_std(env, jQuery);
+    IvfPqIndex::QueryParams qp;
+    qp.nprobe = std::max(1, (int)nProbe);
+    qp.refine = std::max(0, (int)refine);
+
+    std::vector<RagHit> hits;
+    {
+        std::lock_guard<std::mutex> lock(g_rag_mutex);
+        hits = hybrid_locked(query, (size_t)std::max(0, (int)k), qp);
+    }
+    return to_java_hits(env, hits);
+}
+
+// --------- Index trên đĩa (IVF-PQ, mmap) ---------
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_openIndex(
+        JNIEnv* env, jclass /*clazz*/, jstring jDir) {
+    const std::string dir = jstring_to_std(env, jDir);
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    if (!g_index.open(dir)) return JNI_FALSE;
+    if (g_embedder.ready() && g_index.dim() != g_embedder.dim()) {
+        LOGE("openIndex: dim mismatch (index=%d, embedder=%d)", g_index.dim(), g_embedder.dim());
+        g_index.close();
+        return JNI_FALSE;
+    }
+    g_lexical_stale = true;
+    return JNI_TRUE;
+}
+
+// Huấn luyện IVF-PQ từ các tài liệu đang có trong kho RAM rồi chuyển sang dùng index
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_buildIndex(
+        JNIEnv* env, jclass /*clazz*/, jstring jDir, jint nList, jint nSubq) {
+    const std::string dir = jstring_to_std(env, jDir);
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+
+    const size_t n = g_store.size();
+    const int dim  = g_store.dim();
+    if (n == 0 || dim <= 0) return JNI_FALSE;
+
+    std::vector<float> vecs(n * (size_t)dim);
+    for (size_t i = 0; i < n; ++i) g_store.row_f32(i, &vecs[i * (size_t)dim]);
+
+    IvfPqIndex::Params p;
+    p.nlist = std::max(0, (int)nList);
+    p.m     = std::max(0, (int)nSubq);
+
+    // BM25 đang theo kho RAM vẫn đúng sau khi chuyển (id giữ nguyên); nếu đang theo index cũ thì dựng lại
+    if (g_index.is_open()) g_lexical_stale = true;
+    g_index.close();
+    if (!IvfPqIndex::build(dir, vecs.data(), g_store.ids(), g_doc_texts, n, dim, p)) return JNI_FALSE;
+    if (!g_index.open(dir)) return JNI_FALSE;
+
+    g_store.reset(dim, g_store.storage());
+    g_doc_texts.clear();
+    return JNI_TRUE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_ragapp_LlamaBridge_compactIndex(
+        JNIEnv*, jclass /*clazz*/) {
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    return g_index.compact() ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_closeIndex(
+        JNIEnv*, jclass /*clazz*/) {
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    g_index.close();
+    g_lexical_stale = true;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_clearDocuments(
+        JNIEnv*, jclass /*clazz*/) {
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    g_store.reset(g_store.dim(), g_store.storage());
+    g_doc_texts.clear();
+    if (!g_index.is_open()) {
+        g_lexical.clear();
+        g_lexical_stale = false;
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_ragapp_LlamaBridge_releaseEmbedder(
+        JNIEnv*, jclass /*clazz*/) {
+    std::lock_guard<std::mutex> lock(g_rag_mutex);
+    g_embedder.release();
+}
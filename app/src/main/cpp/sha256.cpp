@@ -0,0 +1,171 @@
+// app/src/main/cpp/sha256.cpp
+#include "sha256.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_SHA2)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#define SHA_ARM 1
+#endif
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline uint32_t load_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void compress_scalar(uint32_t st[8], const uint8_t* data, size_t n_blocks) {
+    uint32_t w[64];
+    for (; n_blocks > 0; --n_blocks, data += 64) {
+        for (int i = 0; i < 16; ++i) w[i] = load_be32(data + 4 * i);
+        for (int i = 16; i < 64; ++i) {
+            const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = st[0], b = st[1], c = st[2], d = st[3], e = st[4], f = st[5], g = st[6], h = st[7];
+        for (int i = 0; i < 64; ++i) {
+            const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+        st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+    }
+}
+
+#if SHA_ARM
+
+// 16 nhóm 4 vòng; lịch message W[4i+16..4i+19] được tính ngay sau khi dùng W[4i..4i+3]
+static void compress_arm(uint32_t st[8], const uint8_t* data, size_t n_blocks) {
+    uint32x4_t s0 = vld1q_u32(st);
+    uint32x4_t s1 = vld1q_u32(st + 4);
+    for (; n_blocks > 0; --n_blocks, data += 64) {
+        const uint32x4_t save0 = s0, save1 = s1;
+        uint32x4_t m[4];
+        for (int i = 0; i < 4; ++i) m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+        for (int i = 0; i < 16; ++i) {
+            const uint32x4_t wk   = vaddq_u32(m[i & 3], vld1q_u32(K + 4 * i));
+            const uint32x4_t abcd = s0;
+            s0 = vsha256hq_u32(s0, s1, wk);
+            s1 = vsha256h2q_u32(s1, abcd, wk);
+            if (i < 12) {
+                m[i & 3] = vsha256su1q_u32(vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]), m[(i + 2) & 3], m[(i + 3) & 3]);
+            }
+        }
+        s0 = vaddq_u32(s0, save0);
+        s1 = vaddq_u32(s1, save1);
+    }
+    vst1q_u32(st, s0);
+    vst1q_u32(st + 4, s1);
+}
+
+static const bool g_hw = (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+
+#endif
+
+bool Sha256::hw_accelerated() {
+#if SHA_ARM
+    return g_hw;
+#else
+    return false;
+#endif
+}
+
+static inline void compress(uint32_t st[8], const uint8_t* data, size_t n_blocks) {
+#if SHA_ARM
+    if (g_hw) {
+        compress_arm(st, data, n_blocks);
+        return;
+    }
+#endif
+    compress_scalar(st, data, n_blocks);
+}
+
+void Sha256::reset() {
+    static const uint32_t init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memcpy(state_, init, sizeof(state_));
+    buf_len_ = 0;
+    total_   = 0;
+}
+
+void Sha256::update(const uint8_t* data, size_t n) {
+    total_ += n;
+    if (buf_len_ > 0) {
+        const size_t take = std::min(n, sizeof(buf_) - buf_len_);
+        memcpy(buf_ + buf_len_, data, take);
+        buf_len_ += take;
+        data += take;
+        n -= take;
+        if (buf_len_ < sizeof(buf_)) return;
+        compress(state_, buf_, 1);
+        buf_len_ = 0;
+    }
+    if (n >= 64) {
+        compress(state_, data, n / 64);
+        data += n / 64 * 64;
+        n %= 64;
+    }
+    memcpy(buf_, data, n);
+    buf_len_ = n;
+}
+
+void Sha256::final(uint8_t out[kDigestSize]) {
+    const uint64_t bits = total_ * 8;
+    uint8_t pad[72] = { 0x80 };
+    const size_t pad_len = (buf_len_ < 56 ? 56 : 120) - buf_len_;
+    for (int i = 0; i < 8; ++i) pad[pad_len + i] = (uint8_t)(bits >> (56 - 8 * i));
+    update(pad, pad_len + 8);
+    for (int i = 0; i < 8; ++i) {
+        out[4 * i]     = (uint8_t)(state_[i] >> 24);
+        out[4 * i + 1] = (uint8_t)(state_[i] >> 16);
+        out[4 * i + 2] = (uint8_t)(state_[i] >> 8);
+        out[4 * i + 3] = (uint8_t)state_[i];
+    }
+}
+
+std::string Sha256::final_hex() {
+    uint8_t d[kDigestSize];
+    final(d);
+    return to_hex(d, sizeof(d));
+}
+
+std::string to_hex(const uint8_t* data, size_t n) {
+    static const char* digits = "0123456789abcdef";
+    std::string s(n * 2, '0');
+    for (size_t i = 0; i < n; ++i) {
+        s[2 * i]     = digits[data[i] >> 4];
+        s[2 * i + 1] = digits[data[i] & 15];
+    }
+    return s;
+}
+
+std::string sha256_hex(const uint8_t* data, size_t n) {
+    Sha256 h;
+    h.update(data, n);
+    return h.final_hex();
+}
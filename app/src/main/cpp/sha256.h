@@ -0,0 +1,31 @@
+// app/src/main/cpp/sha256.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// SHA-256 (FIPS 180-4). arm64: dùng lệnh SHA2 của ARMv8 khi toolchain bật __ARM_FEATURE_SHA2
+// và CPU báo HWCAP_SHA2, nếu không thì bản scalar.
+class Sha256 {
+public:
+    static constexpr size_t kDigestSize = 32;
+
+    Sha256() { reset(); }
+    void reset();
+    void update(const uint8_t* data, size_t n);
+    void final(uint8_t out[kDigestSize]);
+    std::string final_hex();
+
+    // true nếu đang dùng lệnh SHA2 phần cứng
+    static bool hw_accelerated();
+
+private:
+    uint32_t state_[8];
+    uint8_t  buf_[64];
+    size_t   buf_len_ = 0;
+    uint64_t total_   = 0;
+};
+
+std::string sha256_hex(const uint8_t* data, size_t n);
+std::string to_hex(const uint8_t* data, size_t n);
@@ -0,0 +1,157 @@
+// app/src/main/cpp/tests/fast_sampler_test.cpp
+//
+// Test host: FastSampler đường nhanh (exact = false) phải chọn đúng token như đường tham chiếu
+// (exact = true) trên cùng logits + seed, có và không có penalties. Có cả phân phối phẳng để đi qua
+// bước nới k (x4) và bước sắp xếp cả vocab. Chạy bằng ctest; mã thoát khác 0 khi có sai khác.
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fast_sampler.h"
+
+namespace {
+
+constexpr int kVocab = 151936;   // cỡ vocab Qwen2
+constexpr int kSteps = 64;    // = penalty_last_n: cửa sổ penalties đầy ở cuối
+
+// Logits cho từng bước: base cố định + nhiễu nhỏ trên các token gần max (chỉ chúng có thể được
+// chọn), để các token được chọn lặp lại và penalties có tác dụng
+struct LogitGen {
+    std::vector<float>   base;
+    std::vector<int32_t> hot;
+    float                noise = 0.f;
+    std::mt19937         rng{ 1234 };
+
+    void finish() {
+        const float m = *std::max_element(base.begin(), base.end());
+        for (size_t i = 0; i < base.size(); ++i) {
+            if (base[i] >= m - FastSampler::kGatherNats) hot.push_back((int32_t)i);
+        }
+    }
+    void fill(std::vector<float>& out) {
+        std::uniform_real_distribution<float> u(-noise, noise);
+        out = base;
+        for (int32_t i : hot) out[(size_t)i] += u(rng);
+    }
+};
+
+// Phân phối nhọn kiểu LM: đa số logit thấp, vài chục token nổi lên
+LogitGen peaked() {
+    LogitGen g;
+    std::mt19937 rng(42);
+    std::normal_distribution<float> nd(0.f, 2.f);
+    g.base.resize(kVocab);
+    for (float& l : g.base) l = nd(rng);
+    for (int i = 0; i < 40; ++i) g.base[(size_t)(rng() % kVocab)] = 14.f + (float)(i % 7);
+    g.noise = 0.5f;
+    g.finish();
+    return g;
+}
+
+// n_near token gần như bằng nhau, phần còn lại thấp hơn max far_gap nats
+LogitGen flat(int n_near, float far_gap) {
+    LogitGen g;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> u(0.f, 1.f);
+    g.base.assign(kVocab, -far_gap);
+    for (int i = 0; i < n_near; ++i) g.base[(size_t)(rng() % kVocab)] = u(rng);
+    g.noise = 0.05f;
+    g.finish();
+    return g;
+}
+
+struct Run {
+    std::vector<llama_token> tokens;
+    int                      n_full_sort = 0;
+};
+
+Run run(LogitGen gen, FastSamplerParams p, bool exact) {
+    p.exact = exact;
+    FastSampler s(kVocab, p);
+    Run r;
+    std::vector<float> logits;
+    for (int i = 0; i < kSteps; ++i) {
+        gen.fill(logits);
+        const std::vector<float> before = logits;
+        const llama_token tok = s.sample(logits.data());
+        // penalties chỉ được ghi tạm: logits phải còn nguyên sau khi chọn
+        if (logits != before) {
+            std::fprintf(stderr, "logits modified at step %d\n", i);
+            r.tokens.push_back(-1);
+            break;
+        }
+        s.accept(tok);
+        r.tokens.push_back(tok);
+    }
+    r.n_full_sort = s.n_full_sort();
+    return r;
+}
+
+int g_failed = 0;
+
+// want_full_sort: -1 không kiểm, 0 đường nhanh không được sắp xếp cả vocab, 1 phải có
+void check(const char* name, const LogitGen& gen, FastSamplerParams p, int want_full_sort) {
+    const Run ref  = run(gen, p, /*exact*/ true);
+    const Run fast = run(gen, p, /*exact*/ false);
+
+    size_t first_diff = ref.tokens.size();
+    for (size_t i = 0; i < ref.tokens.size(); ++i) {
+        if (i >= fast.tokens.size() || ref.tokens[i] != fast.tokens[i]) {
+            first_diff = i;
+            break;
+        }
+    }
+    bool ok = first_diff == ref.tokens.size() && fast.tokens.size() == ref.tokens.size();
+    if (want_full_sort == 0 && fast.n_full_sort != 0) ok = false;
+    if (want_full_sort == 1 && fast.n_full_sort == 0) ok = false;
+
+    std::vector<llama_token> distinct = ref.tokens;
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+    std::printf("%-36s %s  tokens=%zu distinct=%zu full_sort=%d", name, ok ? "ok  " : "FAIL",
+                ref.tokens.size(), distinct.size(), fast.n_full_sort);
+    if (first_diff < ref.tokens.size()) {
+        std::printf("  first diff @%zu: exact=%d fast=%d", first_diff, ref.tokens[first_diff],
+                    first_diff < fast.tokens.size() ? fast.tokens[first_diff] : -1);
+    }
+    std::printf("\n");
+    if (!ok) ++g_failed;
+}
+
+FastSamplerParams params(float temp, float top_p, bool penalties) {
+    FastSamplerParams p;
+    p.temp  = temp;
+    p.top_p = top_p;
+    p.seed  = 20240601;
+    if (penalties) {
+        p.penalty_last_n  = 64;
+        p.penalty_repeat  = 1.3f;
+        p.penalty_freq    = 0.2f;
+        p.penalty_present = 0.1f;
+    } else {
+        p.penalty_repeat = 1.0f;
+    }
+    return p;
+}
+
+}  // namespace
+
+int main() {
+    const LogitGen lm = peaked();
+    for (const bool pen : { false, true }) {
+        const std::string sfx = pen ? " +penalties" : "";
+        check(("greedy" + sfx).c_str(),        lm, params(0.f, 0.95f, pen), -1);
+        check(("peaked t0.7 p0.95" + sfx).c_str(), lm, params(0.7f, 0.95f, pen), 0);
+        check(("peaked t1.0 p1.0" + sfx).c_str(),  lm, params(1.0f, 1.0f, pen), -1);
+        // ~3000 token ngang nhau: nucleus vượt kTopK, k nới 256 -> 1024 -> 3000 mà không cần cả vocab
+        check(("flat near t1.0 p0.98" + sfx).c_str(), flat(3000, 20.f), params(1.0f, 0.98f, pen), 0);
+        // phần đuôi trong kGatherNats-ngoài: top_p sát 1 buộc đi tới bước sắp xếp cả vocab
+        check(("flat tail t1.0 p0.999999" + sfx).c_str(), flat(1000, 17.f), params(1.0f, 0.999999f, pen), 1);
+    }
+    std::printf("%s\n", g_failed ? "FAILED" : "ALL OK");
+    return g_failed ? 1 : 0;
+}
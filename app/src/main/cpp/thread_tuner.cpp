@@ -0,0 +1,108 @@
+// app/src/main/cpp/thread_tuner.cpp
+#include "thread_tuner.h"
+#include "bridge_log.h"
+
+#include <algorithm>
+
+static void push_unique(std::vector<int>& v, int x, int lo, int hi) {
+    x = std::max(lo, std::min(x, hi));
+    if (std::find(v.begin(), v.end(), x) == v.end()) v.push_back(x);
+}
+
+std::vector<ThreadConfig> thread_candidates(const std::vector<CpuInfo>& cpus) {
+    const int n_cpu = std::max(1, (int)cpus.size());
+    const int big   = big_core_count(cpus);
+
+    std::vector<int> dec, pre;
+    push_unique(dec, std::min(big, 4), 1, n_cpu);
+    push_unique(dec, big, 1, n_cpu);
+    push_unique(dec, big - 1, 1, n_cpu);
+    push_unique(dec, big / 2, 1, n_cpu);
+    push_unique(dec, big + 1, 1, n_cpu);
+
+    push_unique(pre, big, 1, n_cpu);
+    push_unique(pre, n_cpu, 1, n_cpu);
+    push_unique(pre, big + (n_cpu - big) / 2, 1, n_cpu);
+    push_unique(pre, big - 1, 1, n_cpu);
+
+    std::vector<ThreadConfig> out;
+    const size_t n = std::max(dec.size(), pre.size());
+    for (size_t i = 0; i < n; ++i) {
+        out.push_back({ dec[std::min(i, dec.size() - 1)], pre[std::min(i, pre.size() - 1)] });
+    }
+    return out;
+}
+
+// Một lần chạy probe; false nếu lỗi. aborted = bị chat chen ngang nên số đo không dùng được.
+static bool run_probe(InferenceEngine& engine, int seq, const std::vector<llama_token>& probe, int n_decode,
+                      ThreadTrial& trial, bool& aborted) {
+    auto lease = engine.lease(seq);
+    engine.with_slot(seq, [seq](llama_context* ctx, std::vector<llama_token>& tokens) {
+        llama_memory_seq_rm(llama_get_memory(ctx), seq, -1, -1);
+        tokens.clear();
+    });
+
+    GenRequest req;
+    req.prompt        = probe;
+    req.max_tokens    = n_decode;
+    req.temp          = 0.f;
+    req.priority      = GenPriority::Background;
+    req.seq           = seq;
+    req.speculative   = false;   // decode đúng 1 token / lần để đo n_threads
+    req.context_shift = false;
+    auto job = engine.submit(std::move(req));
+    if (!job) return false;
+    std::string ignored;
+    while (job->wait_output(&ignored)) ignored.clear();
+    if (!job->ok()) return false;
+
+    const GenStats& st = job->stats();
+    aborted = st.aborts > 0;
+    trial.prefill_tok_s = st.prefill_ms > 0 ? st.n_prefill * 1000.0 / st.prefill_ms : 0;
+    trial.decode_ms_tok = st.token_ms.count() >= 4 ? st.token_ms.mean_ms() : 0;
+    return true;
+}
+
+ThreadTuneResult autotune_threads(InferenceEngine& engine, int seq, const std::vector<llama_token>& probe,
+                                  int n_decode, const std::vector<ThreadConfig>& candidates) {
+    ThreadTuneResult res;
+    const ThreadConfig orig{ engine.n_threads_decode(), engine.n_threads_prefill() };
+    res.best = orig;
+    if (!engine.is_loaded() || probe.empty() || candidates.empty()) return res;
+
+    // làm nóng cache / trang model với cấu hình hiện tại, không tính
+    ThreadTrial warm;
+    bool aborted = false;
+    if (!run_probe(engine, seq, probe, n_decode, warm, aborted)) return res;
+
+    for (const ThreadConfig& cfg : candidates) {
+        engine.set_threads(cfg.n_decode, cfg.n_prefill);
+        ThreadTrial t;
+        t.cfg = cfg;
+        bool ok = run_probe(engine, seq, probe, n_decode, t, aborted);
+        if (ok && aborted) ok = run_probe(engine, seq, probe, n_decode, t, aborted);
+        if (!ok || aborted) {
+            t.prefill_tok_s = 0;
+            t.decode_ms_tok = 0;
+        }
+        LOGI("autotune: decode=%d prefill=%d -> prefill %.1f tok/s, decode %.2f ms/tok",
+             cfg.n_decode, cfg.n_prefill, t.prefill_tok_s, t.decode_ms_tok);
+        res.trials.push_back(t);
+    }
+
+    double best_prefill = 0, best_decode = 0;
+    for (const ThreadTrial& t : res.trials) {
+        if (t.prefill_tok_s > best_prefill) {
+            best_prefill       = t.prefill_tok_s;
+            res.best.n_prefill = t.cfg.n_prefill;
+        }
+        if (t.decode_ms_tok > 0 && (best_decode == 0 || t.decode_ms_tok < best_decode)) {
+            best_decode       = t.decode_ms_tok;
+            res.best.n_decode = t.cfg.n_decode;
+        }
+    }
+    res.ok = best_prefill > 0 || best_decode > 0;
+    engine.set_threads(res.best.n_decode, res.best.n_prefill);
+    LOGI("autotune: best decode=%d prefill=%d", res.best.n_decode, res.best.n_prefill);
+    return res;
+}
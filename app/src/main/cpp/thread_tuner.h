@@ -0,0 +1,33 @@
+// app/src/main/cpp/thread_tuner.h
+#pragma once
+
+#include <vector>
+
+#include "cpu_threads.h"
+#include "engine.h"
+
+// Kết quả đo một cấu hình luồng
+struct ThreadTrial {
+    ThreadConfig cfg;
+    double prefill_tok_s  = 0;   // 0 = không đo được (bị ngắt)
+    double decode_ms_tok  = 0;   // trung bình ms / token sau token đầu; 0 = không đủ token
+};
+
+struct ThreadTuneResult {
+    bool         ok = false;
+    ThreadConfig best;
+    std::vector<ThreadTrial> trials;
+};
+
+// Các cặp (decode, prefill) cần thử, suy ra từ topology: decode quanh số lõi lớn,
+// prefill từ số lõi lớn tới mọi lõi. Số luồng decode và prefill được đo độc lập trong cùng
+// một lần chạy (llama dùng n_threads cho batch 1 token, n_threads_batch cho prefill),
+// nên hai danh sách được ghép theo cặp thay vì tích Descartes.
+std::vector<ThreadConfig> thread_candidates(const std::vector<CpuInfo>& cpus);
+
+// Micro-benchmark trên engine đã load: mỗi ứng viên prefill probe (KV của slot được xoá trước)
+// rồi decode n_decode token, dưới dạng request Background trên slot seq (bên gọi không giữ
+// lease của slot này). Lần đo bị chat chen ngang (aborts > 0) được đo lại một lần.
+// Chọn riêng số luồng prefill nhanh nhất và số luồng decode nhanh nhất rồi áp dụng cho engine.
+ThreadTuneResult autotune_threads(InferenceEngine& engine, int seq, const std::vector<llama_token>& probe,
+                                  int n_decode, const std::vector<ThreadConfig>& candidates);
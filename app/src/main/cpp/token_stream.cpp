@@ -0,0 +1,51 @@
+// app/src/main/cpp/token_stream.cpp
+#include "token_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+size_t Utf8Assembler::push(const char* p, size_t n) {
+    buf_.append(p, n);
+
+    // Lùi tối đa 3 byte tìm byte dẫn của code point cuối
+    const size_t size = buf_.size();
+    for (size_t back = 1; back <= std::min<size_t>(4, size); ++back) {
+        const unsigned char c = (unsigned char)buf_[size - back];
+        if ((c & 0xC0) == 0x80) continue;          // byte tiếp nối
+        const size_t need = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+        return need > back ? size - back : size;
+    }
+    return size;   // byte hỏng: nhả ra nguyên trạng
+}
+
+ByteRing::ByteRing(uint8_t* base, size_t cap, int flush_ms, size_t flush_bytes, Deliver deliver)
+    : base_(base), cap_(cap),
+      flush_bytes_(std::max<size_t>(1, std::min(flush_bytes, cap / 2))),
+      flush_every_(std::chrono::milliseconds(std::max(0, flush_ms))),
+      deliver_(std::move(deliver)),
+      last_(std::chrono::steady_clock::now()) {}
+
+bool ByteRing::write(const char* p, size_t n) {
+    while (n > 0) {
+        if (len_ == cap_ && !flush()) return false;
+        const size_t at    = (start_ + len_) % cap_;
+        const size_t chunk = std::min({ n, cap_ - len_, cap_ - at });
+        memcpy(base_ + at, p, chunk);
+        len_   += chunk;
+        total_ += chunk;
+        p      += chunk;
+        n      -= chunk;
+    }
+    if (len_ >= flush_bytes_ || std::chrono::steady_clock::now() - last_ >= flush_every_) return flush();
+    return true;
+}
+
+bool ByteRing::flush() {
+    last_ = std::chrono::steady_clock::now();
+    if (len_ == 0) return true;
+    const bool ok = deliver_(start_, len_);
+    start_ = (start_ + len_) % cap_;
+    len_   = 0;
+    ++batches_;
+    return ok;
+}
@@ -0,0 +1,65 @@
+// app/src/main/cpp/token_stream.h
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Đầu ra văn bản của vòng sinh token
+struct StreamSink {
+    virtual ~StreamSink() = default;
+    // Chỉ nhận UTF-8 trọn code point; false = dừng sinh
+    virtual bool write(const char* s, size_t n) = 0;
+    virtual bool flush() { return true; }
+    // Tiến độ prefill prompt (done / total token); false = huỷ
+    virtual bool progress(int /*done*/, int /*total*/) { return true; }
+    // Số liệu của request (thứ tự theo GenerationMetrics phía Kotlin), gọi trước completed()
+    virtual void metrics(const double* /*values*/, size_t /*n*/) {}
+    virtual void completed() = 0;
+    virtual void error(const char* msg) = 0;
+};
+
+// Ghép byte của các piece: một ký tự tiếng Việt (2-3 byte) thường bị chia qua hai token
+class Utf8Assembler {
+public:
+    // Nối piece; trả về số byte đầu của data() đã trọn code point
+    size_t push(const char* p, size_t n);
+    const char* data()    const { return buf_.data(); }
+    size_t      pending() const { return buf_.size(); }
+    void consume(size_t n) { buf_.erase(0, n); }
+    void clear() { buf_.clear(); }
+
+private:
+    std::string buf_;
+};
+
+// Ring byte trên vùng nhớ của một direct ByteBuffer. Native chỉ ghi; dữ liệu được giao theo lô
+// qua deliver(offset, len) khi đủ flush_bytes byte hoặc đã qua flush_ms kể từ lô trước.
+// Lô có thể vòng qua cuối ring; bên nhận phải đọc xong trước khi deliver trả về.
+class ByteRing {
+public:
+    using Deliver = std::function<bool(size_t offset, size_t len)>;
+
+    ByteRing(uint8_t* base, size_t cap, int flush_ms, size_t flush_bytes, Deliver deliver);
+
+    bool write(const char* p, size_t n);
+    bool flush();
+
+    uint64_t bytes_total() const { return total_; }
+    uint64_t batches()     const { return batches_; }
+
+private:
+    uint8_t*  base_;
+    size_t    cap_;
+    size_t    flush_bytes_;
+    std::chrono::steady_clock::duration flush_every_;
+    Deliver   deliver_;
+
+    size_t    start_   = 0;   // offset đầu lô chưa giao
+    size_t    len_     = 0;
+    uint64_t  total_   = 0;
+    uint64_t  batches_ = 0;
+    std::chrono::steady_clock::time_point last_;
+};
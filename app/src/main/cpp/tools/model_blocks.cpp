@@ -0,0 +1,55 @@
+// app/src/main/cpp/tools/model_blocks.cpp
+//
+// Công cụ đóng gói (host): sinh các trường kiểm tra của một model cho manifest.json
+// (size_bytes, sha256, block_size, block_sha256) bằng đúng code băm mà app dùng khi kiểm tra.
+//
+//   model_blocks model.gguf [--block-size MB] [--threads N]
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "model_verify.h"
+
+int main(int argc, char** argv) {
+    std::string path;
+    uint64_t block_mb = 16;
+    int n_threads = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--block-size") && i + 1 < argc) {
+            block_mb = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            n_threads = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && path.empty()) {
+            path = argv[i];
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty() || block_mb == 0) {
+        fprintf(stderr, "usage: %s model.gguf [--block-size MB] [--threads N]\n", argv[0]);
+        return 2;
+    }
+
+    const FileIdentity id = file_identity(path);
+    const uint64_t block_size = block_mb << 20;
+    std::vector<std::string> blocks;
+    if (id.ok) blocks = hash_blocks(path, block_size, n_threads);
+    const std::string whole = blocks.empty() ? std::string() : sha256_file(path);
+    if (whole.empty()) {
+        fprintf(stderr, "cannot read %s\n", path.c_str());
+        return 1;
+    }
+
+    printf("{\n  \"size_bytes\": %" PRIu64 ",\n  \"sha256\": \"%s\",\n  \"block_size\": %" PRIu64 ",\n"
+           "  \"block_sha256\": [\n", id.size, whole.c_str(), block_size);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        printf("    \"%s\"%s\n", blocks[i].c_str(), i + 1 < blocks.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
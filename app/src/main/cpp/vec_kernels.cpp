@@ -0,0 +1,385 @@
+// app/src/main/cpp/vec_kernels.cpp
+#include "vec_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define VECK_NEON 1
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+// SDOT (ARMv8.2 dotprod) không có trong baseline arm64-v8a: chỉ bật cho từng hàm, chọn theo HWCAP
+#if defined(__clang__)
+#define VECK_DOTPROD_TARGET __attribute__((target("dotprod")))
+#else
+#define VECK_DOTPROD_TARGET __attribute__((target("+dotprod")))
+#endif
+#define VECK_DOTPROD 1
+#endif
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VECK_X86 1
+#endif
+
+namespace veck {
+
+// ---------- scalar ----------
+
+static float dot_f32_scalar(const float* a, const float* b, size_t n) {
+    float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i]     * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static int32_t dot_i8_scalar(const int8_t* a, const int8_t* b, size_t n) {
+    int32_t s = 0;
+    for (size_t i = 0; i < n; ++i) s += (int32_t)a[i] * (int32_t)b[i];
+    return s;
+}
+
+static float max_f32_scalar(const float* v, size_t n) {
+    float m = n > 0 ? v[0] : -INFINITY;
+    for (size_t i = 1; i < n; ++i) m = std::max(m, v[i]);
+    return m;
+}
+
+static double sum_exp_f32_scalar(const float* v, size_t n, float shift) {
+    double s = 0.0;
+    for (size_t i = 0; i < n; ++i) s += std::exp(v[i] - shift);
+    return s;
+}
+
+static constexpr size_t kSumBlock = 1024;   // số phần tử cộng float trước khi dồn sang double
+
+static size_t select_ge_scalar(const float* v, size_t n, float thr, int32_t* out) {
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (v[i] >= thr) out[k++] = (int32_t)i;
+    }
+    return k;
+}
+
+// expf kiểu Cephes cho x <= 0: x = n*ln2 + r, exp(r) theo đa thức bậc 7, nhân 2^n qua số mũ.
+// x được kẹp ở -87.3 để 2^n còn là số chuẩn (exp(-87.3) ~ 1e-38, không ảnh hưởng tổng).
+static constexpr float kExpLo   = -87.3f;
+static constexpr float kLog2e   = 1.44269504088896341f;
+static constexpr float kLn2Hi   = 0.693359375f;
+static constexpr float kLn2Lo   = -2.12194440e-4f;
+static constexpr float kExpP0   = 1.9875691500e-4f;
+static constexpr float kExpP1   = 1.3981999507e-3f;
+static constexpr float kExpP2   = 8.3334519073e-3f;
+static constexpr float kExpP3   = 4.1665795894e-2f;
+static constexpr float kExpP4   = 1.6666665459e-1f;
+static constexpr float kExpP5   = 5.0000001201e-1f;
+
+#if VECK_NEON
+
+static inline float32x4_t exp_neg_f32x4(float32x4_t x) {
+    x = vmaxq_f32(x, vdupq_n_f32(kExpLo));
+    const int32x4_t   ni = vcvtnq_s32_f32(vmulq_n_f32(x, kLog2e));
+    const float32x4_t nf = vcvtq_f32_s32(ni);
+    float32x4_t r = vfmsq_f32(x, nf, vdupq_n_f32(kLn2Hi));
+    r = vfmsq_f32(r, nf, vdupq_n_f32(kLn2Lo));
+    float32x4_t y = vfmaq_f32(vdupq_n_f32(kExpP1), r, vdupq_n_f32(kExpP0));
+    y = vfmaq_f32(vdupq_n_f32(kExpP2), y, r);
+    y = vfmaq_f32(vdupq_n_f32(kExpP3), y, r);
+    y = vfmaq_f32(vdupq_n_f32(kExpP4), y, r);
+    y = vfmaq_f32(vdupq_n_f32(kExpP5), y, r);
+    y = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.f)), y, vmulq_f32(r, r));
+    const float32x4_t scale = vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(ni, vdupq_n_s32(127)), 23));
+    return vmulq_f32(y, scale);
+}
+
+float max_f32(const float* v, size_t n) {
+    if (n < 16) return max_f32_scalar(v, n);
+    float32x4_t m0 = vld1q_f32(v), m1 = m0, m2 = m0, m3 = m0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        m0 = vmaxq_f32(m0, vld1q_f32(v + i));
+        m1 = vmaxq_f32(m1, vld1q_f32(v + i + 4));
+        m2 = vmaxq_f32(m2, vld1q_f32(v + i + 8));
+        m3 = vmaxq_f32(m3, vld1q_f32(v + i + 12));
+    }
+    float m = vmaxvq_f32(vmaxq_f32(vmaxq_f32(m0, m1), vmaxq_f32(m2, m3)));
+    for (; i < n; ++i) m = std::max(m, v[i]);
+    return m;
+}
+
+double sum_exp_f32(const float* v, size_t n, float shift) {
+    const float32x4_t vs = vdupq_n_f32(shift);
+    double s = 0.0;
+    size_t i = 0;
+    while (i + 8 <= n) {
+        float32x4_t acc0 = vdupq_n_f32(0.f), acc1 = vdupq_n_f32(0.f);
+        const size_t end = std::min(n, i + kSumBlock);
+        for (; i + 8 <= end; i += 8) {
+            acc0 = vaddq_f32(acc0, exp_neg_f32x4(vsubq_f32(vld1q_f32(v + i), vs)));
+            acc1 = vaddq_f32(acc1, exp_neg_f32x4(vsubq_f32(vld1q_f32(v + i + 4), vs)));
+        }
+        s += vaddvq_f32(vaddq_f32(acc0, acc1));
+    }
+    for (; i < n; ++i) s += std::exp(v[i] - shift);
+    return s;
+}
+
+size_t select_ge(const float* v, size_t n, float thr, int32_t* out) {
+    const float32x4_t vt = vdupq_n_f32(thr);
+    size_t k = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const uint32x4_t m = vorrq_u32(vcgeq_f32(vld1q_f32(v + i), vt), vcgeq_f32(vld1q_f32(v + i + 4), vt));
+        if (vmaxvq_u32(m) == 0) continue;   // đa số nhóm không có phần tử nào
+        for (size_t j = i; j < i + 8; ++j) {
+            if (v[j] >= thr) out[k++] = (int32_t)j;
+        }
+    }
+    for (; i < n; ++i) {
+        if (v[i] >= thr) out[k++] = (int32_t)i;
+    }
+    return k;
+}
+
+float dot_f32(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.f), acc1 = vdupq_n_f32(0.f);
+    float32x4_t acc2 = vdupq_n_f32(0.f), acc3 = vdupq_n_f32(0.f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i),      vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4),  vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8),  vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float s = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < n; ++i) s += a[i] * b[i];
+    return s;
+}
+
+#if VECK_DOTPROD
+VECK_DOTPROD_TARGET
+static int32_t dot_i8_sdot(const int8_t* a, const int8_t* b, size_t n) {
+    int32x4_t acc0 = vdupq_n_s32(0), acc1 = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = vdotq_s32(acc0, vld1q_s8(a + i),      vld1q_s8(b + i));
+        acc1 = vdotq_s32(acc1, vld1q_s8(a + i + 16), vld1q_s8(b + i + 16));
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = vdotq_s32(acc0, vld1q_s8(a + i), vld1q_s8(b + i));
+    }
+    int32_t s = vaddvq_s32(vaddq_s32(acc0, acc1));
+    for (; i < n; ++i) s += (int32_t)a[i] * (int32_t)b[i];
+    return s;
+}
+
+static const bool g_has_dotprod = (getauxval(AT_HWCAP) & HWCAP_ASIMDDP) != 0;
+#endif
+
+int32_t dot_i8(const int8_t* a, const int8_t* b, size_t n) {
+#if VECK_DOTPROD
+    if (g_has_dotprod) return dot_i8_sdot(a, b, n);
+#endif
+    // |a*b| <= 127*127 nên cộng 2 tích vào int16 vẫn an toàn trước khi nới lên int32
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const int8x16_t va = vld1q_s8(a + i);
+        const int8x16_t vb = vld1q_s8(b + i);
+        int16x8_t p = vmull_s8(vget_low_s8(va), vget_low_s8(vb));
+        p = vmlal_high_s8(p, va, vb);
+        acc = vpadalq_s16(acc, p);
+    }
+    int32_t s = vaddvq_s32(acc);
+    for (; i < n; ++i) s += (int32_t)a[i] * (int32_t)b[i];
+    return s;
+}
+
+#elif VECK_X86
+
+__attribute__((target("avx2,fma")))
+static float dot_f32_avx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),     _mm256_loadu_ps(b + i),     acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 lo  = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    float s = _mm_cvtss_f32(lo);
+    for (; i < n; ++i) s += a[i] * b[i];
+    return s;
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_i8_avx2(const int8_t* a, const int8_t* b, size_t n) {
+    // maddubs cần (u8 x s8): dùng |a| và sign(b, a); giá trị đã kẹp trong [-127, 127]
+    // nên tổng hai tích trong int16 không bão hoà.
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const __m256i a0 = _mm256_loadu_si256((const __m256i*)(a + i));
+        const __m256i b0 = _mm256_loadu_si256((const __m256i*)(b + i));
+        const __m256i a1 = _mm256_loadu_si256((const __m256i*)(a + i + 32));
+        const __m256i b1 = _mm256_loadu_si256((const __m256i*)(b + i + 32));
+        const __m256i p0 = _mm256_maddubs_epi16(_mm256_sign_epi8(a0, a0), _mm256_sign_epi8(b0, a0));
+        const __m256i p1 = _mm256_maddubs_epi16(_mm256_sign_epi8(a1, a1), _mm256_sign_epi8(b1, a1));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(p0, ones));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(p1, ones));
+    }
+    const __m256i acc = _mm256_add_epi32(acc0, acc1);
+    __m128i s4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0x4e));
+    s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0xb1));
+    int32_t s = _mm_cvtsi128_si32(s4);
+    for (; i < n; ++i) s += (int32_t)a[i] * (int32_t)b[i];
+    return s;
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_neg_f32x8(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(kExpLo));
+    const __m256  nf = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(kLog2e)),
+                                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    const __m256i ni = _mm256_cvtps_epi32(nf);
+    __m256 r = _mm256_fnmadd_ps(nf, _mm256_set1_ps(kLn2Hi), x);
+    r = _mm256_fnmadd_ps(nf, _mm256_set1_ps(kLn2Lo), r);
+    __m256 y = _mm256_fmadd_ps(_mm256_set1_ps(kExpP0), r, _mm256_set1_ps(kExpP1));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(kExpP2));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(kExpP3));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(kExpP4));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(kExpP5));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+    const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(ni, _mm256_set1_epi32(127)), 23));
+    return _mm256_mul_ps(y, scale);
+}
+
+__attribute__((target("avx2,fma")))
+static float hsum_f32x8(__m256 v) {
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma")))
+static float max_f32_avx2(const float* v, size_t n) {
+    if (n < 16) return max_f32_scalar(v, n);
+    __m256 m0 = _mm256_loadu_ps(v), m1 = m0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        m0 = _mm256_max_ps(m0, _mm256_loadu_ps(v + i));
+        m1 = _mm256_max_ps(m1, _mm256_loadu_ps(v + i + 8));
+    }
+    m0 = _mm256_max_ps(m0, m1);
+    __m128 lo = _mm_max_ps(_mm256_castps256_ps128(m0), _mm256_extractf128_ps(m0, 1));
+    lo = _mm_max_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_max_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    float m = _mm_cvtss_f32(lo);
+    for (; i < n; ++i) m = std::max(m, v[i]);
+    return m;
+}
+
+__attribute__((target("avx2,fma")))
+static double sum_exp_f32_avx2(const float* v, size_t n, float shift) {
+    const __m256 vs = _mm256_set1_ps(shift);
+    double s = 0.0;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        const size_t end = std::min(n, i + kSumBlock);
+        for (; i + 16 <= end; i += 16) {
+            acc0 = _mm256_add_ps(acc0, exp_neg_f32x8(_mm256_sub_ps(_mm256_loadu_ps(v + i), vs)));
+            acc1 = _mm256_add_ps(acc1, exp_neg_f32x8(_mm256_sub_ps(_mm256_loadu_ps(v + i + 8), vs)));
+        }
+        s += hsum_f32x8(_mm256_add_ps(acc0, acc1));
+    }
+    for (; i < n; ++i) s += std::exp(v[i] - shift);
+    return s;
+}
+
+__attribute__((target("avx2")))
+static size_t select_ge_avx2(const float* v, size_t n, float thr, int32_t* out) {
+    const __m256 vt = _mm256_set1_ps(thr);
+    size_t k = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(v + i), vt, _CMP_GE_OQ));
+        while (mask) {
+            out[k++] = (int32_t)(i + (size_t)__builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n; ++i) {
+        if (v[i] >= thr) out[k++] = (int32_t)i;
+    }
+    return k;
+}
+
+static const bool g_has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+float max_f32(const float* v, size_t n) {
+    return g_has_avx2 ? max_f32_avx2(v, n) : max_f32_scalar(v, n);
+}
+
+double sum_exp_f32(const float* v, size_t n, float shift) {
+    return g_has_avx2 ? sum_exp_f32_avx2(v, n, shift) : sum_exp_f32_scalar(v, n, shift);
+}
+
+size_t select_ge(const float* v, size_t n, float thr, int32_t* out) {
+    return g_has_avx2 ? select_ge_avx2(v, n, thr, out) : select_ge_scalar(v, n, thr, out);
+}
+
+float dot_f32(const float* a, const float* b, size_t n) {
+    return g_has_avx2 ? dot_f32_avx2(a, b, n) : dot_f32_scalar(a, b, n);
+}
+
+int32_t dot_i8(const int8_t* a, const int8_t* b, size_t n) {
+    return g_has_avx2 ? dot_i8_avx2(a, b, n) : dot_i8_scalar(a, b, n);
+}
+
+#else
+
+float   dot_f32(const float* a, const float* b, size_t n)   { return dot_f32_scalar(a, b, n); }
+int32_t dot_i8 (const int8_t* a, const int8_t* b, size_t n) { return dot_i8_scalar(a, b, n); }
+float   max_f32(const float* v, size_t n)                   { return max_f32_scalar(v, n); }
+double  sum_exp_f32(const float* v, size_t n, float shift)  { return sum_exp_f32_scalar(v, n, shift); }
+size_t  select_ge(const float* v, size_t n, float thr, int32_t* out) { return select_ge_scalar(v, n, thr, out); }
+
+#endif
+
+float normalize(float* v, size_t n) {
+    const float norm = std::sqrt(dot_f32(v, v, n));
+    if (norm > 0.f) {
+        const float inv = 1.f / norm;
+        for (size_t i = 0; i < n; ++i) v[i] *= inv;
+    }
+    return norm;
+}
+
+float quantize_i8(const float* v, int8_t* q, size_t n) {
+    float amax = 0.f;
+    for (size_t i = 0; i < n; ++i) amax = std::max(amax, std::fabs(v[i]));
+    const float scale = amax > 0.f ? amax / 127.f : 1.f;
+    const float inv   = 1.f / scale;
+    for (size_t i = 0; i < n; ++i) {
+        q[i] = (int8_t)std::lround(std::min(127.f, std::max(-127.f, v[i] * inv)));
+    }
+    return scale;
+}
+
+} // namespace veck
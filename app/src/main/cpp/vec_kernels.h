@@ -0,0 +1,29 @@
+// app/src/main/cpp/vec_kernels.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernel dot-product dùng cho tìm kiếm vector.
+// arm64: NEON; dot_i8 dùng SDOT (dotprod) khi CPU có, chọn lúc runtime theo HWCAP.
+// x86_64: AVX2/FMA chọn lúc runtime, fallback scalar.
+namespace veck {
+
+float   dot_f32(const float* a, const float* b, size_t n);
+int32_t dot_i8 (const int8_t* a, const int8_t* b, size_t n);
+
+// L2-normalize tại chỗ; trả về norm ban đầu
+float normalize(float* v, size_t n);
+
+// Kernel cho sampler trên vocab lớn (logits ~151k phần tử mỗi token)
+float  max_f32(const float* v, size_t n);
+// sum exp(v[i] - shift), với v[i] <= shift (exp xấp xỉ đa thức, sai số tương đối ~1e-7;
+// cộng float theo khối rồi dồn sang double để tổng ~151k phần tử không mất chính xác)
+double sum_exp_f32(const float* v, size_t n, float shift);
+// Ghi chỉ số các phần tử v[i] >= thr vào out (cần đủ n chỗ), theo thứ tự tăng; trả về số phần tử
+size_t select_ge(const float* v, size_t n, float thr, int32_t* out);
+
+// Lượng tử hoá đối xứng theo hàng: q[i] = round(v[i] / scale), scale = max|v| / 127
+float quantize_i8(const float* v, int8_t* q, size_t n);
+
+} // namespace veck
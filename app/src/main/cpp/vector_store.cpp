@@ -0,0 +1,127 @@
+// app/src/main/cpp/vector_store.cpp
+#include "vector_store.h"
+#include "vec_kernels.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static constexpr size_t kAlign = 64;
+
+static size_t round_up(size_t v, size_t a) { return (v + a - 1) / a * a; }
+
+VectorStore::~VectorStore() {
+    free(data_);
+}
+
+void VectorStore::reset(int dim, Storage storage) {
+    free(data_);
+    data_      = nullptr;
+    cap_rows_  = 0;
+    dim_       = dim;
+    storage_   = storage;
+    row_bytes_ = round_up((size_t)dim * (storage == Storage::F32 ? sizeof(float) : 1), kAlign);
+    scales_.clear();
+    ids_.clear();
+}
+
+void VectorStore::reserve_rows(size_t rows) {
+    if (rows <= cap_rows_) return;
+    const size_t new_cap = std::max(rows, std::max<size_t>(1024, cap_rows_ * 2));
+
+    void* p = nullptr;
+    if (posix_memalign(&p, kAlign, new_cap * row_bytes_) != 0) return;
+    if (data_) {
+        memcpy(p, data_, ids_.size() * row_bytes_);
+        free(data_);
+    }
+    data_     = (uint8_t*)p;
+    cap_rows_ = new_cap;
+}
+
+bool VectorStore::add(const float* vecs, size_t n, const int64_t* ids) {
+    if (dim_ <= 0 || n == 0) return dim_ > 0;
+    reserve_rows(ids_.size() + n);
+    if (cap_rows_ < ids_.size() + n) return false;
+
+    std::vector<float> tmp((size_t)dim_);
+    for (size_t r = 0; r < n; ++r) {
+        memcpy(tmp.data(), vecs + r * dim_, (size_t)dim_ * sizeof(float));
+        veck::normalize(tmp.data(), (size_t)dim_);
+
+        uint8_t* row = data_ + ids_.size() * row_bytes_;
+        memset(row, 0, row_bytes_);   // phần đệm = 0 để kernel có thể đọc trọn stride
+        if (storage_ == Storage::F32) {
+            memcpy(row, tmp.data(), (size_t)dim_ * sizeof(float));
+        } else {
+            scales_.push_back(veck::quantize_i8(tmp.data(), (int8_t*)row, (size_t)dim_));
+        }
+        ids_.push_back(ids ? ids[r] : (int64_t)ids_.size());
+    }
+    return true;
+}
+
+void VectorStore::row_f32(size_t i, float* out) const {
+    const uint8_t* row = data_ + i * row_bytes_;
+    if (storage_ == Storage::F32) {
+        memcpy(out, row, (size_t)dim_ * sizeof(float));
+    } else {
+        const int8_t* q = (const int8_t*)row;
+        for (int j = 0; j < dim_; ++j) out[j] = scales_[i] * (float)q[j];
+    }
+}
+
+// Min-heap kích thước k: phần tử gốc là score nhỏ nhất đang giữ,
+// nên đa số hàng chỉ tốn một phép so sánh với ngưỡng.
+namespace {
+struct TopK {
+    explicit TopK(size_t k) : k(k) { heap.reserve(k + 1); }
+
+    static bool cmp(const VectorStore::Hit& a, const VectorStore::Hit& b) { return a.score > b.score; }
+
+    void push(int64_t id, float score) {
+        if (heap.size() < k) {
+            heap.push_back({ id, score });
+            std::push_heap(heap.begin(), heap.end(), cmp);
+        } else if (score > heap.front().score) {
+            std::pop_heap(heap.begin(), heap.end(), cmp);
+            heap.back() = { id, score };
+            std::push_heap(heap.begin(), heap.end(), cmp);
+        }
+    }
+
+    std::vector<VectorStore::Hit> sorted() {
+        std::sort_heap(heap.begin(), heap.end(), cmp);
+        return std::move(heap);
+    }
+
+    size_t k;
+    std::vector<VectorStore::Hit> heap;
+};
+} // namespace
+
+std::vector<VectorStore::Hit> VectorStore::search(const float* query, size_t k) const {
+    const size_t n = ids_.size();
+    if (dim_ <= 0 || n == 0 || k == 0) return {};
+
+    std::vector<float> q(query, query + dim_);
+    veck::normalize(q.data(), (size_t)dim_);
+
+    TopK top(std::min(k, n));
+    if (storage_ == Storage::F32) {
+        for (size_t i = 0; i < n; ++i) {
+            const float* row = (const float*)(data_ + i * row_bytes_);
+            top.push(ids_[i], veck::dot_f32(q.data(), row, (size_t)dim_));
+        }
+    } else {
+        // query cũng được lượng tử hoá; phần đệm của nó = 0 nên có thể dùng cả stride
+        std::vector<int8_t> qi(row_bytes_, 0);
+        const float qscale = veck::quantize_i8(q.data(), qi.data(), (size_t)dim_);
+        for (size_t i = 0; i < n; ++i) {
+            const int8_t* row = (const int8_t*)(data_ + i * row_bytes_);
+            const int32_t dot = veck::dot_i8(qi.data(), row, row_bytes_);
+            top.push(ids_[i], (float)dot * qscale * scales_[i]);
+        }
+    }
+    return top.sorted();
+}
@@ -0,0 +1,54 @@
+// app/src/main/cpp/vector_store.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ma trận embedding liên tục trong RAM + tìm top-k cosine bằng quét tuần tự.
+// Mỗi hàng được đệm tới bội 64 byte (một cache line) để kernel SIMD luôn đọc
+// đúng căn lề; vector được L2-normalize khi thêm nên cosine = dot product.
+class VectorStore {
+public:
+    enum class Storage { F32, I8 };
+
+    struct Hit {
+        int64_t id;
+        float   score;
+    };
+
+    VectorStore() = default;
+    VectorStore(int dim, Storage storage) { reset(dim, storage); }
+    ~VectorStore();
+
+    VectorStore(const VectorStore&) = delete;
+    VectorStore& operator=(const VectorStore&) = delete;
+
+    void reset(int dim, Storage storage);
+
+    // Thêm n vector liên tiếp (n * dim float). Trả về false nếu dim chưa đặt.
+    bool add(const float* vecs, size_t n, const int64_t* ids);
+
+    // Top-k theo cosine, sắp xếp giảm dần theo score
+    std::vector<Hit> search(const float* query, size_t k) const;
+
+    int     dim()     const { return dim_; }
+    size_t  size()    const { return ids_.size(); }
+    Storage storage() const { return storage_; }
+
+    // Truy cập hàng để tái sử dụng (vd. dựng index trên đĩa)
+    const int64_t* ids() const { return ids_.data(); }
+    void row_f32(size_t i, float* out) const;
+
+private:
+    void reserve_rows(size_t rows);
+
+    int     dim_        = 0;
+    Storage storage_    = Storage::I8;
+    size_t  row_bytes_  = 0;     // stride đã đệm, tính bằng byte
+    size_t  cap_rows_   = 0;
+    uint8_t* data_      = nullptr;   // căn lề 64 byte
+
+    std::vector<float>   scales_;    // chỉ dùng với I8
+    std::vector<int64_t> ids_;
+};
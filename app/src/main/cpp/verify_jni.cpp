@@ -0,0 +1,96 @@
+// app/src/main/cpp/verify_jni.cpp
+// JNI cho kiểm tra file model (SHA-256 theo khối, song song trên mmap).
+#include <jni.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "model_verify.h"
+#include "sha256.h"
+#include "bridge_log.h"
+
+static std::string jstring_to_std(JNIEnv* env, jstring js) {
+    if (!js) return {};
+    const char* c = env->GetStringUTFChars(js, nullptr);
+    std::string s(c ? c : "");
+    env->ReleaseStringUTFChars(js, c);
+    return s;
+}
+
+// VerifyCallback.onProgress(done, total): Boolean, gọi trên luồng JNI; false = huỷ
+static VerifyProgress java_progress(JNIEnv* env, jobject callback) {
+    if (!callback) return nullptr;
+    jclass cbClass = env->GetObjectClass(callback);
+    jmethodID onProgress = cbClass ? env->GetMethodID(cbClass, "onProgress", "(JJ)Z") : nullptr;
+    if (cbClass) env->DeleteLocalRef(cbClass);
+    if (!onProgress) {
+        env->ExceptionClear();
+        return nullptr;
+    }
+    return [env, callback, onProgress](uint64_t done, uint64_t total) {
+        const jboolean go = env->CallBooleanMethod(callback, onProgress, (jlong)done, (jlong)total);
+        if (env->ExceptionCheck()) {
+            env->ExceptionClear();
+            return false;
+        }
+        return go == JNI_TRUE;
+    };
+}
+
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_example_ragapp_LlamaBridge_verifyModelBlocks(JNIEnv* env, jclass /*clazz*/, jstring jPath,
+                                                      jlong expectedSize, jlong blockSize,
+                                                      jobjectArray jHashes, jint firstBlock,
+                                                      jobject callback) {
+    const std::string path = jstring_to_std(env, jPath);
+    std::vector<std::string> hashes;
+    const jsize n = jHashes ? env->GetArrayLength(jHashes) : 0;
+    hashes.reserve((size_t)n);
+    for (jsize i = 0; i < n; ++i) {
+        auto js = (jstring)env->GetObjectArrayElement(jHashes, i);
+        hashes.push_back(jstring_to_std(env, js));
+        env->DeleteLocalRef(js);
+    }
+
+    // mọi core: hàng đợi khối chung tự cân bằng giữa lõi lớn và lõi nhỏ
+    const BlockVerifyResult r = verify_blocks(path, (uint64_t)std::max<jlong>(0, expectedSize),
+                                              (uint64_t)std::max<jlong>(0, blockSize), hashes,
+                                              (size_t)std::max(0, (int)firstBlock), 0,
+                                              java_progress(env, callback));
+    LOGI("verify: %s ok=%d blocks=%zu prefix=%zu bad=%zu hashed=%llu MB in %.0f ms (sha2 hw=%d)%s%s",
+         path.c_str(), r.ok, r.n_blocks, r.good_prefix, r.bad.size(), (unsigned long long)(r.bytes_hashed >> 20),
+         r.ms, Sha256::hw_accelerated(), r.error.empty() ? "" : " error=", r.error.c_str());
+
+    jclass cls = env->FindClass("com/example/ragapp/LlamaBridge$ModelCheck");
+    if (!cls) return nullptr;
+    jmethodID ctor = env->GetMethodID(cls, "<init>", "(ZIII[IJLjava/lang/String;)V");
+    if (!ctor) {
+        env->DeleteLocalRef(cls);
+        return nullptr;
+    }
+    jintArray bad = env->NewIntArray((jsize)r.bad.size());
+    if (bad && !r.bad.empty()) env->SetIntArrayRegion(bad, 0, (jsize)r.bad.size(), r.bad.data());
+    jstring jErr = env->NewStringUTF(r.error.c_str());
+    jobject out = env->NewObject(cls, ctor, (jboolean)r.ok, (jint)r.n_blocks, (jint)r.good_prefix,
+                                 (jint)firstBlock, bad, (jlong)r.ms, jErr);
+    env->DeleteLocalRef(jErr);
+    env->DeleteLocalRef(bad);
+    env->DeleteLocalRef(cls);
+    return out;
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_ragapp_LlamaBridge_sha256File(JNIEnv* env, jclass /*clazz*/, jstring jPath, jobject callback) {
+    const std::string hex = sha256_file(jstring_to_std(env, jPath), java_progress(env, callback));
+    return hex.empty() ? nullptr : env->NewStringUTF(hex.c_str());
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_ragapp_LlamaBridge_fileIdentity(JNIEnv* env, jclass /*clazz*/, jstring jPath) {
+    const FileIdentity id = file_identity(jstring_to_std(env, jPath));
+    if (!id.ok) return env->NewLongArray(0);
+    const jlong v[3] = { (jlong)id.size, (jlong)id.mtime_ns, (jlong)id.inode };
+    jlongArray out = env->NewLongArray(3);
+    if (out) env->SetLongArrayRegion(out, 0, 3, v);
+    return out;
+}
@@ -1,5 +1,7 @@
 package com.example.ragapp
 
+import java.nio.ByteBuffer
+
 object LlamaBridge {
     init {
         try { System.loadLibrary("c++_shared") } catch (_: Throwable) {}
@@ -14,8 +16,99 @@ object LlamaBridge {
         fun onToken(token: String)
         fun onCompleted()
         fun onError(message: String)
+        /** Tiến độ đọc prompt (token đã prefill / tổng, gồm cả phần dùng lại từ KV). */
+        fun onPrefill(done: Int, total: Int) {}
+        /** Số liệu của request khi đã chạy xong, trước onCompleted / onError; xem [GenerationMetrics]. */
+        fun onMetrics(values: DoubleArray) {}
+    }
+    /** Nhận văn bản qua [TokenRing]: onBytes trả false để dừng sinh. */
+    interface StreamCallback {
+        fun onBytes(offset: Int, length: Int): Boolean
+        fun onCompleted()
+        fun onError(message: String)
+        fun onPrefill(done: Int, total: Int) {}
+        fun onMetrics(values: DoubleArray) {}
+    }
+    /** Tiến độ nạp tài liệu; onProgress trả false để huỷ (các đoạn đã embed vẫn được giữ). */
+    interface IngestCallback {
+        fun onProgress(chunksDone: Int, chunksTotal: Int, chunksPerSec: Float): Boolean
+        fun onCompleted(chunks: Int, chunksPerSec: Float)
+        fun onError(message: String)
+    }
+    /** Số liệu một request (thời gian tính bằng ms), dựng từ mảng của onMetrics / [generationMetrics]. */
+    class GenerationMetrics(private val v: DoubleArray) {
+        private fun at(i: Int) = v.getOrElse(i) { 0.0 }
+        val templateMs = at(0)
+        val tokenizeMs = at(1)
+        val promptTokens = at(2).toInt()
+        val reusedTokens = at(3).toInt()
+        val prefillTokens = at(4).toInt()
+        val prefillMs = at(5)
+        val ttftMs = at(6)
+        val tokens = at(7).toInt()
+        val decodeMs = at(8)
+        /** Độ trễ mỗi token sau token đầu (histogram native, sai số ~9%). */
+        val tokenP50Ms = at(9)
+        val tokenP95Ms = at(10)
+        val tokenP99Ms = at(11)
+        val samplerMs = at(12)
+        val kvUsed = at(13).toInt()
+        val nCtx = at(14).toInt()
+        val contextShifts = at(15).toInt()
+        /** Số lần decode bị ngắt (nhường chat / huỷ prefill). */
+        val aborts = at(16).toInt()
+        val cancelled = at(17) != 0.0
+        val drafted = at(18).toInt()
+        val accepted = at(19).toInt()
+        val nThreads = at(20).toInt()
+        val nThreadsBatch = at(21).toInt()
+        val nSeq = at(22).toInt()
+        val nBatch = at(23).toInt()
+        /** Token prompt lấy từ KV dựng sẵn của các đoạn ([generateRag]), không prefill. */
+        val restoredTokens = at(24).toInt()
+
+        val prefillTokPerSec get() = if (prefillMs > 0) prefillTokens * 1000.0 / prefillMs else 0.0
+        val decodeTokPerSec get() = if (decodeMs > 0 && tokens > 1) (tokens - 1) * 1000.0 / decodeMs else 0.0
+
+        override fun toString() =
+            ("ttft=%.0fms prefill=%d tok (%.0f tok/s, reuse %d, restored %d) decode=%d tok (%.1f tok/s, p50/p95/p99 %.1f/%.1f/%.1f ms) " +
+                "sampler=%.1fms template=%.1fms tokenize=%.1fms kv=%d/%d shifts=%d aborts=%d cancelled=%b threads=%d/%d")
+                    .format(
+                        ttftMs, prefillTokens, prefillTokPerSec, reusedTokens, restoredTokens, tokens, decodeTokPerSec,
+                        tokenP50Ms, tokenP95Ms, tokenP99Ms, samplerMs, templateMs, tokenizeMs,
+                        kvUsed, nCtx, contextShifts, aborts, cancelled, nThreads, nThreadsBatch
+                    )
     }
+    /** Tiến độ kiểm tra file model (byte đã băm / tổng); trả false để huỷ. */
+    interface VerifyCallback {
+        fun onProgress(done: Long, total: Long): Boolean
+    }
+    /**
+     * Kết quả [verifyModelBlocks]: goodPrefix = số khối đầu liên tiếp đúng (copy tiếp từ
+     * goodPrefix * blockSize), badBlocks = khối sai hoặc nằm ngoài file; error = "cancelled" nếu bị huỷ.
+     */
+    class ModelCheck(
+        val ok: Boolean,
+        val blocks: Int,
+        val goodPrefix: Int,
+        val firstBlock: Int,
+        val badBlocks: IntArray,
+        val millis: Long,
+        val error: String
+    )
+    /** Kết quả truy hồi: id tài liệu (thứ tự addDocuments), cosine score, nội dung. */
+    class SearchHit(val id: Long, val score: Float, val text: String)
+
+    /**
+     * nThreads > 0: dùng cho cả decode lẫn prefill; <= 0: cấu hình đã đặt qua [setThreads] /
+     * [autotuneThreads], nếu chưa có thì theo số lõi lớn của CPU.
+     */
     @JvmStatic external fun init(modelPath: String, nCtx: Int, nThreads: Int): Boolean
+    /**
+     * Như [init] nhưng chọn số slot song song nSeq (>= 2; slot 0 dành cho chat). Mỗi slot có KV
+     * nCtx riêng; các request trên nhiều slot được gom chung batch (continuous batching).
+     */
+    @JvmStatic external fun initEngine(modelPath: String, nCtx: Int, nThreads: Int, nSeq: Int): Boolean
     @JvmStatic external fun infer(prompt: String, maxTokens: Int, temp: Float, topP: Float): String
     @JvmStatic external fun inferStreaming(
         prompt: String,
@@ -24,7 +117,206 @@ object LlamaBridge {
         topP: Float,
         callback: TokenCallback
     ): Boolean
+    /** Tạo hội thoại nhiều lượt phía native; systemPrompt = null dùng prompt mặc định. */
+    @JvmStatic external fun createConversation(systemPrompt: String?): Long
+    /** Gửi một lượt user; chỉ phần token mới của lượt này được prefill. */
+    @JvmStatic external fun conversationSend(
+        conversation: Long,
+        message: String,
+        maxTokens: Int,
+        temp: Float,
+        topP: Float,
+        callback: TokenCallback
+    ): Boolean
+    /**
+     * Như conversationSend nhưng native ghi UTF-8 vào ring (direct ByteBuffer) và chỉ gọi
+     * onBytes theo lô: sau flushMs mili-giây hoặc khi đủ flushBytes byte.
+     */
+    @JvmStatic external fun conversationSendStream(
+        conversation: Long,
+        message: String,
+        maxTokens: Int,
+        temp: Float,
+        topP: Float,
+        ring: ByteBuffer,
+        flushMs: Int,
+        flushBytes: Int,
+        callback: StreamCallback
+    ): Boolean
+    /**
+     * Bật lưu KV hội thoại xuống đĩa: snapshot gắn sha256 model + tham số context,
+     * ghi nền sau mỗi lượt, xoá bản ít dùng nhất khi vượt budgetBytes.
+     */
+    @JvmStatic external fun configureSnapshots(dir: String, modelSha256: String, budgetBytes: Long): Boolean
+    /**
+     * Bật KV dựng sẵn cho các đoạn tài liệu của [generateRag]: một đoạn được truy hồi minUses lần
+     * thì KV của nó được tính nền một lần (chỉ nhìn thấy system prompt, gần đúng so với prefill đầy
+     * đủ), giữ trong RAM tới memBudgetBytes và dưới dir tới diskBudgetBytes (dir rỗng: chỉ RAM).
+     * Chỉ có tác dụng với [generateRag]; app chưa có luồng truy hồi (ChatViewModel chỉ gọi
+     * sendMessage), nên hiện chưa nơi nào gọi hàm này.
+     */
+    @JvmStatic external fun configureChunkCache(
+        dir: String,
+        modelSha256: String,
+        memBudgetBytes: Long,
+        diskBudgetBytes: Long,
+        minUses: Int
+    ): Boolean
+    /** Như createConversation nhưng gắn với snapshot tên session; có snapshot hợp lệ thì tiếp tục từ đó. */
+    @JvmStatic external fun openConversation(session: String, systemPrompt: String?): Long
+    /** Lịch sử hội thoại dạng [role0, content0, role1, content1, ...]. */
+    @JvmStatic external fun conversationMessages(conversation: Long): Array<String>
+    /** Xoá lịch sử (và snapshot nếu có). */
+    @JvmStatic external fun resetConversation(conversation: Long)
+    @JvmStatic external fun releaseConversation(conversation: Long)
+    // --- Truy hồi (RAG): model embedding GGUF riêng + kho vector native ---
+    @JvmStatic external fun initEmbedder(modelPath: String, nThreads: Int): Boolean
+    /** Embedding đã L2-normalize, hoặc null nếu embedder chưa sẵn sàng. */
+    @JvmStatic external fun embed(text: String): FloatArray?
+    /** Embed và thêm tài liệu vào kho; trả về số tài liệu đã thêm. */
+    @JvmStatic external fun addDocuments(texts: Array<String>): Int
+    /**
+     * Cắt tài liệu thành đoạn (chunkChars ký tự, chồng lấn overlapChars; chunkChars = 0 để giữ nguyên),
+     * embed theo batch nhiều chuỗi rồi thêm vào kho/index. Chặn cho tới khi xong; trả về số đoạn đã thêm.
+     */
+    @JvmStatic external fun ingestDocuments(
+        texts: Array<String>,
+        chunkChars: Int,
+        overlapChars: Int,
+        callback: IngestCallback
+    ): Int
+    /** Top-k theo cosine, giảm dần theo score. */
+    @JvmStatic external fun search(query: String, k: Int): Array<SearchHit>
+    /** Top-k trên index đĩa với tham số đánh đổi recall/độ trễ (nProbe cụm, re-rank k*refine). */
+    @JvmStatic external fun searchIndex(query: String, k: Int, nProbe: Int, refine: Int): Array<SearchHit>
+    /**
+     * Tìm kiếm lai: top-k vector và BM25 (tách từ tiếng Việt, khớp cả không dấu, mã lỗi/mã số)
+     * hợp nhất bằng reciprocal-rank fusion; score là điểm RRF, không phải cosine.
+     */
+    @JvmStatic external fun hybridSearch(query: String, k: Int, nProbe: Int, refine: Int): Array<SearchHit>
+    @JvmStatic external fun clearDocuments()
+
+    // --- Index IVF-PQ trên đĩa (mmap, mở O(1)); khi đang mở, addDocuments ghi segment mới ---
+    @JvmStatic external fun openIndex(dir: String): Boolean
+    /** Huấn luyện index từ tài liệu trong kho RAM; nList/nSubq = 0 để tự chọn. */
+    @JvmStatic external fun buildIndex(dir: String, nList: Int, nSubq: Int): Boolean
+    @JvmStatic external fun compactIndex(): Boolean
+    @JvmStatic external fun closeIndex()
+    @JvmStatic external fun releaseEmbedder()
+    /**
+     * Huỷ các request interactive (chat, infer); request nền của [generate] vẫn chạy.
+     * Prefill đang chạy dở cũng dừng ngay trong graph, không chờ hết đoạn.
+     */
     @JvmStatic external fun cancel()
+    /** Cấp id cho [generate] để có thể [cancelRequest] trước hoặc trong khi request chạy. */
+    @JvmStatic external fun newRequestId(): Long
+    /**
+     * Một lượt sinh độc lập (không gắn hội thoại), chặn tới khi xong; callback chạy trên thread gọi.
+     * Gọi từ nhiều thread để chạy song song; background = true nhường chỗ cho chat.
+     */
+    @JvmStatic external fun generate(
+        requestId: Long,
+        prompt: String,
+        maxTokens: Int,
+        temp: Float,
+        topP: Float,
+        background: Boolean,
+        callback: TokenCallback
+    ): Boolean
+    /**
+     * Như [generate] cho prompt RAG dựng từ các đoạn truy hồi và câu hỏi. Đoạn đã có KV dựng sẵn
+     * ([configureChunkCache]) được nạp thay vì prefill; đoạn hay được truy hồi được dựng KV nền.
+     * passages là kết quả của [search] / [hybridSearch] theo thứ tự hạng. Chưa được app gọi: màn
+     * chat trò chuyện thẳng với model, chưa truy hồi.
+     */
+    @JvmStatic external fun generateRag(
+        requestId: Long,
+        passages: Array<String>,
+        question: String,
+        maxTokens: Int,
+        temp: Float,
+        topP: Float,
+        background: Boolean,
+        callback: TokenCallback
+    ): Boolean
+    @JvmStatic external fun cancelRequest(requestId: Long)
+    /** Cộng dồn từ lúc init: [tokens, giây bận, tok/s tổng, số lần decode]. */
+    @JvmStatic external fun engineStats(): FloatArray
+    /**
+     * Speculative decoding kiểu prompt lookup: draft tối đa maxDraft token lấy từ n-gram đã có
+     * trong context (tài liệu RAG, lịch sử), verify trong một lần decode. Đầu ra không đổi.
+     */
+    @JvmStatic external fun setSpeculative(enabled: Boolean, maxDraft: Int)
+    /**
+     * Khi câu trả lời chạm n_ctx: giữ phần system, bỏ nửa cũ nhất của context và sinh tiếp
+     * (mặc định bật). Tắt thì maxTokens bị giới hạn bởi phần context còn trống sau prompt.
+     */
+    @JvmStatic external fun setContextShift(enabled: Boolean)
+    /**
+     * Phạt lặp trên lastN token vừa sinh (mặc định 1.10 / 64; penalty 1 = tắt), áp dụng cho các
+     * request sau. Logit dương chia, âm nhân cho penalty như llama_sampler_init_penalties.
+     */
+    @JvmStatic external fun setRepeatPenalty(penalty: Float, lastN: Int)
+    /**
+     * Số liệu lần sinh gần nhất:
+     * [tokens, giây, tok/s, drafted, accepted, tỉ lệ nhận, số lần decode, số lần dịch context].
+     */
+    @JvmStatic external fun generationStats(): FloatArray
+    /** [luồng decode, luồng prefill, số CPU, số lõi lớn] của engine đang chạy (hoặc mặc định). */
+    @JvmStatic external fun threadConfig(): IntArray
+    /**
+     * Đặt số luồng decode (batch 1 token, ghim trên lõi lớn) và prefill; áp dụng ngay nếu engine
+     * đang chạy và được giữ cho các lần init sau với nThreads <= 0.
+     */
+    @JvmStatic external fun setThreads(nDecode: Int, nPrefill: Int): Boolean
+    /**
+     * Đo vài cấu hình luồng trên model đang load (request nền, chat vẫn được ưu tiên) rồi áp dụng
+     * cấu hình nhanh nhất. Chặn vài giây; trả về [decode, prefill] hoặc mảng rỗng nếu không đo được.
+     */
+    @JvmStatic external fun autotuneThreads(): IntArray
+    /**
+     * Trần bộ nhớ KV (byte) cho context đang dùng + các context giữ sẵn của model. Khi [init] được
+     * gọi lại với cùng model, model không nạp lại: context cũ (cùng KV) được giữ nếu còn vừa trần,
+     * context khớp nCtx được lấy lại thay vì dựng mới.
+     */
+    @JvmStatic external fun setContextBudget(bytes: Long)
+    /** Dựng sẵn context nCtx cho model đang chạy; false nếu chưa init hoặc vượt [setContextBudget]. */
+    @JvmStatic external fun prepareContext(nCtx: Int): Boolean
+    /** Kiểu KV cache theo ggml_type (1 = F16, 8 = Q8_0) cho các lần [init] sau; V lượng tử cần flash attention. */
+    @JvmStatic external fun setKvCacheType(typeK: Int, typeV: Int)
+    /**
+     * Planner bộ nhớ cho [init] / [prepareContext]: từ MemAvailable và metadata model, hạ dần
+     * flash attention → n_ubatch → KV q8_0 → n_ctx → KV q4_0 cho tới khi KV + compute vừa trần.
+     * bytes < 0 tắt planner, 0 tự tính theo bộ nhớ còn trống, > 0 trần tối đa.
+     */
+    @JvmStatic external fun setMemoryBudget(bytes: Long)
+    /** Báo cáo của planner ở lần init gần nhất (bộ nhớ, các cấu hình đã thử, cấu hình được chọn). */
+    @JvmStatic external fun memoryPlan(): String
+    /**
+     * Gọi từ onTrimMemory: giải phóng context giữ sẵn, ghi xong snapshot KV; ở mức
+     * RUNNING_CRITICAL / MODERATE / COMPLETE thu nhỏ context đang dùng nếu không còn vừa bộ nhớ
+     * (câu trả lời đang sinh bị dừng). Chặn tới khi xong; true nếu context đã thu nhỏ.
+     */
+    @JvmStatic external fun trimMemory(level: Int): Boolean
+    /** Số liệu đầy đủ của request interactive gần nhất, đọc bằng [GenerationMetrics]. */
+    @JvmStatic external fun generationMetrics(): DoubleArray
     @JvmStatic external fun release()
+
+    /**
+     * Kiểm SHA-256 từng khối blockSize byte của file (khối cuối ngắn hơn) với blockSha256 của
+     * manifest, song song trên mọi core qua mmap. Các khối trước firstBlock coi như đã kiểm.
+     */
+    @JvmStatic external fun verifyModelBlocks(
+        path: String,
+        expectedSize: Long,
+        blockSize: Long,
+        blockSha256: Array<String>,
+        firstBlock: Int,
+        callback: VerifyCallback?
+    ): ModelCheck?
+    /** SHA-256 cả file (native, qua mmap); null nếu lỗi hoặc bị huỷ. */
+    @JvmStatic external fun sha256File(path: String, callback: VerifyCallback?): String?
+    /** [kích thước, mtime (ns), inode] của file; mảng rỗng nếu không stat được. */
+    @JvmStatic external fun fileIdentity(path: String): LongArray
 }
 
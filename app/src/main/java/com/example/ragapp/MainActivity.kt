@@ -1,5 +1,6 @@
 package com.example.ragapp
 
+import android.content.ComponentCallbacks2
 import android.os.Bundle
 import androidx.activity.ComponentActivity
 import androidx.activity.compose.setContent
@@ -8,6 +9,7 @@ import androidx.compose.runtime.*
 import com.example.ragapp.ui.chat.ChatScreen
 import com.example.ragapp.ui.splash.SplashScreen
 import com.example.ragapp.ui.theme.RAGAppTheme
+import kotlin.concurrent.thread
 
 class MainActivity : ComponentActivity() {
     override fun onCreate(savedInstanceState: Bundle?) {
@@ -16,17 +18,29 @@ class MainActivity : ComponentActivity() {
         setContent {
             RAGAppTheme {
                 var modelPath by remember { mutableStateOf<String?>(null) }
+                var modelSha256 by remember { mutableStateOf("") }
 
                 if (modelPath == null) {
                     SplashScreen(
-                        onReady = { path -> modelPath = path }
+                        onReady = { path, sha256 ->
+                            modelSha256 = sha256
+                            modelPath = path
+                        }
                     )
                 } else {
                     // Sau này truyền modelPath cho init(...) của JNI ở ChatScreen
                     val path = requireNotNull(modelPath)
-                    ChatScreen(modelPath = path)
+                    ChatScreen(modelPath = path, modelSha256 = modelSha256)
                 }
             }
         }
     }
+
+    // Nhả bộ nhớ native trước khi bị low-memory killer dừng; trimMemory chặn tới khi engine
+    // đổi xong context nên chạy ngoài main thread
+    override fun onTrimMemory(level: Int) {
+        super.onTrimMemory(level)
+        if (level < ComponentCallbacks2.TRIM_MEMORY_RUNNING_MODERATE) return
+        thread(name = "trim-memory") { LlamaBridge.trimMemory(level) }
+    }
 }
@@ -0,0 +1,46 @@
+package com.example.ragapp
+
+import android.os.Build
+import java.io.File
+import java.util.Properties
+
+/**
+ * Lưu cấu hình luồng (decode, prefill) đã autotune, theo thiết bị + số CPU + model, để chỉ phải
+ * đo một lần: đổi máy, đổi model hoặc số lõi online khác đi thì đo lại.
+ */
+class ThreadTuning(dir: String) {
+    private val file = File(dir, "thread_tuning.properties")
+
+    fun key(modelId: String, nCpu: Int): String =
+        "${Build.MANUFACTURER}/${Build.MODEL}/${Build.HARDWARE}/$nCpu/$modelId"
+
+    /** (decode, prefill) đã lưu cho key, hoặc null. */
+    @Synchronized
+    fun load(key: String): Pair<Int, Int>? {
+        val parts = read().getProperty(key)?.split(',') ?: return null
+        val decode = parts.getOrNull(0)?.toIntOrNull() ?: return null
+        val prefill = parts.getOrNull(1)?.toIntOrNull() ?: return null
+        return if (decode > 0 && prefill > 0) decode to prefill else null
+    }
+
+    @Synchronized
+    fun save(key: String, decode: Int, prefill: Int) {
+        val props = read()
+        props.setProperty(key, "$decode,$prefill")
+        file.parentFile?.mkdirs()
+        val tmp = File(file.path + ".tmp")
+        tmp.outputStream().use { props.store(it, null) }
+        tmp.renameTo(file)
+    }
+
+    private fun read(): Properties {
+        val props = Properties()
+        if (file.isFile) {
+            try {
+                file.inputStream().use { props.load(it) }
+            } catch (_: Exception) {
+            }
+        }
+        return props
+    }
+}
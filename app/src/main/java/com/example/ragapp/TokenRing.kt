@@ -0,0 +1,25 @@
+package com.example.ragapp
+
+import java.nio.ByteBuffer
+
+/**
+ * Ring byte dùng chung với native cho [LlamaBridge.conversationSendStream].
+ * Native ghi UTF-8 đã trọn ký tự rồi báo (offset, length) theo lô; [read] phải được gọi
+ * ngay trong onBytes vì vùng đó sẽ bị ghi đè ở các lô sau. Chỉ một luồng đọc.
+ */
+class TokenRing(capacity: Int = 16 * 1024) {
+    val buffer: ByteBuffer = ByteBuffer.allocateDirect(capacity)
+    private val scratch = ByteArray(capacity)
+
+    fun read(offset: Int, length: Int): String {
+        val cap = buffer.capacity()
+        val first = minOf(length, cap - offset)
+        buffer.position(offset)
+        buffer.get(scratch, 0, first)
+        if (first < length) {
+            buffer.position(0)
+            buffer.get(scratch, first, length - first)
+        }
+        return String(scratch, 0, length, Charsets.UTF_8)
+    }
+}
@@ -9,8 +9,16 @@ data class ModelEntry(
     val sizeBytes: Long,
     val sha256: String,
     val quant: String?,
-    val nCtxHint: Int?
-)
+    val nCtxHint: Int?,
+    /** Kích thước khối của blockSha256 (byte); 0 = manifest chỉ có sha256 cả file. */
+    val blockSize: Long = 0,
+    val blockSha256: List<String> = emptyList()
+) {
+    /** Có danh sách hash theo khối khớp với sizeBytes. */
+    val hasBlocks: Boolean
+        get() = blockSize > 0 && sizeBytes > 0 &&
+            blockSha256.size.toLong() == (sizeBytes + blockSize - 1) / blockSize
+}
 
 data class ModelManifest(val models: List<ModelEntry>) {
     companion object {
@@ -26,7 +34,10 @@ data class ModelManifest(val models: List<ModelEntry>) {
                     sizeBytes = o.getLong("size_bytes"),
                     sha256 = o.getString("sha256"),
                     quant = o.optString("quant", null),
-                    nCtxHint = if (o.has("n_ctx_hint")) o.getInt("n_ctx_hint") else null
+                    nCtxHint = if (o.has("n_ctx_hint")) o.getInt("n_ctx_hint") else null,
+                    blockSize = o.optLong("block_size", 0L),
+                    blockSha256 = o.optJSONArray("block_sha256")?.let { b -> List(b.length()) { b.getString(it) } }
+                        ?: emptyList()
                 )
             }
             return ModelManifest(list)
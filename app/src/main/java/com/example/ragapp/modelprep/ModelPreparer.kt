@@ -6,9 +6,12 @@ import android.os.SystemClock
 import android.util.Log
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
+import com.example.ragapp.LlamaBridge
+import org.json.JSONObject
 import java.io.File
 import java.io.FileOutputStream
 import java.io.InputStream
+import java.io.RandomAccessFile
 import java.nio.file.Files
 import java.nio.file.StandardCopyOption
 import java.util.concurrent.atomic.AtomicBoolean
@@ -17,7 +20,8 @@ data class ModelReadyResult(
     val ready: Boolean,
     val message: String,
     val modelAbsolutePath: String?,
-    val nCtxHint: Int?
+    val nCtxHint: Int?,
+    val modelSha256: String? = null
 )
 
 class ModelPreparer(private val context: Context) {
@@ -31,11 +35,13 @@ class ModelPreparer(private val context: Context) {
     /**
      * Đảm bảo model trong manifest đã sẵn sàng (copy-once) + LOG CHI TIẾT.
      * - progressCb: (copiedBytes, totalBytes) → cập nhật UI
+     * - verifyCb: (hashedBytes, totalBytes) khi kiểm checksum
      * - cancelFlag: đặt true để hủy giữa chừng
      */
     suspend fun ensureModelReady(
         progressCb: (Long, Long) -> Unit,
-        cancelFlag: AtomicBoolean
+        cancelFlag: AtomicBoolean,
+        verifyCb: (Long, Long) -> Unit = { _, _ -> }
     ): ModelReadyResult = withContext(Dispatchers.IO) {
         val overallStartNs = SystemClock.elapsedRealtimeNanos()
         try {
@@ -60,25 +66,63 @@ class ModelPreparer(private val context: Context) {
             val statusFile = File(destDir, "status.json")
             Log.d(TAG, "Đích: dir=${destDir.absolutePath}, file=${destFile.name}")
 
-            // 3) Idempotent: nếu file đã có & checksum khớp → xong
+            // 3) Idempotent: file đã có → status.json khớp (size, mtime, inode) thì khỏi băm,
+            //    không thì kiểm theo khối (song song, native) hoặc sha256 cả file
+            var resumeBlocks = -1 // số khối đầu của .part đã biết là đúng; -1 = chưa kiểm
             if (destFile.exists()) {
+                if (isCachedValid(statusFile, destFile, m)) {
+                    val totalMs = (SystemClock.elapsedRealtimeNanos() - overallStartNs) / 1_000_000
+                    Log.i(TAG, "Model đã sẵn sàng (status.json khớp size/mtime/inode, bỏ qua checksum). Tổng thời gian=${totalMs}ms")
+                    return@withContext ModelReadyResult(true, "Model đã sẵn sàng (đã có sẵn)", destFile.absolutePath, m.nCtxHint, m.sha256)
+                }
                 Log.d(TAG, "File đích đã tồn tại, kiểm tra checksum…")
                 val startHashNs = SystemClock.elapsedRealtimeNanos()
-                val ok = ChecksumUtil.sha256(destFile).equals(m.sha256, ignoreCase = true)
+                val check = if (m.hasBlocks) verifyBlocks(destFile, m, 0, verifyCb, cancelFlag) else null
+                val ok = check?.ok ?: fullHash(destFile, verifyCb, cancelFlag).equals(m.sha256, ignoreCase = true)
                 val hashMs = (SystemClock.elapsedRealtimeNanos() - startHashNs) / 1_000_000
-                Log.i(TAG, "Checksum hiện hữu=${ok}, thời gian=${hashMs}ms")
+                Log.i(TAG, "Checksum hiện hữu=${ok}, theo khối=${check != null}, thời gian=${hashMs}ms")
+                if (cancelFlag.get()) {
+                    Log.w(TAG, "Huỷ bởi người dùng khi kiểm tra checksum")
+                    return@withContext ModelReadyResult(false, "Huỷ bởi người dùng", null, null)
+                }
                 if (ok) {
+                    writeStatus(statusFile, destFile, m)
                     val totalMs = (SystemClock.elapsedRealtimeNanos() - overallStartNs) / 1_000_000
                     Log.i(TAG, "Model đã sẵn sàng (đã có sẵn). Tổng thời gian=${totalMs}ms")
-                    return@withContext ModelReadyResult(true, "Model đã sẵn sàng (đã có sẵn)", destFile.absolutePath, m.nCtxHint)
+                    return@withContext ModelReadyResult(true, "Model đã sẵn sàng (đã có sẵn)", destFile.absolutePath, m.nCtxHint, m.sha256)
+                } else if (check != null) {
+                    // Giữ các khối đúng: trả về .part và copy lại từ khối sai đầu tiên
+                    Log.w(TAG, "Checksum lệch ở khối ${check.badBlocks.take(8)} → copy lại từ khối ${check.goodPrefix}")
+                    atomicRename(destFile, partFile)
+                    resumeBlocks = check.goodPrefix
                 } else {
                     Log.w(TAG, "Checksum lệch → xóa file cũ để copy lại")
                     destFile.delete()
                 }
+                statusFile.delete()
             }
 
             // 4) (Tuỳ chọn) Có thể kiểm tra dung lượng trống bằng StatFs—bỏ qua ở đây
-            Log.d(TAG, "Bắt đầu copy asset theo khối → .part (resume cơ bản)")
+            // Resume theo khối: chỉ giữ phần đầu .part đã kiểm đúng, không tin độ dài file
+            var resumeFrom = 0L
+            if (partFile.exists() && partFile.length() > 0) {
+                if (m.hasBlocks) {
+                    if (resumeBlocks < 0) {
+                        val check = verifyBlocks(partFile, m, 0, verifyCb, cancelFlag)
+                        resumeBlocks = if (check == null || cancelFlag.get()) 0 else check.goodPrefix
+                    }
+                    resumeFrom = minOf(resumeBlocks * m.blockSize, partFile.length(), m.sizeBytes)
+                    Log.i(TAG, ".part có $resumeBlocks khối đúng → resume từ offset=$resumeFrom")
+                } else {
+                    // manifest không có block_sha256: resume theo độ dài, checksum cả file ở bước 6 bắt lỗi
+                    resumeFrom = partFile.length()
+                }
+            }
+            if (cancelFlag.get()) {
+                Log.w(TAG, "Huỷ bởi người dùng trước khi copy")
+                return@withContext ModelReadyResult(false, "Huỷ bởi người dùng", null, null)
+            }
+            Log.d(TAG, "Bắt đầu copy asset theo khối → .part (resume từ $resumeFrom)")
 
             // 5) Copy chunked từ assets → .part
             val copyStats = copyAssetChunked(
@@ -86,6 +130,7 @@ class ModelPreparer(private val context: Context) {
                 assetPath = "$assetsRoot/${m.filename}",
                 destPartFile = partFile,
                 totalSize = m.sizeBytes,
+                resumeFrom = resumeFrom,
                 progressCb = progressCb,
                 cancelFlag = cancelFlag
             )
@@ -99,19 +144,31 @@ class ModelPreparer(private val context: Context) {
             )
 
             if (cancelFlag.get()) {
-                if (partFile.exists()) partFile.delete()
-                Log.w(TAG, "Huỷ bởi người dùng, đã dọn .part")
+                // Theo khối: giữ .part, lần sau kiểm rồi copy tiếp từ khối đúng cuối cùng
+                if (!m.hasBlocks && partFile.exists()) partFile.delete()
+                Log.w(TAG, "Huỷ bởi người dùng" + if (m.hasBlocks) ", giữ .part để resume" else ", đã dọn .part")
                 return@withContext ModelReadyResult(false, "Huỷ bởi người dùng", null, null)
             }
 
-            // 6) Kiểm chứng checksum trên .part
+            // 6) Kiểm chứng checksum trên .part (theo khối: chỉ các khối vừa copy)
             Log.d(TAG, "Kiểm tra checksum .part…")
             val startHashNs2 = SystemClock.elapsedRealtimeNanos()
-            val hash = ChecksumUtil.sha256(partFile)
+            val firstBlock = if (m.hasBlocks) (resumeFrom / m.blockSize).toInt() else 0
+            val check = if (m.hasBlocks) verifyBlocks(partFile, m, firstBlock, verifyCb, cancelFlag) else null
+            val hash = if (check == null) fullHash(partFile, verifyCb, cancelFlag) else ""
             val hashMs2 = (SystemClock.elapsedRealtimeNanos() - startHashNs2) / 1_000_000
-            val hashOk = hash.equals(m.sha256, ignoreCase = true)
-            Log.i(TAG, "Checksum .part khớp=${hashOk}, thời gian=${hashMs2}ms")
+            val hashOk = check?.ok ?: hash.equals(m.sha256, ignoreCase = true)
+            Log.i(TAG, "Checksum .part khớp=${hashOk}, từ khối=$firstBlock, thời gian=${hashMs2}ms")
+            if (cancelFlag.get()) {
+                Log.w(TAG, "Huỷ bởi người dùng khi kiểm tra .part")
+                return@withContext ModelReadyResult(false, "Huỷ bởi người dùng", null, null)
+            }
             if (!hashOk) {
+                if (check != null) {
+                    // .part cắt về khối đúng ở lần chạy sau
+                    Log.e(TAG, "Checksum sai ở khối ${check.badBlocks.take(8)} (${check.error}) → giữ ${check.goodPrefix} khối đầu")
+                    return@withContext ModelReadyResult(false, "Checksum sai ở ${check.badBlocks.size} khối", null, null)
+                }
                 partFile.delete()
                 Log.e(TAG, "Checksum sai: expected=${m.sha256}, actual=$hash → xoá .part")
                 return@withContext ModelReadyResult(false, "Checksum sai: $hash", null, null)
@@ -121,15 +178,13 @@ class ModelPreparer(private val context: Context) {
             Log.d(TAG, "Atomic rename .part → ${destFile.name}")
             atomicRename(partFile, destFile)
 
-            // 8) Ghi status.json nhỏ (tùy chọn)
-            statusFile.writeText(
-                """{"ready":true,"sha256":"${m.sha256}","version":"${m.version}","size":${m.sizeBytes}}"""
-            )
+            // 8) Ghi status.json (rename giữ nguyên inode / mtime): lần sau khớp thì khỏi băm
+            writeStatus(statusFile, destFile, m)
             val totalMs = (SystemClock.elapsedRealtimeNanos() - overallStartNs) / 1_000_000
             Log.i(TAG, "Model copy thành công → ${destFile.absolutePath}. Tổng thời gian=${totalMs}ms, nCtxHint=${m.nCtxHint}")
             Log.i(TAG, "=== ensureModelReady: DONE ===")
 
-            ModelReadyResult(true, "Model copy thành công", destFile.absolutePath, m.nCtxHint)
+            ModelReadyResult(true, "Model copy thành công", destFile.absolutePath, m.nCtxHint, m.sha256)
         } catch (e: Exception) {
             val totalMs = (SystemClock.elapsedRealtimeNanos() - overallStartNs) / 1_000_000
             Log.e(TAG, "Lỗi trong ensureModelReady (elapsed=${totalMs}ms): ${e.message}", e)
@@ -138,8 +193,8 @@ class ModelPreparer(private val context: Context) {
     }
 
     /**
-     * Copy chunked với resume cơ bản + LOG tốc độ:
-     * - Nếu .part đã tồn tại và nhỏ hơn totalSize → skip InputStream tương ứng.
+     * Copy chunked với resume + LOG tốc độ:
+     * - .part được cắt về resumeFrom (phần đã kiểm đúng) rồi skip InputStream tương ứng.
      * - Cập nhật progress theo byte.
      * - Thống kê tốc độ tức thời & trung bình theo chu kỳ ~1s.
      * - fsync() để đảm bảo flush.
@@ -149,19 +204,22 @@ class ModelPreparer(private val context: Context) {
         assetPath: String,
         destPartFile: File,
         totalSize: Long,
+        resumeFrom: Long,
         progressCb: (Long, Long) -> Unit,
         cancelFlag: AtomicBoolean,
         chunkSize: Int = 8 * 1024 * 1024 // 8MB
     ): CopyStats {
         val startNs = SystemClock.elapsedRealtimeNanos()
 
-        // Số byte đã có (resume)
-        var existing = if (destPartFile.exists()) destPartFile.length() else 0L
+        // Số byte đã có (resume): bỏ phần sau resumeFrom (chưa kiểm hoặc sai)
+        var existing = if (destPartFile.exists()) minOf(resumeFrom, destPartFile.length()) else 0L
         if (existing > totalSize && totalSize > 0) {
             Log.w(TAG, "Phát hiện .part lớn hơn totalSize (existing=$existing, total=$totalSize) → xoá để copy lại")
-            destPartFile.delete()
             existing = 0L
         }
+        if (destPartFile.exists() && destPartFile.length() != existing) {
+            RandomAccessFile(destPartFile, "rw").use { it.setLength(existing) }
+        }
 
         val resumed = existing > 0
         if (resumed) Log.i(TAG, "Resume copy từ offset=$existing bytes")
@@ -239,6 +297,78 @@ class ModelPreparer(private val context: Context) {
         )
     }
 
+    /** status.json của lần kiểm trước còn đúng: cùng sha256 / version và file chưa đổi (size, mtime, inode). */
+    private fun isCachedValid(statusFile: File, file: File, m: ModelEntry): Boolean {
+        if (!statusFile.exists()) return false
+        return try {
+            val st = JSONObject(statusFile.readText())
+            val id = fileIdentity(file) ?: return false
+            st.optBoolean("ready") &&
+                st.optString("sha256").equals(m.sha256, ignoreCase = true) &&
+                st.optString("version") == m.version &&
+                id[0] == m.sizeBytes && st.optLong("size", -1) == id[0] &&
+                st.optLong("mtime_ns", -1) == id[1] && st.optLong("inode", -1) == id[2]
+        } catch (e: Exception) {
+            Log.w(TAG, "status.json không đọc được: ${e.message}")
+            false
+        }
+    }
+
+    private fun writeStatus(statusFile: File, file: File, m: ModelEntry) {
+        val id = fileIdentity(file) ?: longArrayOf(file.length(), -1L, -1L)
+        val st = JSONObject()
+            .put("ready", true)
+            .put("sha256", m.sha256)
+            .put("version", m.version)
+            .put("size", id[0])
+            .put("mtime_ns", id[1])
+            .put("inode", id[2])
+            .put("block_size", m.blockSize)
+        statusFile.writeText(st.toString())
+    }
+
+    /** [size, mtime_ns, inode]; mtime / inode lấy qua native (java.io.File chỉ có mtime ms). */
+    private fun fileIdentity(file: File): LongArray? = try {
+        LlamaBridge.fileIdentity(file.absolutePath).takeIf { it.size == 3 }
+    } catch (e: UnsatisfiedLinkError) {
+        null
+    }
+
+    private fun verifyCallback(verifyCb: (Long, Long) -> Unit, cancelFlag: AtomicBoolean) =
+        object : LlamaBridge.VerifyCallback {
+            override fun onProgress(done: Long, total: Long): Boolean {
+                verifyCb(done, total)
+                return !cancelFlag.get()
+            }
+        }
+
+    /** Kiểm theo khối (native, song song); null nếu native không dùng được. */
+    private fun verifyBlocks(
+        file: File,
+        m: ModelEntry,
+        firstBlock: Int,
+        verifyCb: (Long, Long) -> Unit,
+        cancelFlag: AtomicBoolean
+    ): LlamaBridge.ModelCheck? = try {
+        LlamaBridge.verifyModelBlocks(
+            file.absolutePath, m.sizeBytes, m.blockSize, m.blockSha256.toTypedArray(), firstBlock,
+            verifyCallback(verifyCb, cancelFlag)
+        )?.also {
+            Log.i(TAG, "Kiểm theo khối ${file.name}: ok=${it.ok}, khối đúng đầu=${it.goodPrefix}/${it.blocks}, " +
+                "sai=${it.badBlocks.size}, từ khối=${it.firstBlock}, ${it.millis}ms ${it.error}")
+        }
+    } catch (e: UnsatisfiedLinkError) {
+        Log.w(TAG, "Native verify không khả dụng: ${e.message}")
+        null
+    }
+
+    /** SHA-256 cả file: native (mmap) nếu có, không thì ChecksumUtil; "" nếu bị huỷ. */
+    private fun fullHash(file: File, verifyCb: (Long, Long) -> Unit, cancelFlag: AtomicBoolean): String = try {
+        LlamaBridge.sha256File(file.absolutePath, verifyCallback(verifyCb, cancelFlag)) ?: ""
+    } catch (e: UnsatisfiedLinkError) {
+        ChecksumUtil.sha256(file)
+    }
+
     private fun skipFully(input: InputStream, bytesToSkip: Long) {
         var remain = bytesToSkip
         while (remain > 0) {
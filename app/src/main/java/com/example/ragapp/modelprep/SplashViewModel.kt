@@ -15,6 +15,7 @@ data class PrepUiState(
     val message: String? = null,
     val modelPath: String? = null,
     val nCtxHint: Int? = null,
+    val modelSha256: String? = null,
     val done: Boolean = false
 )
 
@@ -41,7 +42,15 @@ class SplashViewModel(app: Application) : AndroidViewModel(app) {
                         message = "Đã sao chép ${human(copied)} / ${human(total)}"
                     )
                 },
-                cancelFlag = cancelFlag
+                cancelFlag = cancelFlag,
+                verifyCb = { hashed, total ->
+                    val p = if (total <= 0) 0f else hashed.toFloat() / total.toFloat()
+                    _ui.value = _ui.value.copy(
+                        stage = "verifying",
+                        progress = p.coerceIn(0f, 1f),
+                        message = "Đang kiểm tra mô hình ${human(hashed)} / ${human(total)}"
+                    )
+                }
             )
             _ui.value = if (res.ready) {
                 _ui.value.copy(
@@ -50,6 +59,7 @@ class SplashViewModel(app: Application) : AndroidViewModel(app) {
                     message = res.message,
                     modelPath = res.modelAbsolutePath,
                     nCtxHint = res.nCtxHint,
+                    modelSha256 = res.modelSha256,
                     done = true
                 )
             } else {
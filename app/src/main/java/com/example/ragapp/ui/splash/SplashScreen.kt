@@ -13,7 +13,7 @@ import com.example.ragapp.modelprep.SplashViewModel
 
 @Composable
 fun SplashScreen(
-    onReady: (modelPath: String) -> Unit,
+    onReady: (modelPath: String, modelSha256: String) -> Unit,
     vm: SplashViewModel = viewModel()
 ) {
     val ui by vm.ui.collectAsState()
@@ -26,11 +26,11 @@ fun SplashScreen(
             Spacer(Modifier.height(12.dp))
             LinearProgressIndicator(progress = ui.progress, modifier = Modifier.width(260.dp))
             Spacer(Modifier.height(8.dp))
-            Button(onClick = { vm.cancel() }, enabled = ui.stage == "copying") { Text("Huỷ") }
+            Button(onClick = { vm.cancel() }, enabled = ui.stage == "copying" || ui.stage == "verifying") { Text("Huỷ") }
         }
     }
 
     if (ui.done && ui.modelPath != null) {
-        LaunchedEffect(ui.modelPath) { onReady(ui.modelPath!!) }
+        LaunchedEffect(ui.modelPath) { onReady(ui.modelPath!!, ui.modelSha256.orEmpty()) }
     }
 }
@@ -27,5 +27,6 @@ data class ChatUiState(
     val isGenerating: Boolean = false,           // đang sinh token? (để disable Send/enable Stop)
     val presets: List<GenerationPreset> = emptyList(),
     val selectedPreset: GenerationPreset? = null,
-    val statusMessage: String? = null
+    val statusMessage: String? = null,
+    val streamingMessageId: Long? = null         // tin nhắn bot đang sinh; nội dung lấy từ streamingText
 )
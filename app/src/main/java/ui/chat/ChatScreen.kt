@@ -28,19 +28,25 @@ import androidx.compose.runtime.getValue
 import androidx.compose.ui.Alignment
 import androidx.compose.ui.Modifier
 import androidx.compose.ui.graphics.Color
+import androidx.compose.ui.platform.LocalContext
 import androidx.compose.ui.text.style.TextAlign
 import androidx.compose.ui.unit.dp
 import androidx.lifecycle.compose.collectAsStateWithLifecycle
 import androidx.lifecycle.viewmodel.compose.viewModel
+import kotlinx.coroutines.flow.StateFlow
 import com.example.ragapp.model.GenerationPreset
 import com.example.ragapp.model.MessageUi
+import java.io.File
 
 @Composable
 fun ChatScreen(
     modelPath: String,
+    modelSha256: String,
     modifier: Modifier = Modifier,
 ) {
-    val viewModel: ChatViewModel = viewModel(factory = ChatViewModel.factory(modelPath))
+    // Snapshot KV hội thoại nằm cạnh thư mục models/ trong filesDir
+    val sessionDir = File(LocalContext.current.filesDir, "sessions").absolutePath
+    val viewModel: ChatViewModel = viewModel(factory = ChatViewModel.factory(modelPath, modelSha256, sessionDir))
     val uiState by viewModel.uiState.collectAsStateWithLifecycle()
     val listState = rememberLazyListState()
 
@@ -69,6 +75,8 @@ fun ChatScreen(
 
         ChatHistory(
             messages = uiState.messages,
+            streamingMessageId = uiState.streamingMessageId,
+            streamingText = viewModel.streamingText,
             listState = listState,
             modifier = Modifier.weight(1f)
         )
@@ -78,6 +86,7 @@ fun ChatScreen(
             onInputChange = viewModel::onInputChange,
             onSend = viewModel::sendMessage,
             onStop = viewModel::stopGeneration,
+            onNewChat = viewModel::newConversation,
             canSend = uiState.input.isNotBlank() && uiState.isModelReady && !uiState.isGenerating,
             canStop = uiState.isGenerating,
             enabled = uiState.isModelReady && !uiState.isGenerating
@@ -136,6 +145,8 @@ private fun StatusHeader(
 @Composable
 private fun ChatHistory(
     messages: List<MessageUi>,
+    streamingMessageId: Long?,
+    streamingText: StateFlow<String>,
     listState: LazyListState,
     modifier: Modifier = Modifier,
 ) {
@@ -159,7 +170,13 @@ private fun ChatHistory(
                 verticalArrangement = Arrangement.spacedBy(8.dp)
             ) {
                 items(messages, key = { it.id }) { message ->
-                    MessageBubble(message = message)
+                    if (message.id == streamingMessageId) {
+                        // chỉ item này đọc streamingText nên chỉ nó recompose theo từng lô token
+                        val text by streamingText.collectAsStateWithLifecycle()
+                        MessageBubble(message = message.copy(text = text))
+                    } else {
+                        MessageBubble(message = message)
+                    }
                 }
             }
         }
@@ -172,6 +189,7 @@ private fun InputBar(
     onInputChange: (String) -> Unit,
     onSend: () -> Unit,
     onStop: () -> Unit,
+    onNewChat: () -> Unit,
     canSend: Boolean,
     canStop: Boolean,
     enabled: Boolean,
@@ -191,12 +209,16 @@ private fun InputBar(
                 Text("Gửi")
             }
         }
-        OutlinedButton(
-            onClick = onStop,
-            enabled = canStop,
-            modifier = Modifier.align(Alignment.End)
+        Row(
+            modifier = Modifier.align(Alignment.End),
+            horizontalArrangement = Arrangement.spacedBy(8.dp)
         ) {
-            Text("Dừng")
+            OutlinedButton(onClick = onNewChat, enabled = enabled) {
+                Text("Trò chuyện mới")
+            }
+            OutlinedButton(onClick = onStop, enabled = canStop) {
+                Text("Dừng")
+            }
         }
     }
 }
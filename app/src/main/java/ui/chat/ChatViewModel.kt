@@ -1,10 +1,13 @@
 package com.example.ragapp.ui.chat
 
+import android.util.Log
 import androidx.lifecycle.ViewModel
 import androidx.lifecycle.ViewModelProvider
 import androidx.lifecycle.viewModelScope
 import androidx.lifecycle.viewmodel.CreationExtras
 import com.example.ragapp.LlamaBridge
+import com.example.ragapp.ThreadTuning
+import com.example.ragapp.TokenRing
 import com.example.ragapp.model.Author
 import com.example.ragapp.model.ChatUiState
 import com.example.ragapp.model.GenerationPreset
@@ -22,10 +25,19 @@ import kotlinx.coroutines.flow.flowOn
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.flow.update
 
-private const val DEFAULT_MAX_THREADS = 4
+private const val TAG = "ChatViewModel"
+private const val SESSION_NAME = "chat"
+private const val SNAPSHOT_BUDGET_BYTES = 256L * 1024 * 1024
+// KV của các context giữ sẵn để đổi preset không phải dựng lại (gồm context đang dùng)
+private const val CONTEXT_BUDGET_BYTES = 384L * 1024 * 1024
+// Gom token thành lô trước khi báo lên UI: ~30 lần/giây hoặc mỗi 256 byte
+private const val STREAM_FLUSH_MS = 33
+private const val STREAM_FLUSH_BYTES = 256
 
 class ChatViewModel(
     private val modelPath: String,
+    private val modelSha256: String,
+    private val sessionDir: String,
     private val presets: List<GenerationPreset> = defaultPresets()
 ) : ViewModel() {
 
@@ -37,8 +49,22 @@ class ChatViewModel(
     )
     val uiState: StateFlow<ChatUiState> = _uiState.asStateFlow()
 
+    // Nội dung tin nhắn bot đang sinh, tách khỏi messages: mỗi lô token chỉ cập nhật
+    // bong bóng cuối thay vì dựng lại cả danh sách
+    private val _streamingText = MutableStateFlow("")
+    val streamingText: StateFlow<String> = _streamingText.asStateFlow()
+    private val tokenRing = TokenRing()
+
     private var streamingJob: Job? = null
-    private val nThreads: Int = Runtime.getRuntime().availableProcessors().coerceAtLeast(1).coerceAtMost(DEFAULT_MAX_THREADS)
+    // Lượt gần nhất (không xoá khi dừng): init chờ lời gọi native của nó kết thúc
+    private var lastTurn: Job? = null
+    // Hội thoại native của màn chat này (0 = chưa tạo); giữ lịch sử + KV giữa các lượt
+    @Volatile private var conversationId: Long = 0L
+    private val threadTuning = ThreadTuning(sessionDir)
+    // Autotune số luồng chỉ chạy một lần mỗi ViewModel (đổi preset không đo lại)
+    @Volatile private var threadsTuned = false
+    // Model đã nạp: đổi preset chỉ đổi context
+    @Volatile private var modelLoaded = false
 
     init {
         _uiState.value.selectedPreset?.let { preset ->
@@ -79,12 +105,14 @@ class ChatViewModel(
         )
 
         streamingJob?.cancel()
+        _streamingText.value = ""
         _uiState.update {
             it.copy(
                 messages = it.messages + userMsg + botMsg,
                 input = "",
                 isGenerating = true,
-                statusMessage = "Đang tạo phản hồi..."
+                statusMessage = "Đang tạo phản hồi...",
+                streamingMessageId = botId
             )
         }
 
@@ -94,17 +122,16 @@ class ChatViewModel(
                 streamCompletion(prompt, preset).collect { event ->
                     when (event) {
                         is StreamEvent.Token -> {
-                            _uiState.update { current ->
-                                current.copy(
-                                    messages = current.messages.map { message ->
-                                        if (message.id == botId) {
-                                            message.copy(text = message.text + event.text)
-                                        } else {
-                                            message
-                                        }
-                                    }
-                                )
+                            _streamingText.value += event.text
+                        }
+
+                        is StreamEvent.Prefill -> {
+                            val status = if (event.done < event.total) {
+                                "Đang đọc ngữ cảnh... ${event.done * 100 / event.total}%"
+                            } else {
+                                "Đang tạo phản hồi..."
                             }
+                            _uiState.update { current -> current.copy(statusMessage = status) }
                         }
 
                         is StreamEvent.Error -> {
@@ -142,9 +169,25 @@ class ChatViewModel(
                         current.copy(isGenerating = false)
                     }
                 }
+                commitStreamingText(botId)
                 streamingJob = null
             }
         }
+        lastTurn = streamingJob
+    }
+
+    // Ghi nội dung đã stream vào danh sách tin nhắn (một lần mỗi lượt)
+    private fun commitStreamingText(botId: Long) {
+        val text = _streamingText.value
+        _uiState.update { current ->
+            if (current.streamingMessageId != botId) return@update current
+            current.copy(
+                messages = current.messages.map { message ->
+                    if (message.id == botId) message.copy(text = text) else message
+                },
+                streamingMessageId = null
+            )
+        }
     }
 
     fun stopGeneration() {
@@ -155,17 +198,44 @@ class ChatViewModel(
         _uiState.update { it.copy(isGenerating = false, statusMessage = "Đã dừng.") }
     }
 
+    fun newConversation() {
+        if (_uiState.value.isGenerating) return
+        _uiState.update { it.copy(messages = emptyList(), statusMessage = null) }
+        val conversation = conversationId
+        if (conversation != 0L) {
+            viewModelScope.launch(Dispatchers.IO) { LlamaBridge.resetConversation(conversation) }
+        }
+    }
+
     private fun initializeModel(preset: GenerationPreset) {
+        val previous = lastTurn
         streamingJob?.cancel()
         streamingJob = null
-        _uiState.update { it.copy(isModelReady = false, statusMessage = "Đang tải mô hình...") }
+        val status = if (modelLoaded) "Đang đổi cấu hình..." else "Đang tải mô hình..."
+        _uiState.update { it.copy(isModelReady = false, statusMessage = status) }
         viewModelScope.launch(Dispatchers.IO) {
             LlamaBridge.cancel()
+            // conversationSendStream chặn tới hết lượt: job stream chỉ xong khi lời gọi native đã
+            // trả về, nên init không đổi context dưới lượt đang chạy
+            previous?.join()
+            LlamaBridge.setContextBudget(CONTEXT_BUDGET_BYTES)
             val ok = try {
-                LlamaBridge.init(modelPath, preset.contextLength, nThreads)
+                // 0 = số luồng decode / prefill theo topology CPU hoặc cấu hình đã tune
+                LlamaBridge.init(modelPath, preset.contextLength, 0)
             } catch (t: Throwable) {
                 false
             }
+            if (ok && conversationId == 0L) {
+                if (modelSha256.isNotEmpty()) {
+                    LlamaBridge.configureSnapshots(sessionDir, modelSha256, SNAPSHOT_BUDGET_BYTES)
+                }
+                restoreConversation()
+            }
+            if (ok) {
+                Log.i(TAG, "memory plan:\n${LlamaBridge.memoryPlan()}")
+                tuneThreads()
+            }
+            modelLoaded = ok
             _uiState.update {
                 it.copy(
                     isModelReady = ok,
@@ -173,22 +243,86 @@ class ChatViewModel(
                     statusMessage = if (ok) null else "Không thể tải mô hình"
                 )
             }
+            // Dựng sẵn context cho các preset còn lại (trong trần bộ nhớ), chat vẫn chạy song song
+            if (ok) {
+                presets.filter { it.contextLength != preset.contextLength }
+                    .forEach { LlamaBridge.prepareContext(it.contextLength) }
+            }
+        }
+    }
+
+    // Áp cấu hình luồng đã lưu cho máy + model này; chưa có thì đo (vài giây, chỉ lần đầu) và
+    // lưu lại cho các lần mở sau. Chạy trước khi báo model sẵn sàng để init lại không cắt ngang phép đo.
+    private fun tuneThreads() {
+        if (threadsTuned) return
+        threadsTuned = true
+        val cpu = LlamaBridge.threadConfig()
+        val key = threadTuning.key(modelSha256.ifEmpty { modelPath }, cpu.getOrElse(2) { 0 })
+        val saved = threadTuning.load(key)
+        if (saved != null) {
+            LlamaBridge.setThreads(saved.first, saved.second)
+            Log.i(TAG, "threads: decode=${saved.first} prefill=${saved.second} (saved)")
+            return
+        }
+        _uiState.update { it.copy(statusMessage = "Đang tối ưu số luồng CPU...") }
+        val best = LlamaBridge.autotuneThreads()
+        if (best.size == 2) {
+            threadTuning.save(key, best[0], best[1])
+            Log.i(TAG, "threads: decode=${best[0]} prefill=${best[1]} (autotuned)")
         }
     }
 
     override fun onCleared() {
         streamingJob?.cancel()
+        val conversation = conversationId
+        conversationId = 0L
         viewModelScope.launch(Dispatchers.IO) { LlamaBridge.cancel() }
-        viewModelScope.launch(Dispatchers.IO) { LlamaBridge.release() }
+        viewModelScope.launch(Dispatchers.IO) {
+            if (conversation != 0L) LlamaBridge.releaseConversation(conversation)
+            LlamaBridge.release()
+        }
         super.onCleared()
     }
 
+    private fun ensureConversation(): Long {
+        if (conversationId == 0L) {
+            conversationId = LlamaBridge.openConversation(SESSION_NAME, null)
+        }
+        return conversationId
+    }
+
+    // Mở hội thoại gắn snapshot; nếu lần chạy trước còn lưu thì dựng lại danh sách tin nhắn
+    private fun restoreConversation() {
+        val conversation = ensureConversation()
+        val flat = LlamaBridge.conversationMessages(conversation)
+        if (flat.isEmpty() || _uiState.value.messages.isNotEmpty()) return
+        val now = System.currentTimeMillis()
+        val restored = (0 until flat.size / 2).map { i ->
+            MessageUi(
+                id = now - flat.size + i,
+                author = if (flat[2 * i] == "user") Author.USER else Author.BOT,
+                text = flat[2 * i + 1],
+                timestampMs = now
+            )
+        }
+        _uiState.update { it.copy(messages = restored) }
+    }
+
     private fun streamCompletion(prompt: String, preset: GenerationPreset) = callbackFlow<StreamEvent> {
         var finished = false
         val scope = this
-        val callback = object : LlamaBridge.TokenCallback {
-            override fun onToken(token: String) {
-                scope.trySendBlocking(StreamEvent.Token(token))
+        val callback = object : LlamaBridge.StreamCallback {
+            override fun onBytes(offset: Int, length: Int): Boolean {
+                scope.trySendBlocking(StreamEvent.Token(tokenRing.read(offset, length)))
+                return true
+            }
+
+            override fun onPrefill(done: Int, total: Int) {
+                scope.trySendBlocking(StreamEvent.Prefill(done, total))
+            }
+
+            override fun onMetrics(values: DoubleArray) {
+                Log.i(TAG, "generation: ${LlamaBridge.GenerationMetrics(values)}")
             }
 
             override fun onCompleted() {
@@ -205,16 +339,20 @@ class ChatViewModel(
         }
 
         val started = try {
-            LlamaBridge.inferStreaming(
-                prompt = prompt,
+            LlamaBridge.conversationSendStream(
+                conversation = ensureConversation(),
+                message = prompt,
                 maxTokens = preset.maxTokens,
                 temp = preset.temperature,
                 topP = preset.topP,
+                ring = tokenRing.buffer,
+                flushMs = STREAM_FLUSH_MS,
+                flushBytes = STREAM_FLUSH_BYTES,
                 callback = callback
             )
         } catch (t: Throwable) {
             finished = true
-            scope.trySendBlocking(StreamEvent.Error(t.message ?: "inferStreaming() lỗi"))
+            scope.trySendBlocking(StreamEvent.Error(t.message ?: "conversationSendStream() lỗi"))
             false
         }
 
@@ -233,17 +371,18 @@ class ChatViewModel(
 
     sealed interface StreamEvent {
         data class Token(val text: String) : StreamEvent
+        data class Prefill(val done: Int, val total: Int) : StreamEvent
         data class Error(val message: String) : StreamEvent
         data object Completed : StreamEvent
     }
 
     companion object {
-        fun factory(modelPath: String): ViewModelProvider.Factory =
+        fun factory(modelPath: String, modelSha256: String, sessionDir: String): ViewModelProvider.Factory =
             object : ViewModelProvider.Factory {
                 override fun <T : ViewModel> create(modelClass: Class<T>, extras: CreationExtras): T {
                     if (modelClass.isAssignableFrom(ChatViewModel::class.java)) {
                         @Suppress("UNCHECKED_CAST")
-                        return ChatViewModel(modelPath) as T
+                        return ChatViewModel(modelPath, modelSha256, sessionDir) as T
                     }
                     throw IllegalArgumentException("Unknown ViewModel class: ${modelClass.name}")
                 }